@@ -2,11 +2,49 @@
 // AUTHOR: Tams Matuszka
 
 #include "Conv.h"
+#include "autotune.h"
+#include "gemm.h"
+#include "parallel.h"
+#include "winograd.h"
+#include <sstream>
 
 namespace layer {
+	namespace {
+		// Output rows of a task of the parallel direct convolution.
+		const int kRowsPerTask = 4;
+
+		const ConvAlgorithm kAlgorithms[] = { ConvAlgorithm::Auto, ConvAlgorithm::Direct,
+											  ConvAlgorithm::Im2col, ConvAlgorithm::WinogradF2,
+											  ConvAlgorithm::WinogradF4, ConvAlgorithm::Fft };
+	}
+
+	const char* ConvAlgorithmName(ConvAlgorithm algorithm) {
+		switch (algorithm) {
+		case ConvAlgorithm::Direct:		return "Direct";
+		case ConvAlgorithm::Im2col:		return "Im2col";
+		case ConvAlgorithm::WinogradF2:	return "WinogradF2";
+		case ConvAlgorithm::WinogradF4:	return "WinogradF4";
+		case ConvAlgorithm::Fft:		return "Fft";
+		default:						return "Auto";
+		}
+	}
+
+	bool ParseConvAlgorithm(const std::string& name, ConvAlgorithm& algorithm) {
+		for (ConvAlgorithm candidate : kAlgorithms) {
+			if (name == ConvAlgorithmName(candidate)) {
+				algorithm = candidate;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
 	// Default constructor and destructor.
-	Conv::Conv() { }
-	Conv::~Conv() { }
+	template<typename T>
+	Conv<T>::Conv() { }
+	template<typename T>
+	Conv<T>::~Conv() { }
 
 	// Creates a Conv layer invoking the base constructor.
 	// @param height:	input height
@@ -17,11 +55,12 @@ namespace layer {
 	// @param f_size:	filter size (filter shape is (f_size, f_size, depth)
 	// @param stride:	step size during sliding.
 	// @param paddig:	how many zeros will be added around tensor.
-	Conv::Conv(int height, int width, int depth, std::string name, int f_count,
-		int f_size, int stride, int padding) : Layer(name) {
+	template<typename T>
+	Conv<T>::Conv(int height, int width, int depth, std::string name, int f_count,
+		int f_size, int stride, int padding) : Layer<T>(name) {
 		LayerType type = LayerType::Conv;
-		Layer::SetType(type);
-		input = Tensor3D<double>(height, width, depth);
+		this->SetType(type);
+		input = Tensor3D<T>(height, width, depth);
 		filter_count = f_count;
 		filter_size = f_size;
 		this->stride = stride;
@@ -29,7 +68,7 @@ namespace layer {
 
 		int out_height = ((height - f_size + 2 * padding) / stride) + 1;
 		int out_width = ((width - f_size + 2 * padding) / stride) + 1;
-		output = Tensor3D<double>(out_height, out_width, f_count);
+		output = Tensor3D<T>(out_height, out_width, f_count);
 
 		this->name = name;
 
@@ -41,7 +80,14 @@ namespace layer {
 
 	// Copy constructor, used for loading parameters from a saved model.
 	// @param other: layer which will be copied.
-	Conv::Conv(const Conv& other) : Layer(other) {
+	template<typename T>
+	Conv<T>::Conv(const Conv& other) : Layer<T>(other) {
+		filter_count = other.filter_count;
+		filter_size = other.filter_size;
+		stride = other.stride;
+		padding = other.padding;
+		algorithm = other.algorithm;
+		activation_name = other.activation_name;
 		weights = other.weights;
 		bias = other.bias;
 		InitGrads();
@@ -54,8 +100,9 @@ namespace layer {
 	// @param f_size:	filter size (filter shape is (f_size, f_size, depth)
 	// @param stride:	step size during sliding.
 	// @param paddig:	how many zeros will be added around tensor.
-	Conv::Conv(convnet_core::Triplet shape, std::string name, int f_count, 
-			   int f_size, int stride, int padding) : Layer(shape, name) {
+	template<typename T>
+	Conv<T>::Conv(convnet_core::Triplet shape, std::string name, int f_count, 
+			   int f_size, int stride, int padding) : Layer<T>(shape, name) {
 		filter_count = f_count;
 		filter_size = f_size;
 		this->stride = stride;
@@ -63,7 +110,7 @@ namespace layer {
 
 		int out_height = ((shape.height - f_size + 2 * padding) / stride) + 1;
 		int out_width = ((shape.width - f_size + 2 * padding) / stride) + 1;
-		output = Tensor3D<double>(out_height, out_width, f_count);
+		output = Tensor3D<T>(out_height, out_width, f_count);
 		
 		// Init variables.
 		InitWeights();
@@ -78,9 +125,10 @@ namespace layer {
 	// @param f_size:	filter size (filter shape is (f_size, f_size, depth)
 	// @param stride:	step size during sliding.
 	// @param paddig:	how many zeros will be added around tensor.
-	Conv::Conv(convnet_core::Tensor3D<double>& prev_activation, std::string name, 
+	template<typename T>
+	Conv<T>::Conv(convnet_core::Tensor3D<T>& prev_activation, std::string name, 
 			   int f_count, int f_size, int stride, int padding)
-		: Layer(prev_activation, name) {
+		: Layer<T>(prev_activation, name) {
 		filter_count = f_count;
 		filter_size = f_size;
 		this->stride = stride;
@@ -89,7 +137,7 @@ namespace layer {
 		convnet_core::Triplet shape = prev_activation.GetShape();
 		int out_height = ((shape.height - f_size + 2 * padding) / stride) + 1;
 		int out_width = ((shape.width - f_size + 2 * padding) / stride) + 1;
-		output = Tensor3D<double>(out_height, out_width, f_count);
+		output = Tensor3D<T>(out_height, out_width, f_count);
 
 		// Init variables.
 		InitWeights();
@@ -99,54 +147,430 @@ namespace layer {
 
 	// Forward pass. Performs convolutions of weights with the input volume.
 	// @param prev_act:	activation map from previous layer
-	void Conv::Forward(const Tensor3D<double>& prev_activation) {
-		input = Tensor3D<double>(prev_activation);
-
-		Tensor3D<double> padded = ZeroPad(input);
-		convnet_core::Triplet out_shape = GetOutputShape();
-
-		int vert_start, vert_end, horiz_start, horiz_end;
-		double inp;	// Value from input tensor.
-		double dotProduct = 0;
-		// Row/column indexes for weight. Auxiliary variables for convolution.
-		int w_row = 0; int w_col = 0; 
-
-		// Loop over channels (filters).
-		for (int c = 0; c < out_shape.depth; ++c) {
-			Tensor3D<double> W = weights[c];
-			Tensor3D<double> b = bias[c];
-
-			// For each filter, convolve input with the filter.
-			for (int h = 0; h < out_shape.height; ++h) {
-				for (int w = 0; w < out_shape.width; ++w) {
-					// Calculate the boundary indexes of the slice.
-					vert_start = h * stride;
-					vert_end = vert_start + filter_size;
-					horiz_start = w * stride;
-					horiz_end = horiz_start + filter_size;
-//std::cout << "v_s: " << vert_start << ", v_e: " << vert_end << ", h_s: " << horiz_start << ", h_e: " << horiz_end << std::endl;
-					dotProduct = 0;
-						
-					// Dot product between input-slice and filter along the depth dimension.
-					for (int weight_depth = 0; weight_depth < W.GetShape().depth; ++weight_depth) {
-						w_row = 0;
-						for (int v_slice = vert_start; v_slice < vert_end; ++v_slice) {
-							w_col = 0;
-							for (int h_slice = horiz_start; h_slice < horiz_end; ++h_slice) {
-								double w = W(w_row, w_col, weight_depth);									
-								inp = padded(v_slice, h_slice, weight_depth);
-//std::cout << "v_s: " << v_slice << ", h_s: " << h_slice << ", w_d: " << weight_depth<< std::endl;
-//std::cout << "w_r: " << w_row << ", w_c: " << w_col << std::endl;
-//std::cout << "I: " << inp << ", W: " << w << std::endl;
-								dotProduct += w * inp;
-								++w_col;
-							}
-							++w_row;
-						}								
+	template<typename T>
+	void Conv<T>::Forward(const ConstTensorView<T>& prev_activation) {
+		input = prev_activation;
+		PackWeights();
+		ForwardSample(input, output);
+	}
+
+	// Batched forward pass. The weights are packed once for the batch.
+	// @param prev_activations:	batch of activation maps from previous layer
+	template<typename T>
+	void Conv<T>::Forward(const Tensor4D<T>& prev_activations) {
+		batch_input = prev_activations;
+		PackWeights();
+
+		const int batch_size = prev_activations.GetBatchSize();
+		batch_output.Resize(batch_size, this->GetOutputShape());
+		for (int n = 0; n < batch_size; ++n)
+			ForwardSample(prev_activations.Sample(n), batch_output.Sample(n));
+	}
+
+	template<typename T>
+	void Conv<T>::ForwardSample(const ConstTensorView<T>& sample, const TensorView<T>& out) {
+		switch (SelectedAlgorithm()) {
+		case ConvAlgorithm::Direct:
+			ForwardDirect(sample, out);
+			break;
+		case ConvAlgorithm::WinogradF2:
+		case ConvAlgorithm::WinogradF4:
+			ForwardWinograd(sample, out);
+			break;
+		case ConvAlgorithm::Fft:
+			ForwardFft(sample, out);
+			break;
+		default:
+			ForwardIm2col(sample, out);
+			break;
+		}
+	}
+
+	// The input is copied into the channel-blocked layout (unless it is
+	// stored that way already), then every filter is slid over it. The
+	// padding is never materialized, Convolve skips the parts of the windows
+	// that lie outside of the input.
+	template<typename T>
+	void Conv<T>::ForwardDirect(const ConstTensorView<T>& sample, const TensorView<T>& out) {
+		convnet_core::Triplet shape = sample.GetShape();
+		convnet_core::Strides strides = sample.GetStrides();
+		// Up to kChannelBlock channels the blocked layout is the interleaved one.
+		const bool is_blocked = shape.depth <= convnet_core::kChannelBlock &&
+								strides.row == shape.width * shape.depth && strides.col == shape.depth &&
+								(shape.depth == 1 || strides.channel == 1);
+		convnet_core::Buffer<T> blocked(is_blocked ? 0 : shape.height * shape.width * shape.depth,
+										convnet_core::StepResource());
+		if (!is_blocked)
+			BlockInput(sample, blocked.data());
+		const T* x = is_blocked ? sample.Data() : blocked.data();
+
+		// The filters and blocks of output rows are independent tasks.
+		const int row_blocks = (out.GetShape().height + kRowsPerTask - 1) / kRowsPerTask;
+		convnet_core::ParallelFor(0, filter_count * row_blocks, 1, [&](int first, int last) {
+			for (int task = first; task < last; ++task) {
+				const int first_row = task % row_blocks * kRowsPerTask;
+				Convolve(x, task / row_blocks, first_row,
+						 std::min(out.GetShape().height, first_row + kRowsPerTask), out);
+			}
+		});
+	}
+
+	// The output is the product of the (f_count x K) weight matrix and the
+	// (K x out_height * out_width) matrix of the lowered input windows, where
+	// K = f_size * f_size * depth. The rows of the product are the planar
+	// output channels, so the GEMM writes the output directly.
+	template<typename T>
+	void Conv<T>::ForwardIm2col(const ConstTensorView<T>& sample, const TensorView<T>& out) {
+		assert(out.IsContiguous());
+		convnet_core::Triplet out_shape = out.GetShape();
+		const int k = filter_size * filter_size * sample.GetShape().depth;
+		const int pixels = out_shape.height * out_shape.width;
+
+		convnet_core::Buffer<T> columns(k * pixels, convnet_core::StepResource());
+		Im2col(sample, columns.data());
+		convnet_core::Gemm(convnet_core::Transpose::No, convnet_core::Transpose::No,
+						   filter_count, pixels, k, packed_weights.data(), k,
+						   columns.data(), pixels, out.Data(), pixels);
+		ApplyEpilogue(out);
+	}
+
+	// The packed weights are the transformed filters. The epilogue is
+	// applied by the output transform, before the tiles are stored.
+	template<typename T>
+	void Conv<T>::ForwardWinograd(const ConstTensorView<T>& sample, const TensorView<T>& out) {
+		assert(out.IsContiguous());
+		convnet_core::Buffer<T> biases(filter_count, convnet_core::StepResource());
+		for (int c = 0; c < filter_count; ++c)
+			biases[c] = bias[c](0, 0, 0);
+		convnet_core::WinogradConvolve(WinogradTile(), sample, packed_weights.data(), padding, out,
+									   biases.data(), ActivationSlope());
+	}
+
+	template<typename T>
+	void Conv<T>::ForwardFft(const ConstTensorView<T>& sample, const TensorView<T>& out) {
+		convnet_core::FftConvolve(fft_plan, sample, filter_spectra.data(), filter_size, padding, out);
+		ApplyEpilogue(out);
+	}
+
+	// The GEMM and the overlap-add of the FFT complete an output plane only
+	// at the end, the epilogue is a single pass over the plane, while it is
+	// still in the cache.
+	template<typename T>
+	void Conv<T>::ApplyEpilogue(const TensorView<T>& out) {
+		convnet_core::Triplet out_shape = out.GetShape();
+		const int pixels = out_shape.height * out_shape.width;
+		const T slope = ActivationSlope();
+		for (int c = 0; c < filter_count; ++c) {
+			T* plane = out.Data() + c * pixels;
+			convnet_core::kernels::BiasLeakyRelu(plane, bias[c](0, 0, 0), slope, plane, pixels);
+		}
+	}
+
+	// Fusing replaces the ReLU layer, which would copy the output and write
+	// it again.
+	// @param activation_name:	name of the fused ReLU layer
+	template<typename T>
+	void Conv<T>::FuseActivation(std::string activation_name) {
+		this->activation_name = activation_name;
+	}
+
+	template<typename T>
+	bool Conv<T>::HasFusedActivation() const {
+		return !activation_name.empty();
+	}
+
+	template<typename T>
+	std::string Conv<T>::GetActivationName() const {
+		return activation_name;
+	}
+
+	// The slope of the ReLU layer.
+	template<typename T>
+	T Conv<T>::ActivationSlope() const {
+		return HasFusedActivation() ? T(0.1) : T(1);
+	}
+
+	// Row (c, i, j) of the matrix holds the input element under weight (i, j)
+	// of channel c for every position of the window, zero where the window
+	// overlaps the padding. The rows are in the order of the planar weights.
+	// The range of window positions inside the input is computed once per
+	// row, so the inner loop has no bounds checks. The rows are filled in
+	// parallel.
+	// @param sample:	input volume
+	// @param columns:	output matrix, row-major
+	template<typename T>
+	void Conv<T>::Im2col(const ConstTensorView<T>& sample, T* columns) {
+		convnet_core::Triplet shape = sample.GetShape();
+		convnet_core::Strides strides = sample.GetStrides();
+		convnet_core::Triplet out_shape = this->GetOutputShape();
+		const int pixels = out_shape.height * out_shape.width;
+		const int area = filter_size * filter_size;
+
+		convnet_core::ParallelFor(0, shape.depth * area, std::max(1, convnet_core::kParallelGrain / pixels),
+								  [&](int first, int last) {
+			for (int r = first; r < last; ++r) {
+				const int c = r / area;
+				const int i = r % area / filter_size;
+				const int j = r % filter_size;
+				T* dst = columns + r * pixels;
+				// Window positions w for which column w * stride + j - padding is inside.
+				const int w_begin = std::min(out_shape.width, std::max(0, (padding - j + stride - 1) / stride));
+				const int w_end = std::max(w_begin, std::min(out_shape.width,
+					(shape.width + padding - j + stride - 1) / stride));
+
+				for (int h = 0; h < out_shape.height; ++h) {
+					const int row = h * stride + i - padding;
+					if (row < 0 || row >= shape.height) {
+						std::fill(dst, dst + out_shape.width, T(0));
+						dst += out_shape.width;
+						continue;
+					}
+
+					const T* src = sample.Data() + row * strides.row + c * strides.channel;
+					int w = 0;
+					for (; w < w_begin; ++w)
+						*dst++ = 0;
+					for (; w < w_end; ++w)
+						*dst++ = src[(w * stride + j - padding) * strides.col];
+					for (; w < out_shape.width; ++w)
+						*dst++ = 0;
+				}
+			}
+		});
+	}
+
+	template<typename T>
+	convnet_core::Layout Conv<T>::PreferredLayout() const {
+		return SelectedAlgorithm() == ConvAlgorithm::Direct ? convnet_core::Layout::CHWc8
+															: convnet_core::Layout::CHW;
+	}
+
+	// The algorithm with the lowest estimated cost. Winograd is eligible for
+	// 3x3, stride 1 layers (with at most 2 padding, so that the backward-data
+	// pass is a convolution with nonnegative padding), Fft for any stride 1
+	// layer. Their transforms are not amortized for shallow inputs, so those
+	// stay on Im2col.
+	template<typename T>
+	ConvAlgorithm Conv<T>::SelectedAlgorithm() const {
+		if (algorithm != ConvAlgorithm::Auto)
+			return algorithm;
+		if (stride != 1)
+			return ConvAlgorithm::Im2col;
+
+		convnet_core::Triplet in_shape = input.GetShape();
+		convnet_core::Triplet out_shape = output.GetShape();
+		ConvAlgorithm best = ConvAlgorithm::Im2col;
+		double best_cost = double(out_shape.height) * out_shape.width *
+						   filter_size * filter_size * in_shape.depth * filter_count;
+		auto consider = [&](ConvAlgorithm candidate, double cost) {
+			if (cost < best_cost) {
+				best = candidate;
+				best_cost = cost;
+			}
+		};
+
+		if (filter_size == 3 && padding <= 2) {
+			consider(ConvAlgorithm::WinogradF2, convnet_core::WinogradCost(2, out_shape, in_shape.depth));
+			consider(ConvAlgorithm::WinogradF4, convnet_core::WinogradCost(4, out_shape, in_shape.depth));
+		}
+		const int n = convnet_core::FftConvolutionSize(filter_size, in_shape, padding, filter_count);
+		if (n > 0)
+			consider(ConvAlgorithm::Fft,
+					 convnet_core::FftConvolutionCost(n, filter_size, in_shape, padding, filter_count));
+		return best;
+	}
+
+	template<typename T>
+	std::vector<ConvAlgorithm> Conv<T>::EligibleAlgorithms() const {
+		std::vector<ConvAlgorithm> eligible = { ConvAlgorithm::Direct, ConvAlgorithm::Im2col };
+		if (stride != 1)
+			return eligible;
+
+		if (filter_size == 3 && padding <= 2) {
+			eligible.push_back(ConvAlgorithm::WinogradF2);
+			eligible.push_back(ConvAlgorithm::WinogradF4);
+		}
+		if (convnet_core::FftConvolutionSize(filter_size, input.GetShape(), padding, filter_count) > 0)
+			eligible.push_back(ConvAlgorithm::Fft);
+
+		return eligible;
+	}
+
+	// The candidates run on the same random input, their temporaries are
+	// allocated from a private arena, released after every run.
+	// @param repetitions:	timed runs of each algorithm, the best one counts
+	template<typename T>
+	ConvAlgorithm Conv<T>::Autotune(int repetitions) {
+		Tensor3D<T> sample(input.GetShape());
+		sample.InitRandom();
+		Tensor3D<T> out(output.GetShape());
+		convnet_core::ArenaResource arena;
+
+		ConvAlgorithm best = ConvAlgorithm::Im2col;
+		double best_time = 0;
+		for (ConvAlgorithm candidate : EligibleAlgorithms()) {
+			SetAlgorithm(candidate);
+			PackWeights();
+			const double time = convnet_core::BestTime(repetitions, [&] {
+				convnet_core::ArenaScope scope(arena);
+				ForwardSample(sample, out);
+			});
+			if (candidate == ConvAlgorithm::Direct || time < best_time) {
+				best = candidate;
+				best_time = time;
+			}
+		}
+		SetAlgorithm(best);
+
+		return best;
+	}
+
+	template<typename T>
+	std::string Conv<T>::Signature() const {
+		convnet_core::Triplet shape = input.GetShape();
+		std::ostringstream signature;
+		signature << (std::is_same<T, float>::value ? "float " : "double ")
+				  << shape.height << "x" << shape.width << "x" << shape.depth << " "
+				  << filter_count << "x" << filter_size << "x" << filter_size
+				  << " s" << stride << " p" << padding
+				  << " t" << convnet_core::DefaultThreadPool().GetThreadCount();
+
+		return signature.str();
+	}
+
+	template<typename T>
+	int Conv<T>::WinogradTile() const {
+		switch (SelectedAlgorithm()) {
+		case ConvAlgorithm::WinogradF2:
+			return 2;
+		case ConvAlgorithm::WinogradF4:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	template<typename T>
+	void Conv<T>::SetAlgorithm(ConvAlgorithm algorithm) {
+		if (this->algorithm != algorithm)
+			weights_dirty = true;
+		this->algorithm = algorithm;
+	}
+
+	template<typename T>
+	ConvAlgorithm Conv<T>::GetAlgorithm() const {
+		return algorithm;
+	}
+
+	// Copies the (planar) weights of the filters into the rows of one
+	// matrix, in the preferred layout. For Winograd the filters of the
+	// forward and the backward-data convolutions are transformed instead.
+	// The storage is reused, and nothing is done until the weights change
+	// (i.e. the transforms are computed once after loading and after each
+	// update).
+	template<typename T>
+	void Conv<T>::PackWeights() {
+		if (!weights_dirty)
+			return;
+
+		convnet_core::Triplet shape = weights[0].GetShape();
+		const int tile = WinogradTile();
+		if (tile > 0) {
+			// (filter_count x depth) and (depth x filter_count) matrices for
+			// each transformed coordinate. The backward-data convolution
+			// swaps the channels and rotates the kernels.
+			assert(filter_size == 3 && stride == 1);
+			const int count = filter_count * shape.depth;
+			packed_weights.Resize(convnet_core::WinogradTransformSize(tile) * count);
+			backward_weights.Resize(convnet_core::WinogradTransformSize(tile) * count);
+			for (int f = 0; f < filter_count; ++f) {
+				for (int c = 0; c < shape.depth; ++c) {
+					const T* kernel = weights[f].Data() + c * 9;
+					convnet_core::WinogradTransformFilter(tile, kernel, false,
+						packed_weights.data() + f * shape.depth + c, count);
+					convnet_core::WinogradTransformFilter(tile, kernel, true,
+						backward_weights.data() + c * filter_count + f, count);
+				}
+			}
+			weights_dirty = false;
+			return;
+		}
+		if (SelectedAlgorithm() == ConvAlgorithm::Fft) {
+			// The spectra of the filter pairs, for each input channel.
+			assert(stride == 1);
+			const int n = convnet_core::FftConvolutionSize(filter_size, input.GetShape(), padding,
+														   filter_count);
+			if (fft_plan.Size() != n)
+				fft_plan = convnet_core::FftPlan<T>(n);
+			const int pair_size = shape.depth * n * n;
+			filter_spectra.Resize((filter_count + 1) / 2 * pair_size);
+			for (int f = 0; f < filter_count; f += 2) {
+				const T* second = f + 1 < filter_count ? weights[f + 1].Data() : nullptr;
+				convnet_core::FftTransformFilters(fft_plan, weights[f].Data(), second, filter_size,
+												  shape.depth, filter_spectra.data() + f / 2 * pair_size);
+			}
+			weights_dirty = false;
+			return;
+		}
+
+		const int k = weights[0].Size();
+		packed_weights.Resize(filter_count * k);
+		for (int f = 0; f < filter_count; ++f) {
+			assert(weights[f].GetLayout() == convnet_core::Layout::CHW);
+			convnet_core::ConvertLayout(weights[f].Data(), convnet_core::Layout::CHW,
+										packed_weights.data() + f * k, PreferredLayout(), shape);
+		}
+		weights_dirty = false;
+	}
+
+	// Convolves a volume with one filter. Both the input and the packed
+	// filter are channel-blocked, so for each block and kernel row the
+	// filter_size pixels of the window (with all channels of the block) are
+	// contiguous in memory, and the dot product runs with unit stride. The
+	// window is clipped to the input, the padding would only add zeros: the
+	// kernel rows and columns inside are computed once per output pixel, so
+	// the inner loop has no bounds checks.
+	// @param blocked:	input volume in the CHWc8 layout, without padding
+	// @param filter:	index of the filter, the channel of the output
+	// @param first_row, last_row:	range of the output rows computed
+	// @param out:		output volume
+	template<typename T>
+	void Conv<T>::Convolve(const T* blocked, int filter, int first_row, int last_row,
+						   const TensorView<T>& out) {
+		convnet_core::Triplet out_shape = out.GetShape();
+		convnet_core::Triplet in_shape = this->GetInputShape();
+		const int height = in_shape.height;
+		const int width = in_shape.width;
+		const T* W = packed_weights.data() + filter * filter_size * filter_size * in_shape.depth;
+		const T b = bias[filter](0, 0, 0);
+		const T slope = ActivationSlope();
+
+		for (int h = first_row; h < last_row; ++h) {
+			// Kernel rows inside the input.
+			const int row0 = h * stride - padding;
+			const int i_begin = std::max(0, -row0);
+			const int i_end = std::min(filter_size, height - row0);
+			for (int w = 0; w < out_shape.width; ++w) {
+				const int col0 = w * stride - padding;
+				const int j_begin = std::max(0, -col0);
+				const int j_end = std::min(filter_size, width - col0);
+				T dotProduct = 0;
+				// Dot product between input-slice and filter, block by block.
+				for (int first = 0; first < in_shape.depth; first += convnet_core::kChannelBlock) {
+					const int block = convnet_core::BlockWidth(in_shape, first);
+					const int length = (j_end - j_begin) * block;
+					const T* x_block = blocked + first * height * width;
+					const T* w_block = W + first * filter_size * filter_size;
+					for (int i = i_begin; i < i_end; ++i) {
+						const T* x = x_block + ((row0 + i) * width + col0 + j_begin) * block;
+						const T* k = w_block + (i * filter_size + j_begin) * block;
+						for (int e = 0; e < length; ++e)
+							dotProduct += k[e] * x[e];
 					}
-//std::cout << "h: " << h << ", w: " << w << ", c: " << c << ", dot: " << dotProduct << std::endl;
-					output(h, w, c) = dotProduct + b(0,0,0);
 				}
+				// The epilogue is applied in registers.
+				const T value = dotProduct + b;
+				out(h, w, filter) = value < 0 ? slope * value : value;
 			}
 		}
 	}
@@ -154,112 +578,172 @@ namespace layer {
 	// Calculates the gradients based on the upstream gradient.
 	// Can be interpreted as a convolution.
 	// param grad_output: upstream gradient.
-	void Conv::Backprop(Tensor3D<double>& grad_output) {
-		Tensor3D<double> padded = ZeroPad(input);
-		grad_input.InitZeros();
-		Tensor3D<double> grad_input_padded(padded.GetShape());
-		grad_input_padded.InitZeros();
-
-		convnet_core::Triplet out_shape = GetOutputShape();
-		int vert_start, vert_end, horiz_start, horiz_end;
-		double inp;	// Value from input tensor.
-		double dotProduct = 0;
-		// Sum of grads for grad_bias.
-		double sum_dOut = 0;
-		// Row/column indexes for weight. Auxiliary variables for convolution.
-		int w_row = 0; int w_col = 0;
-
-		// Calculate gradients w.r.t. input and bias.
-		for (int c = 0; c < out_shape.depth; ++c) {
-			Tensor3D<double> W = weights[c];
-			Tensor3D<double> b = bias[c];
-
-			sum_dOut = 0;
-
-			for (int h = 0; h < out_shape.height; ++h) {
-				for (int w = 0; w < out_shape.width; ++w) {
-					// Calculate the boundary indexes of the slice.
-					vert_start = h * stride;
-					vert_end = vert_start + filter_size;
-					horiz_start = w * stride;
-					horiz_end = horiz_start + filter_size;
-//					std::cout << "h: " << h << ", w: " << w << std::endl;// << ", h_s: " << horiz_start << ", h_e: " << horiz_end << std::endl;
-
-					dotProduct = 0;
-					for (int weight_depth = 0; weight_depth < input.GetShape().depth; ++weight_depth) {
-						w_row = 0;
-						sum_dOut += grad_output(h, w, c);
-						for (int v_slice = vert_start; v_slice < vert_end; ++v_slice) {
-							w_col = 0;
-							for (int h_slice = horiz_start; h_slice < horiz_end; ++h_slice) {
-								//std::cout << "v_s: " << v_slice << ", h_s: " << h_slice << ", w_d: " << weight_depth << std::endl;
-								//std::cout << "w_r: " << w_row << ", w_c: " << w_col << std::endl;
-
-								// Calculate grad_input. "Full convolution" over weights.
-								// dA += sum_h(sum_w(w x dOut_h_w)
-								// where w is the weight and dOut_h_w is a scalar corresponding 
-								// to the gradient of the cost with respect to the output.
-								inp = W(w_row, w_col, weight_depth);
-								double dO = grad_output(h, w, c);
-								//grad_input(v_slice, h_slice, weight_depth) += (inp * dO);
-								grad_input_padded(v_slice, h_slice, weight_depth) += (inp * dO);
-//								std::cout << "g.i.I: " << inp << ", W: " << dO << std::endl << std::endl;
-
-								++w_col;
-							}
-							++w_row;
-						}
-					}
-				}
+	template<typename T>
+	void Conv<T>::Backprop(const ConstTensorView<T>& grad_output) {
+		BackpropSample(grad_output, output.Data(), false);
+	}
+
+	// Batched backpropagation. The samples are backpropagated one by one,
+	// the gradients w.r.t. weights and bias are summed over the batch.
+	// @param grad_outputs:	batch of upstream gradients
+	template<typename T>
+	void Conv<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		for (int n = 0; n < batch_size; ++n) {
+			input = batch_input.Sample(n);
+			BackpropSample(grad_outputs.Sample(n), batch_output.Sample(n).Data(), n > 0);
+			batch_grad_input.SetSample(n, grad_input);
+		}
+	}
+
+	// Both gradients are GEMMs with the lowered input. With the (f_count x K)
+	// weight matrix W, the (K x P) matrix of input windows X (see Im2col) and
+	// the (f_count x P) upstream gradient dOut, where P = out_height * out_width:
+	//	dW = dOut * X^T, a row per filter in the planar order of the weights,
+	//	dX = W^T * dOut, which is scattered back to the input by Col2im.
+	// The gradient w.r.t. the bias of a filter is the sum of its output plane.
+	// With a fused activation, the upstream gradient is first multiplied by
+	// its derivative. The activation keeps the sign, so the derivative is
+	// given by the output.
+	// @param grad_output:	upstream gradient of the sample stored in input
+	// @param activation:	output of the sample
+	// @param accumulate:	whether the weight gradients are added to the existing ones
+	template<typename T>
+	void Conv<T>::BackpropSample(const ConstTensorView<T>& grad_output, const T* activation,
+								 bool accumulate) {
+		convnet_core::Triplet out_shape = this->GetOutputShape();
+		const int k = filter_size * filter_size * input.GetShape().depth;
+		const int pixels = out_shape.height * out_shape.width;
+		PackWeights();
+
+		// Temporaries are allocated from the arena of the current step.
+		// The GEMMs need the upstream gradient as a dense matrix.
+		const T* d_out = grad_output.Data();
+		Tensor3D<T> dense_grad(convnet_core::Triplet{ 0, 0, 0 }, convnet_core::StepResource());
+		if (!grad_output.IsContiguous()) {
+			dense_grad = grad_output;
+			d_out = dense_grad.Data();
+		}
+		convnet_core::Buffer<T> pre_activation(HasFusedActivation() ? filter_count * pixels : 0,
+											   convnet_core::StepResource());
+		if (HasFusedActivation()) {
+			convnet_core::kernels::LeakyReluBackward(activation, d_out, ActivationSlope(),
+													 pre_activation.data(), filter_count * pixels);
+			d_out = pre_activation.data();
+		}
+
+		for (int c = 0; c < filter_count; ++c) {
+			const T sum = convnet_core::kernels::Sum(d_out + c * pixels, pixels);
+			if (accumulate)
+				grad_bias[c](0, 0, 0) += sum;
+			else
+				grad_bias[c](0, 0, 0) = sum;
+		}
+
+		convnet_core::Buffer<T> columns(k * pixels, convnet_core::StepResource());
+		Im2col(input, columns.data());
+
+		// The weight gradients are computed into one matrix, then added to
+		// (or copied into) the gradient of each filter. The output pixels are
+		// split into chunks, whose partial products are computed in parallel
+		// into separate buffers and summed in order, so the result does not
+		// depend on the number of threads.
+		const int grain = std::max(convnet_core::kGemmNR, static_cast<int>(
+			convnet_core::kGemmTaskWork / (double(filter_count) * k)));
+		const int chunks = convnet_core::ChunkCount(pixels, grain);
+		const int matrix_size = filter_count * k;
+		convnet_core::Buffer<T> partials(chunks * matrix_size, convnet_core::StepResource());
+		convnet_core::ParallelFor(0, chunks, 1, [&](int first_chunk, int last_chunk) {
+			for (int chunk = first_chunk; chunk < last_chunk; ++chunk) {
+				int first, last;
+				convnet_core::ChunkRange(0, pixels, chunks, chunk, first, last);
+				convnet_core::Gemm(convnet_core::Transpose::No, convnet_core::Transpose::Yes,
+								   filter_count, k, last - first, d_out + first, pixels,
+								   columns.data() + first, pixels,
+								   partials.data() + chunk * matrix_size, k);
 			}
-			grad_bias[c](0, 0, 0) = sum_dOut;
+		});
+		T* grad_matrix = partials.data();
+		for (int chunk = 1; chunk < chunks; ++chunk)
+			convnet_core::kernels::Add(grad_matrix, partials.data() + chunk * matrix_size,
+									   grad_matrix, matrix_size);
+		for (int f = 0; f < filter_count; ++f) {
+			T* dW = grad_weights[f].Data();
+			const T* row = grad_matrix + f * k;
+			if (accumulate)
+				convnet_core::kernels::Add(dW, row, dW, k);
+			else
+				std::copy(row, row + k, dW);
+		}
+
+		// With Winograd the gradient w.r.t. the input is the convolution of
+		// the upstream gradient, padded by 2 - padding, with the rotated
+		// kernels of the transposed filters.
+		const int tile = WinogradTile();
+		if (tile > 0 && padding <= 2) {
+			convnet_core::WinogradConvolve<T>(tile, ConstTensorView<T>(d_out, out_shape),
+											  backward_weights.data(), 2 - padding, grad_input);
+			return;
 		}
-		// Handle zero-padding.
-		grad_input = Tensor3D<double>(Unpad(grad_input_padded));
-
-		for (int c = 0; c < out_shape.depth; ++c) {
-			Tensor3D<double> W = weights[c];
-			Tensor3D<double> b = bias[c];
-
-			// Calculate gradients w.r.t. weights.
-			// Convolve over padded input with the upstream gradient (dOut).
-			int index = 1 + (padded.GetShape().height - output.GetShape().height) / stride;
-			for (int h = 0; h < index; ++h) {
-				for (int w = 0; w < index; ++w) {
-					// Calculate the boundary indexes of the slice.
-					vert_start = h * stride;
-					vert_end = vert_start + out_shape.height;
-					horiz_start = w * stride;
-					horiz_end = horiz_start + out_shape.height;
-//if (c >=3)					std::cout << "h: " << h << ", w: " << w << std::endl;// << ", h_s: " << horiz_start << ", h_e: " << horiz_end << std::endl;
-
-					//dotProduct = 0;
-					// Dot product between input-slice and dOut along the depth dimension.
-					for (int weight_depth = 0; weight_depth < input.GetShape().depth; ++weight_depth) {
-						dotProduct = 0;
-						w_row = 0;
-						for (int v_slice = vert_start; v_slice < vert_end; ++v_slice) {
-							w_col = 0;
-							for (int h_slice = horiz_start; h_slice < horiz_end; ++h_slice) {
-//if (c >=3)								std::cout << "v_s: " << v_slice << ", h_s: "  << h_slice << ", w_d: " << weight_depth << std::endl;
-//if (c >= 3)								std::cout << "w_r: " << w_row << ", w_c: " << w_col << std::endl;
-
-								// Calculate grad_weights.
-								// dW =  X * dOut
-								inp = padded(v_slice, h_slice, weight_depth);
-								double dO = grad_output(w_row, w_col, c);
-								dotProduct += dO * inp;
-//if (c >=3)								std::cout << "g.w.I: " << inp << ", W: " << dO << std::endl;
-
-								++w_col;
-							}
-							++w_row;
-						}
-						grad_weights[c](h, w, weight_depth) = dotProduct;
+
+		// The planar weight matrix. The packed weights are not used, since
+		// their layout depends on the forward algorithm.
+		convnet_core::Buffer<T> weight_matrix(filter_count * k, convnet_core::StepResource());
+		for (int f = 0; f < filter_count; ++f)
+			std::copy(weights[f].Data(), weights[f].Data() + k, weight_matrix.data() + f * k);
+
+		// The input windows are not needed anymore, their storage is reused
+		// for the gradient w.r.t. the lowered input.
+		convnet_core::Gemm(convnet_core::Transpose::Yes, convnet_core::Transpose::No,
+						   k, pixels, filter_count, weight_matrix.data(), k, d_out, pixels,
+						   columns.data(), pixels);
+		Col2im(columns.data(), grad_input);
+	}
+
+	// Inverse of Im2col: every element of the matrix is added to the input
+	// element it was copied from, the elements of the padding are dropped.
+	// The rows of the input are gathered in parallel: each task collects the
+	// matrix rows that map to its own input rows, so the tasks write disjoint
+	// elements, and the order of the sums is fixed.
+	// @param columns:	(f_size * f_size * depth) x (out_height * out_width) matrix
+	// @param grad:		receives the sums
+	template<typename T>
+	void Conv<T>::Col2im(const T* columns, const TensorView<T>& grad) {
+		convnet_core::Triplet shape = grad.GetShape();
+		convnet_core::Strides strides = grad.GetStrides();
+		convnet_core::Triplet out_shape = this->GetOutputShape();
+		const int pixels = out_shape.height * out_shape.width;
+		const int work = shape.width * filter_size * filter_size;
+
+		convnet_core::ParallelFor(0, shape.depth * shape.height, std::max(1, convnet_core::kParallelGrain / work),
+								  [&](int first, int last) {
+			for (int r = first; r < last; ++r) {
+				const int c = r / shape.height;
+				const int row = r % shape.height;
+				T* dst = grad.Data() + row * strides.row + c * strides.channel;
+				for (int x = 0; x < shape.width; ++x)
+					dst[x * strides.col] = 0;
+
+				// Kernel rows i for which output row h = (row + padding - i) / stride exists.
+				for (int i = 0; i < filter_size; ++i) {
+					const int shifted = row + padding - i;
+					if (shifted < 0 || shifted % stride != 0 || shifted / stride >= out_shape.height)
+						continue;
+					const int h = shifted / stride;
+					for (int j = 0; j < filter_size; ++j) {
+						const int w_begin = std::min(out_shape.width, std::max(0, (padding - j + stride - 1) / stride));
+						const int w_end = std::max(w_begin, std::min(out_shape.width,
+							(shape.width + padding - j + stride - 1) / stride));
+						const T* src = columns + ((c * filter_size + i) * filter_size + j) * pixels +
+									   h * out_shape.width;
+						for (int w = w_begin; w < w_end; ++w)
+							dst[(w * stride + j - padding) * strides.col] += src[w];
 					}
 				}
 			}
-		}
+		});
 	}
 
 	// Adjudsts weights based on the calculated gradients. 
@@ -267,30 +751,38 @@ namespace layer {
 	// @param lr:		learning rate
 	// @param momentum: momentum
 	// Further description of method: http://cs231n.github.io/neural-networks-3/#sgd
-	void Conv::UpdateWeights(double lr, double momentum) {
+	template<typename T>
+	void Conv<T>::UpdateWeights(double lr, double momentum) {
+		// Hyperparameters in the precision of the layer.
+		const T eta = static_cast<T>(lr);
+		const T mu = static_cast<T>(momentum);
 		for (int i = 0; i < grad_weights.size(); ++i) {
-			Tensor3D<double> v_prev(velocities[i]);
-			velocities[i] = velocities[i] *momentum - (grad_weights[i] *lr);
-			weights[i] = weights[i] - (v_prev*momentum) + v_prev*(1 + momentum);
+			// x += -mu * v_prev + (1 + mu) * v, where v = mu * v_prev - lr * dx.
+			// Expanded to x += mu^2 * v_prev - (1 + mu) * lr * dx, so that the
+			// update is done in place. Each line is evaluated in a single loop.
+			weights[i] += velocities[i] * (mu * mu) - grad_weights[i] * ((1 + mu) * eta);
+			velocities[i] = velocities[i] * mu - grad_weights[i] * eta;
 		}
+		weights_dirty = true;
 		
 		for (int i = 0; i < grad_bias.size(); ++i) {
-			bias[i] = bias[i] - (bias[i]*lr);
+			bias[i].Axpy(-eta, grad_bias[i]);
 		}
 	}
 
 	// Store layer parameters in a JSON node.
 	// returns layer: JSON representation of the layer. 
-	nlohmann::json Conv::Serialize() {
+	template<typename T>
+	nlohmann::json Conv<T>::Serialize() {
 		nlohmann::json layer;
 		nlohmann::json weights_json;
 		nlohmann::json bias_json;
 
 		layer["type"] = "conv";
 		layer["name"] = name;
-		layer["height"] = GetInputShape().height;
-		layer["width"] = GetInputShape().width;
-		layer["depth"] = GetInputShape().depth;
+		layer["height"] = this->GetInputShape().height;
+		layer["width"] = this->GetInputShape().width;
+		layer["depth"] = this->GetInputShape().depth;
 		layer["f_count"] = filter_count;
 		layer["f_size"] = filter_size;
 		layer["stride"] = stride;;
@@ -313,126 +805,132 @@ namespace layer {
 	}
 
 	// Not needed.
-	double Conv::Loss(Tensor3D<double>& target) { return 0.0; }
+	template<typename T>
+	double Conv<T>::Loss(Tensor3D<T>& target) { return 0.0; }
 
 	// Getter methods.
-	std::vector<Tensor3D<double>>& Conv::GetWeights() {
+	template<typename T>
+	std::vector<Tensor3D<T>>& Conv<T>::GetWeights() {
+		// The weights may be modified through the reference.
+		weights_dirty = true;
+		return weights;
+	}
+
+	template<typename T>
+	std::vector<Tensor3D<T>>& Conv<T>::GetBias() {
+		return bias;
+	}
+
+	template<typename T>
+	const std::vector<Tensor3D<T>>& Conv<T>::GetWeights() const {
 		return weights;
 	}
 
-	std::vector<Tensor3D<double>>& Conv::GetBias() {
+	template<typename T>
+	const std::vector<Tensor3D<T>>& Conv<T>::GetBias() const {
 		return bias;
 	}
 
-	std::vector<Tensor3D<double>>& Conv::GetGradWeights() {
+	template<typename T>
+	std::vector<Tensor3D<T>>& Conv<T>::GetGradWeights() {
 		return grad_weights;
 	}
 
-	std::vector<Tensor3D<double>>& Conv::GetGradBias() {
+	template<typename T>
+	std::vector<Tensor3D<T>>& Conv<T>::GetGradBias() {
 		return grad_bias;
 	}
 
-	Tensor3D<double> Conv::GetGradInput()
+	template<typename T>
+	Tensor3D<T> Conv<T>::GetGradInput()
 	{
 		return grad_input;
 	}
 
 	// He initialization.
-	void Conv::InitWeights() {
-		weights = std::vector<Tensor3D<double>>(filter_count);
+	template<typename T>
+	void Conv<T>::InitWeights() {
+		weights = std::vector<Tensor3D<T>>(filter_count);
 		for (int i = 0; i < filter_count; ++i) {
-			Tensor3D<double> t(filter_size, filter_size, input.GetShape().depth);
+			Tensor3D<T> t(filter_size, filter_size, input.GetShape().depth);
 			t.InitRandom();
 			weights[i] = t;			
 		}
 	}
 
-	void Conv::InitBias() {
-		bias = std::vector<Tensor3D<double>>(filter_count);
+	template<typename T>
+	void Conv<T>::InitBias() {
+		bias = std::vector<Tensor3D<T>>(filter_count);
 		for (int i = 0; i < filter_count; ++i) {
-			Tensor3D<double> t(1, 1, 1);
+			Tensor3D<T> t(1, 1, 1);
 			t.InitZeros();
 			bias[i] = t;
 		}
 	}
 
-	void Conv::InitGrads() {
-		grad_input = Tensor3D<double>(input.GetShape());
+	template<typename T>
+	void Conv<T>::InitGrads() {
+		grad_input = Tensor3D<T>(input.GetShape());
 		grad_input.InitZeros();
 
-		grad_weights = std::vector<Tensor3D<double>>(filter_count);
-		grad_bias = std::vector<Tensor3D<double>>(filter_count);
-		velocities = std::vector<Tensor3D<double>>(filter_count);
+		grad_weights = std::vector<Tensor3D<T>>(filter_count);
+		grad_bias = std::vector<Tensor3D<T>>(filter_count);
+		velocities = std::vector<Tensor3D<T>>(filter_count);
 
 		for (int i = 0; i < filter_count; ++i) {
-			Tensor3D<double> dB(1, 1, 1);
+			Tensor3D<T> dB(1, 1, 1);
 			dB.InitZeros();
 			grad_bias[i] = dB;
 
-			Tensor3D<double> dW(filter_size, filter_size, input.GetShape().depth);
+			Tensor3D<T> dW(filter_size, filter_size, input.GetShape().depth);
 			dW.InitZeros();
 			grad_weights[i] = dW;
-			velocities[i] = Tensor3D<double>(dW);
+			velocities[i] = Tensor3D<T>(dW);
 		}
 	}
 
-	// Add zeros around each matrices along depth dimension.
-	// param tensor:	tensor on which padding will be applied
-	// returns padded:	zero-padded tensor
-	Tensor3D<double> Conv::ZeroPad(Tensor3D<double> tensor) {
-		convnet_core::Triplet shape = tensor.GetShape();
-		Tensor3D<double> padded(shape.height + 2 * padding,
-								shape.width + 2 * padding,
-								shape.depth);
-		padded.InitZeros();
-
-		for (int i = 0; i < shape.height; ++i) {
-			for (int j = 0; j < shape.width; ++j) {
-				for (int k = 0; k < shape.depth; ++k) {
-					padded(i + padding, j + padding, k) = tensor(i, j, k);
+	// Copies the sample block by block and pixel by pixel, the channels of
+	// a block are adjacent in the destination.
+	// @param sample:	input volume
+	// @param blocked:	destination of height * width * depth elements
+	template<typename T>
+	void Conv<T>::BlockInput(const ConstTensorView<T>& sample, T* blocked) {
+		convnet_core::Triplet shape = sample.GetShape();
+		convnet_core::Strides strides = sample.GetStrides();
+		for (int first = 0; first < shape.depth; first += convnet_core::kChannelBlock) {
+			const int block = convnet_core::BlockWidth(shape, first);
+			for (int i = 0; i < shape.height; ++i) {
+				for (int j = 0; j < shape.width; ++j) {
+					const T* src = sample.Data() + i * strides.row + j * strides.col + first * strides.channel;
+					for (int k = 0; k < block; ++k)
+						*blocked++ = src[k * strides.channel];
 				}
 			}
 		}
-
-		return padded;
 	}
 
 	// Getter methods for deserializing.
-	int Conv::GetFilterCount() {
+	template<typename T>
+	int Conv<T>::GetFilterCount() {
 		return filter_count;
 	}
 
-	int Conv::GetFilterSize() {
+	template<typename T>
+	int Conv<T>::GetFilterSize() {
 		return filter_size;
 	}
 
-	int Conv::GetStride() {
+	template<typename T>
+	int Conv<T>::GetStride() {
 		return stride;
 	}
 
-	int Conv::GetPadding() {
+	template<typename T>
+	int Conv<T>::GetPadding() {
 		return padding;
 	}
 
-	// Removes zero-padding from a tensor.
-	// param padded: zero padded tensor
-	// return unpadded: unpadded tensor
-	Tensor3D<double> Conv::Unpad(Tensor3D<double> padded) {
-		convnet_core::Triplet input_shape = input.GetShape();
-		convnet_core::Triplet padded_shape = padded.GetShape();
-		Tensor3D<double> unpadded(input_shape.height, 
-								  input_shape.width,
-								  input_shape.depth);
-		unpadded.InitZeros();
-
-		for (int i = padding; i < padded_shape.height-padding; ++i) {
-			for (int j = padding; j < padded_shape.width-padding; ++j) {
-				for (int k = 0; k < padded_shape.depth; ++k) {
-					unpadded(i-padding, j-padding, k) = padded(i, j, k);
-				}
-			}
-		}
-
-		return unpadded;
-	}
+	// Layers are instantiated for single and double precision.
+	template class Conv<float>;
+	template class Conv<double>;
 }
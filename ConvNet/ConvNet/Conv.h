@@ -3,10 +3,30 @@
 
 #pragma once
 #include "Layer.h"
+#include "fft.h"
 
 namespace layer {
+	// Implementations of the forward pass of a Conv layer.
+	//	Auto:		the eligible algorithm with the lowest estimated cost
+	//				among Im2col, Winograd and Fft
+	//	Direct:		sliding window over the channel-blocked input, the reference
+	//	Im2col:		the input windows are lowered into the columns of a matrix,
+	//				and multiplied with the weight matrix by a blocked GEMM
+	//	WinogradF2,	Winograd minimal filtering with 2x2 or 4x4 output tiles,
+	//	WinogradF4:	only for 3x3 filters with stride 1 (see winograd.h); the
+	//				backward-data pass is a Winograd convolution too
+	//	Fft:		overlap-add FFT convolution with cached filter spectra,
+	//				for stride 1 layers with large filters or inputs (see fft.h)
+	enum class ConvAlgorithm { Auto, Direct, Im2col, WinogradF2, WinogradF4, Fft };
+
+	// Name of an algorithm, as stored in the tuning cache.
+	const char* ConvAlgorithmName(ConvAlgorithm algorithm);
+	// Inverse of ConvAlgorithmName, returns false for unknown names.
+	bool ParseConvAlgorithm(const std::string& name, ConvAlgorithm& algorithm);
+
 	// Convolutional layer. Applies trained filters on a tensor.
-	class Conv : public Layer
+	template<typename T>
+	class Conv : public Layer<T>
 	{
 	public:
 		Conv();
@@ -16,26 +36,59 @@ namespace layer {
 		Conv(const Conv & other);
 		Conv(convnet_core::Triplet shape, std::string name,
 			 int f_count, int f_size, int stride, int padding);
-		Conv(convnet_core::Tensor3D<double>& prev_activation, std::string name,
+		Conv(convnet_core::Tensor3D<T>& prev_activation, std::string name,
 			 int f_count, int f_size, int stride, int padding);
 
 		// Slides filters over the input and performs convolution.
-		void Forward(const Tensor3D<double>& prev_activation) override;
+		void Forward(const ConstTensorView<T>& prev_activation) override;
 		// Calculates gradients based on the upstream gradient.
-		void Backprop(Tensor3D<double>& grad_output) override;
+		void Backprop(const ConstTensorView<T>& grad_output) override;
 		// Adjudsts weights based on the obtained gradients.
 		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
 		// Used for model saving.
 		nlohmann::json Serialize() override;
 		// Not implemented.
-		double Loss(Tensor3D<double>& target) override;
+		double Loss(Tensor3D<T>& target) override;
+
+		// Batched forward pass, the packed weights are shared by the samples.
+		void Forward(const Tensor4D<T>& prev_activations) override;
+		// Batched backpropagation, the weight gradients are summed over the samples.
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+		// Layout of the input of the forward algorithm.
+		convnet_core::Layout PreferredLayout() const override;
+		// Selects the forward algorithm (Auto by default).
+		void SetAlgorithm(ConvAlgorithm algorithm);
+		ConvAlgorithm GetAlgorithm() const;
+		// The algorithm used, Auto is resolved based on the shapes.
+		ConvAlgorithm SelectedAlgorithm() const;
+		// The algorithms that support the shape, stride and padding of the layer.
+		std::vector<ConvAlgorithm> EligibleAlgorithms() const;
+		// Times the forward pass of every eligible algorithm on a random
+		// input, selects the fastest and returns it.
+		ConvAlgorithm Autotune(int repetitions = 3);
+		// Key of the layer in the tuning cache: precision, input shape,
+		// filters, stride, padding and number of threads.
+		std::string Signature() const;
+		// Applies the 0.1 LeakyReLU of the following ReLU layer in the
+		// epilogue of the forward pass, so the output and the upstream
+		// gradient are those of the activation. The name of the ReLU layer
+		// is kept for saving the model.
+		void FuseActivation(std::string activation_name);
+		bool HasFusedActivation() const;
+		std::string GetActivationName() const;
 
 		// Getter methods.
-		std::vector<Tensor3D<double>>& GetWeights();
-		std::vector<Tensor3D<double>>& GetBias();
-		std::vector<Tensor3D<double>>& GetGradWeights();
-		std::vector<Tensor3D<double>>& GetGradBias();
-		Tensor3D<double> GetGradInput();
+		std::vector<Tensor3D<T>>& GetWeights();
+		std::vector<Tensor3D<T>>& GetBias();
+		// Read-only access, the packed weights are kept.
+		const std::vector<Tensor3D<T>>& GetWeights() const;
+		const std::vector<Tensor3D<T>>& GetBias() const;
+		std::vector<Tensor3D<T>>& GetGradWeights();
+		std::vector<Tensor3D<T>>& GetGradBias();
+		Tensor3D<T> GetGradInput();
 		
 		// Getters for serialization.
 		int GetFilterCount();
@@ -55,25 +108,74 @@ namespace layer {
 
 		// Vector of weight tensor. 
 		// Shape: (f_count, f_size, f_size, inp_depth).
-		std::vector<Tensor3D<double>> weights;
+		std::vector<Tensor3D<T>> weights;
 		// Vector of bias. Shape: (f_count, 1, 1, 1).
-		std::vector<Tensor3D<double>> bias;
+		std::vector<Tensor3D<T>> bias;
 		// Gradients of weights w.r.t. error from prev layer.
-		std::vector<Tensor3D<double>> grad_weights;
+		std::vector<Tensor3D<T>> grad_weights;
 		// Gradients of bias  w.r.t. error from prev layer.
-		std::vector<Tensor3D<double>> grad_bias;
+		std::vector<Tensor3D<T>> grad_bias;
 		// Velocities for Nesterov Accelerated Gradient.
-		std::vector<Tensor3D<double>> velocities;
+		std::vector<Tensor3D<T>> velocities;
+		// Weights of all filters in one matrix, a row per filter in the
+		// preferred layout, or the transformed filters of Winograd.
+		// Repacked before the next forward pass whenever the weights may
+		// have changed.
+		convnet_core::Buffer<T> packed_weights;
+		// Transformed filters of the Winograd backward-data convolution.
+		convnet_core::Buffer<T> backward_weights;
+		// Transform and spectra of the filter pairs of the Fft algorithm.
+		convnet_core::FftPlan<T> fft_plan;
+		convnet_core::Buffer<std::complex<T>> filter_spectra;
+		bool weights_dirty = true;
+		ConvAlgorithm algorithm = ConvAlgorithm::Auto;
+		// Name of the fused ReLU layer, empty if there is none.
+		std::string activation_name;
 
 		// Initializer methods for weights, biases, gradients.
 		void InitWeights();
 		void InitBias();
 		void InitGrads();
-		// Add a border with zeros to the tensor.
-		// Applied along the depth dimension 
-		// (i.e. zero-pad every matrix in the tensor).
-		Tensor3D<double> ZeroPad(Tensor3D<double> tensor);
-		// Removes previously added padding from a tensor (along depth dimension).
-		Tensor3D<double> Unpad(Tensor3D<double> tensor);
+		// Copies a sample into the channel-blocked layout of the direct convolution.
+		void BlockInput(const ConstTensorView<T>& sample, T* blocked);
+		// Packs the weights into the preferred layout, if they are dirty.
+		void PackWeights();
+		// Output tile size of the selected Winograd algorithm, 0 for the others.
+		int WinogradTile() const;
+		// Forward pass of one sample with the selected algorithm.
+		void ForwardSample(const ConstTensorView<T>& sample, const TensorView<T>& out);
+		void ForwardDirect(const ConstTensorView<T>& sample, const TensorView<T>& out);
+		void ForwardIm2col(const ConstTensorView<T>& sample, const TensorView<T>& out);
+		void ForwardWinograd(const ConstTensorView<T>& sample, const TensorView<T>& out);
+		void ForwardFft(const ConstTensorView<T>& sample, const TensorView<T>& out);
+		// Slope of the negative outputs of the epilogue, 1 without activation.
+		T ActivationSlope() const;
+		// Adds the bias of each filter to its (contiguous) output plane and
+		// applies the fused activation, in one pass.
+		void ApplyEpilogue(const TensorView<T>& out);
+		// Convolves a channel-blocked sample with one filter, for a range of
+		// output rows. The padding is implicit.
+		void Convolve(const T* blocked, int filter, int first_row, int last_row,
+					  const TensorView<T>& out);
+		// Lowers the (implicitly zero-padded) windows of a sample into a
+		// (f_size * f_size * depth) x (out_height * out_width) matrix.
+		void Im2col(const ConstTensorView<T>& sample, T* columns);
+		// Adds the elements of a lowered matrix back to their input positions.
+		void Col2im(const T* columns, const TensorView<T>& grad);
+		// Backpropagation of the sample stored in input. The weight gradients
+		// are added to the existing ones if accumulate is true. The output of
+		// the sample is needed for the gradient of the fused activation.
+		void BackpropSample(const ConstTensorView<T>& grad_output, const T* activation,
+							bool accumulate);
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
 	};
 }
@@ -0,0 +1,346 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "DepthwiseConv.h"
+#include "kernels.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace layer {
+	// Default constructor and destructor.
+	template<typename T>
+	DepthwiseConv<T>::DepthwiseConv() { }
+	template<typename T>
+	DepthwiseConv<T>::~DepthwiseConv() { }
+
+	// Creates a DepthwiseConv layer invoking the base constructor.
+	// @param height:		input height
+	// @param width:		input width
+	// @param depth:		input depth
+	// @param name:			name of the layer
+	// @param multiplier:	number of kernels per input channel, the output
+	//						depth is depth * multiplier
+	// @param f_size:		kernel size (kernel shape is (f_size, f_size))
+	// @param stride:		step size during sliding.
+	// @param padding:		how many zeros are added around the input.
+	template<typename T>
+	DepthwiseConv<T>::DepthwiseConv(int height, int width, int depth, std::string name,
+									int multiplier, int f_size, int stride, int padding)
+		: DepthwiseConv(convnet_core::Triplet{ height, width, depth }, name,
+						multiplier, f_size, stride, padding) { }
+
+	template<typename T>
+	DepthwiseConv<T>::DepthwiseConv(convnet_core::Triplet shape, std::string name,
+									int multiplier, int f_size, int stride, int padding)
+		: Layer<T>(shape, name) {
+		this->SetType(LayerType::DepthwiseConv);
+		this->multiplier = multiplier;
+		filter_size = f_size;
+		this->stride = stride;
+		this->padding = padding;
+
+		int out_height = ((shape.height - f_size + 2 * padding) / stride) + 1;
+		int out_width = ((shape.width - f_size + 2 * padding) / stride) + 1;
+		output = Tensor3D<T>(out_height, out_width, shape.depth * multiplier);
+
+		// Init variables.
+		InitWeights();
+		InitBias();
+		InitGrads();
+	}
+
+	// Copy constructor, used for loading parameters from a saved model.
+	// @param other: layer which will be copied.
+	template<typename T>
+	DepthwiseConv<T>::DepthwiseConv(const DepthwiseConv& other) : Layer<T>(other) {
+		multiplier = other.multiplier;
+		filter_size = other.filter_size;
+		stride = other.stride;
+		padding = other.padding;
+		weights = other.weights;
+		bias = other.bias;
+		InitGrads();
+	}
+
+	// o * stride + offset - padding is inside [0, in_size) for o in [begin, end).
+	template<typename T>
+	void DepthwiseConv<T>::OutputRange(int offset, int in_size, int out_size, int& begin, int& end) const {
+		begin = std::min(out_size, std::max(0, (padding - offset + stride - 1) / stride));
+		end = std::max(begin, std::min(out_size, (in_size + padding - offset + stride - 1) / stride));
+	}
+
+	// The channels are processed in parallel. For each output pixel the
+	// kernel rows and columns inside the input are computed once, so the
+	// inner loops have no bounds checks.
+	// @param prev_activation:	activation map from previous layer
+	template<typename T>
+	void DepthwiseConv<T>::Forward(const ConstTensorView<T>& prev_activation) {
+		input = prev_activation;
+		convnet_core::Triplet shape = input.GetShape();
+		convnet_core::Triplet out_shape = output.GetShape();
+		const int f = filter_size;
+		const int work = multiplier * out_shape.height * out_shape.width * f * f;
+
+		convnet_core::ParallelFor(0, shape.depth, std::max(1, convnet_core::kParallelGrain / work),
+								  [&](int first, int last) {
+			for (int c = first; c < last; ++c) {
+				const T* x = input.Data() + c * shape.height * shape.width;
+				for (int o = c * multiplier; o < (c + 1) * multiplier; ++o) {
+					const T* k = weights[o].Data();
+					const T b = bias[o](0, 0, 0);
+					T* y = output.Data() + o * out_shape.height * out_shape.width;
+					for (int h = 0; h < out_shape.height; ++h) {
+						const int row0 = h * stride - padding;
+						const int i_begin = std::max(0, -row0);
+						const int i_end = std::min(f, shape.height - row0);
+						for (int w = 0; w < out_shape.width; ++w) {
+							const int col0 = w * stride - padding;
+							const int j_begin = std::max(0, -col0);
+							const int j_end = std::min(f, shape.width - col0);
+							T sum = 0;
+							for (int i = i_begin; i < i_end; ++i) {
+								const T* x_row = x + (row0 + i) * shape.width + col0 + j_begin;
+								const T* k_row = k + i * f + j_begin;
+								for (int j = 0; j < j_end - j_begin; ++j)
+									sum += k_row[j] * x_row[j];
+							}
+							y[h * out_shape.width + w] = sum + b;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	template<typename T>
+	void DepthwiseConv<T>::Backprop(const ConstTensorView<T>& grad_output) {
+		BackpropSample(grad_output, false);
+	}
+
+	// Batched backpropagation. The samples are backpropagated one by one,
+	// the gradients w.r.t. weights and bias are summed over the batch.
+	// @param grad_outputs:	batch of upstream gradients
+	template<typename T>
+	void DepthwiseConv<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		for (int n = 0; n < batch_size; ++n) {
+			input = batch_input.Sample(n);
+			BackpropSample(grad_outputs.Sample(n), n > 0);
+			batch_grad_input.SetSample(n, grad_input);
+		}
+	}
+
+	// For each kernel element (i, j) the output pixels whose window reads
+	// an input pixel are a rectangle. Over that rectangle the upstream
+	// gradient is multiplied with the input (the weight gradient) and
+	// scattered back with the weight (the input gradient). An input channel
+	// receives gradients from its own kernels only, so the channels are
+	// processed in parallel without sharing any output.
+	// @param grad_output:	upstream gradient
+	// @param accumulate:	whether the weight gradients are added to the existing ones
+	template<typename T>
+	void DepthwiseConv<T>::BackpropSample(const ConstTensorView<T>& grad_output, bool accumulate) {
+		convnet_core::Triplet shape = input.GetShape();
+		convnet_core::Triplet out_shape = this->GetOutputShape();
+		const int f = filter_size;
+		const int pixels = out_shape.height * out_shape.width;
+		const int work = multiplier * pixels * f * f;
+
+		// Temporaries are allocated from the arena of the current step.
+		const T* d_out = grad_output.Data();
+		Tensor3D<T> dense_grad(convnet_core::Triplet{ 0, 0, 0 }, convnet_core::StepResource());
+		if (!grad_output.IsContiguous()) {
+			dense_grad = grad_output;
+			d_out = dense_grad.Data();
+		}
+		if (grad_input.Size() != input.Size())
+			grad_input = Tensor3D<T>(shape);
+
+		convnet_core::ParallelFor(0, shape.depth, std::max(1, convnet_core::kParallelGrain / work),
+								  [&](int first, int last) {
+			for (int c = first; c < last; ++c) {
+				const T* x = input.Data() + c * shape.height * shape.width;
+				T* dx = grad_input.Data() + c * shape.height * shape.width;
+				std::fill(dx, dx + shape.height * shape.width, T(0));
+
+				for (int o = c * multiplier; o < (c + 1) * multiplier; ++o) {
+					const T* d = d_out + o * pixels;
+					const T* k = weights[o].Data();
+					T* dw = grad_weights[o].Data();
+
+					const T bias_sum = convnet_core::kernels::Sum(d, pixels);
+					grad_bias[o](0, 0, 0) = accumulate ? grad_bias[o](0, 0, 0) + bias_sum : bias_sum;
+
+					for (int i = 0; i < f; ++i) {
+						int h_begin, h_end;
+						OutputRange(i, shape.height, out_shape.height, h_begin, h_end);
+						for (int j = 0; j < f; ++j) {
+							int w_begin, w_end;
+							OutputRange(j, shape.width, out_shape.width, w_begin, w_end);
+							const T weight = k[i * f + j];
+							T sum = 0;
+							for (int h = h_begin; h < h_end; ++h) {
+								const T* d_row = d + h * out_shape.width;
+								// Input index of output pixel (h, w) is base + w * stride.
+								const int base = (h * stride + i - padding) * shape.width + j - padding;
+								for (int w = w_begin; w < w_end; ++w) {
+									sum += d_row[w] * x[base + w * stride];
+									dx[base + w * stride] += weight * d_row[w];
+								}
+							}
+							dw[i * f + j] = accumulate ? dw[i * f + j] + sum : sum;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	template<typename T>
+	void DepthwiseConv<T>::UpdateWeights(double lr, double momentum) {
+		// Hyperparameters in the precision of the layer.
+		const T eta = static_cast<T>(lr);
+		const T mu = static_cast<T>(momentum);
+		for (int i = 0; i < grad_weights.size(); ++i) {
+			// Nesterov momentum, in place (see Conv::UpdateWeights).
+			weights[i] += velocities[i] * (mu * mu) - grad_weights[i] * ((1 + mu) * eta);
+			velocities[i] = velocities[i] * mu - grad_weights[i] * eta;
+		}
+
+		for (int i = 0; i < grad_bias.size(); ++i) {
+			bias[i].Axpy(-eta, grad_bias[i]);
+		}
+	}
+
+	// Store layer parameters in a JSON node.
+	// returns layer: JSON representation of the layer.
+	template<typename T>
+	nlohmann::json DepthwiseConv<T>::Serialize() {
+		nlohmann::json layer;
+		nlohmann::json weights_json;
+		nlohmann::json bias_json;
+
+		layer["type"] = "depthwise_conv";
+		layer["name"] = name;
+		layer["height"] = this->GetInputShape().height;
+		layer["width"] = this->GetInputShape().width;
+		layer["depth"] = this->GetInputShape().depth;
+		layer["multiplier"] = multiplier;
+		layer["f_size"] = filter_size;
+		layer["stride"] = stride;
+		layer["padding"] = padding;
+
+		for (int filter = 0; filter < weights.size(); ++filter) {
+			nlohmann::json weight;
+			for (int h = 0; h < filter_size; ++h)
+				for (int w = 0; w < filter_size; ++w)
+					weight.push_back(weights[filter](h, w, 0));
+
+			weights_json[std::to_string(filter)] = weight;
+			bias_json.push_back(bias[filter](0, 0, 0));
+		}
+		layer["weights"] = weights_json;
+		layer["bias"] = bias_json;
+
+		return layer;
+	}
+
+	// Not needed.
+	template<typename T>
+	double DepthwiseConv<T>::Loss(Tensor3D<T>& target) { return 0.0; }
+
+	// Getter methods.
+	template<typename T>
+	std::vector<Tensor3D<T>>& DepthwiseConv<T>::GetWeights() {
+		return weights;
+	}
+
+	template<typename T>
+	std::vector<Tensor3D<T>>& DepthwiseConv<T>::GetBias() {
+		return bias;
+	}
+
+	template<typename T>
+	std::vector<Tensor3D<T>>& DepthwiseConv<T>::GetGradWeights() {
+		return grad_weights;
+	}
+
+	template<typename T>
+	std::vector<Tensor3D<T>>& DepthwiseConv<T>::GetGradBias() {
+		return grad_bias;
+	}
+
+	template<typename T>
+	Tensor3D<T> DepthwiseConv<T>::GetGradInput() {
+		return grad_input;
+	}
+
+	template<typename T>
+	int DepthwiseConv<T>::GetMultiplier() {
+		return multiplier;
+	}
+
+	template<typename T>
+	int DepthwiseConv<T>::GetFilterSize() {
+		return filter_size;
+	}
+
+	template<typename T>
+	int DepthwiseConv<T>::GetStride() {
+		return stride;
+	}
+
+	template<typename T>
+	int DepthwiseConv<T>::GetPadding() {
+		return padding;
+	}
+
+	template<typename T>
+	void DepthwiseConv<T>::InitWeights() {
+		const int count = input.GetShape().depth * multiplier;
+		weights = std::vector<Tensor3D<T>>(count);
+		for (int i = 0; i < count; ++i) {
+			Tensor3D<T> t(filter_size, filter_size, 1);
+			t.InitRandom();
+			weights[i] = t;
+		}
+	}
+
+	template<typename T>
+	void DepthwiseConv<T>::InitBias() {
+		const int count = input.GetShape().depth * multiplier;
+		bias = std::vector<Tensor3D<T>>(count);
+		for (int i = 0; i < count; ++i) {
+			Tensor3D<T> t(1, 1, 1);
+			t.InitZeros();
+			bias[i] = t;
+		}
+	}
+
+	template<typename T>
+	void DepthwiseConv<T>::InitGrads() {
+		grad_input = Tensor3D<T>(input.GetShape());
+		grad_input.InitZeros();
+
+		const int count = input.GetShape().depth * multiplier;
+		grad_weights = std::vector<Tensor3D<T>>(count);
+		grad_bias = std::vector<Tensor3D<T>>(count);
+		velocities = std::vector<Tensor3D<T>>(count);
+		for (int i = 0; i < count; ++i) {
+			Tensor3D<T> dB(1, 1, 1);
+			dB.InitZeros();
+			grad_bias[i] = dB;
+
+			Tensor3D<T> dW(filter_size, filter_size, 1);
+			dW.InitZeros();
+			grad_weights[i] = dW;
+			velocities[i] = Tensor3D<T>(dW);
+		}
+	}
+
+	// Layers are instantiated for single and double precision.
+	template class DepthwiseConv<float>;
+	template class DepthwiseConv<double>;
+}
@@ -0,0 +1,94 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+#include "Layer.h"
+
+namespace layer {
+	// Depthwise convolutional layer. Every input channel is convolved with
+	// its own multiplier f_size x f_size kernels, output channel
+	// c * multiplier + j is channel c convolved with kernel j of the channel.
+	// It is the grouped convolution with one channel per group; followed by
+	// a 1x1 Conv it gives the depthwise separable convolution of MobileNet.
+	// A kernel has only f_size^2 weights, so the sums are computed directly
+	// (a GEMM would have an inner dimension of f_size^2), with the windows
+	// clipped to the input instead of padding it.
+	template<typename T>
+	class DepthwiseConv : public Layer<T>
+	{
+	public:
+		DepthwiseConv();
+		~DepthwiseConv();
+		DepthwiseConv(int height, int width, int depth, std::string name,
+					  int multiplier, int f_size, int stride, int padding);
+		DepthwiseConv(convnet_core::Triplet shape, std::string name,
+					  int multiplier, int f_size, int stride, int padding);
+		DepthwiseConv(const DepthwiseConv& other);
+
+		// Convolves every channel with its kernels.
+		void Forward(const ConstTensorView<T>& prev_activation) override;
+		// Calculates gradients based on the upstream gradient.
+		void Backprop(const ConstTensorView<T>& grad_output) override;
+		// Adjusts weights based on the obtained gradients.
+		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
+		// Used for model saving.
+		nlohmann::json Serialize() override;
+		// Not implemented.
+		double Loss(Tensor3D<T>& target) override;
+
+		// Batched backpropagation, the weight gradients are summed over the samples.
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+
+		// Getter methods. Kernel i belongs to input channel i / multiplier,
+		// its shape is (f_size, f_size, 1).
+		std::vector<Tensor3D<T>>& GetWeights();
+		std::vector<Tensor3D<T>>& GetBias();
+		std::vector<Tensor3D<T>>& GetGradWeights();
+		std::vector<Tensor3D<T>>& GetGradBias();
+		Tensor3D<T> GetGradInput();
+
+		// Getters for serialization.
+		int GetMultiplier();
+		int GetFilterSize();
+		int GetStride();
+		int GetPadding();
+
+	private:
+		// Number of kernels per input channel.
+		int multiplier;
+		int filter_size;
+		int stride;
+		int padding;
+
+		std::vector<Tensor3D<T>> weights;
+		std::vector<Tensor3D<T>> bias;
+		std::vector<Tensor3D<T>> grad_weights;
+		std::vector<Tensor3D<T>> grad_bias;
+		// Velocities for Nesterov Accelerated Gradient.
+		std::vector<Tensor3D<T>> velocities;
+
+		// Initializer methods for weights, biases, gradients.
+		void InitWeights();
+		void InitBias();
+		void InitGrads();
+		// Range [begin, end) of the output coordinates whose window contains
+		// the input coordinate index + offset, for kernel offset offset.
+		void OutputRange(int offset, int in_size, int out_size, int& begin, int& end) const;
+		// Backpropagation of the sample stored in input. The weight gradients
+		// are added to the existing ones if accumulate is true.
+		void BackpropSample(const ConstTensorView<T>& grad_output, bool accumulate);
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
+	};
+}
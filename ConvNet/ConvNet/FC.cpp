@@ -2,20 +2,25 @@
 // AUTHOR: Tams Matuszka
 
 #include "FC.h"
+#include "gemm.h"
+#include "parallel.h"
 
 namespace layer {
 	// Default constructor and destructor.
-	FC::FC() { }
-	FC::~FC() { }
+	template<typename T>
+	FC<T>::FC() { }
+	template<typename T>
+	FC<T>::~FC() { }
 
 	// Creates a FC layer invoking the base constructor.
 	// @param name:			name of the layer
 	// @param num_hidden:	number of neurons in the hidden layer.
-	FC::FC(std::string name, int num_hidden) : Layer(name) {
+	template<typename T>
+	FC<T>::FC(std::string name, int num_hidden) : Layer<T>(name) {
 		LayerType type = LayerType::FC;
-		Layer::SetType(type);
+		this->SetType(type);
 
-		output = Tensor3D<double>(num_hidden, 1, 1);
+		output = Tensor3D<T>(num_hidden, 1, 1);
 		InitBias();
 		has_weights_initialized = false;
 	}
@@ -24,13 +29,14 @@ namespace layer {
 	// @param name:			name of the layer
 	// @param num_input:	number of neurons in the input layer.
 	// @param num_hidden:	number of neurons in the hidden layer.
-	FC::FC(std::string name, int num_input, int num_hidden) : Layer(name) {
+	template<typename T>
+	FC<T>::FC(std::string name, int num_input, int num_hidden) : Layer<T>(name) {
 		LayerType type = LayerType::FC;
-		Layer::SetType(type);
+		this->SetType(type);
 
-		input = Tensor3D<double>(num_input, 1, 1);
+		input = Tensor3D<T>(num_input, 1, 1);
 		this->num_hidden = num_hidden;
-		output = Tensor3D<double>(num_hidden, 1, 1);
+		output = Tensor3D<T>(num_hidden, 1, 1);
 		InitWeights();
 		InitBias();
 		InitGrads();
@@ -40,7 +46,8 @@ namespace layer {
 	// Copy constructor, used for loading parameters from a saved model.
 	// Hence, has_weight_initizalized is set to true.
 	// param other: layer which will be copied.
-	FC::FC(const FC& other) : Layer(other) { 
+	template<typename T>
+	FC<T>::FC(const FC& other) : Layer<T>(other) { 
 		this->num_hidden = other.num_hidden;
 		weights = other.weights;
 		bias = other.bias;
@@ -53,10 +60,11 @@ namespace layer {
 	// @param prev_activation:	tensor from previous layer
 	// @param name:				layer name
 	// @param num_hidden:		number of neurons in the hidden layer.
-	FC::FC(convnet_core::Tensor3D<double>& prev_activation, std::string name,
-		   int num_hidden) : Layer(prev_activation, name) {
+	template<typename T>
+	FC<T>::FC(convnet_core::Tensor3D<T>& prev_activation, std::string name,
+		   int num_hidden) : Layer<T>(prev_activation, name) {
 		this->num_hidden = num_hidden;
-		output = Tensor3D<double>(num_hidden, 1, 1);
+		output = Tensor3D<T>(num_hidden, 1, 1);
 		InitWeights();
 		InitBias();
 		InitGrads();
@@ -64,69 +72,170 @@ namespace layer {
 	}
 
 	// Forward pass. Performs the following operation: H(X) = Wx + b.
+	// The input is treated as a flattened vector, through a view, and
+	// multiplied with the packed weights by a vectorized GEMV, or with the
+	// sparse weights.
 	// @param prev_act:	activation map from previous layer
-	void FC::Forward(const Tensor3D<double>& prev_activation) 	{
-		input = Tensor3D<double>(prev_activation);
-		bool has_flattened = false;
-
-		if (input.GetShape().width != 1 && input.GetShape().depth != 1) {
-			tmp_input = input;
-			input = input.Flatten();
-			has_flattened = true;
-		}
+	template<typename T>
+	void FC<T>::Forward(const ConstTensorView<T>& prev_activation) 	{
+		// Input and its shape will be needed for backprop.
+		input = prev_activation;
 			
 		if (!has_weights_initialized) {
 			InitWeights();
 			InitGrads();
 		}
 		
-		for (int n = 0; n < output.GetShape().height; n++) {	
-			double dot = 0;
-
-			for (int i = 0; i < input.GetShape().height; i++)
-				for (int j = 0; j < input.GetShape().width; j++) 
-					for (int k = 0; k < input.GetShape().depth; k++) {
-						int weight_index = MapToUnrolledIndex( i, j, k );
-						dot += (input(i, j, k) * weights(weight_index, n, 0));
-					}
-			
-			output(n, 0, 0) = dot + bias(n, 0, 0);;
-		}
-
-		// Input and its shape will be needed for backprop.
-		if (has_flattened)
-			input = tmp_input;
+		ConstTensorView<T> x = input.Flatten();
+		const int num_input = x.GetShape().height;
+		const int num_output = output.GetShape().height;
+		assert(weights.Size() == num_input * num_output);
+		PackWeights();
+		std::copy(bias.Data(), bias.Data() + num_output, output.Data());
+		if (use_sparse)
+			convnet_core::SpMV(sparse_weights, x.Data(), output.Data(), true);
+		else
+			convnet_core::Gemv(num_input, num_output, x.Data(), packed_weights.data(),
+							   output.Data(), true);
 	}
 
 	// Calculates the gradients from the upstream gradient.
 	// Performs the following operations.
 	// dX = dOut*W
 	// dW = X*dOut
-	// db = sum(dOut)
+	// db = dOut
 	// param grad_output: upstream gradient.
-	void FC::Backprop(Tensor3D<double>& grad_output) {
-		grad_input.InitZeros();
+	template<typename T>
+	void FC<T>::Backprop(const ConstTensorView<T>& grad_output) {
+		assert(grad_output.IsContiguous());
 		// Handle flattened input.
-		tmp_input = input;
-		input = input.Flatten();
-
-//std::cout << input.GetShape().height << " " << input.GetShape().width << " " << input.GetShape().depth << std::endl;
-		double sum = 0;
-		for (int n = 0; n < output.GetShape().height; n++) 		{
-			for (int i = 0; i < input.GetShape().height; i++)
-				for (int j = 0; j < input.GetShape().width; j++)
-					for (int k = 0; k < input.GetShape().depth; k++) {
-//std::cout << n << " " << i << " " << j << " " << k << std::endl;
-						int weight_index = MapToUnrolledIndex(i, j, k);
-						grad_input(i, j, k) += grad_output(n, 0, 0) * weights(weight_index, n, 0);
-						grad_weights(weight_index, n, 0) = input(i, j, k) * grad_output(n, 0, 0);
-					}
-			sum += grad_output(n, 0, 0);
+		Backward(1, input.Flatten().Data(), grad_output.Data(), grad_input.Flatten().Data(),
+				 false, 0, 0);
+	}
+
+	// @param grad_output:		upstream gradient
+	// @param learning_rate:	learning rate
+	// @param momentum:			Nesterov momentum
+	template<typename T>
+	void FC<T>::BackpropAndUpdate(const ConstTensorView<T>& grad_output,
+								  double learning_rate, double momentum) {
+		assert(grad_output.IsContiguous());
+		Backward(1, input.Flatten().Data(), grad_output.Data(), grad_input.Flatten().Data(),
+				 true, learning_rate, momentum);
+	}
+
+	// Batched forward pass, H(X) = Wx + b for every sample. The samples are
+	// the rows of a (batch_size x num_input) matrix, which is multiplied with
+	// the weights by the blocked GEMM, so each block of the weights is loaded
+	// once for several samples. Sparse weights are multiplied with each
+	// sample separately.
+	// @param prev_activations:	batch of activation maps from previous layer
+	template<typename T>
+	void FC<T>::Forward(const Tensor4D<T>& prev_activations) {
+		batch_input = prev_activations;
+		const int batch_size = prev_activations.GetBatchSize();
+		if (!has_weights_initialized) {
+			// The shape of the input is needed for the initialization.
+			input = prev_activations.Sample(0);
+			InitWeights();
+			InitGrads();
+		}
+
+		const int num_input = prev_activations.SampleSize();
+		const int num_output = output.GetShape().height;
+		assert(weights.Size() == num_input * num_output);
+		batch_output.Resize(batch_size, output.GetShape());
+		for (int n = 0; n < batch_size; ++n)
+			batch_output.SetSample(n, bias);
+
+		PackWeights();
+		if (use_sparse) {
+			for (int n = 0; n < batch_size; ++n)
+				convnet_core::SpMV(sparse_weights, batch_input.Sample(n).Data(),
+								   batch_output.Sample(n).Data(), true);
+			return;
 		}
-		grad_bias = grad_bias + sum;
+		convnet_core::Gemm(convnet_core::Transpose::No, convnet_core::Transpose::No,
+						   batch_size, num_output, num_input, batch_input.Data(), num_input,
+						   weights.Data(), num_output, batch_output.Data(), num_output, true);
+	}
 
-		// Restore input to its original shape
-		input = tmp_input;
+	// Batched backpropagation, the weight and bias gradients are summed over
+	// the samples.
+	// dX_n = dOut_n*W
+	// dW = sum_n(X_n*dOut_n)
+	// db = sum_n(dOut_n)
+	// param grad_outputs: batch of upstream gradients.
+	template<typename T>
+	void FC<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		Backward(batch_size, batch_input.Data(), grad_outputs.Data(), batch_grad_input.Data(),
+				 false, 0, 0);
+	}
+
+	// @param grad_outputs:		batch of upstream gradients
+	// @param learning_rate:	learning rate
+	// @param momentum:			Nesterov momentum
+	template<typename T>
+	void FC<T>::BackpropAndUpdate(const Tensor4D<T>& grad_outputs,
+								  double learning_rate, double momentum) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		Backward(batch_size, batch_input.Data(), grad_outputs.Data(), batch_grad_input.Data(),
+				 true, learning_rate, momentum);
+	}
+
+	// The weights are processed row by row, in parallel. A row belongs to
+	// one input, so its part of the input gradients (a dot product for each
+	// sample) and its gradient (the sum of the scaled upstream gradients)
+	// depend on that row only. While the row is in the cache, it is also
+	// updated, and the packed copy of the forward pass is updated in place,
+	// so the weights, their gradients and the velocities are read once.
+	template<typename T>
+	void FC<T>::Backward(int batch_size, const T* x, const T* d_out, T* dx,
+						 bool update, double learning_rate, double momentum) {
+		const int num_input = weights.GetShape().height;
+		const int num_output = weights.GetShape().width;
+		const T eta = static_cast<T>(learning_rate);
+		const T mu = static_cast<T>(momentum);
+		// The packed copy is kept only if it is up to date and in use.
+		const bool repack = update && !weights_dirty && !use_sparse;
+		const int grain = std::max(1, convnet_core::kParallelGrain / (num_output * (batch_size + 1)));
+
+		convnet_core::ParallelFor(0, num_input, grain, [&](int first, int last) {
+			using namespace convnet_core;
+			for (int i = first; i < last; ++i) {
+				T* w = weights.Data() + i * num_output;
+				T* dw = grad_weights.Data() + i * num_output;
+				for (int n = 0; n < batch_size; ++n)
+					dx[n * num_input + i] = kernels::Dot(w, d_out + n * num_output, num_output);
+
+				kernels::MulScalar(d_out, x[i], dw, num_output);
+				for (int n = 1; n < batch_size; ++n)
+					kernels::Axpy(x[n * num_input + i], d_out + n * num_output, dw, num_output);
+				if (!update)
+					continue;
+
+				kernels::NesterovStep(dw, eta, mu, w, velocities.Data() + i * num_output, num_output);
+				if (repack) {
+					for (int j = 0; j < num_output; j += kGemmNR)
+						std::copy(w + j, w + std::min(num_output, j + kGemmNR),
+								  packed_weights.data() + j * num_input + i * kGemmNR);
+				}
+			}
+		});
+
+		std::copy(d_out, d_out + num_output, grad_bias.Data());
+		for (int n = 1; n < batch_size; ++n)
+			convnet_core::kernels::Add(grad_bias.Data(), d_out + n * num_output,
+									   grad_bias.Data(), num_output);
+		if (update) {
+			bias.Axpy(-eta, grad_bias);
+			weights_dirty = !repack;
+		}
 	}
 
 	// Adjudsts weights based on the calculated gradients. 
@@ -134,17 +243,71 @@ namespace layer {
 	// @param lr:		learning rate
 	// @param momentum: momentum
 	// Further description of method: http://cs231n.github.io/neural-networks-3/#sgd
-	void FC::UpdateWeights(double lr, double momentum) {
-		Tensor3D<double> v_prev(velocities);
-		velocities = velocities*momentum - (grad_weights*lr);
-		weights = weights - (v_prev*momentum) + v_prev*(1 + momentum);
+	template<typename T>
+	void FC<T>::UpdateWeights(double lr, double momentum) {
+		// Hyperparameters in the precision of the layer.
+		const T eta = static_cast<T>(lr);
+		const T mu = static_cast<T>(momentum);
+		// x += -mu * v_prev + (1 + mu) * v, where v = mu * v_prev - lr * dx.
+		// Expanded to x += mu^2 * v_prev - (1 + mu) * lr * dx, so that the
+		// update is done in place, in a single loop.
+		convnet_core::kernels::NesterovStep(grad_weights.Data(), eta, mu, weights.Data(),
+											velocities.Data(), weights.Size());
+		weights_dirty = true;
 		
-		bias = bias - (grad_bias*lr);
+		bias.Axpy(-eta, grad_bias);
+	}
+
+	// Sorts the magnitudes of the weights partially, the weights below the
+	// k-th smallest magnitude are set to zero, along with enough of those
+	// equal to it.
+	// @param sparsity:	fraction of the weights to prune, between 0 and 1
+	template<typename T>
+	int FC<T>::Prune(double sparsity) {
+		assert(sparsity >= 0 && sparsity <= 1);
+		const int size = weights.Size();
+		const int count = static_cast<int>(sparsity * size);
+		T* w = weights.Data();
+		if (count > 0) {
+			std::vector<T> magnitudes(size);
+			for (int i = 0; i < size; ++i)
+				magnitudes[i] = std::abs(w[i]);
+			std::nth_element(magnitudes.begin(), magnitudes.begin() + count - 1, magnitudes.end());
+			const T threshold = magnitudes[count - 1];
+			int pruned = 0;
+			for (int i = 0; i < size; ++i)
+				if (std::abs(w[i]) < threshold) {
+					w[i] = 0;
+					++pruned;
+				}
+			for (int i = 0; i < size && pruned < count; ++i)
+				if (w[i] != 0 && std::abs(w[i]) == threshold) {
+					w[i] = 0;
+					++pruned;
+				}
+		}
+		weights_dirty = true;
+
+		return static_cast<int>(std::count(w, w + size, T(0)));
 	}
 
-	// Stores layer parameters in a JSON node.
+	template<typename T>
+	double FC<T>::Density() const {
+		return convnet_core::Density(weights.Data(), weights.Size());
+	}
+
+	template<typename T>
+	bool FC<T>::IsSparse() {
+		PackWeights();
+		return use_sparse;
+	}
+
+	// Stores layer parameters in a JSON node. Sparse weights are stored in
+	// CSR format, a row per input: "format" is "csr", and the weights are
+	// given by "row_offsets", "columns" and "values".
 	// returns layer: JSON representation of the layer. 
-	nlohmann::json FC::Serialize() {
+	template<typename T>
+	nlohmann::json FC<T>::Serialize() {
 		nlohmann::json layer;
 		nlohmann::json weights_json;
 		nlohmann::json bias_json;
@@ -152,18 +315,28 @@ namespace layer {
 		layer["type"] = "fc";
 		layer["name"] = name;
 		// Take flattening into account.
-		int inp_num = GetInputShape().height * GetInputShape().width * GetInputShape().depth;
+		int inp_num = this->GetInputShape().height * this->GetInputShape().width * this->GetInputShape().depth;
 		layer["input"] = inp_num;
-		layer["output"] = GetOutputShape().height;
-
-		for (int inp = 0; inp < inp_num; ++inp) {
-			nlohmann::json weight;
-			for (int out = 0; out < GetOutputShape().height; ++out)
-				weight.push_back(weights(inp, out, 0));
-
-			weights_json[std::to_string(inp)] = weight;
+		layer["output"] = this->GetOutputShape().height;
+
+		if (Density() < convnet_core::kSparseDensity) {
+			convnet_core::CsrMatrix<T> csr = convnet_core::ToCsr(convnet_core::Transpose::No, inp_num,
+																  this->GetOutputShape().height,
+																  weights.Data(), weights.GetShape().width);
+			layer["format"] = "csr";
+			weights_json["row_offsets"] = csr.row_offsets;
+			weights_json["columns"] = csr.columns;
+			weights_json["values"] = csr.values;
+		} else {
+			for (int inp = 0; inp < inp_num; ++inp) {
+				nlohmann::json weight;
+				for (int out = 0; out < this->GetOutputShape().height; ++out)
+					weight.push_back(weights(inp, out, 0));
+
+				weights_json[std::to_string(inp)] = weight;
+			}
 		}
-		for (int out = 0; out < GetOutputShape().height; ++out)
+		for (int out = 0; out < this->GetOutputShape().height; ++out)
 			bias_json.push_back(bias(out, 0, 0));
 
 		layer["weights"] = weights_json;
@@ -173,62 +346,94 @@ namespace layer {
 	}
 
 	// Not needed.
-	double FC::Loss(Tensor3D<double>& target) { return 0.0; }
+	template<typename T>
+	double FC<T>::Loss(Tensor3D<T>& target) { return 0.0; }
 
 	// Getter methods.
-	Tensor3D<double>& FC::GetWeights() 	{
+	template<typename T>
+	Tensor3D<T>& FC<T>::GetWeights() 	{
+		weights_dirty = true;
 		return weights;
 	}
 
-	Tensor3D<double>& FC::GetBias() {
+	template<typename T>
+	Tensor3D<T>& FC<T>::GetBias() {
 		return bias;
 	}
 
-	Tensor3D<double>& FC::GetGradWeights() 	{
+	template<typename T>
+	Tensor3D<T>& FC<T>::GetGradWeights() 	{
 		return grad_weights;
 	}
 
-	Tensor3D<double>& FC::GetGradBias() {
+	template<typename T>
+	Tensor3D<T>& FC<T>::GetGradBias() {
 		return grad_bias;
 	}
 
-	Tensor3D<double> FC::GetGradInput() {
+	template<typename T>
+	Tensor3D<T> FC<T>::GetGradInput() {
 		return grad_input;
 	}
 	
 	// He initialization.
-	void FC::InitWeights() {
+	template<typename T>
+	void FC<T>::InitWeights() {
 		convnet_core::Triplet input_shape = input.GetShape();
-		weights = Tensor3D<double>(input_shape.height*input_shape.width*input_shape.depth,
+		weights = Tensor3D<T>(input_shape.height*input_shape.width*input_shape.depth,
 						   num_hidden, 1);
 
 		weights.InitRandom();
+		weights_dirty = true;
 	}
 
-	void FC::InitBias() {
-			bias = Tensor3D<double>(num_hidden, 1, 1);
+	template<typename T>
+	void FC<T>::InitBias() {
+			bias = Tensor3D<T>(num_hidden, 1, 1);
 			bias.InitZeros();
 	}
 
-	void FC::InitGrads() {
-		grad_input = Tensor3D<double>(input.GetShape().height,
+	template<typename T>
+	void FC<T>::InitGrads() {
+		grad_input = Tensor3D<T>(input.GetShape().height,
 									  input.GetShape().width, 
 									  input.GetShape().depth);
 		grad_input.InitZeros();
 		int inp_num = input.GetShape().height*input.GetShape().width*input.GetShape().depth;
-		grad_weights = Tensor3D<double>(inp_num, num_hidden, 1);
+		grad_weights = Tensor3D<T>(inp_num, num_hidden, 1);
 		grad_weights.InitZeros();
-		velocities = Tensor3D<double>(inp_num, num_hidden, 1);
+		velocities = Tensor3D<T>(inp_num, num_hidden, 1);
 		velocities.InitZeros();
 		
-		grad_bias = Tensor3D<double>(num_hidden, 1, 1);
+		grad_bias = Tensor3D<T>(num_hidden, 1, 1);
 		grad_bias.InitZeros();
 	}
 
-	// Map original index of tensor to the unrolled version.
-	int FC::MapToUnrolledIndex(int row, int col, int depth) {
-		return depth * (input.GetShape().height * input.GetShape().width) +
-			col * (input.GetShape().height) +
-			row;
+	// Packs the weights into panels for the GEMV of the forward pass, or
+	// compresses their transpose if they are sparse, if they may have changed
+	// since the last packing.
+	template<typename T>
+	void FC<T>::PackWeights() {
+		if (!weights_dirty)
+			return;
+
+		const int num_output = weights.GetShape().width;
+		const int num_input = weights.GetShape().height;
+		use_sparse = Density() < convnet_core::kSparseDensity;
+		if (use_sparse) {
+			sparse_weights = convnet_core::ToCsr(convnet_core::Transpose::Yes, num_output, num_input,
+												 weights.Data(), num_output);
+			packed_weights.Resize(0);
+		} else {
+			sparse_weights = convnet_core::CsrMatrix<T>();
+			packed_weights.Resize(convnet_core::GemvPackedSize(num_input, num_output));
+			convnet_core::PackGemvMatrix(num_input, num_output, weights.Data(), num_output,
+										 packed_weights.data());
+		}
+		weights_dirty = false;
 	}
-}
\ No newline at end of file
+
+	// Layers are instantiated for single and double precision.
+	template class FC<float>;
+	template class FC<double>;
+}
@@ -3,10 +3,13 @@
 
 #pragma once
 #include "Layer.h"
+#include "sparse.h"
 
 namespace layer {
-	// Fully-connected layer.
-	class FC : public Layer
+	// Fully-connected layer. If the weights are sparse enough (e.g. after
+	// pruning), the forward pass multiplies with their CSR form.
+	template<typename T>
+	class FC : public Layer<T>
 	{
 	public:
 		FC();
@@ -16,51 +19,103 @@ namespace layer {
 		FC(std::string name, int num_input, int num_hidden);
 		FC(convnet_core::Triplet shape, std::string name, int num_hidden);
 		FC(const FC & other);
-		FC(convnet_core::Tensor3D<double>& prev_activation,
+		FC(convnet_core::Tensor3D<T>& prev_activation,
 		   std::string name, int num_hidden);
  
 		// Forward pass.
-		void Forward(const Tensor3D<double>& prev_activation) override;
+		void Forward(const ConstTensorView<T>& prev_activation) override;
 		// Calculates gradients based on the upstream gradient.
-		void Backprop(Tensor3D<double>& grad_output) override;
+		void Backprop(const ConstTensorView<T>& grad_output) override;
 		// Adjudsts weights based on the obtained gradients.
 		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
 		// Used for model saving.
 		nlohmann::json Serialize() override;
 		// Not implemented.
-		double Loss(Tensor3D<double>& target) override;
+		double Loss(Tensor3D<T>& target) override;
 
-		// Getter methods
-		Tensor3D<double>& GetWeights();
-		Tensor3D<double>& GetBias();
-		Tensor3D<double>& GetGradWeights();
-		Tensor3D<double>& GetGradBias();
-		Tensor3D<double> GetGradInput();
+		// Batched forward pass, the product of the batch and the weights is
+		// computed by a blocked GEMM.
+		void Forward(const Tensor4D<T>& prev_activations) override;
+		// Batched backpropagation, the weight gradients are summed over the samples.
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		// Backpropagation with the momentum update of each row of the weights
+		// right after its gradient, so the weights are streamed once per step.
+		void BackpropAndUpdate(const ConstTensorView<T>& grad_output,
+							   double learning_rate, double momentum = 0.9) override;
+		void BackpropAndUpdate(const Tensor4D<T>& grad_outputs,
+							   double learning_rate, double momentum = 0.9) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+
+		// Magnitude pruning, sets the given fraction of the weights, those of
+		// the smallest magnitude, to zero. Pruned weights become nonzero again
+		// if the layer is trained further.
+		// @returns:	the number of zero weights
+		int Prune(double sparsity);
+		// Fraction of the nonzero weights.
+		double Density() const;
+		// Whether the forward pass uses the sparse weights.
+		bool IsSparse();
+
+		// Getter methods. The weights may be modified through GetWeights,
+		// they are repacked before the next forward pass.
+		Tensor3D<T>& GetWeights();
+		Tensor3D<T>& GetBias();
+		Tensor3D<T>& GetGradWeights();
+		Tensor3D<T>& GetGradBias();
+		Tensor3D<T> GetGradInput();
 
 	private:
 		// Number of neurons in the output layer
 		int num_hidden;
 		// Vector of weight tensor. 
 		// Shape: (input.height, output.height, 1).
-		Tensor3D<double> weights;
+		Tensor3D<T> weights;
 		// Shape: (output.height, 1, 1).
-		Tensor3D<double> bias;
+		Tensor3D<T> bias;
 		// Gradients of weights w.r.t. error from prev layer.
-		Tensor3D<double> grad_weights;
+		Tensor3D<T> grad_weights;
 		// Gradients of bias  w.r.t. error from prev layer.
-		Tensor3D<double> grad_bias;
+		Tensor3D<T> grad_bias;
 		// Velocities for momentum.
-		Tensor3D<double> velocities;
-		// Auxiliary tensor for flattening in the forward pass.
-		Tensor3D<double> tmp_input;
+		Tensor3D<T> velocities;
 		// Required for model loading.
 		bool has_weights_initialized;
+		// Copy of the weights in column panels of kGemmNR outputs (see
+		// PackGemvMatrix), so the forward pass streams the matrix once.
+		// Repacked before the next forward pass whenever the weights may
+		// have changed.
+		convnet_core::Buffer<T> packed_weights;
+		// Transposed weights in CSR format, a row per output. Used instead
+		// of the packed weights if their density is below kSparseDensity.
+		convnet_core::CsrMatrix<T> sparse_weights;
+		bool use_sparse = false;
+		bool weights_dirty = true;
 
 		// Initialization methods.
 		void InitWeights();
 		void InitBias();
 		void InitGrads();
-		// Returns with the index of data element in the unrolled vector.
-		int MapToUnrolledIndex(int row, int col, int depth);
+		// Packs the weights (or compresses them if they are sparse), if they
+		// are dirty.
+		void PackWeights();
+		// Backward pass of batch_size samples, stored one after the other.
+		// If update is true, the weights are updated with Nesterov momentum.
+		// @param x:		inputs of the samples
+		// @param d_out:	upstream gradients of the samples
+		// @param dx:		input gradients of the samples
+		void Backward(int batch_size, const T* x, const T* d_out, T* dx,
+					  bool update, double learning_rate, double momentum);
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
 	};
 }
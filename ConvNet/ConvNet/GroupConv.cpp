@@ -0,0 +1,234 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "GroupConv.h"
+#include <algorithm>
+
+namespace layer {
+	// Default constructor and destructor.
+	template<typename T>
+	GroupConv<T>::GroupConv() { }
+	template<typename T>
+	GroupConv<T>::~GroupConv() { }
+
+	// Creates a GroupConv layer invoking the base constructor.
+	// @param height:	input height
+	// @param width:	input width
+	// @param depth:	input depth, a multiple of groups
+	// @param name:		name of the layer
+	// @param f_count:	number of filters in the layer, a multiple of groups
+	// @param f_size:	filter size (filter shape is (f_size, f_size, depth / groups))
+	// @param stride:	step size during sliding.
+	// @param padding:	how many zeros are added around the input.
+	// @param groups:	number of groups
+	template<typename T>
+	GroupConv<T>::GroupConv(int height, int width, int depth, std::string name, int f_count,
+							int f_size, int stride, int padding, int groups)
+		: GroupConv(convnet_core::Triplet{ height, width, depth }, name, f_count,
+					f_size, stride, padding, groups) { }
+
+	template<typename T>
+	GroupConv<T>::GroupConv(convnet_core::Triplet shape, std::string name, int f_count,
+							int f_size, int stride, int padding, int groups)
+		: Layer<T>(shape, name) {
+		this->SetType(LayerType::GroupConv);
+		filter_count = f_count;
+		filter_size = f_size;
+		this->stride = stride;
+		this->padding = padding;
+		Init(groups);
+	}
+
+	// Copy constructor, used for loading parameters from a saved model.
+	// @param other: layer which will be copied.
+	template<typename T>
+	GroupConv<T>::GroupConv(const GroupConv& other) : Layer<T>(other) {
+		filter_count = other.filter_count;
+		filter_size = other.filter_size;
+		stride = other.stride;
+		padding = other.padding;
+		groups = other.groups;
+	}
+
+	template<typename T>
+	void GroupConv<T>::Init(int group_count) {
+		convnet_core::Triplet shape = input.GetShape();
+		assert(group_count > 0 && shape.depth % group_count == 0 && filter_count % group_count == 0);
+		convnet_core::Triplet group_shape = { shape.height, shape.width, shape.depth / group_count };
+
+		groups.clear();
+		for (int g = 0; g < group_count; ++g)
+			groups.push_back(Conv<T>(group_shape, name + "_" + std::to_string(g),
+									 filter_count / group_count, filter_size, stride, padding));
+
+		convnet_core::Triplet group_output = groups[0].GetOutputShape();
+		output = Tensor3D<T>(group_output.height, group_output.width, filter_count);
+		grad_input = Tensor3D<T>(shape);
+		grad_input.InitZeros();
+	}
+
+	// The groups keep their slices of the input for the backward pass, the
+	// input is not copied as a whole. The output channels of a group are
+	// contiguous in the (planar) output.
+	// @param prev_activation:	activation map from previous layer
+	template<typename T>
+	void GroupConv<T>::Forward(const ConstTensorView<T>& prev_activation) {
+		convnet_core::Triplet shape = prev_activation.GetShape();
+		convnet_core::Triplet group_shape = { shape.height, shape.width, shape.depth / GetGroupCount() };
+		for (int g = 0; g < GetGroupCount(); ++g) {
+			groups[g].Forward(prev_activation.Slice(0, 0, g * group_shape.depth, group_shape));
+			const Tensor3D<T>& group_output = groups[g].GetOutput();
+			std::copy(group_output.Data(), group_output.Data() + group_output.Size(),
+					  output.Data() + g * group_output.Size());
+		}
+	}
+
+	// Every group backpropagates its slice of the upstream gradient, the
+	// gradients w.r.t. the input slices are gathered into grad_input.
+	// @param grad_output:	upstream gradient
+	template<typename T>
+	void GroupConv<T>::Backprop(const ConstTensorView<T>& grad_output) {
+		convnet_core::Triplet out_shape = grad_output.GetShape();
+		convnet_core::Triplet group_out = { out_shape.height, out_shape.width, out_shape.depth / GetGroupCount() };
+		for (int g = 0; g < GetGroupCount(); ++g) {
+			groups[g].Backprop(grad_output.Slice(0, 0, g * group_out.depth, group_out));
+			const Tensor3D<T>& group_grad = groups[g].GetGrads();
+			std::copy(group_grad.Data(), group_grad.Data() + group_grad.Size(),
+					  grad_input.Data() + g * group_grad.Size());
+		}
+	}
+
+	// Batched forward pass. The channels of each group are gathered into a
+	// batch of their own, so every group runs its batched forward pass once.
+	// @param prev_activations:	batch of activation maps from previous layer
+	template<typename T>
+	void GroupConv<T>::Forward(const Tensor4D<T>& prev_activations) {
+		const int batch_size = prev_activations.GetBatchSize();
+		convnet_core::Triplet shape = prev_activations.GetShape();
+		convnet_core::Triplet group_shape = { shape.height, shape.width, shape.depth / GetGroupCount() };
+		batch_output.Resize(batch_size, output.GetShape());
+
+		Tensor4D<T> group_input(batch_size, group_shape, convnet_core::StepResource());
+		for (int g = 0; g < GetGroupCount(); ++g) {
+			for (int n = 0; n < batch_size; ++n)
+				group_input.SetSample(n, prev_activations.Sample(n).Slice(0, 0, g * group_shape.depth, group_shape));
+			groups[g].Forward(group_input);
+
+			const Tensor4D<T>& group_output = groups[g].GetBatchOutput();
+			const int size = group_output.SampleSize();
+			for (int n = 0; n < batch_size; ++n)
+				std::copy(group_output.Sample(n).Data(), group_output.Sample(n).Data() + size,
+						  batch_output.Sample(n).Data() + g * size);
+		}
+	}
+
+	// Batched backpropagation, the weight gradients of every group are
+	// summed over the samples.
+	// @param grad_outputs:	batch of upstream gradients
+	template<typename T>
+	void GroupConv<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = grad_outputs.GetBatchSize();
+		convnet_core::Triplet out_shape = grad_outputs.GetShape();
+		convnet_core::Triplet group_out = { out_shape.height, out_shape.width, out_shape.depth / GetGroupCount() };
+		batch_grad_input.Resize(batch_size, input.GetShape());
+
+		Tensor4D<T> group_grad(batch_size, group_out, convnet_core::StepResource());
+		for (int g = 0; g < GetGroupCount(); ++g) {
+			for (int n = 0; n < batch_size; ++n)
+				group_grad.SetSample(n, grad_outputs.Sample(n).Slice(0, 0, g * group_out.depth, group_out));
+			groups[g].Backprop(group_grad);
+
+			const Tensor4D<T>& group_grad_input = groups[g].GetBatchGrads();
+			const int size = group_grad_input.SampleSize();
+			for (int n = 0; n < batch_size; ++n)
+				std::copy(group_grad_input.Sample(n).Data(), group_grad_input.Sample(n).Data() + size,
+						  batch_grad_input.Sample(n).Data() + g * size);
+		}
+	}
+
+	template<typename T>
+	void GroupConv<T>::UpdateWeights(double lr, double momentum) {
+		for (Conv<T>& group : groups)
+			group.UpdateWeights(lr, momentum);
+	}
+
+	// Store layer parameters in a JSON node. The filters are numbered
+	// through the groups, in the format of Conv.
+	// returns layer: JSON representation of the layer.
+	template<typename T>
+	nlohmann::json GroupConv<T>::Serialize() {
+		nlohmann::json layer;
+		nlohmann::json weights_json;
+		nlohmann::json bias_json;
+
+		layer["type"] = "group_conv";
+		layer["name"] = name;
+		layer["height"] = this->GetInputShape().height;
+		layer["width"] = this->GetInputShape().width;
+		layer["depth"] = this->GetInputShape().depth;
+		layer["f_count"] = filter_count;
+		layer["f_size"] = filter_size;
+		layer["stride"] = stride;
+		layer["padding"] = padding;
+		layer["groups"] = GetGroupCount();
+
+		int filter = 0;
+		// Read through the const accessors, so that the groups are not repacked.
+		for (const Conv<T>& group : groups) {
+			for (int f = 0; f < static_cast<int>(group.GetWeights().size()); ++f, ++filter) {
+				const Tensor3D<T>& kernel = group.GetWeights()[f];
+				nlohmann::json weight;
+				for (int d = 0; d < kernel.GetShape().depth; ++d)
+					for (int h = 0; h < kernel.GetShape().height; ++h)
+						for (int w = 0; w < kernel.GetShape().width; ++w)
+							weight.push_back(kernel(h, w, d));
+
+				weights_json[std::to_string(filter)] = weight;
+				bias_json.push_back(group.GetBias()[f](0, 0, 0));
+			}
+		}
+		layer["weights"] = weights_json;
+		layer["bias"] = bias_json;
+
+		return layer;
+	}
+
+	// Not implemented.
+	template<typename T>
+	double GroupConv<T>::Loss(Tensor3D<T>& target) { return 0.0; }
+
+	// Getter methods.
+	template<typename T>
+	Conv<T>& GroupConv<T>::GetGroup(int group) {
+		return groups[group];
+	}
+
+	template<typename T>
+	int GroupConv<T>::GetGroupCount() {
+		return static_cast<int>(groups.size());
+	}
+
+	template<typename T>
+	int GroupConv<T>::GetFilterCount() {
+		return filter_count;
+	}
+
+	template<typename T>
+	int GroupConv<T>::GetFilterSize() {
+		return filter_size;
+	}
+
+	template<typename T>
+	int GroupConv<T>::GetStride() {
+		return stride;
+	}
+
+	template<typename T>
+	int GroupConv<T>::GetPadding() {
+		return padding;
+	}
+
+	// Layers are instantiated for single and double precision.
+	template class GroupConv<float>;
+	template class GroupConv<double>;
+}
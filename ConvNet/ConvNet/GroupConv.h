@@ -0,0 +1,74 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+#include "Conv.h"
+
+namespace layer {
+	// Grouped convolutional layer. The input channels and the filters are
+	// split into groups, the filters of a group span only the channels of
+	// their group, so the layer costs 1 / groups of a dense Conv with the
+	// same number of filters. Each group is a dense Conv layer on a slice
+	// of the channels (with every algorithm of Conv), the outputs of group
+	// g are the output channels [g * f_count / groups, (g + 1) * f_count / groups).
+	template<typename T>
+	class GroupConv : public Layer<T>
+	{
+	public:
+		GroupConv();
+		~GroupConv();
+		GroupConv(int height, int width, int depth, std::string name,
+				  int f_count, int f_size, int stride, int padding, int groups);
+		GroupConv(convnet_core::Triplet shape, std::string name,
+				  int f_count, int f_size, int stride, int padding, int groups);
+		GroupConv(const GroupConv& other);
+
+		// Convolves every group of channels with the filters of the group.
+		void Forward(const ConstTensorView<T>& prev_activation) override;
+		// Calculates gradients based on the upstream gradient.
+		void Backprop(const ConstTensorView<T>& grad_output) override;
+		// Adjusts the weights of every group.
+		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
+		// Used for model saving.
+		nlohmann::json Serialize() override;
+		// Not implemented.
+		double Loss(Tensor3D<T>& target) override;
+
+		// Batched versions, the weight gradients are summed over the samples.
+		void Forward(const Tensor4D<T>& prev_activations) override;
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+
+		// The dense convolution of a group. Its filters span depth / groups
+		// channels, filter i of the group is filter g * f_count / groups + i
+		// of the layer.
+		Conv<T>& GetGroup(int group);
+		int GetGroupCount();
+		int GetFilterCount();
+		int GetFilterSize();
+		int GetStride();
+		int GetPadding();
+
+	private:
+		std::vector<Conv<T>> groups;
+		int filter_count;
+		int filter_size;
+		int stride;
+		int padding;
+
+		// Creates the groups and the output, input must be set.
+		void Init(int group_count);
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
+	};
+}
@@ -2,22 +2,27 @@
 #include <iostream>
 
 namespace layer {
-	Layer::Layer() {  }
-	Layer::Layer(std::string name) {
+	template<typename T>
+	Layer<T>::Layer() {  }
+	template<typename T>
+	Layer<T>::Layer(std::string name) {
 		this->name = name; 
 	}
 
-	Layer::Layer(const convnet_core::Triplet& shape, std::string name) {
+	template<typename T>
+	Layer<T>::Layer(const convnet_core::Triplet& shape, std::string name) {
 		this->name = name;
-		input = Tensor3D<double>(shape.height, shape.width, shape.depth);
+		input = Tensor3D<T>(shape.height, shape.width, shape.depth);
 	}
 
-	Layer::Layer(convnet_core::Tensor3D<double>& prev_activation, std::string name) {
+	template<typename T>
+	Layer<T>::Layer(convnet_core::Tensor3D<T>& prev_activation, std::string name) {
 		this->name = name;
-		input = Tensor3D<double>(prev_activation);
+		input = Tensor3D<T>(prev_activation);
 	}
 
-	Layer::Layer(const Layer& other) {
+	template<typename T>
+	Layer<T>::Layer(const Layer& other) {
 		input = other.input;
 		output = other.output;
 		grad_input = other.grad_input;
@@ -25,33 +30,137 @@ namespace layer {
 		type = other.type;
 	}
 
-	Layer::~Layer() { }
-	convnet_core::Tensor3D<double>& Layer::GetInput() {
+	template<typename T>
+	Layer<T>::~Layer() { }
+	template<typename T>
+	convnet_core::Tensor3D<T>& Layer<T>::GetInput() {
 		return input;
 	}
-	convnet_core::Tensor3D<double>& Layer::GetOutput() {
+	template<typename T>
+	convnet_core::Tensor3D<T>& Layer<T>::GetOutput() {
 		return output;
 	}
-	convnet_core::Tensor3D<double>& Layer::GetGrads() {
+	template<typename T>
+	convnet_core::Tensor3D<T>& Layer<T>::GetGrads() {
 		return grad_input;
 	}
-	convnet_core::Triplet Layer::GetInputShape() {
+	template<typename T>
+	convnet_core::Tensor4D<T>& Layer<T>::GetBatchOutput() {
+		return batch_output;
+	}
+	template<typename T>
+	convnet_core::Tensor4D<T>& Layer<T>::GetBatchGrads() {
+		return batch_grad_input;
+	}
+	template<typename T>
+	convnet_core::Triplet Layer<T>::GetInputShape() {
 		return input.GetShape();
 	}
-	convnet_core::Triplet Layer::GetOutputShape() {
+	template<typename T>
+	convnet_core::Triplet Layer<T>::GetOutputShape() {
 		return output.GetShape();
 	}
-	convnet_core::Triplet Layer::GetGradsShape() {
+	template<typename T>
+	convnet_core::Triplet Layer<T>::GetGradsShape() {
 		return grad_input.GetShape();
 	}
-	std::string Layer::GetName() {
+	template<typename T>
+	std::string Layer<T>::GetName() {
 		return name;
 	}
-	void Layer::SetType(LayerType type) {
+	template<typename T>
+	void Layer<T>::SetType(LayerType type) {
 		this->type = type;
 	}
 
-	LayerType Layer::GetType() {
+	template<typename T>
+	LayerType Layer<T>::GetType() {
 		return type;
 	}
+
+	template<typename T>
+	void Layer<T>::SetResources(convnet_core::MemoryResource* input_resource,
+								convnet_core::MemoryResource* output_resource,
+								convnet_core::MemoryResource* grad_resource) {
+		input.SetResource(input_resource);
+		output.SetResource(output_resource);
+		grad_input.SetResource(grad_resource);
+	}
+
+	// Layers use the planar layout by default.
+	template<typename T>
+	convnet_core::Layout Layer<T>::PreferredLayout() const {
+		return convnet_core::Layout::CHW;
+	}
+
+	// Layers keep their input by default.
+	template<typename T>
+	bool Layer<T>::IsInPlace() const {
+		return false;
+	}
+
+	// Forwards the samples one by one.
+	// @param prev_activations:	batch of activation maps from previous layer
+	template<typename T>
+	void Layer<T>::Forward(const Tensor4D<T>& prev_activations) {
+		// Kept for the backpropagation.
+		batch_input = prev_activations;
+		const int batch_size = prev_activations.GetBatchSize();
+		for (int n = 0; n < batch_size; ++n) {
+			Forward(prev_activations.Sample(n));
+			if (n == 0)
+				batch_output.Resize(batch_size, output.GetShape());
+			batch_output.SetSample(n, output);
+		}
+	}
+
+	// Backpropagates the samples one by one. The forward pass of each sample
+	// is repeated first, since the state of the layer (e.g. the routing of
+	// the gradients) belongs to the last sample of the batch.
+	// @param grad_outputs:	batch of upstream gradients
+	template<typename T>
+	void Layer<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		for (int n = 0; n < batch_size; ++n) {
+			Forward(batch_input.Sample(n));
+			Backprop(grad_outputs.Sample(n));
+			batch_grad_input.SetSample(n, grad_input);
+		}
+	}
+
+	template<typename T>
+	void Layer<T>::BackpropAndUpdate(const ConstTensorView<T>& grad_output,
+									 double learning_rate, double momentum) {
+		Backprop(grad_output);
+		UpdateWeights(learning_rate, momentum);
+	}
+
+	template<typename T>
+	void Layer<T>::BackpropAndUpdate(const Tensor4D<T>& grad_outputs,
+									 double learning_rate, double momentum) {
+		Backprop(grad_outputs);
+		UpdateWeights(learning_rate, momentum);
+	}
+
+	// @param targets:	batch of targets, one for each sample of the last batch
+	template<typename T>
+	double Layer<T>::Loss(const Tensor4D<T>& targets) {
+		const int batch_size = batch_output.GetBatchSize();
+		assert(targets.GetBatchSize() == batch_size);
+		Tensor3D<T> target(targets.GetShape(), convnet_core::StepResource());
+		double loss = 0;
+		for (int n = 0; n < batch_size; ++n) {
+			output = batch_output.Sample(n);
+			target = targets.Sample(n);
+			loss += Loss(target);
+		}
+
+		return loss;
+	}
+
+	// Layers are instantiated for single and double precision.
+	template class Layer<float>;
+	template class Layer<double>;
 }
@@ -4,58 +4,108 @@
 #pragma once
 #include <iostream>
 #include "tensor3D.h"
+#include "tensor4D.h"
 #include <nlohmann\json.hpp>
 
 using ::convnet_core::Tensor3D;
+using ::convnet_core::Tensor4D;
+using ::convnet_core::TensorView;
+using ::convnet_core::ConstTensorView;
 
 namespace layer {
 	// Enum for specific layer types.
-	enum class LayerType { Conv, ReLU, Pool, FC, Softmax };
+	enum class LayerType { Conv, ReLU, Pool, FC, Softmax, GroupConv, DepthwiseConv };
 
 	// Base class of the layers. Specific layers will be inherited from this class.
 	// Easily extensible with new layers, four virtual methods have to be overridden.
+	// Templated on the scalar type (float or double) of the tensors.
+	template<typename T>
 	class Layer
 	{
 	public:
 		Layer();
 		Layer(std::string name);
 		Layer(const convnet_core::Triplet& shape, std::string name);
-		Layer(Tensor3D<double>& prev_activation, std::string name);
+		Layer(Tensor3D<T>& prev_activation, std::string name);
 		Layer(const Layer& other);
 		~Layer();
 
 		// Getter methods.
-		Tensor3D<double>& GetInput();
-		Tensor3D<double>& GetOutput();
-		Tensor3D<double>& GetGrads();
+		Tensor3D<T>& GetInput();
+		Tensor3D<T>& GetOutput();
+		Tensor3D<T>& GetGrads();
+		Tensor4D<T>& GetBatchOutput();
+		Tensor4D<T>& GetBatchGrads();
 		convnet_core::Triplet GetInputShape();
 		convnet_core::Triplet GetOutputShape();
 		convnet_core::Triplet GetGradsShape();
 		std::string GetName();
 		void SetType(LayerType type);
 		LayerType GetType();
+		// Moves the input, output and input gradient to the given resources,
+		// e.g. the regions of a memory plan (see Model::PlanMemory). The
+		// contents are not preserved.
+		void SetResources(convnet_core::MemoryResource* input_resource,
+						  convnet_core::MemoryResource* output_resource,
+						  convnet_core::MemoryResource* grad_resource);
 
 		// Core functionality of a layer. Specific layer subclasses
 		// have to override these methods.
 
-		// Forward propagation.
-		virtual void Forward(const Tensor3D<double>& prev_activation) = 0;
+		// Forward propagation. The previous activation is passed as a view,
+		// so reshaped or sliced tensors can be forwarded without copying.
+		virtual void Forward(const ConstTensorView<T>& prev_activation) = 0;
 		// Backpropagation for obtaining gradients.
-		virtual void Backprop(Tensor3D<double>& grad_output) = 0;
+		virtual void Backprop(const ConstTensorView<T>& grad_output) = 0;
 		// Adjusts weigths based on the gradients obtained by backprop.
 		virtual void UpdateWeights(double learning_rate, double momentum = 0.9) = 0;
 		// Serialization method for saving layer parameters.
 		virtual nlohmann::json Serialize() = 0;
 		// Returns the loss with respect to the given loss function and target.
-		virtual double Loss(Tensor3D<double>& target) = 0;
+		virtual double Loss(Tensor3D<T>& target) = 0;
+
+		// Batched versions, process a minibatch of samples at once. The
+		// default implementations run the single-sample methods on each
+		// sample. Layers override them where the batch can be processed more
+		// efficiently, layers with trainable parameters have to override them.
+
+		// Forward propagation of a batch, the result is stored in batch_output.
+		virtual void Forward(const Tensor4D<T>& prev_activations);
+		// Backpropagation of a batch, the gradients w.r.t. the trainable
+		// parameters are summed over the samples.
+		virtual void Backprop(const Tensor4D<T>& grad_outputs);
+		// Sum of the losses of the samples of the last batch.
+		virtual double Loss(const Tensor4D<T>& targets);
+
+		// Backpropagation followed by the update of the weights, as used in
+		// training. The default implementations call Backprop and then
+		// UpdateWeights, layers may override them to update each weight in
+		// the same pass as its gradient is computed.
+		virtual void BackpropAndUpdate(const ConstTensorView<T>& grad_output,
+									   double learning_rate, double momentum = 0.9);
+		virtual void BackpropAndUpdate(const Tensor4D<T>& grad_outputs,
+									   double learning_rate, double momentum = 0.9);
+
+		// Memory layout in which the layer reads its input most efficiently.
+		// Inputs are passed as views (planar or interleaved), a layer converts
+		// them to its preferred layout internally.
+		virtual convnet_core::Layout PreferredLayout() const;
+		// Whether the forward pass may overwrite its input with the output,
+		// and the backward pass the upstream gradient with the input
+		// gradient, when they share memory (see Model::PlanMemory).
+		virtual bool IsInPlace() const;
 
 	protected:
 		// Input tensor of a layer, either an image or the output of the previous layer.
-		Tensor3D<double> input;
+		Tensor3D<T> input;
 		// Output tensor that stores the result of the forward pass.
-		Tensor3D<double> output;
+		Tensor3D<T> output;
 		// Gradient with respect to the input of the layer. 
-		Tensor3D<double> grad_input;
+		Tensor3D<T> grad_input;
+		// Input, output and input gradient of the last batch.
+		Tensor4D<T> batch_input;
+		Tensor4D<T> batch_output;
+		Tensor4D<T> batch_grad_input;
 		// Name of the layer, used for convenience.
 		std::string name;
 		// Specific type of the layer.
@@ -2,12 +2,14 @@
 // AUTHOR: Tams Matuszka
 
 #include "MaxPool.h"
-#include <limits>
+#include "parallel.h"
 
 namespace layer {
 	// Default constructor and destructor.
-	MaxPool::MaxPool() { }
-	MaxPool::~MaxPool() { }
+	template<typename T>
+	MaxPool<T>::MaxPool() { }
+	template<typename T>
+	MaxPool<T>::~MaxPool() { }
 
 	// Creates a MaxPool layer invoking the base constructor.
 	// @param name:			name of the layer
@@ -16,16 +18,17 @@ namespace layer {
 	// @param depth:		input depth
 	// @param stride:		step size during sliding
 	// @param pool_size:	pool size
-	MaxPool::MaxPool(std::string name, int height, int width, int depth,
-					 int stride, int pool_size) : Layer(name) {
+	template<typename T>
+	MaxPool<T>::MaxPool(std::string name, int height, int width, int depth,
+					 int stride, int pool_size) : Layer<T>(name) {
 		LayerType type = LayerType::Pool;
-		Layer::SetType(type);
+		this->SetType(type);
 
-		input = Tensor3D<double>(height, width, depth);
+		input = Tensor3D<T>(height, width, depth);
 		int out_height = (height - pool_size) / stride + 1;
 		int out_width = (width - pool_size) / stride + 1;
-		output = Tensor3D<double>(out_height, out_width, depth);
-		grad_input = Tensor3D<double>(height, width, depth);
+		output = Tensor3D<T>(out_height, out_width, depth);
+		grad_input = Tensor3D<T>(height, width, depth);
 		this->stride = stride;
 		this->pool_size = pool_size;
 	}
@@ -35,12 +38,13 @@ namespace layer {
 	// @param name:			name of the layer
 	// @param stride:		step size during sliding
 	// @param pool_size:	pool size
-	MaxPool::MaxPool(convnet_core::Triplet shape, std::string name,
-					 int stride, int pool_size) : Layer(shape, name) {
+	template<typename T>
+	MaxPool<T>::MaxPool(convnet_core::Triplet shape, std::string name,
+					 int stride, int pool_size) : Layer<T>(shape, name) {
 		int out_height = (shape.height - pool_size) / stride + 1;
 		int out_width = (shape.width - pool_size) / stride + 1;
-		output = Tensor3D<double>(out_height, out_width, shape.depth);
-		grad_input = Tensor3D<double>(shape.height, shape.width, shape.depth);
+		output = Tensor3D<T>(out_height, out_width, shape.depth);
+		grad_input = Tensor3D<T>(shape.height, shape.width, shape.depth);
 		grad_input.InitZeros(); 
 
 		this->stride = stride;
@@ -52,13 +56,14 @@ namespace layer {
 	// @param name:			name of the layer
 	// @param stride:		step size during sliding
 	// @param pool_size:	pool size
-	MaxPool::MaxPool(Tensor3D<double>& prev_activation, std::string name,
-					 int stride, int pool_size) : Layer(prev_activation, name) {
+	template<typename T>
+	MaxPool<T>::MaxPool(Tensor3D<T>& prev_activation, std::string name,
+					 int stride, int pool_size) : Layer<T>(prev_activation, name) {
 		convnet_core::Triplet shape = prev_activation.GetShape();
 		int out_height = (shape.height - pool_size) / stride + 1;
 		int out_width = (shape.width - pool_size) / stride + 1;
-		output = Tensor3D<double>(out_height, out_width, shape.depth);
-		grad_input = Tensor3D<double>(shape.height, shape.width, shape.depth);
+		output = Tensor3D<T>(out_height, out_width, shape.depth);
+		grad_input = Tensor3D<T>(shape.height, shape.width, shape.depth);
 		grad_input.InitZeros();
 
 		this->stride = stride;
@@ -67,90 +72,150 @@ namespace layer {
 
 	// Copy constructor, used for loading parameters from a saved model.
 	// param other: layer which will be copied.
-	MaxPool::MaxPool(const MaxPool& other) : Layer(other) {
+	template<typename T>
+	MaxPool<T>::MaxPool(const MaxPool& other) : Layer<T>(other) {
 		stride = other.stride;
 		pool_size = other.pool_size;
 	}
 
-	// Spatially reduces input volume. Slides a p_size*p_size window on
-	// each depth slice. Then, stores the maximum element of the window.
-	// @param prev_act:	activation map from previous layer
-	void MaxPool::Forward(const Tensor3D<double>& prev_activation) {
-		input = Tensor3D<double>(prev_activation);
-		max_indexes.clear();
-
-		convnet_core::Triplet out_shape = GetOutputShape();
-
-		int vert_start, vert_end, horiz_start, horiz_end;
-		// Placeholder of maximum value in every slice.
-		double max = std::numeric_limits<double>::lowest();
-		convnet_core::Triplet max_index;
-		double elem;
-		for (int h = 0; h < out_shape.height; ++h) {
-			for (int w = 0; w < out_shape.width; ++w) {
-				for (int c = 0; c < out_shape.depth; ++c) {
-					// Calculate the boundary indexes of the slice.
-					vert_start = h * stride;
-					vert_end = vert_start + pool_size;
-					horiz_start = w * stride;
-					horiz_end = horiz_start + pool_size;
-
-					// Find the maximum value of the slice and save it.
-					max = std::numeric_limits<double>::lowest();
-					for (int v_slice = vert_start; v_slice < vert_end; ++v_slice) {
-						for (int h_slice = horiz_start; h_slice < horiz_end; ++h_slice) {
-							elem = input(v_slice, h_slice, c);
-							if (elem > max) {
-								max = elem;
-								max_index.height = v_slice;
-								max_index.width = h_slice;
-								max_index.depth = c;
-							}								
+	namespace {
+		// Pools the output rows [first, last) of a plane. The window is read
+		// row by row with unit stride. A pool size and stride known at
+		// compile time (the common 2x2 window with stride 2) unroll the
+		// window, 0 selects the runtime values.
+		// @param plane:		first element of the input plane
+		// @param offset:		offset of the plane in the input
+		// @param out, indexes:	first element of the output plane
+		template<int kPool, int kStride, typename T>
+		void PoolRows(const T* plane, int offset, int in_width, int pool_size, int stride,
+					  T* out, int* indexes, int out_width, int first, int last) {
+			const int p = kPool > 0 ? kPool : pool_size;
+			const int s = kStride > 0 ? kStride : stride;
+			for (int h = first; h < last; ++h) {
+				const T* row = plane + h * s * in_width;
+				for (int w = 0; w < out_width; ++w) {
+					// The first maximum of the window in row-major order is kept.
+					const T* window = row + w * s;
+					T max = window[0];
+					int arg = 0;
+					for (int i = 0; i < p; ++i) {
+						for (int j = 0; j < p; ++j) {
+							if (window[i * in_width + j] > max) {
+								max = window[i * in_width + j];
+								arg = i * in_width + j;
+							}
 						}
 					}
-					output(h, w, c) = max;
-//					std::cout << max_index.height << " " << max_index.width << " " << max_index.depth << std::endl;
-					max_indexes.push_back(max_index);
+					out[h * out_width + w] = max;
+					indexes[h * out_width + w] = offset + static_cast<int>(window - plane) + arg;
 				}
 			}
 		}
 	}
 
+	// The planes and their rows are independent, they are pooled in parallel.
+	// @param sample:	input in planar order
+	// @param out:		output in planar order
+	// @param indexes:	as many elements as the output
+	template<typename T>
+	void MaxPool<T>::Pool(const T* sample, T* out, int* indexes) {
+		const convnet_core::Triplet in_shape = this->GetInputShape();
+		const convnet_core::Triplet out_shape = this->GetOutputShape();
+		const int in_plane = in_shape.height * in_shape.width;
+		const int out_plane = out_shape.height * out_shape.width;
+		const bool pool_2x2 = pool_size == 2 && stride == 2;
+		const int grain = std::max(1, convnet_core::kParallelGrain /
+									  (out_shape.width * pool_size * pool_size));
+
+		convnet_core::ParallelFor(0, out_shape.depth * out_shape.height, grain, [&](int first, int last) {
+			// Split the range of (channel, row) pairs at the plane boundaries.
+			while (first < last) {
+				const int c = first / out_shape.height;
+				const int row_end = std::min(last, (c + 1) * out_shape.height);
+				const int h0 = first - c * out_shape.height;
+				const int h1 = row_end - c * out_shape.height;
+				if (pool_2x2)
+					PoolRows<2, 2>(sample + c * in_plane, c * in_plane, in_shape.width, 2, 2,
+								   out + c * out_plane, indexes + c * out_plane, out_shape.width, h0, h1);
+				else
+					PoolRows<0, 0>(sample + c * in_plane, c * in_plane, in_shape.width, pool_size, stride,
+								   out + c * out_plane, indexes + c * out_plane, out_shape.width, h0, h1);
+				first = row_end;
+			}
+		});
+	}
+
+	// Spatially reduces input volume. Slides a p_size*p_size window on
+	// each depth slice. Then, stores the maximum element of the window.
+	// @param prev_act:	activation map from previous layer
+	template<typename T>
+	void MaxPool<T>::Forward(const ConstTensorView<T>& prev_activation) {
+		// Copied in planar order.
+		input = prev_activation;
+		// Allocated by the first pass only.
+		max_indexes.resize(output.Size());
+		Pool(input.Data(), output.Data(), max_indexes.data());
+	}
+
 	// Calculates the gradients from the upstream gradient.
-	// Stores the max-indexes of each window and multiplies it with 
-	// corresponding upstream gradient.
+	// Routes each upstream gradient to the max-index of its window. The
+	// gradients of overlapping windows are added.
 	// param grad_output: upstream gradient.
-	void MaxPool::Backprop(Tensor3D<double>& grad_out) {
+	template<typename T>
+	void MaxPool<T>::Backprop(const ConstTensorView<T>& grad_out) {
+		assert(grad_out.Size() == static_cast<int>(max_indexes.size()) && grad_out.IsContiguous());
 		grad_input.InitZeros();
-		convnet_core::Triplet grad_shape = GetOutputShape();
-		assert(grad_shape.height * grad_shape.width * grad_shape.depth == max_indexes.size());
-
-		int count = 0;
-		for (int r = 0; r < grad_shape.height; ++r) {
-			for (int c = 0; c < grad_shape.width; ++c) {
-				for (int d = 0; d < grad_shape.depth; ++d) {
-					convnet_core::Triplet index = max_indexes[count];
-					double grad_val = grad_out(r, c, d);
-					grad_input(index.height, index.width, index.depth) = grad_val;
-					++count;
-				}
-			}
+		const T* d_out = grad_out.Data();
+		T* d_in = grad_input.Data();
+		for (int k = 0; k < static_cast<int>(max_indexes.size()); ++k)
+			d_in[max_indexes[k]] += d_out[k];
+	}
+
+	// @param prev_activations:	batch of activation maps from previous layer
+	template<typename T>
+	void MaxPool<T>::Forward(const Tensor4D<T>& prev_activations) {
+		batch_input = prev_activations;
+		const int batch_size = prev_activations.GetBatchSize();
+		const int out_size = output.Size();
+		batch_output.Resize(batch_size, output.GetShape());
+		batch_max_indexes.resize(batch_size * out_size);
+		for (int n = 0; n < batch_size; ++n)
+			Pool(batch_input.Sample(n).Data(), batch_output.Sample(n).Data(),
+				 batch_max_indexes.data() + n * out_size);
+	}
+
+	// @param grad_outputs:	batch of upstream gradients
+	template<typename T>
+	void MaxPool<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		const int batch_size = batch_input.GetBatchSize();
+		assert(grad_outputs.GetBatchSize() == batch_size);
+		const int out_size = output.Size();
+		batch_grad_input.Resize(batch_size, batch_input.GetShape());
+		batch_grad_input.InitZeros();
+		for (int n = 0; n < batch_size; ++n) {
+			const T* d_out = grad_outputs.Sample(n).Data();
+			const int* indexes = batch_max_indexes.data() + n * out_size;
+			T* d_in = batch_grad_input.Sample(n).Data();
+			for (int k = 0; k < out_size; ++k)
+				d_in[indexes[k]] += d_out[k];
 		}
 	}
 
 	// Not implemented, no trainable parameters.
-	void MaxPool::UpdateWeights(double lr, double momentum) { }
+	template<typename T>
+	void MaxPool<T>::UpdateWeights(double lr, double momentum) { }
 
 	// Store layer parameters in a JSON node.
 	// returns layer: JSON representation of the layer. 
-	nlohmann::json MaxPool::Serialize() {
+	template<typename T>
+	nlohmann::json MaxPool<T>::Serialize() {
 		nlohmann::json layer;
 
 		layer["type"] = "pool";
 		layer["name"] = name;
-		layer["height"] = GetInputShape().height;
-		layer["width"] = GetInputShape().width;
-		layer["depth"] = GetInputShape().depth;
+		layer["height"] = this->GetInputShape().height;
+		layer["width"] = this->GetInputShape().width;
+		layer["depth"] = this->GetInputShape().depth;
 		layer["p_size"] = GetPoolSize();
 		layer["stride"] = GetStride();;
 		
@@ -158,14 +223,21 @@ namespace layer {
 	}
 
 	// Not implemented.
-	double MaxPool::Loss(Tensor3D<double>& target) { 	return 0.0; }
+	template<typename T>
+	double MaxPool<T>::Loss(Tensor3D<T>& target) { 	return 0.0; }
 
 	// Getters for serialization.
-	int MaxPool::GetPoolSize() {
+	template<typename T>
+	int MaxPool<T>::GetPoolSize() {
 		return pool_size;
 	}
 
-	int MaxPool::GetStride() {
+	template<typename T>
+	int MaxPool<T>::GetStride() {
 		return stride;
 	}
+
+	// Layers are instantiated for single and double precision.
+	template class MaxPool<float>;
+	template class MaxPool<double>;
 }
\ No newline at end of file
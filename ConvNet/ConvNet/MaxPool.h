@@ -8,7 +8,8 @@
 namespace layer {
 	// MaxPool Layer which is responsible for spatially reducing layers.
 	// Also used for ensuring translation invariance.
-	class MaxPool : public Layer {
+	template<typename T>
+	class MaxPool : public Layer<T> {
 	public:
 		MaxPool();
 		~MaxPool();
@@ -16,20 +17,29 @@ namespace layer {
 				int stride, int pool_size);
 		MaxPool(convnet_core::Triplet shape, std::string name,
 			int stride, int pool_size);
-		MaxPool(convnet_core::Tensor3D<double>& prev_activation, std::string name,
+		MaxPool(convnet_core::Tensor3D<T>& prev_activation, std::string name,
 			int stride, int pool_size);
 		MaxPool(const MaxPool& other);
 
 		// Reduces the spatial size of input.
-		void Forward(const Tensor3D<double>& prev_activation) override;
+		void Forward(const ConstTensorView<T>& prev_activation) override;
 		// Calculates gradients based on the upstream gradient.
-		void Backprop(Tensor3D<double>& grad_output) override;
+		void Backprop(const ConstTensorView<T>& grad_output) override;
 		// Not implemented, there are no trainable parameters of MaxPool layer.
 		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
 		// Used for model saving.
 		nlohmann::json Serialize() override;
 		// Not implemented.
-		double Loss(Tensor3D<double>& target) override;
+		double Loss(Tensor3D<T>& target) override;
+
+		// Batched forward pass, the maximum positions of every sample are kept.
+		void Forward(const Tensor4D<T>& prev_activations) override;
+		// Batched backpropagation, routes the gradients to the stored
+		// positions without repeating the forward pass.
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
 
 		// Getters for serialization.
 		int GetPoolSize();
@@ -40,9 +50,26 @@ namespace layer {
 		int stride;
 		// Size of subsampling windows.
 		int pool_size;
-		// Stores the indexes of max element in each slices.
+		// Stores the indexes of max element in each slices, as offsets in
+		// the planar input, in the planar order of the output.
 		// Used in backprop for gradient routing.
-		std::vector<convnet_core::Triplet> max_indexes;
+		std::vector<int> max_indexes;
+		// The same for every sample of the last batch, one after the other.
+		std::vector<int> batch_max_indexes;
+
+		// Pools a planar sample into a planar output, and stores the offsets
+		// of the maximums.
+		void Pool(const T* sample, T* out, int* indexes);
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
 	};
 }
 
@@ -4,11 +4,16 @@
 #include "Model.h"
 #include "Conv.h"
 #include "Utils.h"
+#include "autotune.h"
 
 namespace convnet_core {
 	// Default constructor and destructor.
-	Model::Model()  { }
-	Model::~Model() { }
+	template<typename T>
+	Model<T>::Model()  { }
+	template<typename T>
+	Model<T>::~Model() {
+		ReleasePlan();
+	}
 
 	// Fits the model with an image. Includes forward pass and backpropagation.
 	// Finnaly, trainable parameters are updated based on the gradients obtained
@@ -18,36 +23,38 @@ namespace convnet_core {
 	// @param lr:		learning rate hyperparameter, used for weight update.
 	// @param momentum: Nesterov momentum, used for ensuring faster convergence.
 	// @returns	pair<bool, double>: a pair that contains whether prediction was correct and the loss.
-	std::pair<bool, double> Model::Fit(Tensor3D<double>& input, 
-									   Tensor3D<double>& target,
+	template<typename T>
+	std::pair<bool, double> Model<T>::Fit(Tensor3D<T>& input, 
+									   Tensor3D<T>& target,
 									   double lr, double momentum) {
+		// Training needs the activations of every layer.
+		if (memory_plan == MemoryPlan::Inference)
+			PlanMemory(MemoryPlan::Training);
+		// Temporaries of the layers are released at the end of the step.
+		ArenaScope step(arena);
 		// Stores whether prediction was correct and the loss.
 		bool correct = false;
 		double loss = 1000;
-		Tensor3D<double> predicted = Predict(input);
+		Tensor3D<T> predicted = Predict(input);
 
 		if (utils::ComparePrediction(predicted, target))
 			correct = true;
 
-		Tensor3D<double> error = (predicted - target);
+		// The prediction is not needed anymore, reuse its storage for the error.
+		Tensor3D<T> error(std::move(predicted));
+		error -= target;
 		loss = layers.back()->Loss(target);
 
-		// Backpropagation to calculate the gradients.
+		// Backpropagation to calculate the gradients, the weights are adjusted
+		// based on the calculated gradients and learning rate.
 		for (int i = layers.size()-1; i >= 0; --i) {
 			if (i == layers.size() - 1) {
-				layers[i]->Backprop(error);
+				layers[i]->BackpropAndUpdate(error, lr);
 			} else {
-				// Handle flattened FC inputs.
-				if (layers[i+1]->GetType() == layer::LayerType::FC) {
-					Tensor3D<double> reshaped = layers[i+1]->GetGrads().Reshape(layers[i]->GetOutputShape());
-					layers[i]->Backprop(reshaped);
-				} else {
-					layers[i]->Backprop(layers[i + 1]->GetGrads());
-				}				
+				// Handle flattened FC inputs. Reshaping only creates a view,
+				// the gradient is not copied.
+				layers[i]->BackpropAndUpdate(layers[i + 1]->GetGrads().Reshape(layers[i]->GetOutputShape()), lr);
 			}
-				
-			// Adjust weights based on the calculated gradients and learning rate.
-			layers[i]->UpdateWeights(lr);
 		}
 
 		return std::pair<bool, double>(correct, loss);
@@ -56,7 +63,9 @@ namespace convnet_core {
 	// Classifies an image represented as a 3D tensor.
 	// @param input:	input image as a 3D tensor.
 	// @returns:		one-hot encoded prediction.
-	Tensor3D<double> Model::Predict(const Tensor3D<double>& input) {
+	template<typename T>
+	Tensor3D<T> Model<T>::Predict(const Tensor3D<T>& input) {
+		ArenaScope step(arena);
 		for (int i = 0; i < layers.size(); ++i) {
 			if (i == 0) {
 					layers[i]->Forward(input);
@@ -68,13 +77,81 @@ namespace convnet_core {
 		return layers.back()->GetOutput();
 	}
 
-	// Saves a model to the hard disk.
+	// Fits the model with a minibatch. Every layer processes the whole batch
+	// at once, then the trainable parameters are updated once, with the mean
+	// of the gradients of the samples.
+	// @param inputs:	batch of input images.
+	// @param targets:	batch of one-hot encoded target variables.
+	// @param lr:		learning rate hyperparameter, used for weight update.
+	// @param momentum: Nesterov momentum, used for ensuring faster convergence.
+	// @returns	pair<int, double>: number of correct predictions and the mean loss.
+	template<typename T>
+	std::pair<int, double> Model<T>::FitBatch(const Tensor4D<T>& inputs,
+											  const Tensor4D<T>& targets,
+											  double lr, double momentum) {
+		assert(inputs.GetBatchSize() == targets.GetBatchSize());
+		ArenaScope step(arena);
+		const int batch_size = inputs.GetBatchSize();
+		Tensor4D<T> predicted = PredictBatch(inputs);
+
+		int correct = 0;
+		for (int n = 0; n < batch_size; ++n) {
+			if (utils::ComparePrediction<T>(predicted.Sample(n), targets.Sample(n)))
+				++correct;
+		}
+		double loss = layers.back()->Loss(targets) / batch_size;
+
+		// Gradient of the mean loss, the layers sum the gradients of the samples.
+		Tensor4D<T> error(std::move(predicted));
+		error -= targets;
+		error *= T(1) / batch_size;
+
+		for (int i = layers.size() - 1; i >= 0; --i) {
+			if (i == layers.size() - 1)
+				layers[i]->BackpropAndUpdate(error, lr, momentum);
+			else
+				layers[i]->BackpropAndUpdate(layers[i + 1]->GetBatchGrads(), lr, momentum);
+		}
+
+		return std::pair<int, double>(correct, loss);
+	}
+
+	// Classifies a batch of images.
+	// @param inputs:	batch of input images.
+	// @returns:		batch of predictions.
+	template<typename T>
+	Tensor4D<T> Model<T>::PredictBatch(const Tensor4D<T>& inputs) {
+		ArenaScope step(arena);
+		for (int i = 0; i < layers.size(); ++i) {
+			if (i == 0)
+				layers[i]->Forward(inputs);
+			else
+				layers[i]->Forward(layers[i - 1]->GetBatchOutput());
+		}
+
+		return layers.back()->GetBatchOutput();
+	}
+
+	// Saves a model to the hard disk. Fused activations are saved as
+	// separate ReLU layers, as they were loaded.
 	// @param path: path of the model file.
-	void Model::Save(std::string path) {
+	template<typename T>
+	void Model<T>::Save(std::string path) {
 		nlohmann::json model_json;
+		int index = 0;
 		for (int i = 0; i < layers.size(); ++i) {			
-			model_json["layer_" + IntToAlphabet(i)] = layers[i]->Serialize();
+			nlohmann::json layer = layers[i]->Serialize();
+			model_json["layer_" + IntToAlphabet(index++)] = layer;
+			if (layer["type"] != "conv")
+				continue;
+
+			layer::Conv<T>* conv = static_cast<layer::Conv<T>*>(layers[i]);
+			if (conv->HasFusedActivation()) {
+				layer::ReLU<T> relu(conv->GetOutputShape(), conv->GetActivationName());
+				model_json["layer_" + IntToAlphabet(index++)] = relu.Serialize();
+			}
 		}
+		model_json["precision"] = Precision();
 
 		std::ofstream o(path);
 		o << std::setw(4) << model_json;
@@ -82,43 +159,190 @@ namespace convnet_core {
 	}
 
 	// Loads a model to the hard disk.
-	// @param path: path of the model file.
-	void Model::Load(std::string path) {
+	// @param path:			path of the model file.
+	// @param tuning_cache:	path of the tuning cache, empty to use the
+	//						estimated costs of the algorithms instead.
+	template<typename T>
+	void Model<T>::Load(std::string path, std::string tuning_cache) {
 		std::ifstream i(path);
 		nlohmann::json model_json;
 		i >> model_json;
+		TuningCache cache(tuning_cache);
+		// Selects the algorithm of a convolution from the cache, or by
+		// benchmarking it. Layers of the same signature are benchmarked only
+		// once.
+		auto tune = [&](layer::Conv<T>& conv) {
+			if (tuning_cache.empty())
+				return;
+
+			const std::string signature = conv.Signature();
+			layer::ConvAlgorithm algorithm;
+			if (!layer::ParseConvAlgorithm(cache.Find(signature), algorithm)) {
+				algorithm = conv.Autotune();
+				cache.Store(signature, layer::ConvAlgorithmName(algorithm));
+			}
+			conv.SetAlgorithm(algorithm);
+		};
 
-		// Construct layers from the model file.
+		// Construct layers from the model file. Entries other than
+		// layers (e.g. precision) are skipped. A ReLU layer directly after a
+		// Conv layer is fused into its forward pass, the other ones run in
+		// place.
+		layer::Conv<T>* last_conv = nullptr;
 		for (auto& layer : model_json) {
+			if (!layer.is_object())
+				continue;
+
+			// The Conv layer preceding this one, if any.
+			layer::Conv<T>* previous_conv = last_conv;
+			last_conv = nullptr;
 			if (layer["type"] == "pool") {
-				layer::MaxPool* pool = new layer::MaxPool(utils::ReadPoolLayerJSON(layer));
+				layer::MaxPool<T>* pool = new layer::MaxPool<T>(utils::ReadPoolLayerJSON<T>(layer));
 				Add(pool);
 			} else if (layer["type"] == "conv") {
-				layer::Conv *conv = new layer::Conv(utils::ReadConvLayerJSON(layer));
+				layer::Conv<T> *conv = new layer::Conv<T>(utils::ReadConvLayerJSON<T>(layer));
+				tune(*conv);
+				Add(conv);
+				last_conv = conv;
+			} else if (layer["type"] == "group_conv") {
+				layer::GroupConv<T>* conv = new layer::GroupConv<T>(utils::ReadGroupConvLayerJSON<T>(layer));
+				// Every group is a dense convolution of its own.
+				for (int g = 0; g < conv->GetGroupCount(); ++g)
+					tune(conv->GetGroup(g));
+				Add(conv);
+			} else if (layer["type"] == "depthwise_conv") {
+				layer::DepthwiseConv<T>* conv = new layer::DepthwiseConv<T>(utils::ReadDepthwiseConvLayerJSON<T>(layer));
 				Add(conv);
 			} else if (layer["type"] == "relu") {
-				layer::ReLU* relu = new layer::ReLU(utils::ReadReLUJSON(layer));
-				Add(relu);
+				// Only a layer that is not fused is added to the model.
+				layer::ReLU<T> relu = utils::ReadReLUJSON<T>(layer);
+				if (previous_conv && relu.GetInput().Size() == previous_conv->GetOutput().Size()) {
+					previous_conv->FuseActivation(relu.GetName());
+				} else {
+					relu.SetInPlace(true);
+					Add(new layer::ReLU<T>(relu));
+				}
 			} else if (layer["type"] == "fc") {
-				layer::FC *fc = new layer::FC(utils::ReadFCLayerJSON(layer));
+				layer::FC<T> *fc = new layer::FC<T>(utils::ReadFCLayerJSON<T>(layer));
 				Add(fc);
 			} else if (layer["type"] == "softmax") {
-				layer::Softmax* softmax = new layer::Softmax(utils::ReadSoftmaxJSON(layer));
+				layer::Softmax<T>* softmax = new layer::Softmax<T>(utils::ReadSoftmaxJSON<T>(layer));
 				Add(softmax);
 			}
 		}
+		if (!tuning_cache.empty())
+			cache.Save();
+		PlanMemory(MemoryPlan::Training);
 	}
 
-	void Model::Add(layer::Layer* layer) {
+	template<typename T>
+	void Model<T>::Add(layer::Layer<T>* layer) {
+		// The lifetimes of the planned tensors change.
+		ReleasePlan();
 		layers.push_back(layer);
 	}
 
+	// With L layers, a training step runs the forward pass of layer i in
+	// step i and its backward pass in step 2L - 1 - i. The input of a layer
+	// is read by its backward pass, and its gradient by the backward pass of
+	// the previous layer. During inference the output of layer i is read
+	// last by layer i + 1, in step i + 1. An in-place layer writes its output
+	// into its input and its gradient into the upstream gradient, so they
+	// share one region, which lives as long as the longer of the two.
+	// @param plan:	placement of the tensors
+	template<typename T>
+	void Model<T>::PlanMemory(MemoryPlan plan) {
+		ReleasePlan();
+		if (plan == MemoryPlan::None || layers.empty())
+			return;
+
+		const bool training = plan == MemoryPlan::Training;
+		const int count = layers.size();
+		std::vector<TensorLifetime> lifetimes;
+		auto place = [&](const Tensor3D<T>& tensor, int first, int last) {
+			lifetimes.push_back(TensorLifetime{ tensor.Size() * sizeof(T), first, last });
+			return static_cast<int>(lifetimes.size()) - 1;
+		};
+
+		// Index of the lifetime of the tensors of each layer.
+		std::vector<int> inputs(count), outputs(count), grads(count);
+		inputs[0] = place(layers[0]->GetInput(), 0, training ? 2 * count - 1 : 0);
+		for (int i = 0; i < count; ++i) {
+			const int last = training ? 2 * count - 1 - i : i + 1;
+			if (i > 0 && layers[i]->IsInPlace() && inputs[i] == outputs[i - 1]) {
+				outputs[i] = inputs[i];
+				lifetimes[outputs[i]].last = std::max(lifetimes[outputs[i]].last, last);
+			} else {
+				outputs[i] = place(layers[i]->GetOutput(), i, last);
+			}
+			if (i + 1 == count)
+				continue;
+
+			// Forward copies the output into the input of the next layer,
+			// which is skipped if they share the storage.
+			if (layers[i + 1]->GetInput().Size() == layers[i]->GetOutput().Size())
+				inputs[i + 1] = outputs[i];
+			else
+				inputs[i + 1] = place(layers[i + 1]->GetInput(), i + 1, last);
+		}
+		if (training) {
+			// From the last layer, the upstream gradient is placed first.
+			for (int i = count - 1; i >= 0; --i) {
+				if (i + 1 < count && layers[i]->IsInPlace() &&
+					layers[i]->GetGrads().Size() == layers[i + 1]->GetGrads().Size()) {
+					grads[i] = grads[i + 1];
+					lifetimes[grads[i]].last = 2 * count - i;
+				} else {
+					grads[i] = place(layers[i]->GetGrads(), 2 * count - 1 - i, 2 * count - i);
+				}
+			}
+		} else {
+			int largest = 0;
+			for (int i = 1; i < count; ++i) {
+				if (layers[i]->GetGrads().Size() > layers[largest]->GetGrads().Size())
+					largest = i;
+			}
+			std::fill(grads.begin(), grads.end(), place(layers[largest]->GetGrads(), 0, count));
+		}
+
+		std::vector<size_t> offsets;
+		planned_block.Resize(static_cast<int>(convnet_core::PlanMemory(lifetimes, offsets)));
+		for (size_t t = 0; t < lifetimes.size(); ++t)
+			regions.emplace_back(new RegionResource(planned_block.data() + offsets[t], lifetimes[t].bytes));
+		for (int i = 0; i < count; ++i)
+			layers[i]->SetResources(regions[inputs[i]].get(), regions[outputs[i]].get(), regions[grads[i]].get());
+		memory_plan = plan;
+	}
+
+	template<typename T>
+	MemoryPlan Model<T>::GetMemoryPlan() const {
+		return memory_plan;
+	}
+
+	template<typename T>
+	size_t Model<T>::PlannedBytes() const {
+		return memory_plan == MemoryPlan::None ? 0 : planned_block.size();
+	}
+
+	template<typename T>
+	void Model<T>::ReleasePlan() {
+		if (memory_plan == MemoryPlan::None)
+			return;
+
+		for (layer::Layer<T>* layer : layers)
+			layer->SetResources(DefaultResource(), DefaultResource(), DefaultResource());
+		regions.clear();
+		planned_block = Buffer<char>();
+		memory_plan = MemoryPlan::None;
+	}
+
 	// Evaluates an image an returns whether prediction was accurate and with the loss.
 	// @param input:	input image as a 3D tensor.
 	// @param target:	one-hot encoded target variable.
 	// @returns	pair<bool, double>: a pair that contains whether prediction was correct and the loss.
-	std::pair<bool, double> Model::Evaluate(Tensor3D<double>& input, Tensor3D<double>& target) {
-		Tensor3D<double> predicted = Predict(input);
+	template<typename T>
+	std::pair<bool, double> Model<T>::Evaluate(Tensor3D<T>& input, Tensor3D<T>& target) {
+		Tensor3D<T> predicted = Predict(input);
 		bool correct = false;
 		double loss;
 
@@ -134,7 +358,8 @@ namespace convnet_core {
 	// Maps int numbers to the alphabet.
 	// Required for serialization.
 	// param n: number to map
-	std::string Model::IntToAlphabet(int n) {
+	template<typename T>
+	std::string Model<T>::IntToAlphabet(int n) {
 		assert(n >= 0 && n < 26);
 		std::string alphabet = "abcdefghijklmnopqrstuvwxyz";
 		std::string result;
@@ -142,5 +367,28 @@ namespace convnet_core {
 
 		return result;
 	}
-}
 
+	template<typename T>
+	std::string Model<T>::Precision() {
+		return std::is_same<T, float>::value ? "float" : "double";
+	}
+
+	// Reads the precision of a saved model.
+	// @param path: path of the model file.
+	// @returns:	"float" or "double".
+	template<typename T>
+	std::string Model<T>::ReadPrecision(std::string path) {
+		std::ifstream i(path);
+		nlohmann::json model_json;
+		i >> model_json;
+
+		if (model_json.count("precision") == 0)
+			return "double";
+
+		return model_json["precision"];
+	}
+
+	// Models are instantiated for single and double precision.
+	template class Model<float>;
+	template class Model<double>;
+}
@@ -6,14 +6,27 @@
 #include <memory>
 #include "Layer.h"
 #include "Conv.h"
+#include "GroupConv.h"
+#include "DepthwiseConv.h"
 #include "ReLU.h"
 #include "MaxPool.h"
 #include "FC.h"
 #include "Softmax.h"
 
 namespace convnet_core {
+	// Placement of the activations and gradients of the layers (see Model::PlanMemory).
+	//	None:		every layer keeps its own tensors
+	//	Training:	every activation is kept for the backward pass, the gradients
+	//				reuse the memory of the activations that are not needed anymore
+	//	Inference:	an output is kept only until the next layer has read it, so
+	//				the activations take about two buffers, the gradients share one
+	enum class MemoryPlan { None, Training, Inference };
+
 	// This class is responsible for representing a CNN.
 	// Interface is inspired by Keras.
+	// Templated on the scalar type (float or double) of the layers, the
+	// precision of a saved model can be queried with ReadPrecision.
+	template<typename T>
 	class Model
 	{
 	public:
@@ -21,24 +34,59 @@ namespace convnet_core {
 		~Model();
 
 		// Fits the model with one training example.
-		std::pair<bool, double> Fit(Tensor3D<double>& input, 
-									Tensor3D<double>& target,
+		std::pair<bool, double> Fit(Tensor3D<T>& input, 
+									Tensor3D<T>& target,
 									double learning_rate, double momentum=0.9);
 		// Classifies an image. 
-		Tensor3D<double> Predict(const Tensor3D<double>& input);
+		Tensor3D<T> Predict(const Tensor3D<T>& input);
+		// Fits the model with a minibatch, the gradients are averaged over the samples.
+		std::pair<int, double> FitBatch(const Tensor4D<T>& inputs,
+										const Tensor4D<T>& targets,
+										double learning_rate, double momentum=0.9);
+		// Classifies a batch of images.
+		Tensor4D<T> PredictBatch(const Tensor4D<T>& inputs);
 		// Saves a trained model.
 		void Save(std::string path);
-		// Loads a model from hard disk.
-		void Load(std::string path);
-		// Adds a layer to the layer container.
-		void Add(layer::Layer* layer);
+		// Loads a model from hard disk. A ReLU layer following a Conv layer
+		// is fused into the Conv layer, the other ReLU layers run in place. If a tuning cache is given, the
+		// algorithm of each Conv layer is read from it, or selected by
+		// benchmarking the eligible ones and stored in it (see autotune.h).
+		void Load(std::string path, std::string tuning_cache = "");
+		// Adds a layer to the layer container. Releases the memory plan.
+		void Add(layer::Layer<T>* layer);
+		// Places the inputs, outputs and input gradients of the layers into
+		// one preallocated block. The output of a layer is the input of the
+		// next one, and tensors whose lifetimes do not overlap share memory.
+		// Fit switches an inference plan to a training plan. Loading plans
+		// for training.
+		void PlanMemory(MemoryPlan plan = MemoryPlan::Training);
+		MemoryPlan GetMemoryPlan() const;
+		// Size of the block of the memory plan in bytes.
+		size_t PlannedBytes() const;
 		// Evaluates an image an returns whether prediction was accurate and with the loss.
-		std::pair<bool, double> Evaluate(Tensor3D<double>& input, Tensor3D<double>& target);
+		std::pair<bool, double> Evaluate(Tensor3D<T>& input, Tensor3D<T>& target);
+		// Name of the scalar type of the model ("float" or "double").
+		static std::string Precision();
+		// Reads the precision of a saved model. Models saved without precision are double.
+		static std::string ReadPrecision(std::string path);
 
 	private:
 		// Container of layers, layers are dynamically typed in order to 
 		// apply specialized methods.
-		std::vector<layer::Layer*> layers;
+		std::vector<layer::Layer<T>*> layers;
+		// Storage of the temporaries of one Fit or Predict call, reset after
+		// each call. Grows to the peak usage of a step, so steady-state
+		// training and inference do not allocate.
+		ArenaResource arena;
+		// Block of the memory plan and its regions, a region per planned
+		// tensor. The layers are not owned by the model, their tensors are
+		// moved back to the default pool when the plan is released.
+		MemoryPlan memory_plan = MemoryPlan::None;
+		Buffer<char> planned_block;
+		std::vector<std::unique_ptr<RegionResource>> regions;
+
+		// Moves the tensors of the layers back to the default pool.
+		void ReleasePlan();
 
 		// Maps int numbers to the alphabet.
 		// Required for serialization.
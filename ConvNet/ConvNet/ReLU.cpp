@@ -5,103 +5,177 @@
 
 namespace layer {
 	// Default consturctor and destructor.
-	ReLU::ReLU() { }
-	ReLU::~ReLU() { }
+	template<typename T>
+	ReLU<T>::ReLU() { }
+	template<typename T>
+	ReLU<T>::~ReLU() { }
 
 	// Creates a ReLU layer invoking the base constructor.
 	// @param height:	input height
 	// @param width:	input width
 	// @param depth:	input depth
 	// @param name:		name of the layer
-	ReLU::ReLU(std::string name, int height, int width, int depth) : Layer(name)	{
+	template<typename T>
+	ReLU<T>::ReLU(std::string name, int height, int width, int depth) : Layer<T>(name)	{
 		LayerType type = LayerType::ReLU;
-		Layer::SetType(type);
+		this->SetType(type);
 
-		input = Tensor3D<double>(height, width, depth);
-		output = Tensor3D<double>(height, width, depth);
-		grad_input = Tensor3D<double>(height, width, depth);
+		input = Tensor3D<T>(height, width, depth);
+		output = Tensor3D<T>(height, width, depth);
+		grad_input = Tensor3D<T>(height, width, depth);
 	}
 
 	// Copy constructor, used for loading parameters from a saved model.
 	// param other: layer which will be copied.
-	ReLU::ReLU(const ReLU& other) : Layer(other) { }
+	template<typename T>
+	ReLU<T>::ReLU(const ReLU& other) : Layer<T>(other), in_place(other.in_place) { }
 
 	// Creates a ReLU layer invoking the base constructor.
 	// @param shape:	input shape
 	// @param name:		name of the layer
-	ReLU::ReLU(convnet_core::Triplet shape, std::string name) : Layer(shape, name) {
-		output = Tensor3D<double>(shape.height, shape.width, shape.depth);
-		grad_input = Tensor3D<double>(shape.height, shape.width, shape.depth);
+	template<typename T>
+	ReLU<T>::ReLU(convnet_core::Triplet shape, std::string name) : Layer<T>(shape, name) {
+		output = Tensor3D<T>(shape.height, shape.width, shape.depth);
+		grad_input = Tensor3D<T>(shape.height, shape.width, shape.depth);
 	}
 
 	// Creates a ReLU layer invoking the base constructor.
 	// @param prev_act:	tensor from previous layer
 	// @param name:		name of the layer
-	ReLU::ReLU(convnet_core::Tensor3D<double>& prev_activation, std::string name) 
-			: Layer(prev_activation, name) {
+	template<typename T>
+	ReLU<T>::ReLU(convnet_core::Tensor3D<T>& prev_activation, std::string name) 
+			: Layer<T>(prev_activation, name) {
 		convnet_core::Triplet shape = prev_activation.GetShape();
-		output = Tensor3D<double>(shape.height, shape.width, shape.depth);
-		grad_input = Tensor3D<double>(shape.height, shape.width, shape.depth);
+		output = Tensor3D<T>(shape.height, shape.width, shape.depth);
+		grad_input = Tensor3D<T>(shape.height, shape.width, shape.depth);
 	}
 
 	// Applies rectified linear unit non-linearity on previous activation map.
+	// In in-place mode the previous activation is read directly, and
+	// overwritten if the output shares its memory.
 	// @param prev_act: activation map from previous layer
-	void ReLU::Forward(const Tensor3D<double>& prev_activation) {
-		input = Tensor3D<double>(prev_activation);
-		
-		int depth = input.GetShape().depth;
-		int height = input.GetShape().height;
-		int width = input.GetShape().width;
-		output = Tensor3D<double>(height, width, depth);
-
-		for (int k = 0; k < depth; ++k) {
-			for (int i = 0; i < height; ++i) {
-				for (int j = 0; j < width; ++j) {
-					//output(i, j, k) = input(i, j, k) > 0 ? input(i, j, k) : 0;
-					output(i, j, k) = input(i, j, k) < 0 ? (0.1*input(i, j, k)) : (1 * input(i, j, k));
-
-				}
-			}
+	template<typename T>
+	void ReLU<T>::Forward(const ConstTensorView<T>& prev_activation) {
+		if (in_place) {
+			const int size = prev_activation.Size();
+			if (output.Size() != size)
+				output = Tensor3D<T>(prev_activation.GetShape());
+			// Strided views are copied in planar order first.
+			if (!prev_activation.IsContiguous())
+				output = prev_activation;
+			const T* x = prev_activation.IsContiguous() ? prev_activation.Data() : output.Data();
+			mask.resize((size + 31) / 32);
+			convnet_core::kernels::LeakyReluMask(x, T(0.1), output.Data(), mask.data(), size);
+			return;
 		}
+
+		input = prev_activation;
+		
+		// Every element is overwritten, the storage is reused between calls.
+		if (output.Size() != input.Size())
+			output = Tensor3D<T>(input.GetShape());
+
+		// Leaky ReLU: output = input < 0 ? 0.1 * input : input.
+		convnet_core::kernels::LeakyRelu(input.Data(), T(0.1), output.Data(), input.Size());
 	}
 
 	// Calculates the gradients from the upstream gradient.
 	// param grad_output: upstream gradient.
-	void ReLU::Backprop(Tensor3D<double>& grad_out) {
-		grad_input.InitZeros();
-
-		int depth = input.GetShape().depth;
-		int height = input.GetShape().height;
-		int width = input.GetShape().width;
-		for (int k = 0; k < depth; ++k) {
-			for (int i = 0; i < height; ++i) {
-				for (int j = 0; j < width; ++j) {
-					//grad_input(i, j, k) = input(i, j, k) < 0 ? 0 : (1 * grad_out(i, j, k));
-					grad_input(i, j, k) = input(i, j, k) < 0 ? (0.1*grad_out(i, j, k)) : (1 * grad_out(i, j, k));
-				}
-			}
+	template<typename T>
+	void ReLU<T>::Backprop(const ConstTensorView<T>& grad_out) {
+		if (in_place) {
+			// The upstream gradient is overwritten if the input gradient
+			// shares its memory.
+			assert(grad_out.IsContiguous() && grad_out.Size() == output.Size());
+			if (grad_input.Size() != output.Size())
+				grad_input = Tensor3D<T>(output.GetShape());
+			convnet_core::kernels::LeakyReluMaskBackward(mask.data(), grad_out.Data(), T(0.1),
+														 grad_input.Data(), output.Size());
+			return;
+		}
+
+		// Upstream gradients are dense, every element is overwritten.
+		assert(grad_out.IsContiguous() && grad_out.Size() == input.Size());
+		if (grad_input.Size() != input.Size())
+			grad_input = Tensor3D<T>(input.GetShape());
+
+		// grad_input = input < 0 ? 0.1 * grad_out : grad_out.
+		convnet_core::kernels::LeakyReluBackward(input.Data(), grad_out.Data(), T(0.1), 
+												 grad_input.Data(), input.Size());
+	}
+
+	// Applies the non-linearity on a batch with a single kernel call.
+	// @param prev_activations: batch of activation maps from previous layer
+	template<typename T>
+	void ReLU<T>::Forward(const Tensor4D<T>& prev_activations) {
+		if (in_place) {
+			// The input batch is not copied.
+			batch_output.Resize(prev_activations.GetBatchSize(), prev_activations.GetShape());
+			batch_mask.resize((prev_activations.Size() + 31) / 32);
+			convnet_core::kernels::LeakyReluMask(prev_activations.Data(), T(0.1), batch_output.Data(),
+												 batch_mask.data(), prev_activations.Size());
+			return;
 		}
+
+		batch_input = prev_activations;
+		batch_output.Resize(batch_input.GetBatchSize(), batch_input.GetShape());
+		convnet_core::kernels::LeakyRelu(batch_input.Data(), T(0.1), batch_output.Data(), 
+										 batch_input.Size());
+	}
+
+	// param grad_outputs: batch of upstream gradients.
+	template<typename T>
+	void ReLU<T>::Backprop(const Tensor4D<T>& grad_outputs) {
+		if (in_place) {
+			assert(grad_outputs.Size() == batch_output.Size());
+			batch_grad_input.Resize(batch_output.GetBatchSize(), batch_output.GetShape());
+			convnet_core::kernels::LeakyReluMaskBackward(batch_mask.data(), grad_outputs.Data(), T(0.1),
+														 batch_grad_input.Data(), batch_output.Size());
+			return;
+		}
+
+		assert(grad_outputs.Size() == batch_input.Size());
+		batch_grad_input.Resize(batch_input.GetBatchSize(), batch_input.GetShape());
+		convnet_core::kernels::LeakyReluBackward(batch_input.Data(), grad_outputs.Data(), T(0.1),
+												 batch_grad_input.Data(), batch_input.Size());
+	}
+
+	template<typename T>
+	void ReLU<T>::SetInPlace(bool in_place) {
+		this->in_place = in_place;
+	}
+
+	template<typename T>
+	bool ReLU<T>::IsInPlace() const {
+		return in_place;
 	}
 
 	// Not implemented, no trainable parameters.
-	void ReLU::UpdateWeights(double lr, double momentum) { }
+	template<typename T>
+	void ReLU<T>::UpdateWeights(double lr, double momentum) { }
 
 	// Stores layer parameters in a JSON node.
 	// returns layer: JSON representation of the layer. 
-	nlohmann::json ReLU::Serialize() {
+	template<typename T>
+	nlohmann::json ReLU<T>::Serialize() {
 		nlohmann::json layer;
 
 		layer["type"] = "relu";
 		layer["name"] = name;
-		layer["height"] = GetInputShape().height;
-		layer["width"] = GetInputShape().width;
-		layer["depth"] = GetInputShape().depth;
+		layer["height"] = this->GetInputShape().height;
+		layer["width"] = this->GetInputShape().width;
+		layer["depth"] = this->GetInputShape().depth;
 
 		return layer;
 	}
 
 	// Not implemented.
-	double ReLU::Loss(Tensor3D<double>& target) { return 0.0; }
+	template<typename T>
+	double ReLU<T>::Loss(Tensor3D<T>& target) { return 0.0; }
+
+	// Layers are instantiated for single and double precision.
+	template class ReLU<float>;
+	template class ReLU<double>;
 }
 
 
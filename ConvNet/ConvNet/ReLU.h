@@ -5,27 +5,61 @@
 #include "Layer.h"
 
 namespace layer {
-	// Rectified linear unit, non-linearity layer.
-	class ReLU : public Layer
+	// Rectified linear unit, non-linearity layer. In in-place mode the input
+	// is not kept, only the signs of its elements (a bit per element) are
+	// stored for the backward pass. The output may then share the memory of
+	// the input, and the input gradient that of the upstream gradient.
+	template<typename T>
+	class ReLU : public Layer<T>
 	{
 	public:
 		ReLU();
 		ReLU(std::string name, int height, int width, int depth);
 		ReLU(const ReLU & other);
 		ReLU(convnet_core::Triplet shape, std::string name);
-		ReLU(Tensor3D<double>& prev_activation, std::string name);
+		ReLU(Tensor3D<T>& prev_activation, std::string name);
 		~ReLU();
 
 		// Forward pass.
-		void Forward(const Tensor3D<double>& prev_activation) override;
+		void Forward(const ConstTensorView<T>& prev_activation) override;
 		// Calculates gradients based on the upstream gradient.
-		void Backprop(Tensor3D<double>& grad_out) override;
+		void Backprop(const ConstTensorView<T>& grad_out) override;
 		// Not implemented, no trainable params.
 		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
 		// Used for model saving.
 		nlohmann::json Serialize() override;
 		// Not implemented.
-		double Loss(Tensor3D<double>& target) override;
+		double Loss(Tensor3D<T>& target) override;
+
+		// Batched versions, the whole batch is processed by one kernel call.
+		void Forward(const Tensor4D<T>& prev_activations) override;
+		void Backprop(const Tensor4D<T>& grad_outputs) override;
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+
+		// Selects the in-place mode (off by default). GetInput is not
+		// updated by the forward pass in this mode.
+		void SetInPlace(bool in_place);
+		bool IsInPlace() const override;
+
+	private:
+		bool in_place = false;
+		// Signs of the input of the last forward pass (see kernels::LeakyReluMask),
+		// in in-place mode.
+		std::vector<unsigned> mask;
+		// The same for the last batch.
+		std::vector<unsigned> batch_mask;
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
+		using Layer<T>::batch_input;
+		using Layer<T>::batch_output;
+		using Layer<T>::batch_grad_input;
 	};
 }
 
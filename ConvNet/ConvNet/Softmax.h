@@ -6,26 +6,39 @@
 namespace layer {
 	// Softmax non-linearity, applied on the output of last FC layer.
 	// Calculates the probabilities of belonging to each class.
-	class Softmax : public Layer
+	template<typename T>
+	class Softmax : public Layer<T>
 	{
 	public:
 		Softmax();
 		~Softmax();
 
-		Softmax(convnet_core::Tensor3D<double>& prev_activation, std::string name);
+		Softmax(convnet_core::Tensor3D<T>& prev_activation, std::string name);
 		Softmax(std::string name, int height, int width, int depth);
 		Softmax(const Softmax & other);
 
 		// Forward pass, calculates softmax function on each data element.
-		void Forward(const Tensor3D<double>& prev_activation) override;
+		void Forward(const ConstTensorView<T>& prev_activation) override;
 		// Calculates the categorical cross entropy loss w.r.t. to an input/target pair.
-		double Loss(Tensor3D<double>& target) override;
+		double Loss(Tensor3D<T>& target) override;
 		// Calculates gradients based on the upstream gradient.
-		void Backprop(Tensor3D<double>& grad_out) override;
+		void Backprop(const ConstTensorView<T>& grad_out) override;
 		// Not implemented, no trainable parameters.
 		void UpdateWeights(double learning_rate, double momentum = 0.9) override;
 		// Used for model saving.
 		nlohmann::json Serialize() override;
+
+		// Batched versions of the base class.
+		using Layer<T>::Forward;
+		using Layer<T>::Backprop;
+		using Layer<T>::Loss;
+
+	protected:
+		// Members of the dependent base class.
+		using Layer<T>::input;
+		using Layer<T>::output;
+		using Layer<T>::grad_input;
+		using Layer<T>::name;
 	};
 
 }
@@ -1,6 +1,11 @@
 #include "TestConv.h"
 #include "Conv.h"
+#include "GroupConv.h"
+#include "DepthwiseConv.h"
+#include "Model.h"
 #include "Utils.h"
+#include "autotune.h"
+#include "parallel.h"
 
 TestConv::TestConv() { }
 TestConv::~TestConv() { }
@@ -11,22 +16,22 @@ bool TestConv::TestConstructor() {
 	shape.height = 5; shape.width = 5; shape.depth = 3;
 	int f_count = 2; int f_size = 3; 
 	int stride = 2; int padding = 1;
-	layer::Conv conv(shape, "conv_1", f_count, 
+	layer::Conv<double> conv(shape, "conv_1", f_count, 
 					 f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 
-	layer::Conv conv_prev(conv.GetInput(), "conv_prev1", f_count,
+	layer::Conv<double> conv_prev(conv.GetInput(), "conv_prev1", f_count,
 		f_size, stride, padding);
 	utils::PrintLayerShapes(conv_prev);
 
 	// same padding
 	stride = 1;
 	padding = (f_size - 1) / 2;
-	layer::Conv conv2(shape, "conv_2", f_count,
+	layer::Conv<double> conv2(shape, "conv_2", f_count,
 					 f_size, stride, padding);
 	utils::PrintLayerShapes(conv2);
 
-	layer::Conv conv_prev2(conv2.GetInput(), "conv_prev2", f_count,
+	layer::Conv<double> conv_prev2(conv2.GetInput(), "conv_prev2", f_count,
 		f_size, stride, padding);
 	utils::PrintLayerShapes(conv_prev2);
 
@@ -34,47 +39,36 @@ bool TestConv::TestConstructor() {
 }
 
 bool TestConv::TestPadding() {
-	/*std::vector<int> vec({ 1,2,3,4,5,6,7,8,9 });
-	Tensor3D<double> tensor = utils::CreateTensorFromVec(vec, 3, 3);
-	tensor = Tensor3D<double>(2, 2, 2);
-	tensor.InitRandom();
-	
-	int f_count = 2; int f_size = 3;
-	int stride = 2; int padding = 2;
-	layer::Conv conv(tensor, "conv_1", f_count,
-		f_size, stride, padding);
-	
-	std::cout << "Input: " << std::endl;
-	convnet_core::PrintTensor(conv.GetInput());
-	
-	std::cout << "Padded: " << std::endl;
-	Tensor3D<double> padded = conv.ZeroPad(conv.GetInput());
-	convnet_core::PrintTensor(padded);
-	*/
-	return true;
-}
-
-bool TestConv::TestUnpadding() {
-	//std::vector<int> vec({ 1,2,3,4,5,6,7,8,9 });
-	//Tensor3D<double> tensor = utils::CreateTensorFromVec(vec, 3, 3);
-	//tensor = Tensor3D<double>(2, 2, 2);
-	//tensor.InitRandom();
-
-	//int f_count = 2; int f_size = 3;
-	//int stride = 2; int padding = 2;
-	//layer::Conv conv(tensor, "conv_1", f_count, f_size, stride, padding);
-
-	//std::cout << "Input: " << std::endl;
-	//convnet_core::PrintTensor(conv.GetInput());
-
-	//std::cout << "Padded: " << std::endl;
-	//Tensor3D<double> padded = conv.ZeroPad(conv.GetInput());
-	//convnet_core::PrintTensor(padded);
+	std::cout << "TestConv::TestPadding" << std::endl;
+
+	// The direct convolution clips the windows to the input instead of
+	// padding it. Up to a padding larger than the kernel (windows entirely
+	// outside), with a single channel (used without a copy) and with a
+	// partial channel block, it matches the lowered convolution.
+	const int depths[] = { 1, 11 };
+	for (int depth : depths) {
+		Tensor3D<double> input(6, 5, depth);
+		input.InitRandom();
+		for (int padding = 0; padding <= 4; ++padding) {
+			std::vector<Tensor3D<double>> outputs;
+			const layer::ConvAlgorithm algorithms[] = { layer::ConvAlgorithm::Im2col,
+														layer::ConvAlgorithm::Direct };
+			for (layer::ConvAlgorithm algorithm : algorithms) {
+				layer::Conv<double> conv(input, "conv_pad", 2, 3, 2, padding);
+				for (int f = 0; f < 2; ++f) {
+					for (int i = 0; i < conv.GetWeights()[f].Size(); ++i)
+						conv.GetWeights()[f][i] = ((f * 7 + i * 5) % 9) / 9.0 - 0.5;
+					conv.GetBias()[f](0, 0, 0) = 0.5 + f;
+				}
+				conv.SetAlgorithm(algorithm);
+				conv.Forward(input);
+				outputs.push_back(conv.GetOutput());
+			}
+			for (int i = 0; i < outputs[0].Size(); ++i)
+				assert(std::abs(outputs[0][i] - outputs[1][i]) < 1e-12);
+		}
+	}
 
-	//std::cout << "Unpadded: " << std::endl;
-	//Tensor3D<double> unpadded = conv.Unpad(padded);
-	//convnet_core::PrintTensor(unpadded);
-	
 	return true;
 }
 
@@ -88,7 +82,7 @@ bool TestConv::TestForward() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_1", f_count,
+	layer::Conv<double> conv(input, "conv_1", f_count,
 		f_size, stride, padding);
 	conv.GetWeights()[0] = filter;
 
@@ -114,7 +108,7 @@ bool TestConv::TestForwardPadded() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 2; int padding = 1;
-	layer::Conv conv(input, "conv_pad", f_count,
+	layer::Conv<double> conv(input, "conv_pad", f_count,
 		f_size, stride, padding);
 	conv.GetWeights()[0] = filter;
 
@@ -139,7 +133,7 @@ bool TestConv::TestForward2() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_1", f_count,
+	layer::Conv<double> conv(input, "conv_1", f_count,
 		f_size, stride, padding);
 	conv.GetWeights()[0] = filter;
 
@@ -183,7 +177,7 @@ bool TestConv::TestForwardDeep() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_deep", f_count,
+	layer::Conv<double> conv(input, "conv_deep", f_count,
 		f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 
@@ -246,7 +240,7 @@ bool TestConv::TestForward3() {
 	// Define the Conv layer.
 	int f_count = 2; int f_size = 3;
 	int stride = 2; int padding = 1;
-	layer::Conv conv(input, "conv_1", f_count,
+	layer::Conv<double> conv(input, "conv_1", f_count,
 		f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 
@@ -284,7 +278,7 @@ bool TestConv::TestBackprop() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_1", f_count, f_size, stride, padding);
+	layer::Conv<double> conv(input, "conv_1", f_count, f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 	std::cout << conv.GetWeights()[0].GetShape().depth << std::endl;
 
@@ -332,7 +326,7 @@ bool TestConv::TestBackprop2() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_1", f_count, f_size, stride, padding);
+	layer::Conv<double> conv(input, "conv_1", f_count, f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 	std::cout << conv.GetWeights()[0].GetShape().depth << std::endl;
 
@@ -348,7 +342,7 @@ bool TestConv::TestBackprop2() {
 	convnet_core::PrintTensor(d_out);
 	std::cout << "Loss: " << d_out.Sum() << std::endl;
 
-	layer::Conv conv2(conv.GetOutput(), "conv_2", f_count, f_size, stride, padding);
+	layer::Conv<double> conv2(conv.GetOutput(), "conv_2", f_count, f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 	std::cout << conv.GetWeights()[0].GetShape().depth << std::endl;
 	conv2.GetWeights()[0] = filter2;
@@ -392,7 +386,7 @@ bool TestConv::TestBackpropPadded() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 1;
-	layer::Conv conv(input, "conv_1", f_count, f_size, stride, padding);
+	layer::Conv<double> conv(input, "conv_1", f_count, f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 	std::cout << conv.GetWeights()[0].GetShape().depth << std::endl;
 
@@ -417,3 +411,489 @@ bool TestConv::TestBackpropPadded() {
 
 	return true;
 }
+
+bool TestConv::TestAlgorithms() {
+	std::cout << "TestConv::TestAlgorithms" << std::endl;
+
+	// Rectangular input, 11 channels (a full and a partial channel block),
+	// with padding and stride.
+	Tensor3D<double> input(7, 6, 11);
+	input.InitRandom();
+	const layer::ConvAlgorithm algorithms[] = { layer::ConvAlgorithm::Direct,
+												layer::ConvAlgorithm::Im2col };
+	std::vector<Tensor3D<double>> outputs;
+	for (layer::ConvAlgorithm algorithm : algorithms) {
+		layer::Conv<double> conv(input, "conv_alg", 3, 3, 2, 1);
+		for (int f = 0; f < 3; ++f) {
+			conv.GetWeights()[f] = Tensor3D<double>(3, 3, 11);
+			for (int i = 0; i < conv.GetWeights()[f].Size(); ++i)
+				conv.GetWeights()[f][i] = ((f * 31 + i * 7) % 13) / 13.0 - 0.5;
+			conv.GetBias()[f](0, 0, 0) = f;
+		}
+		conv.SetAlgorithm(algorithm);
+		conv.Forward(input);
+		outputs.push_back(conv.GetOutput());
+	}
+
+	assert(outputs[0].GetShape().height == 4 && outputs[0].GetShape().width == 3);
+	for (int i = 0; i < outputs[0].Size(); ++i)
+		assert(std::abs(outputs[0][i] - outputs[1][i]) < 1e-12);
+
+	return true;
+}
+
+bool TestConv::TestBackpropGradients() {
+	std::cout << "TestConv::TestBackpropGradients" << std::endl;
+
+	// Rectangular input with padding and stride. The loss is the dot product
+	// of the output with a fixed tensor G, so the upstream gradient is G and
+	// the loss is linear in every parameter: central differences are exact
+	// up to rounding.
+	Tensor3D<double> input(7, 6, 5);
+	input.InitRandom();
+	layer::Conv<double> conv(input, "conv_grad", 3, 3, 2, 1);
+	for (int f = 0; f < 3; ++f)
+		conv.GetBias()[f](0, 0, 0) = 0.1 * f;
+	conv.Forward(input);
+	Tensor3D<double> G(conv.GetOutput().GetShape());
+	for (int i = 0; i < G.Size(); ++i)
+		G[i] = ((i * 5) % 9) / 9.0 - 0.4;
+	conv.Backprop(G);
+
+	auto loss = [&](const Tensor3D<double>& x) {
+		conv.Forward(x);
+		double sum = 0;
+		for (int i = 0; i < G.Size(); ++i)
+			sum += conv.GetOutput()[i] * G[i];
+		return sum;
+	};
+	const double eps = 1e-3;
+
+	Tensor3D<double> grad_input = conv.GetGradInput();
+	for (int i = 0; i < input.Size(); ++i) {
+		Tensor3D<double> x(input);
+		x[i] += eps;
+		double up = loss(x);
+		x[i] -= 2 * eps;
+		double numeric = (up - loss(x)) / (2 * eps);
+		assert(std::abs(numeric - grad_input[i]) < 1e-8);
+	}
+	for (int f = 0; f < 3; ++f) {
+		// GetWeights marks the packed weights stale, so it is called for every change.
+		for (int i = 0; i < conv.GetWeights()[f].Size(); ++i) {
+			const double w = conv.GetWeights()[f][i];
+			conv.GetWeights()[f][i] = w + eps;
+			double up = loss(input);
+			conv.GetWeights()[f][i] = w - eps;
+			double numeric = (up - loss(input)) / (2 * eps);
+			conv.GetWeights()[f][i] = w;
+			assert(std::abs(numeric - conv.GetGradWeights()[f][i]) < 1e-8);
+		}
+		double sum = 0;
+		for (int h = 0; h < G.GetShape().height; ++h)
+			for (int w = 0; w < G.GetShape().width; ++w)
+				sum += G(h, w, f);
+		assert(std::abs(sum - conv.GetGradBias()[f](0, 0, 0)) < 1e-12);
+	}
+
+	return true;
+}
+
+bool TestConv::TestWinograd() {
+	std::cout << "TestConv::TestWinograd" << std::endl;
+
+	// Rectangular input whose output is not a multiple of the tiles, with
+	// every padding the backward-data convolution supports.
+	Tensor3D<double> input(9, 7, 5);
+	input.InitRandom();
+	const layer::ConvAlgorithm algorithms[] = { layer::ConvAlgorithm::Im2col,
+												layer::ConvAlgorithm::WinogradF2,
+												layer::ConvAlgorithm::WinogradF4 };
+	for (int padding = 0; padding <= 2; ++padding) {
+		// Copies of a layer start with zero gradients, the results are kept.
+		std::vector<Tensor3D<double>> outputs, grad_inputs;
+		std::vector<std::vector<Tensor3D<double>>> grad_weights;
+		for (layer::ConvAlgorithm algorithm : algorithms) {
+			layer::Conv<double> conv(input, "conv_wino", 4, 3, 1, padding);
+			for (int f = 0; f < 4; ++f) {
+				for (int i = 0; i < conv.GetWeights()[f].Size(); ++i)
+					conv.GetWeights()[f][i] = ((f * 17 + i * 5) % 11) / 11.0 - 0.5;
+				conv.GetBias()[f](0, 0, 0) = 0.25 * f;
+			}
+			conv.SetAlgorithm(algorithm);
+			conv.Forward(input);
+			Tensor3D<double> grad_output(conv.GetOutput().GetShape());
+			for (int i = 0; i < grad_output.Size(); ++i)
+				grad_output[i] = ((i * 3) % 7) / 7.0 - 0.3;
+			conv.Backprop(grad_output);
+			outputs.push_back(conv.GetOutput());
+			grad_inputs.push_back(conv.GetGradInput());
+			grad_weights.push_back(conv.GetGradWeights());
+		}
+
+		double grad_norm = 0;
+		for (int i = 0; i < input.Size(); ++i)
+			grad_norm += std::abs(grad_inputs[0][i]);
+		assert(grad_norm > 0);
+		for (int a = 1; a < 3; ++a) {
+			for (int i = 0; i < outputs[0].Size(); ++i)
+				assert(std::abs(outputs[a][i] - outputs[0][i]) < 1e-12);
+			for (int i = 0; i < input.Size(); ++i)
+				assert(std::abs(grad_inputs[a][i] - grad_inputs[0][i]) < 1e-12);
+			for (int f = 0; f < 4; ++f)
+				for (int i = 0; i < grad_weights[0][f].Size(); ++i)
+					assert(std::abs(grad_weights[a][f][i] - grad_weights[0][f][i]) < 1e-12);
+		}
+	}
+
+	// Auto picks Winograd for deep enough 3x3, stride 1 layers, with the
+	// tiles that fit the output better.
+	assert(layer::Conv<double>(12, 12, 12, "conv_auto", 8, 3, 1, 0).SelectedAlgorithm() ==
+		   layer::ConvAlgorithm::WinogradF2);
+	assert(layer::Conv<double>(58, 58, 32, "conv_auto", 32, 3, 1, 0).SelectedAlgorithm() ==
+		   layer::ConvAlgorithm::WinogradF4);
+	assert(layer::Conv<double>(26, 26, 3, "conv_auto", 12, 3, 1, 0).SelectedAlgorithm() ==
+		   layer::ConvAlgorithm::Im2col);
+	assert(layer::Conv<double>(26, 26, 32, "conv_auto", 32, 3, 2, 0).SelectedAlgorithm() ==
+		   layer::ConvAlgorithm::Im2col);
+
+	return true;
+}
+
+bool TestConv::TestFft() {
+	std::cout << "TestConv::TestFft" << std::endl;
+
+	// The transform matches the definition of the DFT.
+	const int n = 16;
+	convnet_core::FftPlan<double> plan(n);
+	std::vector<std::complex<double>> x(n), spectrum(n);
+	for (int i = 0; i < n; ++i)
+		x[i] = std::complex<double>((i * 7) % 5 - 2.0, (i * 3) % 4 - 1.5);
+	spectrum = x;
+	plan.Transform(spectrum.data(), 1, false);
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < n; ++k) {
+		std::complex<double> expected(0, 0);
+		for (int i = 0; i < n; ++i)
+			expected += x[i] * std::polar(1.0, -2 * pi * i * k / n);
+		assert(std::abs(spectrum[k] - expected) < 1e-10);
+	}
+	plan.Transform(spectrum.data(), 1, true);
+	for (int i = 0; i < n; ++i)
+		assert(std::abs(spectrum[i] / double(n) - x[i]) < 1e-12);
+
+	// 5x5 filters (an odd count, so one filter has no pair) on a
+	// rectangular input, with and without padding.
+	Tensor3D<double> input(13, 11, 4);
+	input.InitRandom();
+	for (int padding = 0; padding <= 2; padding += 2) {
+		std::vector<Tensor3D<double>> outputs;
+		const layer::ConvAlgorithm algorithms[] = { layer::ConvAlgorithm::Im2col,
+													layer::ConvAlgorithm::Fft };
+		for (layer::ConvAlgorithm algorithm : algorithms) {
+			layer::Conv<double> conv(input, "conv_fft", 5, 5, 1, padding);
+			for (int f = 0; f < 5; ++f) {
+				for (int i = 0; i < conv.GetWeights()[f].Size(); ++i)
+					conv.GetWeights()[f][i] = ((f * 13 + i * 3) % 17) / 17.0 - 0.5;
+				conv.GetBias()[f](0, 0, 0) = 0.5 * f;
+			}
+			conv.SetAlgorithm(algorithm);
+			conv.Forward(input);
+			outputs.push_back(conv.GetOutput());
+		}
+		for (int i = 0; i < outputs[0].Size(); ++i)
+			assert(std::abs(outputs[0][i] - outputs[1][i]) < 1e-10);
+	}
+
+	// Auto picks Fft for large filters on large inputs.
+	assert(layer::Conv<float>(224, 224, 16, "conv_auto", 16, 7, 1, 3).SelectedAlgorithm() ==
+		   layer::ConvAlgorithm::Fft);
+
+	return true;
+}
+
+bool TestConv::TestThreads() {
+	std::cout << "TestConv::TestThreads" << std::endl;
+
+	// Large enough for every stage to be split into several tasks. The
+	// results must not depend on the number of threads, bit for bit.
+	Tensor3D<double> input(32, 30, 16);
+	input.InitRandom();
+	const layer::ConvAlgorithm algorithms[] = { layer::ConvAlgorithm::Direct,
+												layer::ConvAlgorithm::Im2col,
+												layer::ConvAlgorithm::WinogradF4,
+												layer::ConvAlgorithm::Fft };
+	for (layer::ConvAlgorithm algorithm : algorithms) {
+		// Copies of a layer start with zero gradients, the results are kept.
+		std::vector<Tensor3D<double>> outputs, grad_inputs;
+		std::vector<std::vector<Tensor3D<double>>> grad_weights;
+		for (int threads = 1; threads <= 3; threads += 2) {
+			convnet_core::SetThreadCount(threads);
+			layer::Conv<double> conv(input, "conv_threads", 16, 3, 1, 1);
+			for (int f = 0; f < 16; ++f)
+				for (int i = 0; i < conv.GetWeights()[f].Size(); ++i)
+					conv.GetWeights()[f][i] = ((f * 29 + i * 11) % 19) / 19.0 - 0.5;
+			conv.SetAlgorithm(algorithm);
+			conv.Forward(input);
+			Tensor3D<double> grad_output(conv.GetOutput().GetShape());
+			for (int i = 0; i < grad_output.Size(); ++i)
+				grad_output[i] = ((i * 7) % 13) / 13.0 - 0.5;
+			conv.Backprop(grad_output);
+			outputs.push_back(conv.GetOutput());
+			grad_inputs.push_back(conv.GetGradInput());
+			grad_weights.push_back(conv.GetGradWeights());
+		}
+
+		double grad_norm = 0;
+		for (int i = 0; i < input.Size(); ++i)
+			grad_norm += std::abs(grad_inputs[0][i]);
+		assert(grad_norm > 0);
+		for (int i = 0; i < outputs[0].Size(); ++i)
+			assert(outputs[0][i] == outputs[1][i]);
+		for (int i = 0; i < input.Size(); ++i)
+			assert(grad_inputs[0][i] == grad_inputs[1][i]);
+		for (int f = 0; f < 16; ++f)
+			for (int i = 0; i < grad_weights[0][f].Size(); ++i)
+				assert(grad_weights[0][f][i] == grad_weights[1][f][i]);
+	}
+	convnet_core::SetThreadCount(0);
+
+	return true;
+}
+
+bool TestConv::TestAutotune() {
+	std::cout << "TestConv::TestAutotune" << std::endl;
+
+	// The names round-trip.
+	const layer::ConvAlgorithm all[] = { layer::ConvAlgorithm::Auto, layer::ConvAlgorithm::Direct,
+										 layer::ConvAlgorithm::Im2col, layer::ConvAlgorithm::WinogradF2,
+										 layer::ConvAlgorithm::WinogradF4, layer::ConvAlgorithm::Fft };
+	for (layer::ConvAlgorithm algorithm : all) {
+		layer::ConvAlgorithm parsed;
+		assert(layer::ParseConvAlgorithm(layer::ConvAlgorithmName(algorithm), parsed));
+		assert(parsed == algorithm);
+	}
+	layer::ConvAlgorithm parsed;
+	assert(!layer::ParseConvAlgorithm("", parsed));
+
+	// Winograd and Fft are eligible for 3x3, stride 1 layers only, the
+	// tuned layer computes the same output.
+	Tensor3D<double> input(10, 9, 6);
+	input.InitRandom();
+	layer::Conv<double> conv(input, "conv_tune", 4, 3, 1, 1);
+	assert(conv.EligibleAlgorithms().size() == 5);
+	assert(layer::Conv<double>(input, "conv_tune", 4, 3, 2, 1).EligibleAlgorithms().size() == 2);
+	conv.SetAlgorithm(layer::ConvAlgorithm::Im2col);
+	conv.Forward(input);
+	Tensor3D<double> expected = conv.GetOutput();
+
+	layer::ConvAlgorithm tuned = conv.Autotune(1);
+	std::vector<layer::ConvAlgorithm> eligible = conv.EligibleAlgorithms();
+	assert(std::find(eligible.begin(), eligible.end(), tuned) != eligible.end());
+	assert(conv.SelectedAlgorithm() == tuned);
+	conv.Forward(input);
+	for (int i = 0; i < expected.Size(); ++i)
+		assert(std::abs(conv.GetOutput()[i] - expected[i]) < 1e-10);
+
+	// The cache keeps the entries across instances.
+	const std::string path = "tuning-test.json";
+	std::remove(path.c_str());
+	{
+		convnet_core::TuningCache cache(path);
+		assert(cache.Find(conv.Signature()).empty());
+		cache.Store(conv.Signature(), layer::ConvAlgorithmName(tuned));
+		cache.Save();
+	}
+	convnet_core::TuningCache cache(path);
+	assert(cache.Find(conv.Signature()) == layer::ConvAlgorithmName(tuned));
+	std::remove(path.c_str());
+
+	return true;
+}
+
+bool TestConv::TestGroupConv() {
+	std::cout << "TestConv::TestGroupConv" << std::endl;
+
+	// A grouped convolution is the dense one with the weights outside of
+	// the group of a filter set to zero.
+	Tensor3D<double> input(7, 6, 6);
+	input.InitRandom();
+	layer::GroupConv<double> group(input.GetShape(), "group", 4, 3, 2, 1, 2);
+	layer::Conv<double> dense(input, "dense", 4, 3, 2, 1);
+	for (int f = 0; f < 4; ++f) {
+		layer::Conv<double>& conv = group.GetGroup(f / 2);
+		Tensor3D<double>& kernel = conv.GetWeights()[f % 2];
+		dense.GetWeights()[f].InitZeros();
+		for (int h = 0; h < 3; ++h)
+			for (int w = 0; w < 3; ++w)
+				for (int d = 0; d < 3; ++d)
+					dense.GetWeights()[f](h, w, f / 2 * 3 + d) = kernel(h, w, d);
+		conv.GetBias()[f % 2](0, 0, 0) = 0.5 * f;
+		dense.GetBias()[f](0, 0, 0) = 0.5 * f;
+	}
+
+	group.Forward(input);
+	dense.Forward(input);
+	for (int i = 0; i < dense.GetOutput().Size(); ++i)
+		assert(std::abs(group.GetOutput()[i] - dense.GetOutput()[i]) < 1e-12);
+
+	Tensor3D<double> grad_output(dense.GetOutput().GetShape());
+	for (int i = 0; i < grad_output.Size(); ++i)
+		grad_output[i] = ((i * 5) % 11) / 11.0 - 0.5;
+	group.Backprop(grad_output);
+	dense.Backprop(grad_output);
+	for (int i = 0; i < input.Size(); ++i)
+		assert(std::abs(group.GetGrads()[i] - dense.GetGrads()[i]) < 1e-12);
+	for (int f = 0; f < 4; ++f) {
+		Tensor3D<double>& grad = group.GetGroup(f / 2).GetGradWeights()[f % 2];
+		for (int h = 0; h < 3; ++h)
+			for (int w = 0; w < 3; ++w)
+				for (int d = 0; d < 3; ++d)
+					assert(std::abs(grad(h, w, d) - dense.GetGradWeights()[f](h, w, f / 2 * 3 + d)) < 1e-12);
+	}
+
+	// A batch of two copies gives the same outputs and twice the gradients.
+	Tensor4D<double> batch(std::vector<Tensor3D<double>>{ input, input });
+	Tensor4D<double> grad_batch(std::vector<Tensor3D<double>>{ grad_output, grad_output });
+	group.Forward(batch);
+	group.Backprop(grad_batch);
+	for (int i = 0; i < dense.GetOutput().Size(); ++i)
+		assert(std::abs(group.GetBatchOutput().Sample(1).Data()[i] - dense.GetOutput()[i]) < 1e-12);
+	for (int i = 0; i < input.Size(); ++i)
+		assert(std::abs(group.GetBatchGrads().Sample(1).Data()[i] - dense.GetGrads()[i]) < 1e-12);
+	assert(std::abs(group.GetGroup(1).GetGradBias()[0](0, 0, 0) - 2 * dense.GetGradBias()[2](0, 0, 0)) < 1e-12);
+
+	// The layer survives a round trip through JSON.
+	layer::GroupConv<double> loaded = utils::ReadGroupConvLayerJSON<double>(group.Serialize());
+	loaded.Forward(input);
+	for (int i = 0; i < dense.GetOutput().Size(); ++i)
+		assert(std::abs(loaded.GetOutput()[i] - dense.GetOutput()[i]) < 1e-12);
+
+	// Loading a model with a tuning cache tunes the groups.
+	const std::string path = "group-test.json";
+	const std::string cache_path = "group-tuning-test.json";
+	std::remove(cache_path.c_str());
+	convnet_core::Model<double> model;
+	model.Add(new layer::GroupConv<double>(group));
+	model.Save(path);
+	convnet_core::Model<double> tuned;
+	tuned.Load(path, cache_path);
+	convnet_core::TuningCache cache(cache_path);
+	assert(!cache.Find(group.GetGroup(0).Signature()).empty());
+	Tensor3D<double> predicted = tuned.Predict(input);
+	for (int i = 0; i < dense.GetOutput().Size(); ++i)
+		assert(std::abs(predicted[i] - dense.GetOutput()[i]) < 1e-10);
+	std::remove(path.c_str());
+	std::remove(cache_path.c_str());
+
+	return true;
+}
+
+bool TestConv::TestDepthwiseConv() {
+	std::cout << "TestConv::TestDepthwiseConv" << std::endl;
+
+	// A depthwise convolution is the grouped one with a group per channel.
+	Tensor3D<double> input(9, 8, 3);
+	input.InitRandom();
+	for (int padding = 0; padding <= 2; ++padding) {
+		layer::DepthwiseConv<double> depthwise(input.GetShape(), "depthwise", 2, 3, 2, padding);
+		layer::GroupConv<double> group(input.GetShape(), "group", 6, 3, 2, padding, 3);
+		for (int f = 0; f < 6; ++f) {
+			group.GetGroup(f / 2).GetWeights()[f % 2] = depthwise.GetWeights()[f];
+			depthwise.GetBias()[f](0, 0, 0) = 0.25 * f;
+			group.GetGroup(f / 2).GetBias()[f % 2](0, 0, 0) = 0.25 * f;
+		}
+
+		depthwise.Forward(input);
+		group.Forward(input);
+		for (int i = 0; i < group.GetOutput().Size(); ++i)
+			assert(std::abs(depthwise.GetOutput()[i] - group.GetOutput()[i]) < 1e-12);
+
+		Tensor3D<double> grad_output(group.GetOutput().GetShape());
+		for (int i = 0; i < grad_output.Size(); ++i)
+			grad_output[i] = ((i * 7) % 13) / 13.0 - 0.5;
+		depthwise.Backprop(grad_output);
+		group.Backprop(grad_output);
+		for (int i = 0; i < input.Size(); ++i)
+			assert(std::abs(depthwise.GetGrads()[i] - group.GetGrads()[i]) < 1e-12);
+		for (int f = 0; f < 6; ++f) {
+			for (int i = 0; i < 9; ++i)
+				assert(std::abs(depthwise.GetGradWeights()[f][i] -
+								group.GetGroup(f / 2).GetGradWeights()[f % 2][i]) < 1e-12);
+			assert(std::abs(depthwise.GetGradBias()[f](0, 0, 0) -
+							group.GetGroup(f / 2).GetGradBias()[f % 2](0, 0, 0)) < 1e-12);
+		}
+
+		layer::DepthwiseConv<double> loaded = utils::ReadDepthwiseConvLayerJSON<double>(depthwise.Serialize());
+		loaded.Forward(input);
+		for (int i = 0; i < group.GetOutput().Size(); ++i)
+			assert(std::abs(loaded.GetOutput()[i] - depthwise.GetOutput()[i]) < 1e-12);
+	}
+
+	return true;
+}
+
+bool TestConv::TestFusedActivation() {
+	std::cout << "TestConv::TestFusedActivation" << std::endl;
+
+	// With every algorithm, a Conv layer with a fused activation computes
+	// the output and the gradients of a Conv layer followed by a ReLU layer.
+	Tensor3D<double> input(10, 9, 5);
+	input.InitRandom();
+	layer::Conv<double> reference(input, "conv", 4, 3, 1, 1);
+	for (int f = 0; f < 4; ++f)
+		reference.GetBias()[f](0, 0, 0) = 0.25 * f - 0.5;
+	Tensor3D<double> grad_output(reference.GetOutputShape());
+	for (int i = 0; i < grad_output.Size(); ++i)
+		grad_output[i] = ((i * 7) % 13) / 13.0 - 0.5;
+
+	for (layer::ConvAlgorithm algorithm : reference.EligibleAlgorithms()) {
+		layer::Conv<double> conv(reference);
+		conv.SetAlgorithm(algorithm);
+		layer::ReLU<double> relu(conv.GetOutputShape(), "relu");
+		conv.Forward(input);
+		relu.Forward(conv.GetOutput());
+		relu.Backprop(grad_output);
+		conv.Backprop(relu.GetGrads());
+
+		layer::Conv<double> fused(reference);
+		fused.SetAlgorithm(algorithm);
+		fused.FuseActivation("relu");
+		fused.Forward(input);
+		fused.Backprop(grad_output);
+
+		for (int i = 0; i < relu.GetOutput().Size(); ++i)
+			assert(std::abs(fused.GetOutput()[i] - relu.GetOutput()[i]) < 1e-10);
+		for (int i = 0; i < input.Size(); ++i)
+			assert(std::abs(fused.GetGrads()[i] - conv.GetGrads()[i]) < 1e-10);
+		for (int f = 0; f < 4; ++f) {
+			for (int i = 0; i < conv.GetGradWeights()[f].Size(); ++i)
+				assert(std::abs(fused.GetGradWeights()[f][i] - conv.GetGradWeights()[f][i]) < 1e-10);
+			assert(std::abs(fused.GetGradBias()[f](0, 0, 0) - conv.GetGradBias()[f](0, 0, 0)) < 1e-10);
+		}
+	}
+
+	// Loading fuses the ReLU layer, saving writes it back.
+	const std::string path = "fused-test.json";
+	convnet_core::Model<double> model;
+	model.Add(new layer::Conv<double>(reference));
+	model.Add(new layer::ReLU<double>(reference.GetOutputShape(), "relu"));
+	model.Add(new layer::Conv<double>(reference.GetOutputShape(), "conv_2", 2, 3, 2, 0));
+	Tensor3D<double> expected = model.Predict(input);
+	model.Save(path);
+
+	convnet_core::Model<double> loaded;
+	loaded.Load(path);
+	Tensor3D<double> predicted = loaded.Predict(input);
+	for (int i = 0; i < expected.Size(); ++i)
+		assert(std::abs(predicted[i] - expected[i]) < 1e-10);
+
+	nlohmann::json saved, resaved;
+	std::ifstream(path) >> saved;
+	loaded.Save(path);
+	std::ifstream(path) >> resaved;
+	assert(saved == resaved);
+	std::remove(path.c_str());
+
+	return true;
+}
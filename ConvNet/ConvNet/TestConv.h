@@ -6,7 +6,6 @@ public:
 	~TestConv();
 	bool TestConstructor();
 	bool TestPadding();
-	bool TestUnpadding();
 	bool TestForward();
 	bool TestForwardPadded();
 	bool TestForward2();
@@ -16,5 +15,14 @@ public:
 	bool TestBackprop();
 	bool TestBackprop2();
 	bool TestBackpropPadded();
+	bool TestAlgorithms();
+	bool TestBackpropGradients();
+	bool TestWinograd();
+	bool TestFft();
+	bool TestThreads();
+	bool TestAutotune();
+	bool TestGroupConv();
+	bool TestDepthwiseConv();
+	bool TestFusedActivation();
 };
 
@@ -10,7 +10,7 @@ bool TestFC::TestConstructor() {
 	std::cout << "TestFC::TestConstructor" << std::endl;
 
 	Tensor3D<double> tensor(28, 28, 1);
-	layer::FC fc(tensor, "fc", 128);
+	layer::FC<double> fc(tensor, "fc", 128);
 	utils::PrintLayerShapes(fc);
 
 	return true;
@@ -25,7 +25,7 @@ bool TestFC::TestForward() {
 	std::vector<int> w_vec({ 1,2,3,4,5,6 });
 	Tensor3D<double> weights = utils::CreateTensorFromVec(w_vec, 3, 2);
 
-	layer::FC fc(input, "fc", 2);
+	layer::FC<double> fc(input, "fc", 2);
 
 	fc.GetWeights() = weights;
 
@@ -51,7 +51,7 @@ bool TestFC::TestBackprop() {
 	Tensor3D<double> error = utils::CreateTensorFromVec(e_vec, 2, 1);
 
 	//Tensor3D<double> tensor(2, 1, 1);
-	layer::FC fc(input, "fc", 2);
+	layer::FC<double> fc(input, "fc", 2);
 
 	fc.GetWeights() = weights;
 
@@ -67,6 +67,193 @@ bool TestFC::TestBackprop() {
 	convnet_core::PrintTensor(fc.GetGradWeights());
 
 	assert(fc.GetOutput()(0, 0, 0) == 22 && fc.GetOutput()(1, 0, 0) == 28);
+	assert(fc.GetGradInput()(0, 0, 0) == 7 && fc.GetGradInput()(2, 0, 0) == 27);
+	assert(fc.GetGradWeights()(2, 0, 0) == 9 && fc.GetGradWeights()(2, 1, 0) == 6);
+	// The bias gradient of each output is its upstream gradient.
+	assert(fc.GetGradBias()(0, 0, 0) == 3 && fc.GetGradBias()(1, 0, 0) == 2);
+
+	return true;
+}
+
+bool TestFC::TestForwardFloat() {
+	std::cout << "TestFC::TestForwardFloat" << std::endl;
+
+	std::vector<int> vec({ 1,2, 3 });
+	Tensor3D<float> input = utils::CreateTensorFromVec<float>(vec, 3, 1);
+
+	std::vector<int> w_vec({ 1,2,3,4,5,6 });
+	Tensor3D<float> weights = utils::CreateTensorFromVec<float>(w_vec, 3, 2);
+
+	layer::FC<float> fc(input, "fc", 2);
+
+	fc.GetWeights() = weights;
+
+	fc.Forward(fc.GetInput());
+	std::cout << "Result: " << std::endl;
+	convnet_core::PrintTensor(fc.GetOutput());
+
+	assert(fc.GetOutput()(0, 0, 0) == 22 && fc.GetOutput()(1, 0, 0) == 28);
+
+	return true;
+}
+
+bool TestFC::TestBatch() {
+	std::cout << "TestFC::TestBatch" << std::endl;
+
+	std::vector<Tensor3D<double>> inputs;
+	inputs.push_back(utils::CreateTensorFromVec(std::vector<int>({ 1, 2, 3 }), 3, 1));
+	inputs.push_back(utils::CreateTensorFromVec(std::vector<int>({ 3, 2, 1 }), 3, 1));
+	std::vector<Tensor3D<double>> errors;
+	errors.push_back(utils::CreateTensorFromVec(std::vector<int>({ 3, 2 }), 2, 1));
+	errors.push_back(utils::CreateTensorFromVec(std::vector<int>({ 1, 1 }), 2, 1));
+
+	std::vector<int> w_vec({ 1,2,3,4,5,6 });
+	layer::FC<double> fc(inputs[0], "fc", 2);
+	fc.GetWeights() = utils::CreateTensorFromVec(w_vec, 3, 2);
+
+	fc.Forward(convnet_core::Tensor4D<double>(inputs));
+	ConstTensorView<double> out0 = fc.GetBatchOutput().Sample(0);
+	ConstTensorView<double> out1 = fc.GetBatchOutput().Sample(1);
+	assert(out0(0, 0, 0) == 22 && out0(1, 0, 0) == 28);
+	assert(out1(0, 0, 0) == 14 && out1(1, 0, 0) == 20);
+
+	// Input gradients are computed per sample, weight gradients are summed.
+	fc.Backprop(convnet_core::Tensor4D<double>(errors));
+	ConstTensorView<double> dx0 = fc.GetBatchGrads().Sample(0);
+	ConstTensorView<double> dx1 = fc.GetBatchGrads().Sample(1);
+	std::cout << "Weight gradient: " << std::endl;
+	convnet_core::PrintTensor(fc.GetGradWeights());
+	assert(dx0(0, 0, 0) == 7 && dx0(1, 0, 0) == 17 && dx0(2, 0, 0) == 27);
+	assert(dx1(0, 0, 0) == 3 && dx1(1, 0, 0) == 7 && dx1(2, 0, 0) == 11);
+	assert(fc.GetGradWeights()(0, 0, 0) == 6 && fc.GetGradWeights()(0, 1, 0) == 5);
+	assert(fc.GetGradWeights()(2, 0, 0) == 10 && fc.GetGradWeights()(2, 1, 0) == 7);
+	assert(fc.GetGradBias()(0, 0, 0) == 4 && fc.GetGradBias()(1, 0, 0) == 3);
+
+	return true;
+}
+
+bool TestFC::TestPackedWeights() {
+	std::cout << "TestFC::TestPackedWeights" << std::endl;
+
+	// The size of the FC layer of the digit model, the outputs are not a
+	// multiple of the panel width. Integer values give exact results.
+	const int num_input = 800, num_output = 61, batch_size = 3;
+	Tensor3D<double> input(num_input, 1, 1);
+	layer::FC<double> fc(input, "fc", num_output);
+	std::vector<Tensor3D<double>> inputs(batch_size, Tensor3D<double>(num_input, 1, 1));
+	for (int n = 0; n < batch_size; ++n)
+		for (int i = 0; i < num_input; ++i)
+			inputs[n](i, 0, 0) = (i * (n + 1)) % 5 - 2;
+
+	for (int pass = 0; pass < 2; ++pass) {
+		// The weights are changed through the getter, they must be repacked.
+		for (int i = 0; i < num_input; ++i)
+			for (int o = 0; o < num_output; ++o)
+				fc.GetWeights()(i, o, 0) = (i + o * (pass + 2)) % 7 - 3;
+		fc.GetBias()(1, 0, 0) = pass + 1;
+
+		fc.Forward(convnet_core::Tensor4D<double>(inputs));
+		for (int n = 0; n < batch_size; ++n) {
+			fc.Forward(inputs[n]);
+			ConstTensorView<double> batch_out = fc.GetBatchOutput().Sample(n);
+			for (int o = 0; o < num_output; ++o) {
+				double expected = fc.GetBias()(o, 0, 0);
+				for (int i = 0; i < num_input; ++i)
+					expected += inputs[n](i, 0, 0) * fc.GetWeights()(i, o, 0);
+				assert(fc.GetOutput()(o, 0, 0) == expected);
+				assert(batch_out(o, 0, 0) == expected);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool TestFC::TestFusedUpdate() {
+	std::cout << "TestFC::TestFusedUpdate" << std::endl;
+
+	const int num_input = 100, num_output = 13, batch_size = 3;
+	std::vector<Tensor3D<double>> inputs, errors;
+	for (int n = 0; n < batch_size; ++n) {
+		inputs.push_back(Tensor3D<double>(num_input, 1, 1));
+		inputs.back().InitRandom();
+		errors.push_back(Tensor3D<double>(num_output, 1, 1));
+		errors.back().InitRandom();
+	}
+	convnet_core::Tensor4D<double> input_batch(inputs), error_batch(errors);
+
+	// The fused pass must update the weights exactly like UpdateWeights,
+	// and keep the packed weights of the forward pass up to date.
+	layer::FC<double> separate(inputs[0], "fc", num_output);
+	layer::FC<double> fused(separate);
+	auto same = [](const auto& a, const auto& b) {
+		return a.Size() == b.Size() && std::equal(a.Data(), a.Data() + a.Size(), b.Data());
+	};
+	for (int step = 0; step < 2; ++step) {
+		separate.Forward(inputs[step]);
+		fused.Forward(inputs[step]);
+		separate.Backprop(errors[step]);
+		separate.UpdateWeights(0.01, 0.9);
+		fused.BackpropAndUpdate(errors[step], 0.01, 0.9);
+		assert(same(fused.GetGradInput(), separate.GetGradInput()));
+
+		separate.Forward(input_batch);
+		fused.Forward(input_batch);
+		assert(same(fused.GetBatchOutput(), separate.GetBatchOutput()));
+		separate.Backprop(error_batch);
+		separate.UpdateWeights(0.01, 0.9);
+		fused.BackpropAndUpdate(error_batch, 0.01, 0.9);
+		assert(same(fused.GetBatchGrads(), separate.GetBatchGrads()));
+	}
+	separate.Forward(inputs[0]);
+	fused.Forward(inputs[0]);
+	assert(same(fused.GetOutput(), separate.GetOutput()));
+	assert(same(fused.GetWeights(), separate.GetWeights()));
+	assert(same(fused.GetBias(), separate.GetBias()));
+
+	return true;
+}
+
+bool TestFC::TestSparse() {
+	std::cout << "TestFC::TestSparse" << std::endl;
+
+	const int num_input = 100, num_output = 13, batch_size = 3;
+	std::vector<Tensor3D<double>> inputs;
+	for (int n = 0; n < batch_size; ++n) {
+		inputs.push_back(Tensor3D<double>(num_input, 1, 1));
+		inputs.back().InitRandom();
+	}
+	layer::FC<double> fc(inputs[0], "fc", num_output);
+	fc.GetBias().InitRandom();
+	assert(!fc.IsSparse());
+
+	// The smallest 90% of the weights are removed.
+	const int pruned = fc.Prune(0.9);
+	assert(pruned == 1170);
+	assert(std::abs(fc.Density() - 0.1) < 1e-12);
+	assert(fc.IsSparse());
+
+	fc.Forward(convnet_core::Tensor4D<double>(inputs));
+	for (int n = 0; n < batch_size; ++n) {
+		fc.Forward(inputs[n]);
+		for (int o = 0; o < num_output; ++o) {
+			double expected = fc.GetBias()(o, 0, 0);
+			for (int i = 0; i < num_input; ++i)
+				expected += inputs[n](i, 0, 0) * fc.GetWeights()(i, o, 0);
+			assert(std::abs(fc.GetOutput()(o, 0, 0) - expected) < 1e-12);
+			assert(fc.GetBatchOutput().Sample(n)(o, 0, 0) == fc.GetOutput()(o, 0, 0));
+		}
+	}
+
+	// Sparse layers are saved in CSR format.
+	nlohmann::json json = fc.Serialize();
+	assert(json["format"] == "csr");
+	assert(json["weights"]["values"].size() == num_input * num_output - pruned);
+	layer::FC<double> loaded(utils::ReadFCLayerJSON<double>(json));
+	for (int i = 0; i < fc.GetWeights().Size(); ++i)
+		assert(loaded.GetWeights()[i] == fc.GetWeights()[i]);
+	loaded.Forward(inputs[0]);
+	assert(loaded.IsSparse());
 
 	return true;
 }
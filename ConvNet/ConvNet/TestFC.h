@@ -7,5 +7,10 @@ public:
 	bool TestConstructor();
 	bool TestForward();
 	bool TestBackprop();
+	bool TestForwardFloat();
+	bool TestBatch();
+	bool TestPackedWeights();
+	bool TestFusedUpdate();
+	bool TestSparse();
 };
 
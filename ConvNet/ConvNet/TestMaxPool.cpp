@@ -13,7 +13,7 @@ bool TestMaxPool::TestConstructor() {
 	
 	int stride = 2;
 	int pool_size = 2;
-	layer::MaxPool pool(shape, "Pool 1", stride, pool_size);
+	layer::MaxPool<double> pool(shape, "Pool 1", stride, pool_size);
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
@@ -42,7 +42,7 @@ bool TestMaxPool::TestConstructorWithTensor() {
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
-	layer::MaxPool pool(tensor, "Pool Tens", stride, pool_size);
+	layer::MaxPool<double> pool(tensor, "Pool Tens", stride, pool_size);
 	convnet_core::PrintTensor(pool.GetInput());
 	utils::PrintLayerShapes(pool);
 
@@ -69,7 +69,7 @@ bool TestMaxPool::TestConstructorWithMat() {
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
-	layer::MaxPool pool(tensor, "Pool Mat", stride, pool_size);
+	layer::MaxPool<double> pool(tensor, "Pool Mat", stride, pool_size);
 	utils::PrintLayerShapes(pool);
 	
 	assert(pool.GetInputShape().width == shape.width && pool.GetInputShape().height == shape.height &&
@@ -95,7 +95,7 @@ bool TestMaxPool::TestForward() {
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
-	layer::MaxPool pool(tensor, "Pool Forward", stride, pool_size);
+	layer::MaxPool<double> pool(tensor, "Pool Forward", stride, pool_size);
 	convnet_core::PrintTensor(pool.GetInput());
 	utils::PrintLayerShapes(pool);
 
@@ -119,7 +119,7 @@ bool TestMaxPool::TestForwardWithMat() {
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
-	layer::MaxPool pool(tensor, "Pool Mat", stride, pool_size);
+	layer::MaxPool<double> pool(tensor, "Pool Mat", stride, pool_size);
 
 	convnet_core::PrintTensor(pool.GetInput());
 	utils::PrintLayerShapes(pool);
@@ -148,7 +148,7 @@ bool TestMaxPool::TestBackprop() {
 	int out_height = (shape.height - pool_size) / stride + 1;
 	int out_width = (shape.width - pool_size) / stride + 1;
 
-	layer::MaxPool pool(tensor, "Pool Backprop", stride, pool_size);
+	layer::MaxPool<double> pool(tensor, "Pool Backprop", stride, pool_size);
 	convnet_core::PrintTensor(pool.GetInput());
 	utils::PrintLayerShapes(pool);
 
@@ -165,3 +165,66 @@ bool TestMaxPool::TestBackprop() {
 
 	return true;
 }
+
+bool TestMaxPool::TestPoolSizes() {
+	std::cout << "TestMaxPool::TestPoolSizes" << std::endl;
+
+	// The input of the first pooling layer of the model. Few distinct values,
+	// so the windows have ties, the first maximum in row-major order is kept.
+	convnet_core::Tensor3D<double> tensor(52, 52, 3);
+	for (int i = 0; i < tensor.Size(); ++i)
+		tensor[i] = (i * 7) % 5;
+	convnet_core::Tensor3D<double> grad(52, 52, 3);
+	for (int i = 0; i < grad.Size(); ++i)
+		grad[i] = i % 3 + 1;
+
+	// The 2x2 fast path, a larger window and overlapping windows.
+	const int sizes[][2] = { { 2, 2 }, { 3, 3 }, { 3, 2 } };
+	for (const auto& size : sizes) {
+		const int pool_size = size[0], stride = size[1];
+		layer::MaxPool<double> pool(tensor, "pool", stride, pool_size);
+		convnet_core::Triplet out_shape = pool.GetOutputShape();
+		pool.Forward(tensor);
+		convnet_core::Tensor3D<double> grad_out(out_shape.height, out_shape.width, out_shape.depth);
+		for (int i = 0; i < grad_out.Size(); ++i)
+			grad_out[i] = grad[i];
+		pool.Backprop(grad_out);
+
+		convnet_core::Tensor3D<double> expected_grad(52, 52, 3);
+		expected_grad.InitZeros();
+		for (int c = 0; c < out_shape.depth; ++c) {
+			for (int h = 0; h < out_shape.height; ++h) {
+				for (int w = 0; w < out_shape.width; ++w) {
+					int max_row = h * stride, max_col = w * stride;
+					for (int i = 0; i < pool_size; ++i)
+						for (int j = 0; j < pool_size; ++j)
+							if (tensor(h * stride + i, w * stride + j, c) > tensor(max_row, max_col, c)) {
+								max_row = h * stride + i;
+								max_col = w * stride + j;
+							}
+					assert(pool.GetOutput()(h, w, c) == tensor(max_row, max_col, c));
+					expected_grad(max_row, max_col, c) += grad_out(h, w, c);
+				}
+			}
+		}
+		for (int i = 0; i < expected_grad.Size(); ++i)
+			assert(pool.GetGrads()[i] == expected_grad[i]);
+
+		// The batch routes the gradients of each sample without a new forward pass.
+		std::vector<convnet_core::Tensor3D<double>> inputs{ tensor, tensor };
+		inputs[1] *= 2.0;
+		std::vector<convnet_core::Tensor3D<double>> grads{ grad_out, grad_out };
+		pool.Forward(convnet_core::Tensor4D<double>(inputs));
+		pool.Backprop(convnet_core::Tensor4D<double>(grads));
+		for (int i = 0; i < pool.GetOutput().Size(); ++i) {
+			assert(pool.GetBatchOutput().Sample(0).Data()[i] == pool.GetOutput()[i]);
+			assert(pool.GetBatchOutput().Sample(1).Data()[i] == 2 * pool.GetOutput()[i]);
+		}
+		for (int i = 0; i < expected_grad.Size(); ++i) {
+			assert(pool.GetBatchGrads().Sample(0).Data()[i] == expected_grad[i]);
+			assert(pool.GetBatchGrads().Sample(1).Data()[i] == expected_grad[i]);
+		}
+	}
+
+	return true;
+}
@@ -8,5 +8,6 @@ public:
 	bool TestForward();
 	bool TestForwardWithMat();
 	bool TestBackprop();
+	bool TestPoolSizes();
 };
 
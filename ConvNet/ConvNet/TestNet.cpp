@@ -15,18 +15,19 @@
 #include "Conv.h"
 #include "FC.h"
 #include "Softmax.h"
+#include "Model.h"
 
 bool TestNet::TestReluPool() {
 	std::vector<int> vec{ 10, -20, 30, 40, -50, 60, 70, -80, 90, 100, -110, 120, 130, -140, 150, 160 };
 	convnet_core::Tensor3D<double> tensor = utils::CreateTensorFromVec(vec);
 
-	layer::ReLU relu(tensor, "ReLU forward");
+	layer::ReLU<double> relu(tensor, "ReLU forward");
 	relu.Forward(relu.GetInput());
 	std::cout << "Relu Forward:" << std::endl;
 	convnet_core::PrintTensor(relu.GetOutput());
 
 	std::cout << "Pool Forward:" << std::endl;
-	layer::MaxPool pool(relu.GetOutput(), "pool", 2, 2);
+	layer::MaxPool<double> pool(relu.GetOutput(), "pool", 2, 2);
 	pool.Forward(relu.GetOutput());
 	convnet_core::PrintTensor(pool.GetOutput());
 	vec = std::vector<int>{ 1, 2, 3, 4 };
@@ -65,7 +66,7 @@ bool TestNet::TrainConvLayer() {
 
 	int f_count = 1; int f_size = 2;
 	int stride = 1; int padding = 0;
-	layer::Conv conv(input, "conv_1", f_count, f_size, stride, padding);
+	layer::Conv<double> conv(input, "conv_1", f_count, f_size, stride, padding);
 	utils::PrintLayerShapes(conv);
 	std::cout << conv.GetWeights()[0].GetShape().depth << std::endl;
 
@@ -144,7 +145,7 @@ bool TestNet::TrainFC() {
 	Tensor3D<double> d_out(2, 1, 1);
 
 	//Tensor3D<double> tensor(2, 1, 1);
-	layer::FC fc(input, "fc", 2);
+	layer::FC<double> fc(input, "fc", 2);
 	//fc.GetWeights() = weights;
 
 	Tensor3D<double> dW, db;
@@ -219,9 +220,9 @@ bool TestNet::TrainFC2() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(2, 1, 1);
 	
-	layer::FC fc(input, "fc", 10);
-	layer::ReLU relu("relu", 10, 1, 1);
-	layer::FC fc2("fc2", 10, 2);
+	layer::FC<double> fc(input, "fc", 10);
+	layer::ReLU<double> relu("relu", 10, 1, 1);
+	layer::FC<double> fc2("fc2", 10, 2);
 
 	Tensor3D<double> dW, db;
 
@@ -303,9 +304,9 @@ bool TestNet::TrainMNISTdigit() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(10, 1, 1);
 
-	layer::FC fc(input, "fc", 128);
-	layer::ReLU relu("relu", 128, 1, 1);
-	layer::FC fc2("fc2", 128, 10);
+	layer::FC<double> fc(input, "fc", 128);
+	layer::ReLU<double> relu("relu", 128, 1, 1);
+	layer::FC<double> fc2("fc2", 128, 10);
 
 	Tensor3D<double> dW, db;
 
@@ -370,9 +371,9 @@ bool TestNet::TrainSignFC() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(10, 1, 1);
 
-	layer::FC fc(input, "fc", 128);
-	layer::ReLU relu("relu", 128, 1, 1);
-	layer::FC fc2("fc2", 128, 10);
+	layer::FC<double> fc(input, "fc", 128);
+	layer::ReLU<double> relu("relu", 128, 1, 1);
+	layer::FC<double> fc2("fc2", 128, 10);
 
 	Tensor3D<double> dW, db;
 
@@ -436,22 +437,22 @@ bool TestNet::TrainSignCE() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(6, 1, 1);
 
-	layer::Conv conv(input, "conv", 4, 3, 1, 0);
+	layer::Conv<double> conv(input, "conv", 4, 3, 1, 0);
 	utils::PrintLayerShapes(conv);
-	layer::ReLU relu("relu", 50, 50, 4);
+	layer::ReLU<double> relu("relu", 50, 50, 4);
 	utils::PrintLayerShapes(relu);
-	layer::MaxPool pool("pool", 50, 50, 4, 2, 2);
+	layer::MaxPool<double> pool("pool", 50, 50, 4, 2, 2);
 	utils::PrintLayerShapes(pool);
-	layer::FC fc("fc", 25*25*4, 128);
+	layer::FC<double> fc("fc", 25*25*4, 128);
 	utils::PrintLayerShapes(fc);
-	layer::ReLU relu_2("relu_2", 128, 1, 1);
+	layer::ReLU<double> relu_2("relu_2", 128, 1, 1);
 	utils::PrintLayerShapes(relu);
-	layer::FC fc_2("fc_2", 128, 6);
+	layer::FC<double> fc_2("fc_2", 128, 6);
 	utils::PrintLayerShapes(fc_2);
-	layer::Softmax softmax("softmax", 6, 1, 1);
+	layer::Softmax<double> softmax("softmax", 6, 1, 1);
 
 	Tensor3D<double> dW, db, target;
-	utils::Dataset trainingSet = utils::GetTrainingSet(dataset_path, 50);
+	utils::Dataset<double> trainingSet = utils::GetTrainingSet<double>(dataset_path, 50);
 
 	double lr = 0.003;
 	double cum_loss = 0;
@@ -538,40 +539,40 @@ bool TestNet::TrainSignCE2() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(6, 1, 1);
 
-	layer::MaxPool pool_0(input, "pool_0", 2, 2);
-	pool_0 = utils::ReadPoolLayer("models/pool_0.json");
+	layer::MaxPool<double> pool_0(input, "pool_0", 2, 2);
+	pool_0 = utils::ReadPoolLayer<double>("models/pool_0.json");
 	utils::PrintLayerShapes(pool_0);
-	layer::Conv conv(26, 26, 3, "conv", 12, 3, 1, 0);
-	conv = utils::ReadConvLayer("models/1200/conv-93.json");
+	layer::Conv<double> conv(26, 26, 3, "conv", 12, 3, 1, 0);
+	conv = utils::ReadConvLayer<double>("models/1200/conv-93.json");
 	utils::PrintLayerShapes(conv);
-	layer::ReLU relu("relu", 24, 24, 12);
-	relu = utils::ReadReLU("models/relu.json");
+	layer::ReLU<double> relu("relu", 24, 24, 12);
+	relu = utils::ReadReLU<double>("models/relu.json");
 	utils::PrintLayerShapes(relu);
-	layer::MaxPool pool("pool", 24, 24, 12, 2, 2);
-	pool = utils::ReadPoolLayer("models/pool.json");
+	layer::MaxPool<double> pool("pool", 24, 24, 12, 2, 2);
+	pool = utils::ReadPoolLayer<double>("models/pool.json");
 	utils::PrintLayerShapes(pool);
-	layer::Conv conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
-	conv_2 = utils::ReadConvLayer("models/1200/conv_2-93.json");
+	layer::Conv<double> conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
+	conv_2 = utils::ReadConvLayer<double>("models/1200/conv_2-93.json");
 	utils::PrintLayerShapes(conv_2);
-	layer::ReLU relu_1("relu_1", 10, 10, 8);
-	relu_1 = utils::ReadReLU("models/relu_1.json");
+	layer::ReLU<double> relu_1("relu_1", 10, 10, 8);
+	relu_1 = utils::ReadReLU<double>("models/relu_1.json");
 	utils::PrintLayerShapes(relu_1);
-	//layer::FC fc("fc", 12 * 12 * 12, 64);
-	layer::FC fc("fc", 10 * 10 * 8, 64);
-	fc = utils::ReadFCLayer("models/1200/fc-93.json");
+	//layer::FC<double> fc("fc", 12 * 12 * 12, 64);
+	layer::FC<double> fc("fc", 10 * 10 * 8, 64);
+	fc = utils::ReadFCLayer<double>("models/1200/fc-93.json");
 	utils::PrintLayerShapes(fc);
-	layer::ReLU relu_2("relu_2", 64, 1, 1);
-	relu_2 = utils::ReadReLU("models/relu_2.json");
+	layer::ReLU<double> relu_2("relu_2", 64, 1, 1);
+	relu_2 = utils::ReadReLU<double>("models/relu_2.json");
 	utils::PrintLayerShapes(relu_2);
-	layer::FC fc_2("fc_2", 64, 12);
+	layer::FC<double> fc_2("fc_2", 64, 12);
 	utils::PrintLayerShapes(fc_2);
-	fc_2 = utils::ReadFCLayer("models/1200/fc_2-93.json");
-	layer::Softmax softmax("softmax", 12, 1, 1);
-	softmax = utils::ReadSoftmax("models/softmax.json");
+	fc_2 = utils::ReadFCLayer<double>("models/1200/fc_2-93.json");
+	layer::Softmax<double> softmax("softmax", 12, 1, 1);
+	softmax = utils::ReadSoftmax<double>("models/softmax.json");
 
 	Tensor3D<double> dW, db, target;
-	utils::Dataset trainingSet = utils::GetTrainingSet(dataset_path, 1000);
-	utils::Dataset validSet = utils::GetValidationSet(dataset_path, 100);
+	utils::Dataset<double> trainingSet = utils::GetTrainingSet<double>(dataset_path, 1000);
+	utils::Dataset<double> validSet = utils::GetValidationSet<double>(dataset_path, 100);
 	
 	double lr = 0.0001;
 	double cum_loss = 0;
@@ -684,29 +685,29 @@ bool TestNet::TrainSignCE2() {
 
 bool TestNet::Evaluate() {
 	std::string dataset_path = "../../../datasets/traffic_signs/train-52x52/";
-	utils::Dataset testSet = utils::GetTestSet(dataset_path, 1);
+	utils::Dataset<double> testSet = utils::GetTestSet<double>(dataset_path, 1);
 
 	// Create layers.
-	layer::MaxPool pool_0("pool_0", 52, 52, 3, 2, 2);
-	pool_0 = utils::ReadPoolLayer("models/pool_0.json");
-	layer::Conv conv(26, 26, 3, "conv", 12, 3, 1, 0);
-	conv = utils::ReadConvLayer("models/1200/conv-9-.json");
-	layer::ReLU relu("relu", 24, 24, 12);
-	relu = utils::ReadReLU("models/relu.json");
-	layer::MaxPool pool("pool", 24, 24, 12, 2, 2);
-	pool = utils::ReadPoolLayer("models/pool.json");
-	layer::Conv conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
-	conv_2 = utils::ReadConvLayer("models/1200/conv_2-9-.json");
-	layer::ReLU relu_1("relu_1", 10, 10, 8);
-	relu_1 = utils::ReadReLU("models/relu_1.json");
-	layer::FC fc("fc", 10 * 10 * 8, 64);
-	fc = utils::ReadFCLayer("models/1200/fc-9-.json");
-	layer::ReLU relu_2("relu_2", 64, 1, 1);
-	relu_2 = utils::ReadReLU("models/relu_2.json");
-	layer::FC fc_2("fc_2", 64, 12);
-	fc_2 = utils::ReadFCLayer("models/1200/fc_2-9-.json");
-	layer::Softmax softmax("softmax", 12, 1, 1);
-	softmax = utils::ReadSoftmax("models/softmax.json");
+	layer::MaxPool<double> pool_0("pool_0", 52, 52, 3, 2, 2);
+	pool_0 = utils::ReadPoolLayer<double>("models/pool_0.json");
+	layer::Conv<double> conv(26, 26, 3, "conv", 12, 3, 1, 0);
+	conv = utils::ReadConvLayer<double>("models/1200/conv-9-.json");
+	layer::ReLU<double> relu("relu", 24, 24, 12);
+	relu = utils::ReadReLU<double>("models/relu.json");
+	layer::MaxPool<double> pool("pool", 24, 24, 12, 2, 2);
+	pool = utils::ReadPoolLayer<double>("models/pool.json");
+	layer::Conv<double> conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
+	conv_2 = utils::ReadConvLayer<double>("models/1200/conv_2-9-.json");
+	layer::ReLU<double> relu_1("relu_1", 10, 10, 8);
+	relu_1 = utils::ReadReLU<double>("models/relu_1.json");
+	layer::FC<double> fc("fc", 10 * 10 * 8, 64);
+	fc = utils::ReadFCLayer<double>("models/1200/fc-9-.json");
+	layer::ReLU<double> relu_2("relu_2", 64, 1, 1);
+	relu_2 = utils::ReadReLU<double>("models/relu_2.json");
+	layer::FC<double> fc_2("fc_2", 64, 12);
+	fc_2 = utils::ReadFCLayer<double>("models/1200/fc_2-9-.json");
+	layer::Softmax<double> softmax("softmax", 12, 1, 1);
+	softmax = utils::ReadSoftmax<double>("models/softmax.json");
 
 	Tensor3D<double> input, target;
 	int correct = 0;
@@ -753,16 +754,16 @@ bool TestNet::TrainSign() {
 	// Gradient w.r.t error.
 	Tensor3D<double> d_out(10, 1, 1);
 
-	layer::Conv conv(input, "conv", 32, 3, 1, 0);
+	layer::Conv<double> conv(input, "conv", 32, 3, 1, 0);
 	utils::PrintLayerShapes(conv);
-	layer::ReLU relu("relu", 50, 50, 32);
+	layer::ReLU<double> relu("relu", 50, 50, 32);
 	utils::PrintLayerShapes(relu);
-	layer::MaxPool pool("pool", 50, 50, 32, 2, 2);
+	layer::MaxPool<double> pool("pool", 50, 50, 32, 2, 2);
 	utils::PrintLayerShapes(pool);
-	layer::FC fc("fc", 25 * 25 * 32, 10);
+	layer::FC<double> fc("fc", 25 * 25 * 32, 10);
 	utils::PrintLayerShapes(fc);
-	//	layer::ReLU relu-fc("relu-fc", 128, 1, 1);
-	//	layer::FC fc2("fc2", 128, 10);
+	//	layer::ReLU<double> relu-fc("relu-fc", 128, 1, 1);
+	//	layer::FC<double> fc2("fc2", 128, 10);
 
 	Tensor3D<double> dW, db;
 
@@ -818,3 +819,71 @@ bool TestNet::TrainSign() {
 	return true;
 }
 
+
+bool TestNet::TestMemoryPlan() {
+	std::cout << "TestNet::TestMemoryPlan" << std::endl;
+
+	// Two models with the same layers, the second one is planned. The
+	// plan changes only where the tensors are stored.
+	layer::Conv<double> conv(convnet_core::Triplet{ 8, 8, 3 }, "conv", 4, 3, 1, 1);
+	layer::FC<double> fc("fc", 64, 3);
+	convnet_core::Model<double> models[2];
+	for (convnet_core::Model<double>& model : models) {
+		model.Add(new layer::Conv<double>(conv));
+		model.Add(new layer::ReLU<double>("relu", 8, 8, 4));
+		model.Add(new layer::MaxPool<double>("pool", 8, 8, 4, 2, 2));
+		model.Add(new layer::FC<double>(fc));
+		model.Add(new layer::Softmax<double>("softmax", 3, 1, 1));
+	}
+	assert(models[1].GetMemoryPlan() == convnet_core::MemoryPlan::None);
+	models[1].PlanMemory(convnet_core::MemoryPlan::Training);
+	const size_t training_bytes = models[1].PlannedBytes();
+	assert(training_bytes > 0);
+
+	Tensor3D<double> input(8, 8, 3);
+	input.InitRandom();
+	Tensor3D<double> target(3, 1, 1);
+	target.InitZeros();
+	target(1, 0, 0) = 1;
+	for (int step = 0; step < 3; ++step) {
+		std::pair<bool, double> expected = models[0].Fit(input, target, 0.01);
+		std::pair<bool, double> planned = models[1].Fit(input, target, 0.01);
+		assert(std::abs(planned.second - expected.second) < 1e-12);
+	}
+
+	// Inference keeps fewer activations, Fit plans for training again.
+	models[1].PlanMemory(convnet_core::MemoryPlan::Inference);
+	assert(models[1].PlannedBytes() < training_bytes);
+	Tensor3D<double> expected = models[0].Predict(input);
+	Tensor3D<double> predicted = models[1].Predict(input);
+	for (int i = 0; i < expected.Size(); ++i)
+		assert(std::abs(predicted[i] - expected[i]) < 1e-12);
+	assert(std::abs(models[1].Fit(input, target, 0.01).second - models[0].Fit(input, target, 0.01).second) < 1e-12);
+	assert(models[1].GetMemoryPlan() == convnet_core::MemoryPlan::Training);
+
+	// An in-place ReLU shares the activation and the gradient of the Conv
+	// layer.
+	convnet_core::Model<double> in_place;
+	in_place.Add(new layer::Conv<double>(conv));
+	layer::ReLU<double>* relu = new layer::ReLU<double>("relu", 8, 8, 4);
+	relu->SetInPlace(true);
+	in_place.Add(relu);
+	in_place.Add(new layer::MaxPool<double>("pool", 8, 8, 4, 2, 2));
+	in_place.Add(new layer::FC<double>(fc));
+	in_place.Add(new layer::Softmax<double>("softmax", 3, 1, 1));
+	convnet_core::Model<double> reference;
+	reference.Add(new layer::Conv<double>(conv));
+	reference.Add(new layer::ReLU<double>("relu", 8, 8, 4));
+	reference.Add(new layer::MaxPool<double>("pool", 8, 8, 4, 2, 2));
+	reference.Add(new layer::FC<double>(fc));
+	reference.Add(new layer::Softmax<double>("softmax", 3, 1, 1));
+	in_place.PlanMemory(convnet_core::MemoryPlan::Training);
+	assert(in_place.PlannedBytes() < training_bytes);
+	for (int step = 0; step < 3; ++step) {
+		std::pair<bool, double> expected = reference.Fit(input, target, 0.01);
+		std::pair<bool, double> planned = in_place.Fit(input, target, 0.01);
+		assert(std::abs(planned.second - expected.second) < 1e-12);
+	}
+
+	return true;
+}
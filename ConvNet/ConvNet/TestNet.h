@@ -15,4 +15,5 @@ public:
 	bool TrainSignSimple();
 	bool TrainSign();
 	void TestJSON();
+	bool TestMemoryPlan();
 };
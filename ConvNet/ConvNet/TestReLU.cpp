@@ -1,6 +1,7 @@
 #include "TestReLU.h"
 #include "ReLU.h"
 #include "Utils.h"
+#include <algorithm>
 #include <iostream>
 #include <opencv2/imgcodecs.hpp>
 
@@ -11,7 +12,7 @@ bool TestReLU::TestConstructor() {
 	shape.width = 2;
 	shape.depth = 1;
 	
-	layer::ReLU relu(shape, "ReLU 1");
+	layer::ReLU<double> relu(shape, "ReLU 1");
 	utils::PrintLayerShapes(relu);
 
 	assert(relu.GetInputShape().width == shape.width && relu.GetInputShape().height == shape.height &&
@@ -34,7 +35,7 @@ bool TestReLU::TestConstructorWithTensor()
 	Tensor3D<double> tensor = utils::CreateTensorFromVec(vec);
 	convnet_core::Triplet shape = tensor.GetShape();
 
-	layer::ReLU relu(tensor, "ReLUTensor");
+	layer::ReLU<double> relu(tensor, "ReLUTensor");
 	convnet_core::PrintTensor(relu.GetInput());
 	utils::PrintLayerShapes(relu);
 
@@ -56,7 +57,7 @@ bool TestReLU::TestConstructorWithMat() {
 	convnet_core::Tensor3D<double> tensor = utils::CreateTensorFromImage("../../../datasets/traffic_signs/1_0000_.bmp");
 	convnet_core::Triplet shape = tensor.GetShape();
 
-	layer::ReLU relu(tensor, "ReLUMat");
+	layer::ReLU<double> relu(tensor, "ReLUMat");
 	utils::PrintLayerShapes(relu);
 
 	assert(relu.GetInputShape().width == shape.width && relu.GetInputShape().height == shape.height &&
@@ -78,7 +79,7 @@ bool TestReLU::TestForward() {
 	Tensor3D<double> tensor = utils::CreateTensorFromVec(vec);
 	convnet_core::Triplet shape = tensor.GetShape();
 
-	layer::ReLU relu(tensor, "ReLU forward");
+	layer::ReLU<double> relu(tensor, "ReLU forward");
 	convnet_core::PrintTensor(relu.GetInput());
 	utils::PrintLayerShapes(relu);
 
@@ -90,3 +91,56 @@ bool TestReLU::TestForward() {
 
 	return true;
 }
+
+bool TestReLU::TestInPlace() {
+	std::cout << "TestRelu::TestInPlace" << std::endl;
+
+	// 3 * 5 * 5 elements, the mask does not end on a word boundary.
+	convnet_core::Triplet shape{ 5, 5, 3 };
+	std::vector<Tensor3D<double>> inputs, grads;
+	for (int n = 0; n < 2; ++n) {
+		inputs.emplace_back(5, 5, 3);
+		grads.emplace_back(5, 5, 3);
+		for (int i = 0; i < inputs[n].Size(); ++i) {
+			inputs[n][i] = (i * 37 + n) % 11 - 5.5;
+			grads[n][i] = (i * 13 + n) % 7 - 3.0;
+		}
+	}
+
+	layer::ReLU<double> relu(shape, "relu");
+	layer::ReLU<double> in_place(shape, "relu_in_place");
+	in_place.SetInPlace(true);
+	assert(!relu.IsInPlace() && in_place.IsInPlace());
+	assert(layer::ReLU<double>(in_place).IsInPlace());
+
+	auto same = [](const auto& a, const auto& b) {
+		return a.Size() == b.Size() && std::equal(a.Data(), a.Data() + a.Size(), b.Data());
+	};
+	relu.Forward(inputs[0]);
+	relu.Backprop(grads[0]);
+	in_place.Forward(inputs[0]);
+	in_place.Backprop(grads[0]);
+	assert(same(relu.GetOutput(), in_place.GetOutput()));
+	assert(same(relu.GetGrads(), in_place.GetGrads()));
+
+	// The output overwrites the input and the gradient the upstream one.
+	Tensor3D<double>& output = in_place.GetOutput();
+	output = inputs[0];
+	in_place.Forward(output);
+	assert(same(relu.GetOutput(), output));
+	Tensor3D<double>& grad = in_place.GetGrads();
+	grad = grads[0];
+	in_place.Backprop(grad);
+	assert(same(relu.GetGrads(), grad));
+
+	relu.Forward(convnet_core::Tensor4D<double>(inputs));
+	relu.Backprop(convnet_core::Tensor4D<double>(grads));
+	in_place.Forward(convnet_core::Tensor4D<double>(inputs));
+	in_place.Backprop(convnet_core::Tensor4D<double>(grads));
+	assert(same(relu.GetBatchOutput(), in_place.GetBatchOutput()));
+	assert(same(relu.GetBatchGrads(), in_place.GetBatchGrads()));
+
+	std::cout << "ReLU in-place test: SUCCESS" << std::endl << std::endl;
+
+	return true;
+}
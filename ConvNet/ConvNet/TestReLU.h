@@ -6,5 +6,6 @@ public:
 	bool TestConstructorWithTensor();
 	bool TestConstructorWithMat();
 	bool TestForward();
+	bool TestInPlace();
 };
 
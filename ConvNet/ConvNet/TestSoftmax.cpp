@@ -12,7 +12,7 @@ void TestSoftmax::TestForward() {
 	tensor(2, 0, 0) = -0.81; tensor(3, 0, 0) = 3.91;
 	convnet_core::Triplet shape = tensor.GetShape();
 	
-	layer::Softmax softmax(tensor, "softmax");
+	layer::Softmax<double> softmax(tensor, "softmax");
 	convnet_core::PrintTensor(softmax.GetInput());
 	utils::PrintLayerShapes(softmax);
 
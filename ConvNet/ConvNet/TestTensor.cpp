@@ -1,8 +1,11 @@
+#include <cmath>
 #include <iostream>
 #include <vector>
 
 #include "TestTensor.h"
 #include "tensor3D.h"
+#include "tensor4D.h"
+#include "gemm.h"
 #include "Utils.h"
 
 #include <opencv2/core/core.hpp>
@@ -135,7 +138,475 @@ bool TestTensor::TestTensorFromMatIntFail()
 	return true;
 }
 
-TestTensor::
+bool TestTensor::TestMoveSemantics() {
+	std::cout << "TestMoveSemantics" << std::endl;
+	Tensor3D<double> t(3, 3, 2);
+	t.InitRandom();
+	double value = t(2, 1, 1);
+
+	Tensor3D<double> moved(std::move(t));
+	assert(moved(2, 1, 1) == value);
+	assert(t.Size() == 0);
+
+	Tensor3D<double> assigned;
+	assigned = std::move(moved);
+	assert(assigned(2, 1, 1) == value);
+	assert(moved.Size() == 0);
+
+	return true;
+}
+
+bool TestTensor::TestCompoundOperators() {
+	std::cout << "TestCompoundOperators" << std::endl;
+	std::vector<int> vec{ 1, 2, 3, 4 };
+	Tensor3D<double> a = utils::CreateTensorFromVec(vec, 2, 2);
+	Tensor3D<double> b = utils::CreateTensorFromVec(vec, 2, 2);
+
+	a += b;
+	assert(a(1, 1, 0) == 8);
+	a -= b;
+	assert(a(1, 1, 0) == 4);
+	a *= b;
+	assert(a(1, 1, 0) == 16);
+	a *= 0.5;
+	assert(a(1, 1, 0) == 8);
+	a /= 2;
+	assert(a(1, 1, 0) == 4);
+	a += 1.0;
+	assert(a(1, 1, 0) == 5);
+
+	// a = 2 * b + a
+	a.Axpy(2, b);
+	assert(a(1, 1, 0) == 13);
+	// a = 2 * b + 0.5 * a
+	a.Axpby(2, b, 0.5);
+	assert(a(1, 1, 0) == 14.5);
+
+	return true;
+}
+
+bool TestTensor::TestView() {
+	std::cout << "TestView" << std::endl;
+	std::vector<int> vec{ 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	Tensor3D<double> t = utils::CreateTensorFromVec(vec, 3, 3);
+
+	// Flattening and reshaping share the storage of the tensor.
+	convnet_core::TensorView<double> flat = t.Flatten();
+	assert(flat.GetShape().height == 9 && flat.Data() == t.Data());
+	assert(flat(5, 0, 0) == 6);
+	flat(5, 0, 0) = 60;
+	assert(t(1, 2, 0) == 60);
+
+	// A window is a strided view, a copy of it is densely packed.
+	convnet_core::ConstTensorView<double> window = t.View().Slice(1, 1, 0, { 2, 2, 1 });
+	assert(!window.IsContiguous());
+	assert(window(0, 0, 0) == 5 && window(1, 1, 0) == 9);
+	Tensor3D<double> copy(window);
+	assert(copy(0, 1, 0) == 60 && copy.GetShape().width == 2);
+
+	return true;
+}
+
+bool TestTensor::TestExpressions() {
+	std::cout << "TestExpressions" << std::endl;
+	std::vector<int> vec{ 1, 2, 3, 4 };
+	Tensor3D<double> a = utils::CreateTensorFromVec(vec, 2, 2);
+	Tensor3D<double> b = utils::CreateTensorFromVec(vec, 2, 2);
+
+	// The whole chain is evaluated in a single loop on construction.
+	Tensor3D<double> c = a * 2.0 + b * b - 1.0;
+	assert(c.GetShape().height == 2 && c.GetShape().width == 2);
+	assert(c(1, 1, 0) == 23 && c(0, 0, 0) == 2);
+
+	// Element-wise expressions may refer to the assigned tensor.
+	c = c - a / 2.0;
+	assert(c(1, 1, 0) == 21);
+	c += 2.0 * a - b;
+	assert(c(1, 1, 0) == 25);
+	assert(convnet_core::Sum(a + b) == 20);
+
+	// Assigning to an empty tensor takes the shape of the expression.
+	Tensor3D<double> d;
+	d = a + 1.0;
+	assert(d.Size() == 4 && d(0, 1, 0) == 3);
+
+	return true;
+}
+
+bool TestTensor::TestKernels() {
+	using namespace convnet_core::kernels;
+	std::cout << "TestKernels" << std::endl;
+	const SimdLevel detected = DetectSimdLevel();
+	std::cout << "Detected instruction set: " << SimdLevelName(detected) << std::endl;
+
+	// Odd size, so the scalar remainder is exercised too. The values are not
+	// exact binary fractions, so a fused multiply-add would round differently.
+	const int n = 37;
+	std::vector<double> a(n), b(n);
+	for (int i = 0; i < n; ++i) {
+		a[i] = std::sin(i * 1.3) * 2.7 + 0.1;
+		b[i] = std::cos(i * 0.7) / 3.0;
+	}
+
+	std::vector<unsigned char> pixels(3 * n);
+	for (int i = 0; i < 3 * n; ++i)
+		pixels[i] = static_cast<unsigned char>(i * 7);
+
+	std::vector<std::vector<double>> expected;
+	double expected_sum = 0;
+	double expected_dot = 0;
+	const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512 };
+	for (SimdLevel level : levels) {
+		if (level > detected)
+			break;
+		SetSimdLevel(level);
+		std::cout << "Kernels: " << SimdLevelName(GetSimdLevel()) << std::endl;
+
+		std::vector<std::vector<double>> results(8, std::vector<double>(n));
+		Add(a.data(), b.data(), results[0].data(), n);
+		Mul(a.data(), b.data(), results[1].data(), n);
+		DivScalar(a.data(), 3.0, results[2].data(), n);
+		results[3] = b;
+		Axpby(2.0, a.data(), 0.5, results[3].data(), n);
+		Sign(b.data(), results[4].data(), n);
+		Fill(results[5].data(), 1.5, n);
+		LeakyRelu(a.data(), 0.1, results[6].data(), n);
+		LeakyReluBackward(a.data(), b.data(), 0.1, results[7].data(), n);
+		results.push_back(std::vector<double>(3 * n));
+		DeinterleaveU8(pixels.data(), 3, 255.0, results[8].data(), n, n);
+		results.push_back(std::vector<double>(n));
+		BiasLeakyRelu(a.data(), -0.5, 0.1, results[9].data(), n);
+		// Parameters in results[10], velocities in results[11].
+		results.push_back(a);
+		results.push_back(b);
+		NesterovStep(b.data(), 0.01, 0.9, results[10].data(), results[11].data(), n);
+		// In place, with the signs in a bit mask, then the gradient in place.
+		results.push_back(a);
+		results.push_back(b);
+		std::vector<unsigned> mask((n + 31) / 32);
+		LeakyReluMask(results[12].data(), 0.1, results[12].data(), mask.data(), n);
+		LeakyReluMaskBackward(mask.data(), results[13].data(), 0.1, results[13].data(), n);
+		double sum = Sum(a.data(), n);
+		double dot = Dot(a.data(), b.data(), n);
+
+		// Element-wise kernels must give exactly the same results on every level.
+		if (level == SimdLevel::Scalar) {
+			expected = results;
+			expected_sum = sum;
+			expected_dot = dot;
+		}
+		assert(results == expected);
+		assert(results[12] == results[6] && results[13] == results[7]);
+		for (int i = 0; i < n; ++i)
+			assert(((mask[i / 32] >> (i % 32)) & 1) == (a[i] < 0 ? 1u : 0u));
+		std::vector<float> planes(3 * n);
+		DeinterleaveU8(pixels.data(), 3, 255.0f, planes.data(), n, n);
+		for (int i = 0; i < n; ++i)
+			for (int k = 0; k < 3; ++k)
+				assert(planes[k * n + i] == pixels[3 * i + k] * (1 / 255.0f));
+		assert(std::abs(sum - expected_sum) < 1e-12);
+		assert(std::abs(dot - expected_dot) < 1e-12);
+	}
+	SetSimdLevel(detected);
+
+	// Sum was accumulated in int before.
+	Tensor3D<double> t(1, 1, 4);
+	t.InitZeros();
+	t += 0.25;
+	assert(t.Sum() == 1.0);
+
+	// Channels are separated into planes.
+	for (int i = 0; i < n; ++i)
+		for (int k = 0; k < 3; ++k)
+			assert(expected[8][k * n + i] == pixels[3 * i + k] * (1 / 255.0));
+	// The bias is added before the activation.
+	assert(expected[9][0] == 0.1 * (a[0] - 0.5));
+	// The velocity is updated after the parameters.
+	assert(expected[11][0] == b[0] * 0.9 - b[0] * 0.01);
+
+	return true;
+}
+
+bool TestTensor::TestMemory() {
+	using namespace convnet_core;
+	std::cout << "TestMemory" << std::endl;
+
+	// Storage is 64-byte aligned.
+	Tensor3D<float> a(3, 5, 7);
+	assert(reinterpret_cast<size_t>(a.Data()) % kTensorAlignment == 0);
+	assert(a.GetResource() == DefaultResource());
+	for (int i = 0; i < a.Size(); ++i)
+		assert(a[i] == 0);
+
+	// Freed blocks are reused by the pool.
+	{
+		Tensor3D<float> freed(3, 5, 7);
+	}
+	const size_t allocations = DefaultResource()->SystemAllocations();
+	for (int i = 0; i < 10; ++i) {
+		Tensor3D<float> t(3, 5, 7);
+		t += 1.0f;
+	}
+	assert(DefaultResource()->SystemAllocations() == allocations);
+
+	// Assignments reuse the existing storage.
+	Tensor3D<double> b(4, 4, 2), c(4, 4, 2);
+	const double* storage = b.Data();
+	c += 1.0;
+	b = c;
+	b = c * 2.0;
+	assert(b.Data() == storage && b(3, 3, 1) == 2.0);
+
+	ArenaResource arena;
+	{
+		ArenaScope step(arena);
+		assert(StepResource() == &arena);
+		Tensor3D<double> temp(Triplet{ 8, 8, 3 }, StepResource());
+		assert(temp.GetResource() == &arena);
+		assert(reinterpret_cast<size_t>(temp.Data()) % kTensorAlignment == 0);
+		temp += 1.0;
+
+		// Tensors of the default pool copy the contents of arena tensors.
+		Tensor3D<double> kept(temp.GetShape());
+		kept = std::move(temp);
+		assert(kept.GetResource() == DefaultResource() && kept(7, 7, 2) == 1.0);
+
+		// Copies are allocated from the default pool.
+		Tensor3D<double> copy(kept);
+		assert(copy.GetResource() == DefaultResource());
+	}
+	assert(StepResource() == DefaultResource());
+	// The arena grew to the peak usage of the step.
+	assert(arena.Capacity() >= 8 * 8 * 3 * sizeof(double));
+
+	// Steps that fit in the arena do not allocate.
+	const size_t capacity = arena.Capacity();
+	const size_t before = DefaultResource()->SystemAllocations();
+	for (int i = 0; i < 10; ++i) {
+		ArenaScope step(arena);
+		Tensor3D<double> temp(Triplet{ 8, 8, 3 }, StepResource());
+	}
+	assert(arena.Capacity() == capacity);
+	assert(DefaultResource()->SystemAllocations() == before);
+
+	// Tensors of disjoint lifetimes share memory in a plan.
+	std::vector<size_t> offsets;
+	const std::vector<TensorLifetime> lifetimes = { { 100, 0, 1 }, { 200, 1, 2 }, { 100, 2, 3 } };
+	assert(PlanMemory(lifetimes, offsets) == 384);
+	assert(offsets[1] == 0 && offsets[0] == 256 && offsets[2] == 256);
+
+	// A region serves the requests that fit, the default pool the others.
+	Buffer<char> block(256, DefaultResource());
+	RegionResource region(block.data(), 256);
+	Tensor3D<float> planned(Triplet{ 4, 4, 4 }, &region);
+	assert(planned.Data() == static_cast<void*>(block.data()));
+	planned.SetResource(DefaultResource());
+	assert(planned.Data() != static_cast<void*>(block.data()) && planned.Size() == 64);
+	Tensor3D<float> large(Triplet{ 8, 8, 8 }, &region);
+	assert(large.Data() != static_cast<void*>(block.data()));
+
+	return true;
+}
+
+bool TestTensor::TestTensor4D() {
+	using namespace convnet_core;
+	std::cout << "TestTensor4D" << std::endl;
+
+	std::vector<Tensor3D<double>> samples;
+	for (int n = 0; n < 3; ++n) {
+		Tensor3D<double> sample(2, 3, 2);
+		sample.InitZeros();
+		sample += n;
+		sample(1, 2, 1) = 10 * n;
+		samples.push_back(sample);
+	}
+	Tensor4D<double> batch(samples);
+	assert(batch.GetBatchSize() == 3 && batch.SampleSize() == 12 && batch.Size() == 36);
+
+	// Samples are views of the batch.
+	assert(batch.Sample(2)(0, 0, 0) == 2 && batch.Sample(2)(1, 2, 1) == 20);
+	assert(batch.Sample(1).Data() == batch.Data() + 12);
+	batch.Sample(0)(0, 1, 0) = -1;
+	assert(batch.Data()[1] == -1);
+
+	// Samples can be set from any view with the same number of elements.
+	batch.SetSample(1, samples[2].Reshape(Triplet{ 12, 1, 1 }));
+	assert(batch.Sample(1)(1, 2, 1) == 20);
+
+	// Shrinking the batch reuses the storage.
+	const double* storage = batch.Data();
+	batch.Resize(2, Triplet{ 3, 2, 2 });
+	assert(batch.Data() == storage && batch.Size() == 24);
+
+	return true;
+}
+
+bool TestTensor::TestLayout() {
+	using namespace convnet_core;
+	std::cout << "TestLayout" << std::endl;
+
+	// Depth 11 has a full and a partial channel block.
+	Triplet shape = { 3, 4, 11 };
+	Tensor3D<double> planar(shape);
+	for (int k = 0; k < shape.depth; ++k)
+		for (int i = 0; i < shape.height; ++i)
+			for (int j = 0; j < shape.width; ++j)
+				planar(i, j, k) = 100 * k + 10 * i + j;
+
+	const Layout layouts[] = { Layout::CHW, Layout::HWC, Layout::CHWc8 };
+	for (Layout from : layouts) {
+		Tensor3D<double> converted = planar.ToLayout(from);
+		assert(converted.GetLayout() == from);
+		// Elements are accessed by their logical position in every layout.
+		for (int k = 0; k < shape.depth; ++k)
+			for (int i = 0; i < shape.height; ++i)
+				for (int j = 0; j < shape.width; ++j)
+					assert(converted(i, j, k) == planar(i, j, k));
+
+		for (Layout to : layouts) {
+			Tensor3D<double> back = converted.ToLayout(to).ToLayout(Layout::CHW);
+			for (int i = 0; i < planar.Size(); ++i)
+				assert(back.Data()[i] == planar.Data()[i]);
+		}
+	}
+
+	// Interleaved pixels of a cv::Mat are copied directly into an HWC tensor.
+	Tensor3D<double> hwc = planar.ToLayout(Layout::HWC);
+	assert(hwc.Data()[1] == planar(0, 0, 1));
+	cv::Mat image(2, 3, CV_8UC3);
+	for (int i = 0; i < image.rows; ++i)
+		for (int j = 0; j < image.cols * 3; ++j)
+			image.ptr<uchar>(i)[j] = static_cast<uchar>(10 * i + j);
+	Tensor3D<double> from_mat(image);
+	Tensor3D<double> from_mat_hwc(image, Layout::HWC);
+	for (int k = 0; k < 3; ++k)
+		for (int i = 0; i < image.rows; ++i)
+			for (int j = 0; j < image.cols; ++j)
+				assert(from_mat(i, j, k) == from_mat_hwc(i, j, k));
+	Tensor3D<double> from_mat_blocked(image, Layout::CHWc8);
+	assert(from_mat_blocked(1, 2, 2) == from_mat(1, 2, 2));
+
+	// Converted images are borrowed without copying.
+	cv::Mat converted(2, 3, CV_64FC3);
+	for (int i = 0; i < converted.rows; ++i)
+		for (int j = 0; j < converted.cols * 3; ++j)
+			converted.ptr<double>(i)[j] = image.ptr<uchar>(i)[j] * (1 / 255.0);
+	ConstTensorView<double> borrowed = BorrowImage<double>(converted);
+	assert(borrowed.Data() == converted.ptr<double>(0));
+	assert(borrowed(1, 2, 1) == from_mat(1, 2, 1));
+
+	return true;
+}
+
+bool TestTensor::TestParallel() {
+	using namespace convnet_core;
+	std::cout << "TestParallel" << std::endl;
+
+	// Every index is visited exactly once, also by nested loops.
+	ThreadPool pool(4);
+	const int n = 100000;
+	std::vector<int> visits(n, 0);
+	ParallelFor(pool, 0, n, 1000, [&](int first, int last) {
+		ParallelFor(pool, first, last, 10, [&](int nested_first, int nested_last) {
+			for (int i = nested_first; i < nested_last; ++i)
+				++visits[i];
+		});
+	});
+	for (int i = 0; i < n; ++i)
+		assert(visits[i] == 1);
+
+	// Reductions do not depend on the number of threads.
+	std::vector<double> values(n);
+	for (int i = 0; i < n; ++i)
+		values[i] = 1.0 / (i + 1);
+	auto partial_sum = [&](int first, int last) {
+		double sum = 0;
+		for (int i = first; i < last; ++i)
+			sum += values[i];
+		return sum;
+	};
+	auto add = [](double a, double b) { return a + b; };
+	ThreadPool serial(1);
+	assert(ParallelReduce(pool, 0, n, 1000, 0.0, partial_sum, add) ==
+		   ParallelReduce(serial, 0, n, 1000, 0.0, partial_sum, add));
+
+	// Element-wise primitives on tensors.
+	Tensor3D<double> a(100, 100, 3), b(100, 100, 3), out(100, 100, 3);
+	for (int i = 0; i < a.Size(); ++i) {
+		a[i] = i % 7;
+		b[i] = 2;
+	}
+	Map(a, out, [](double x) { return x * x; });
+	assert(out[10] == 9);
+	Zip(a, b, out, [](double x, double y) { return x - y; });
+	assert(out[10] == 1);
+	assert(Reduce(a, 0.0, [](double x, double y) { return std::max(x, y); }) == 6);
+	assert(a.Sum() == Reduce(a, 0.0, add));
+
+	return true;
+}
+
+bool TestTensor::TestGemm() {
+	using namespace convnet_core;
+	std::cout << "TestGemm" << std::endl;
+
+	// Sizes that are not multiples of the blocks, k larger than a block.
+	const int m = 13, n = 37, k = 300;
+	std::vector<double> a(m * k), b(k * n), c(m * n, 1.0);
+	for (int i = 0; i < m * k; ++i)
+		a[i] = (i % 11) - 5;
+	for (int i = 0; i < k * n; ++i)
+		b[i] = (i % 7) - 3;
+	// The same operands stored transposed.
+	std::vector<double> a_t(k * m), b_t(n * k);
+	for (int i = 0; i < m; ++i)
+		for (int p = 0; p < k; ++p)
+			a_t[p * m + i] = a[i * k + p];
+	for (int p = 0; p < k; ++p)
+		for (int j = 0; j < n; ++j)
+			b_t[j * k + p] = b[p * n + j];
+
+	// The microkernel of every instruction set gives the exact result.
+	const kernels::SimdLevel detected = kernels::DetectSimdLevel();
+	const kernels::SimdLevel levels[] = { kernels::SimdLevel::Scalar, kernels::SimdLevel::SSE2,
+										  kernels::SimdLevel::AVX2, kernels::SimdLevel::AVX512 };
+	for (kernels::SimdLevel level : levels) {
+		if (level > detected)
+			break;
+		kernels::SetSimdLevel(level);
+		for (int variant = 0; variant < 4; ++variant) {
+			const Transpose trans_a = variant & 1 ? Transpose::Yes : Transpose::No;
+			const Transpose trans_b = variant & 2 ? Transpose::Yes : Transpose::No;
+			std::fill(c.begin(), c.end(), 1.0);
+			Gemm(trans_a, trans_b, m, n, k,
+				 trans_a == Transpose::Yes ? a_t.data() : a.data(), trans_a == Transpose::Yes ? m : k,
+				 trans_b == Transpose::Yes ? b_t.data() : b.data(), trans_b == Transpose::Yes ? k : n,
+				 c.data(), n, true);
+			for (int i = 0; i < m; ++i) {
+				for (int j = 0; j < n; ++j) {
+					double expected = 1.0;
+					for (int p = 0; p < k; ++p)
+						expected += a[i * k + p] * b[p * n + j];
+					assert(c[i * n + j] == expected);
+				}
+			}
+		}
+
+		// Vector-matrix product with the packed B, the first row of A as x.
+		std::vector<double> packed(GemvPackedSize(k, n)), y(n, 1.0);
+		PackGemvMatrix(k, n, b.data(), n, packed.data());
+		Gemv(k, n, a.data(), packed.data(), y.data(), true);
+		for (int j = 0; j < n; ++j) {
+			double expected = 1.0;
+			for (int p = 0; p < k; ++p)
+				expected += a[p] * b[p * n + j];
+			assert(y[j] == expected);
+		}
+	}
+	kernels::SetSimdLevel(detected);
+
+	return true;
+}
 
 TestTensor::~TestTensor() { }
 
@@ -151,7 +622,7 @@ bool TestTensor::CompareMatToTensor(std::vector<cv::Mat> bgr,
 		for (int i = 0; i < bgr[ch].rows; ++i) {
 			for (int j = 0; j < bgr[ch].cols; ++j)
 				// Take into account the normalization factor.
-				if ((double)bgr[ch].at<uchar>(i, j) != tensor.get(i, j, ch)*255.0) {
+				if (bgr[ch].at<uchar>(i, j) * (1 / 255.0) != tensor.get(i, j, ch)) {
 					std::cout << "Error: " << (double)bgr[ch].at<uchar>(i, j) << " != "
 							  << tensor.get(i, j, ch)*255.0 << std::endl;
 
@@ -14,6 +14,16 @@ public:
 	bool TestTensorFromMatFail();
 	bool TestInitZeros();
 	bool TestInitRandom();
+	bool TestMoveSemantics();
+	bool TestCompoundOperators();
+	bool TestView();
+	bool TestExpressions();
+	bool TestKernels();
+	bool TestMemory();
+	bool TestTensor4D();
+	bool TestLayout();
+	bool TestParallel();
+	bool TestGemm();
 	~TestTensor();
 
 private:
@@ -10,6 +10,8 @@
 #include "tensor3D.h"
 #include "Layer.h"
 #include "Conv.h"
+#include "GroupConv.h"
+#include "DepthwiseConv.h"
 #include "FC.h"
 #include "MaxPool.h"
 #include "Softmax.h"
@@ -21,14 +23,16 @@
 // Util functions.
 namespace utils {
 	// A pair that stores images and corresponding labels.
-	typedef std::vector<std::pair<Tensor3D<double>, Tensor3D<double>>> Dataset;
+	template<typename T>
+	using Dataset = std::vector<std::pair<Tensor3D<T>, Tensor3D<T>>>;
 
-	static void PrintShape(convnet_core::Triplet& shape) {
+	static void PrintShape(const convnet_core::Triplet& shape) {
 		std::cout << "(" << shape.height << +", " << shape.width
 			<< ", " << shape.depth << ")" << std::endl;
 	}
 
-	static void PrintLayerShapes(layer::Layer& layer) {
+	template<typename T>
+	static void PrintLayerShapes(layer::Layer<T>& layer) {
 		std::cout << "Input shape: ";
 		PrintShape(layer.GetInputShape());
 		std::cout << "Output shape: ";
@@ -37,13 +41,14 @@ namespace utils {
 		PrintShape(layer.GetGradsShape());
 	}
 
-	static Tensor3D<double> CreateTensorFromVec(std::vector<int> vec, 
+	template<typename T = double>
+	static Tensor3D<T> CreateTensorFromVec(std::vector<int> vec, 
 											int rows = 4, int cols = 4) {
 		assert(vec.size() == rows*cols);
 		cv::Mat img = cv::Mat(rows, cols, CV_32F);
 		memcpy(img.data, vec.data(), vec.size() * sizeof(int));
 
-		Tensor3D<double> tensor(rows, cols, img.channels());
+		Tensor3D<T> tensor(rows, cols, img.channels());
 		for (int i = 0; i < rows; ++i) {
 			for (int j = 0; j < cols; ++j) {
 				tensor(i, j, 0) = img.at<int>(i, j);
@@ -53,7 +58,8 @@ namespace utils {
 		return tensor;
 	}
 
-	static Tensor3D<double> CreateTensorFromImage(std::string path) {
+	template<typename T = double>
+	static Tensor3D<T> CreateTensorFromImage(std::string path) {
 		cv::Mat img;
 		std::string imageName(path);
 		img = cv::imread(imageName.c_str(), cv::IMREAD_COLOR);
@@ -61,17 +67,18 @@ namespace utils {
 		std::vector<cv::Mat> bgr(3);
 		cv::split(img, bgr);
 
-		convnet_core::Tensor3D<double> tensor(img);
+		convnet_core::Tensor3D<T> tensor(img);
 
 		return tensor;
 	}
 
-	static Tensor3D<double> CreateTensorFrom3DVec(std::vector<Tensor3D<double>> vec,
+	template<typename T = double>
+	static Tensor3D<T> CreateTensorFrom3DVec(std::vector<Tensor3D<T>> vec,
 		int rows = 4, int cols = 4) {
 		
-		Tensor3D<double> tensor(rows, cols, vec.size());
+		Tensor3D<T> tensor(rows, cols, vec.size());
 		for (int c = 0; c < vec.size(); ++c) {
-			Tensor3D<double> t = vec[c];
+			Tensor3D<T> t = vec[c];
 			for (int i = 0; i < rows; ++i) {
 				for (int j = 0; j < cols; ++j) {
 					tensor(i, j, c) = t(i, j, 0);
@@ -83,14 +90,15 @@ namespace utils {
 		return tensor;
 	}
 
-	static Dataset GetTrainingSet(std::string base_path_dir, int sample_per_class) {
-		Dataset dataset;
+	template<typename T>
+	static Dataset<T> GetTrainingSet(std::string base_path_dir, int sample_per_class) {
+		Dataset<T> dataset;
 
 		std::string path_dir = base_path_dir;
-		Tensor3D<double> X, target;
+		Tensor3D<T> X, target;
 
 		for (int i = 0; i < 12; ++i) {
-			target = Tensor3D<double>(12, 1, 1);
+			target = Tensor3D<T>(12, 1, 1);
 			target.InitZeros();
 			target(i, 0, 0) = 1;
 			for (int j = 0; j < sample_per_class; ++j) {
@@ -121,22 +129,23 @@ namespace utils {
 						.append(".bmp");
 				}
 //std::cout << path_dir << std::endl;
-				X = utils::CreateTensorFromImage(path_dir);
-				dataset.push_back(std::pair<Tensor3D<double>, Tensor3D<double>>(X, target));
+				X = utils::CreateTensorFromImage<T>(path_dir);
+				dataset.push_back(std::pair<Tensor3D<T>, Tensor3D<T>>(X, target));
 			}
 		}
 
 		return dataset;
 	}
 
-	static Dataset GetValidationSet(std::string base_path_dir, int sample_per_class) {
-		Dataset dataset;
+	template<typename T>
+	static Dataset<T> GetValidationSet(std::string base_path_dir, int sample_per_class) {
+		Dataset<T> dataset;
 
 		std::string path_dir = base_path_dir;
-		Tensor3D<double> X, target;
+		Tensor3D<T> X, target;
 
 		for (int i = 0; i < 12; ++i) {
-			target = Tensor3D<double>(12, 1, 1);
+			target = Tensor3D<T>(12, 1, 1);
 			target.InitZeros();
 			target(i, 0, 0) = 1;
 			for (int j = 0; j < sample_per_class; ++j) {
@@ -160,22 +169,23 @@ namespace utils {
 						.append(".bmp");
 				}
 //				std::cout << path_dir << std::endl;
-				X = utils::CreateTensorFromImage(path_dir);
-				dataset.push_back(std::pair<Tensor3D<double>, Tensor3D<double>>(X, target));
+				X = utils::CreateTensorFromImage<T>(path_dir);
+				dataset.push_back(std::pair<Tensor3D<T>, Tensor3D<T>>(X, target));
 			}
 		}
 
 		return dataset;
 	}
 
-	static Dataset GetTestSet(std::string base_path_dir, int sample_per_class) {
-		Dataset dataset;
+	template<typename T>
+	static Dataset<T> GetTestSet(std::string base_path_dir, int sample_per_class) {
+		Dataset<T> dataset;
 
 		std::string path_dir = base_path_dir;
-		Tensor3D<double> X, target;
+		Tensor3D<T> X, target;
 
 		for (int i = 0; i < 12; ++i) {
-			target = Tensor3D<double>(12, 1, 1);
+			target = Tensor3D<T>(12, 1, 1);
 			target.InitZeros();
 			target(i, 0, 0) = 1;
 			for (int j = 0; j < sample_per_class; ++j) {
@@ -198,8 +208,8 @@ namespace utils {
 						.append("_4").append(std::to_string(j + 500))
 						.append(".bmp");
 				}
-				X = utils::CreateTensorFromImage(path_dir);
-				dataset.push_back(std::pair<Tensor3D<double>, Tensor3D<double>>(X, target));
+				X = utils::CreateTensorFromImage<T>(path_dir);
+				dataset.push_back(std::pair<Tensor3D<T>, Tensor3D<T>>(X, target));
 			}
 
 		}
@@ -207,11 +217,27 @@ namespace utils {
 		return dataset;
 	}
 
-	static bool ComparePrediction(Tensor3D<double> pred, Tensor3D<double> target) {
+	// Copies count examples of a dataset, starting at first, into a batch of
+	// inputs and a batch of targets. Reuses the storage of the batches.
+	template<typename T>
+	static void GetBatch(const Dataset<T>& dataset, int first, int count,
+						 convnet_core::Tensor4D<T>& inputs, convnet_core::Tensor4D<T>& targets) {
+		assert(first >= 0 && count > 0 && first + count <= static_cast<int>(dataset.size()));
+		inputs.Resize(count, dataset[first].first.GetShape());
+		targets.Resize(count, dataset[first].second.GetShape());
+		for (int n = 0; n < count; ++n) {
+			inputs.SetSample(n, dataset[first + n].first);
+			targets.SetSample(n, dataset[first + n].second);
+		}
+	}
+
+	template<typename T>
+	static bool ComparePrediction(const convnet_core::ConstTensorView<T>& pred, 
+								  const convnet_core::ConstTensorView<T>& target) {
 		assert(pred.GetShape().height == target.GetShape().height);
 
 		int pred_index = -1, target_index = -1;
-		double max = std::numeric_limits<double>::lowest();
+		T max = std::numeric_limits<T>::lowest();
 		for (int i = 0; i < pred.GetShape().height; ++i) {
 			if (target(i, 0, 0) == 1)
 				target_index = i;
@@ -229,7 +255,13 @@ namespace utils {
 		return (pred_index == target_index);
 	}
 
-	static void WritePoolLayer(layer::MaxPool pool, std::string path) {
+	template<typename T>
+	static bool ComparePrediction(const Tensor3D<T>& pred, const Tensor3D<T>& target) {
+		return ComparePrediction(pred.View(), target.View());
+	}
+
+	template<typename T>
+	static void WritePoolLayer(layer::MaxPool<T> pool, std::string path) {
 		std::ofstream o(path);
 		nlohmann::json layer;
 		
@@ -245,25 +277,28 @@ namespace utils {
 	}
 
 	// TODO: DELETE READ FROM PATH FUNCTIONS
-	static layer::MaxPool ReadPoolLayer(std::string path) {
+	template<typename T>
+	static layer::MaxPool<T> ReadPoolLayer(std::string path) {
 		std::ifstream i(path);
 		nlohmann::json layer;
 		i >> layer;
 
-		layer::MaxPool pool = layer::MaxPool(layer["name"], layer["height"],
+		layer::MaxPool<T> pool = layer::MaxPool<T>(layer["name"], layer["height"],
 			layer["width"], layer["depth"], layer["stride"], layer["p_size"]);
 
 		return pool;
 	}
 
-	static layer::MaxPool ReadPoolLayerJSON(nlohmann::json layer) {
-		layer::MaxPool pool = layer::MaxPool(layer["name"], layer["height"],
+	template<typename T>
+	static layer::MaxPool<T> ReadPoolLayerJSON(nlohmann::json layer) {
+		layer::MaxPool<T> pool = layer::MaxPool<T>(layer["name"], layer["height"],
 			layer["width"], layer["depth"], layer["stride"], layer["p_size"]);
 
 		return pool;
 	}
 
-	static void WriteReLU(layer::ReLU relu, std::string path) {
+	template<typename T>
+	static void WriteReLU(layer::ReLU<T> relu, std::string path) {
 		std::ofstream o(path);
 		nlohmann::json layer;
 
@@ -276,25 +311,28 @@ namespace utils {
 		o << std::setw(4) << layer;
 	}
 
-	static layer::ReLU ReadReLU(std::string path) {
+	template<typename T>
+	static layer::ReLU<T> ReadReLU(std::string path) {
 		std::ifstream i(path);
 		nlohmann::json layer;
 		i >> layer;
 
-		layer::ReLU relu = layer::ReLU(layer["name"], layer["height"],
+		layer::ReLU<T> relu = layer::ReLU<T>(layer["name"], layer["height"],
 											 layer["width"], layer["depth"]);
 
 		return relu;
 	}
 
-	static layer::ReLU ReadReLUJSON(nlohmann::json layer) {
-		layer::ReLU relu = layer::ReLU(layer["name"], layer["height"],
+	template<typename T>
+	static layer::ReLU<T> ReadReLUJSON(nlohmann::json layer) {
+		layer::ReLU<T> relu = layer::ReLU<T>(layer["name"], layer["height"],
 			layer["width"], layer["depth"]);
 
 		return relu;
 	}
 
-	static void WriteSoftmax(layer::Softmax softmax, std::string path) {
+	template<typename T>
+	static void WriteSoftmax(layer::Softmax<T> softmax, std::string path) {
 		std::ofstream o(path);
 		nlohmann::json layer;
 
@@ -305,27 +343,30 @@ namespace utils {
 		o << std::setw(4) << layer;
 	}
 
-	static layer::Softmax ReadSoftmax(std::string path) {
+	template<typename T>
+	static layer::Softmax<T> ReadSoftmax(std::string path) {
 		std::ifstream i(path);
 		nlohmann::json layer;
 		i >> layer;
 
-		layer::Softmax softmax = layer::Softmax(layer["name"], 
+		layer::Softmax<T> softmax = layer::Softmax<T>(layer["name"], 
 												layer["height"], 
 												1, 1);
 
 		return softmax;
 	}
 
-	static layer::Softmax ReadSoftmaxJSON(nlohmann::json layer) {
-		layer::Softmax softmax = layer::Softmax(layer["name"],
+	template<typename T>
+	static layer::Softmax<T> ReadSoftmaxJSON(nlohmann::json layer) {
+		layer::Softmax<T> softmax = layer::Softmax<T>(layer["name"],
 												layer["height"], 
 												1, 1);
 
 		return softmax;
 	}
 
-	static void WriteConvLayer(layer::Conv conv, std::string path) {
+	template<typename T>
+	static void WriteConvLayer(layer::Conv<T> conv, std::string path) {
 		std::ofstream o(path);
 		nlohmann::json layer;
 		nlohmann::json weights;
@@ -357,12 +398,13 @@ namespace utils {
 		o << std::setw(4) << layer;
 	}
 
-	static layer::Conv ReadConvLayer(std::string path) {
+	template<typename T>
+	static layer::Conv<T> ReadConvLayer(std::string path) {
 		std::ifstream i(path);
 		nlohmann::json layer;
 		i >> layer;
 		
-		layer::Conv conv = layer::Conv(layer["height"], layer["width"],
+		layer::Conv<T> conv = layer::Conv<T>(layer["height"], layer["width"],
 									   layer["depth"], layer["name"], 
 									   layer["f_count"], layer["f_size"],
 									   layer["stride"], layer["padding"]);
@@ -393,8 +435,9 @@ namespace utils {
 		return conv;
 	}
 
-	static layer::Conv ReadConvLayerJSON(nlohmann::json layer) {
-		layer::Conv conv = layer::Conv(layer["height"], layer["width"],
+	template<typename T>
+	static layer::Conv<T> ReadConvLayerJSON(nlohmann::json layer) {
+		layer::Conv<T> conv = layer::Conv<T>(layer["height"], layer["width"],
 			layer["depth"], layer["name"],
 			layer["f_count"], layer["f_size"],
 			layer["stride"], layer["padding"]);
@@ -425,7 +468,8 @@ namespace utils {
 		return conv;
 	}
 
-	static void WriteFCLayer(layer::FC fc, std::string path) {
+	template<typename T>
+	static void WriteFCLayer(layer::FC<T> fc, std::string path) {
 		std::ofstream o(path);
 		nlohmann::json layer;
 		nlohmann::json weights;
@@ -452,12 +496,69 @@ namespace utils {
 		o << std::setw(4) << layer;
 	}
 
-	static layer::FC ReadFCLayer(std::string path) {
+	// Reads a GroupConv layer saved by GroupConv::Serialize.
+	template<typename T>
+	static layer::GroupConv<T> ReadGroupConvLayerJSON(nlohmann::json layer) {
+		layer::GroupConv<T> conv = layer::GroupConv<T>(layer["height"], layer["width"],
+			layer["depth"], layer["name"],
+			layer["f_count"], layer["f_size"],
+			layer["stride"], layer["padding"], layer["groups"]);
+
+		// Filter i is filter i % per_group of group i / per_group.
+		const int per_group = conv.GetFilterCount() / conv.GetGroupCount();
+		int b_ind = 0;
+		for (auto& element : layer["bias"]) {
+			conv.GetGroup(b_ind / per_group).GetBias()[b_ind % per_group](0, 0, 0) = element;
+			++b_ind;
+		}
+
+		int filter_size = layer["f_size"];
+		int group_depth = int(layer["depth"]) / conv.GetGroupCount();
+		for (nlohmann::json::iterator it = layer["weights"].begin();
+			it != layer["weights"].end(); ++it) {
+			const int filter = std::stoi(it.key());
+			Tensor3D<T>& kernel = conv.GetGroup(filter / per_group).GetWeights()[filter % per_group];
+			for (int h = 0; h < filter_size; ++h)
+				for (int w = 0; w < filter_size; ++w)
+					for (int d = 0; d < group_depth; ++d)
+						kernel(h, w, d) = it.value()[d * (filter_size*filter_size) + h * filter_size + w];
+		}
+
+		return conv;
+	}
+
+	// Reads a DepthwiseConv layer saved by DepthwiseConv::Serialize.
+	template<typename T>
+	static layer::DepthwiseConv<T> ReadDepthwiseConvLayerJSON(nlohmann::json layer) {
+		layer::DepthwiseConv<T> conv = layer::DepthwiseConv<T>(layer["height"], layer["width"],
+			layer["depth"], layer["name"],
+			layer["multiplier"], layer["f_size"],
+			layer["stride"], layer["padding"]);
+
+		int b_ind = 0;
+		for (auto& element : layer["bias"]) {
+			conv.GetBias()[b_ind](0, 0, 0) = element;
+			++b_ind;
+		}
+
+		int filter_size = layer["f_size"];
+		for (nlohmann::json::iterator it = layer["weights"].begin();
+			it != layer["weights"].end(); ++it) {
+			for (int h = 0; h < filter_size; ++h)
+				for (int w = 0; w < filter_size; ++w)
+					conv.GetWeights()[std::stoi(it.key())](h, w, 0) = it.value()[h * filter_size + w];
+		}
+
+		return conv;
+	}
+
+	template<typename T>
+	static layer::FC<T> ReadFCLayer(std::string path) {
 		std::ifstream i(path);
 		nlohmann::json layer;
 		i >> layer;
 
-		layer::FC fc = layer::FC(layer["name"], layer["input"], layer["output"]);
+		layer::FC<T> fc = layer::FC<T>(layer["name"], layer["input"], layer["output"]);
 
 		int b_ind = 0;
 		for (auto& element : layer["bias"]) {
@@ -478,8 +579,9 @@ namespace utils {
 		return fc;
 	}
 
-	static layer::FC ReadFCLayerJSON(nlohmann::json layer) {
-		layer::FC fc = layer::FC(layer["name"], layer["input"], layer["output"]);
+	template<typename T>
+	static layer::FC<T> ReadFCLayerJSON(nlohmann::json layer) {
+		layer::FC<T> fc = layer::FC<T>(layer["name"], layer["input"], layer["output"]);
 
 		if (layer.count("bias") == 0 ||
 			layer.count("weights") == 0) {
@@ -492,6 +594,19 @@ namespace utils {
 			++b_ind;
 		}
 
+		if (layer.value("format", "dense") == "csr") {
+			// A row per input.
+			convnet_core::CsrMatrix<T> csr;
+			csr.rows = layer["input"];
+			csr.cols = layer["output"];
+			csr.row_offsets = layer["weights"]["row_offsets"].get<std::vector<int>>();
+			csr.columns = layer["weights"]["columns"].get<std::vector<int>>();
+			csr.values = layer["weights"]["values"].get<std::vector<T>>();
+			assert(static_cast<int>(csr.row_offsets.size()) == csr.rows + 1);
+			convnet_core::FromCsr(csr, fc.GetWeights().Data(), csr.cols);
+			return fc;
+		}
+
 		for (nlohmann::json::iterator it = layer["weights"].begin();
 			it != layer["weights"].end(); ++it) {
 
@@ -0,0 +1,107 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "autotune.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+namespace convnet_core {
+	// The brand string is stored in the registers of the cpuid leaves
+	// 0x80000002 to 0x80000004, 16 characters each.
+	std::string CpuModel() {
+		char brand[49] = { 0 };
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 0x80000000);
+		if (static_cast<unsigned int>(info[0]) >= 0x80000004) {
+			for (int i = 0; i < 3; ++i) {
+				__cpuid(info, 0x80000002 + i);
+				std::memcpy(brand + 16 * i, info, 16);
+			}
+		}
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+		unsigned int info[4];
+		if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+			for (unsigned int i = 0; i < 3; ++i) {
+				__get_cpuid(0x80000002 + i, &info[0], &info[1], &info[2], &info[3]);
+				std::memcpy(brand + 16 * i, info, 16);
+			}
+		}
+#endif
+		// The string is padded with spaces on some CPUs.
+		std::string model(brand);
+		const size_t first = model.find_first_not_of(' ');
+		if (first == std::string::npos)
+			return "unknown";
+
+		return model.substr(first, model.find_last_not_of(' ') - first + 1);
+	}
+
+	std::string TuningCachePath() {
+		std::string path;
+#ifdef _MSC_VER
+		char* value = nullptr;
+		size_t length = 0;
+		if (_dupenv_s(&value, &length, "CONVNET_TUNING_CACHE") == 0 && value != nullptr) {
+			path = value;
+			free(value);
+		}
+#else
+		const char* value = std::getenv("CONVNET_TUNING_CACHE");
+		if (value != nullptr)
+			path = value;
+#endif
+		return path;
+	}
+
+	TuningCache::TuningCache(std::string path)
+		: path(path), cpu(CpuModel()), entries(nlohmann::json::object()), changed(false) {
+		std::ifstream i(path);
+		if (!i)
+			return;
+
+		try {
+			i >> entries;
+		} catch (const std::exception&) {
+			entries = nlohmann::json::object();
+		}
+		if (!entries.is_object())
+			entries = nlohmann::json::object();
+	}
+
+	std::string TuningCache::Find(const std::string& signature) const {
+		auto machine = entries.find(cpu);
+		if (machine == entries.end() || !machine->is_object())
+			return "";
+
+		auto entry = machine->find(signature);
+		if (entry == machine->end() || !entry->is_string())
+			return "";
+
+		return entry->get<std::string>();
+	}
+
+	void TuningCache::Store(const std::string& signature, const std::string& value) {
+		if (!entries[cpu].is_object())
+			entries[cpu] = nlohmann::json::object();
+		entries[cpu][signature] = value;
+		changed = true;
+	}
+
+	void TuningCache::Save() {
+		if (!changed)
+			return;
+
+		std::ofstream o(path);
+		o << std::setw(4) << entries;
+		changed = false;
+	}
+}
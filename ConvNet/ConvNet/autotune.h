@@ -0,0 +1,61 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <nlohmann/json.hpp>
+
+namespace convnet_core {
+	// The fastest algorithm of a layer depends on the CPU, so the autotuner
+	// measures them on the machine it runs on, and keeps its choices in a
+	// cache file, keyed by the CPU model and the signature of the layer:
+	//	{ "<CPU model>": { "<layer signature>": "<algorithm>", ... }, ... }
+	// Later runs on the same kind of CPU read the choice instead of measuring.
+
+	// Brand string of the CPU, "unknown" if it cannot be queried.
+	std::string CpuModel();
+	// Path of the tuning cache set by the CONVNET_TUNING_CACHE environment
+	// variable, empty if it is not set.
+	std::string TuningCachePath();
+
+	// Tuning cache of one file, with the entries of the current CPU.
+	class TuningCache
+	{
+	public:
+		// Reads the file, a missing or malformed file gives an empty cache.
+		explicit TuningCache(std::string path);
+
+		// The value stored for a signature on this CPU, empty if there is none.
+		std::string Find(const std::string& signature) const;
+		void Store(const std::string& signature, const std::string& value);
+		// Writes the file if entries were stored. The entries of other CPUs
+		// are kept.
+		void Save();
+
+	private:
+		std::string path;
+		std::string cpu;
+		nlohmann::json entries;
+		bool changed;
+	};
+
+	// Shortest wall-clock time of repetitions calls of f, in seconds, after
+	// a first call that warms up the caches and the allocators.
+	template<typename F>
+	double BestTime(int repetitions, const F& f) {
+		typedef std::chrono::steady_clock Clock;
+		f();
+		double best = std::numeric_limits<double>::infinity();
+		for (int r = 0; r < repetitions; ++r) {
+			const Clock::time_point start = Clock::now();
+			f();
+			best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+		}
+
+		return best;
+	}
+}
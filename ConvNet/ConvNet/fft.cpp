@@ -0,0 +1,245 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "fft.h"
+#include "memory.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace convnet_core {
+	namespace {
+		// Complex products are written out, std::complex multiplication
+		// handles infinities and NaNs in a slow library call.
+		template<typename T>
+		inline std::complex<T> Multiply(const std::complex<T>& a, const std::complex<T>& b) {
+			return std::complex<T>(a.real() * b.real() - a.imag() * b.imag(),
+								   a.real() * b.imag() + a.imag() * b.real());
+		}
+
+		// Range of transform sizes considered for the convolution.
+		const int kMinFftSize = 8;
+		const int kMaxFftSize = 128;
+		// Weight of the transforms in the cost estimate, relative to the
+		// GEMM and the products (measured on 5x5 and 7x7 layers).
+		const double kTransformWeight = 4;
+	}
+
+	template<typename T>
+	FftPlan<T>::FftPlan() : n(0) { }
+
+	template<typename T>
+	FftPlan<T>::FftPlan(int n) : n(n), bit_reverse(n), twiddles(n / 2) {
+		assert(n > 0 && (n & (n - 1)) == 0);
+		int bits = 0;
+		while ((1 << bits) < n)
+			++bits;
+		for (int i = 0; i < n; ++i) {
+			int reversed = 0;
+			for (int b = 0; b < bits; ++b)
+				if (i & (1 << b))
+					reversed |= 1 << (bits - 1 - b);
+			bit_reverse[i] = reversed;
+		}
+
+		const double pi = 3.14159265358979323846;
+		for (int k = 0; k < n / 2; ++k)
+			twiddles[k] = std::complex<T>(T(std::cos(2 * pi * k / n)), T(-std::sin(2 * pi * k / n)));
+	}
+
+	template<typename T>
+	int FftPlan<T>::Size() const {
+		return n;
+	}
+
+	// Iterative Cooley-Tukey transform: bit-reversal permutation, then
+	// log2(n) stages of butterflies of doubling length.
+	template<typename T>
+	void FftPlan<T>::Transform(std::complex<T>* data, int stride, bool inverse) const {
+		for (int i = 0; i < n; ++i) {
+			const int j = bit_reverse[i];
+			if (i < j)
+				std::swap(data[i * stride], data[j * stride]);
+		}
+
+		for (int length = 2; length <= n; length *= 2) {
+			const int half = length / 2;
+			const int step = n / length;
+			for (int first = 0; first < n; first += length) {
+				std::complex<T>* a = data + first * stride;
+				std::complex<T>* b = a + half * stride;
+				for (int j = 0; j < half; ++j) {
+					std::complex<T> w = twiddles[j * step];
+					if (inverse)
+						w = std::conj(w);
+					const std::complex<T> u = a[j * stride];
+					const std::complex<T> v = Multiply(b[j * stride], w);
+					a[j * stride] = u + v;
+					b[j * stride] = u - v;
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	void FftPlan<T>::Transform2D(std::complex<T>* data, bool inverse) const {
+		for (int i = 0; i < n; ++i)
+			Transform(data + i * n, 1, inverse);
+		for (int i = 0; i < n; ++i)
+			for (int j = i + 1; j < n; ++j)
+				std::swap(data[i * n + j], data[j * n + i]);
+		for (int i = 0; i < n; ++i)
+			Transform(data + i * n, 1, inverse);
+	}
+
+	double FftConvolutionCost(int n, int filter_size, Triplet in_shape, int padding, int out_depth) {
+		const int block = n - filter_size + 1;
+		const double blocks = double((in_shape.height + 2 * padding + block - 1) / block) *
+							  ((in_shape.width + 2 * padding + block - 1) / block);
+		double log_n = 0;
+		while ((1 << int(log_n)) < n)
+			++log_n;
+		// n log2(n) / 2 butterflies per 1D transform of about 5 operations
+		// each, 2n 1D transforms per 2D one.
+		const double transform = kTransformWeight * 5.0 * n * n * log_n;
+		const double pairs = (out_depth + 1) / 2;
+		// A complex multiply-add is 4 real ones.
+		return blocks * (in_shape.depth * transform + pairs * (in_shape.depth * 4.0 * n * n + transform));
+	}
+
+	int FftConvolutionSize(int filter_size, Triplet in_shape, int padding, int out_depth) {
+		int best = 0;
+		for (int n = kMinFftSize; n <= kMaxFftSize; n *= 2) {
+			if (n < 2 * filter_size)
+				continue;
+			if (best == 0 || FftConvolutionCost(n, filter_size, in_shape, padding, out_depth) <
+							 FftConvolutionCost(best, filter_size, in_shape, padding, out_depth))
+				best = n;
+		}
+		return best;
+	}
+
+	template<typename T>
+	void FftTransformFilters(const FftPlan<T>& plan, const T* first, const T* second,
+							 int filter_size, int depth, std::complex<T>* spectra) {
+		const int n = plan.Size();
+		const int k = filter_size;
+		const T scale = T(1) / (T(n) * n);
+		for (int c = 0; c < depth; ++c) {
+			std::complex<T>* spectrum = spectra + c * n * n;
+			std::fill(spectrum, spectrum + n * n, std::complex<T>(0, 0));
+			for (int i = 0; i < k; ++i) {
+				for (int j = 0; j < k; ++j) {
+					const int index = (c * k + k - 1 - i) * k + k - 1 - j;
+					spectrum[i * n + j] = std::complex<T>(first[index] * scale,
+														  second ? second[index] * scale : T(0));
+				}
+			}
+			plan.Transform2D(spectrum, false);
+		}
+	}
+
+	// The layer correlates: out(h, w) = sum x(h + i, w + j) W(i, j) over the
+	// padded input x, which is the full convolution of x with the rotated
+	// kernels at (h + f_size - 1, w + f_size - 1). The full convolution of a
+	// block with a kernel fits in n x n, so the circular convolution of the
+	// transforms equals the linear one.
+	template<typename T>
+	void FftConvolve(const FftPlan<T>& plan, const ConstTensorView<T>& input,
+					 const std::complex<T>* spectra, int filter_size, int padding,
+					 const TensorView<T>& out) {
+		const int n = plan.Size();
+		const int k = filter_size;
+		const int block = n - k + 1;
+		assert(block > 0);
+		Triplet shape = input.GetShape();
+		Strides strides = input.GetStrides();
+		Triplet out_shape = out.GetShape();
+		Strides out_strides = out.GetStrides();
+		const int padded_height = shape.height + 2 * padding;
+		const int padded_width = shape.width + 2 * padding;
+		assert(out_shape.height == padded_height - k + 1 && out_shape.width == padded_width - k + 1);
+		const int pairs = (out_shape.depth + 1) / 2;
+		const int area = n * n;
+
+		for (int c = 0; c < out_shape.depth; ++c)
+			for (int h = 0; h < out_shape.height; ++h)
+				for (int w = 0; w < out_shape.width; ++w)
+					out(h, w, c) = 0;
+
+		// Temporaries are allocated from the arena of the current step. The
+		// blocks are processed in turn, the channels and the pairs of filters
+		// of a block in parallel; every pair adds to its own output channels.
+		const int grain = std::max(1, kParallelGrain / area);
+		Buffer<std::complex<T>> blocks(shape.depth * area, StepResource());
+		for (int row0 = 0; row0 < padded_height; row0 += block) {
+			for (int col0 = 0; col0 < padded_width; col0 += block) {
+				// Spectra of the block of every input channel.
+				ParallelFor(0, shape.depth, grain, [&](int first_channel, int last_channel) {
+					for (int c = first_channel; c < last_channel; ++c) {
+						std::complex<T>* x = blocks.data() + c * area;
+						std::fill(x, x + area, std::complex<T>(0, 0));
+						const int rows = std::min(block, padded_height - row0);
+						const int cols = std::min(block, padded_width - col0);
+						for (int i = 0; i < rows; ++i) {
+							const int row = row0 + i - padding;
+							if (row < 0 || row >= shape.height)
+								continue;
+							const T* src = input.Data() + c * strides.channel + row * strides.row;
+							for (int j = 0; j < cols; ++j) {
+								const int col = col0 + j - padding;
+								if (col >= 0 && col < shape.width)
+									x[i * n + j] = std::complex<T>(src[col * strides.col], 0);
+							}
+						}
+						plan.Transform2D(x, false);
+					}
+				});
+
+				ParallelFor(0, pairs, grain, [&](int first_pair, int last_pair) {
+					Buffer<std::complex<T>> product(area, StepResource());
+					for (int p = first_pair; p < last_pair; ++p) {
+						std::complex<T>* z = product.data();
+						std::fill(z, z + area, std::complex<T>(0, 0));
+						for (int c = 0; c < shape.depth; ++c) {
+							const std::complex<T>* x = blocks.data() + c * area;
+							const std::complex<T>* s = spectra + (p * shape.depth + c) * area;
+							for (int e = 0; e < area; ++e)
+								z[e] += Multiply(x[e], s[e]);
+						}
+						plan.Transform2D(z, true);
+
+						// The real part belongs to filter 2p, the imaginary one to 2p + 1.
+						T* first = out.Data() + 2 * p * out_strides.channel;
+						T* second = 2 * p + 1 < out_shape.depth ? first + out_strides.channel : nullptr;
+						for (int i = 0; i < n; ++i) {
+							const int h = row0 + i - (k - 1);
+							if (h < 0 || h >= out_shape.height)
+								continue;
+							for (int j = 0; j < n; ++j) {
+								const int w = col0 + j - (k - 1);
+								if (w < 0 || w >= out_shape.width)
+									continue;
+								const int offset = h * out_strides.row + w * out_strides.col;
+								first[offset] += z[i * n + j].real();
+								if (second)
+									second[offset] += z[i * n + j].imag();
+							}
+						}
+					}
+				});
+			}
+		}
+	}
+
+	template class FftPlan<float>;
+	template class FftPlan<double>;
+	template void FftTransformFilters<float>(const FftPlan<float>&, const float*, const float*,
+											 int, int, std::complex<float>*);
+	template void FftTransformFilters<double>(const FftPlan<double>&, const double*, const double*,
+											  int, int, std::complex<double>*);
+	template void FftConvolve<float>(const FftPlan<float>&, const ConstTensorView<float>&,
+									 const std::complex<float>*, int, int, const TensorView<float>&);
+	template void FftConvolve<double>(const FftPlan<double>&, const ConstTensorView<double>&,
+									  const std::complex<double>*, int, int, const TensorView<double>&);
+}
@@ -0,0 +1,75 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include "tensorView.h"
+#include <complex>
+#include <vector>
+
+namespace convnet_core {
+	// Precomputed tables of a radix-2 fast Fourier transform of n elements,
+	// n is a power of two. Transforms are in place and not normalized, the
+	// inverse transform multiplies by n (n^2 in 2D).
+	template<typename T>
+	class FftPlan
+	{
+	public:
+		FftPlan();
+		explicit FftPlan(int n);
+
+		int Size() const;
+		// Transforms n elements, stride elements apart.
+		void Transform(std::complex<T>* data, int stride, bool inverse) const;
+		// Transforms the rows, transposes, and transforms the rows again, so
+		// the 2D spectrum of a row-major n x n matrix is stored transposed.
+		// That makes no difference to element-wise products, and the inverse
+		// transform of a transposed spectrum has the original orientation.
+		void Transform2D(std::complex<T>* data, bool inverse) const;
+
+	private:
+		int n;
+		// Index of each element after the bit-reversal permutation.
+		std::vector<int> bit_reverse;
+		// exp(-2 * pi * i * k / n) for k < n / 2.
+		std::vector<std::complex<T>> twiddles;
+	};
+
+	// FFT convolution of a volume with f_size x f_size filters (stride 1,
+	// without bias) by overlap-add. The zero-padded input is cut into blocks
+	// of (n - f_size + 1) x (n - f_size + 1), the n x n spectrum of each block
+	// is multiplied with the cached filter spectra, and the inverse transforms
+	// are added to the output, where the blocks overlap by f_size - 1. Two
+	// filters share a transform: their spectra are the real and imaginary
+	// parts of one complex spectrum, as the results are real.
+
+	// Estimated number of operations of FftConvolve with n x n transforms.
+	// The transforms are weighted, their butterflies are scalar and less
+	// cache friendly than the products. Comparable to the f_size^2 * input
+	// depth * out depth operations per output pixel of a GEMM based
+	// convolution.
+	// @param in_shape:		shape of the input (without padding)
+	double FftConvolutionCost(int n, int filter_size, Triplet in_shape, int padding, int out_depth);
+	// The transform size with the lowest estimated cost.
+	int FftConvolutionSize(int filter_size, Triplet in_shape, int padding, int out_depth);
+
+	// Computes the spectra of a pair of filters for FftConvolve: for each
+	// channel the transform of the kernel of the first filter (rotated by
+	// 180 degrees, since the layer correlates) plus i times the kernel of the
+	// second one, scaled by 1 / n^2 to normalize the inverse transform.
+	// @param first, second:	planar f_size x f_size x depth filters, second
+	//							may be nullptr for an odd number of filters
+	// @param spectra:			receives depth spectra of n x n elements
+	template<typename T>
+	void FftTransformFilters(const FftPlan<T>& plan, const T* first, const T* second,
+							 int filter_size, int depth, std::complex<T>* spectra);
+
+	// @param input:		input volume
+	// @param spectra:		spectra of the filter pairs, see FftTransformFilters
+	// @param out:			output volume, (height + 2 * padding - f_size + 1) x
+	//						(width + 2 * padding - f_size + 1) x out depth
+	template<typename T>
+	void FftConvolve(const FftPlan<T>& plan, const ConstTensorView<T>& input,
+					 const std::complex<T>* spectra, int filter_size, int padding,
+					 const TensorView<T>& out);
+}
@@ -0,0 +1,177 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "gemm.h"
+#include "kernels.h"
+#include "memory.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace convnet_core {
+	namespace {
+		// Packs an (mc x kc) block of op(A) into row panels of kGemmMR rows.
+		// Within a panel the kGemmMR elements of a column are adjacent, the
+		// panel is zero-padded to full height.
+		// @param a:	first element of the block
+		template<typename T>
+		void PackA(bool transpose, int mc, int kc, const T* a, int lda, T* packed) {
+			// Distances of the elements of op(A) in the rows and columns.
+			const int row_step = transpose ? 1 : lda;
+			const int col_step = transpose ? lda : 1;
+			for (int i = 0; i < mc; i += kGemmMR) {
+				const int rows = std::min(kGemmMR, mc - i);
+				for (int p = 0; p < kc; ++p) {
+					for (int r = 0; r < rows; ++r)
+						packed[r] = a[(i + r) * row_step + p * col_step];
+					for (int r = rows; r < kGemmMR; ++r)
+						packed[r] = 0;
+					packed += kGemmMR;
+				}
+			}
+		}
+
+		// Packs a (kc x nc) block of op(B) into column panels of kGemmNR
+		// columns, zero-padded to full width.
+		// @param b:	first element of the block
+		template<typename T>
+		void PackB(bool transpose, int kc, int nc, const T* b, int ldb, T* packed) {
+			const int row_step = transpose ? 1 : ldb;
+			const int col_step = transpose ? ldb : 1;
+			for (int j = 0; j < nc; j += kGemmNR) {
+				const int cols = std::min(kGemmNR, nc - j);
+				for (int p = 0; p < kc; ++p) {
+					const T* row = b + p * row_step + j * col_step;
+					if (col_step == 1) {
+						for (int s = 0; s < cols; ++s)
+							packed[s] = row[s];
+					} else {
+						for (int s = 0; s < cols; ++s)
+							packed[s] = row[s * col_step];
+					}
+					for (int s = cols; s < kGemmNR; ++s)
+						packed[s] = 0;
+					packed += kGemmNR;
+				}
+			}
+		}
+
+		int RoundUp(int value, int multiple) {
+			return (value + multiple - 1) / multiple * multiple;
+		}
+
+		template<typename T>
+		void GemmSerial(bool trans_a, bool trans_b, int m, int n, int k,
+						const T* a, int lda, const T* b, int ldb, T* c, int ldc, bool accumulate) {
+			if (k <= 0) {
+				if (!accumulate)
+					for (int i = 0; i < m; ++i)
+						std::fill(c + i * ldc, c + i * ldc + n, T(0));
+				return;
+			}
+
+			// Panels are temporaries of the current step.
+			Buffer<T> packed_a(kGemmMC * std::min(k, kGemmKC), StepResource());
+			Buffer<T> packed_b(RoundUp(std::min(n, kGemmNC), kGemmNR) * std::min(k, kGemmKC),
+							   StepResource());
+
+			for (int jc = 0; jc < n; jc += kGemmNC) {
+				const int nc = std::min(kGemmNC, n - jc);
+				for (int pc = 0; pc < k; pc += kGemmKC) {
+					const int kc = std::min(kGemmKC, k - pc);
+					// Later blocks of k are added to the partial result.
+					const bool add = accumulate || pc > 0;
+					PackB(trans_b, kc, nc, trans_b ? b + jc * ldb + pc : b + pc * ldb + jc,
+						  ldb, packed_b.data());
+
+					for (int ic = 0; ic < m; ic += kGemmMC) {
+						const int mc = std::min(kGemmMC, m - ic);
+						PackA(trans_a, mc, kc, trans_a ? a + pc * lda + ic : a + ic * lda + pc,
+							  lda, packed_a.data());
+
+						for (int jr = 0; jr < nc; jr += kGemmNR) {
+							const int nr = std::min(kGemmNR, nc - jr);
+							const T* b_panel = packed_b.data() + jr * kc;
+							for (int ir = 0; ir < mc; ir += kGemmMR) {
+								const int mr = std::min(kGemmMR, mc - ir);
+								kernels::GemmKernel(kc, packed_a.data() + ir * kc, b_panel,
+													c + (ic + ir) * ldc + jc + jr, ldc, mr, nr, add);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Large products are split along the longer side of C into blocks of
+	// whole microkernel tiles, computed in parallel. Every element of C is
+	// computed by one task in the same order, so the result does not depend
+	// on the number of threads.
+	template<typename T>
+	void Gemm(Transpose transpose_a, Transpose transpose_b, int m, int n, int k,
+			  const T* a, int lda, const T* b, int ldb, T* c, int ldc, bool accumulate) {
+		const bool trans_a = transpose_a == Transpose::Yes;
+		const bool trans_b = transpose_b == Transpose::Yes;
+		if (m <= 0 || n <= 0)
+			return;
+
+		const double depth = std::max(k, 1);
+		const double work = m * n * depth;
+		if (work < 2 * kGemmTaskWork) {
+			GemmSerial(trans_a, trans_b, m, n, k, a, lda, b, ldb, c, ldc, accumulate);
+			return;
+		}
+
+		if (n >= m) {
+			// Column blocks of kGemmNR columns.
+			const int units = (n + kGemmNR - 1) / kGemmNR;
+			const int grain = std::max(1, static_cast<int>(kGemmTaskWork / (m * kGemmNR * depth)));
+			ParallelFor(0, units, grain, [&](int first, int last) {
+				const int j0 = first * kGemmNR;
+				const int j1 = std::min(n, last * kGemmNR);
+				GemmSerial(trans_a, trans_b, m, j1 - j0, k, a, lda,
+						   trans_b ? b + j0 * ldb : b + j0, ldb, c + j0, ldc, accumulate);
+			});
+		} else {
+			// Row blocks of kGemmMR rows.
+			const int units = (m + kGemmMR - 1) / kGemmMR;
+			const int grain = std::max(1, static_cast<int>(kGemmTaskWork / (n * kGemmMR * depth)));
+			ParallelFor(0, units, grain, [&](int first, int last) {
+				const int i0 = first * kGemmMR;
+				const int i1 = std::min(m, last * kGemmMR);
+				GemmSerial(trans_a, trans_b, i1 - i0, n, k, trans_a ? a + i0 : a + i0 * lda, lda,
+						   b, ldb, c + i0 * ldc, ldc, accumulate);
+			});
+		}
+	}
+
+	int GemvPackedSize(int k, int n) {
+		return RoundUp(n, kGemmNR) * k;
+	}
+
+	template<typename T>
+	void PackGemvMatrix(int k, int n, const T* b, int ldb, T* packed) {
+		PackB(false, k, n, b, ldb, packed);
+	}
+
+	// Every panel gives kGemmNR elements of y, the panels are independent.
+	template<typename T>
+	void Gemv(int k, int n, const T* x, const T* packed, T* y, bool accumulate) {
+		const int panels = (n + kGemmNR - 1) / kGemmNR;
+		const int grain = std::max(1, static_cast<int>(kGemmTaskWork / (std::max(k, 1) * double(kGemmNR))));
+		ParallelFor(0, panels, grain, [&](int first, int last) {
+			for (int j = first; j < last; ++j)
+				kernels::GemvKernel(k, x, packed + j * k * kGemmNR, y + j * kGemmNR,
+									std::min(kGemmNR, n - j * kGemmNR), accumulate);
+		});
+	}
+
+	template void Gemm<float>(Transpose, Transpose, int, int, int, const float*, int,
+							  const float*, int, float*, int, bool);
+	template void Gemm<double>(Transpose, Transpose, int, int, int, const double*, int,
+							   const double*, int, double*, int, bool);
+	template void PackGemvMatrix<float>(int, int, const float*, int, float*);
+	template void PackGemvMatrix<double>(int, int, const double*, int, double*);
+	template void Gemv<float>(int, int, const float*, const float*, float*, bool);
+	template void Gemv<double>(int, int, const double*, const double*, double*, bool);
+}
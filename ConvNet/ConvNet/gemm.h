@@ -0,0 +1,55 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+namespace convnet_core {
+	// Blocking parameters of the matrix multiplication. The microkernel keeps
+	// an kGemmMR x kGemmNR block of C in registers, a kGemmKC x kGemmNR panel
+	// of B is sized for the L1 cache and a kGemmMC x kGemmKC block of A for
+	// the L2 cache.
+	const int kGemmMR = 4;
+	const int kGemmNR = 8;
+	const int kGemmKC = 256;
+	const int kGemmMC = 96;
+	const int kGemmNC = 2048;
+	// Minimum number of multiply-adds of a task of a parallel GEMM.
+	const double kGemmTaskWork = 65536;
+
+	// Whether an operand of Gemm is used transposed.
+	enum class Transpose { No, Yes };
+
+	// General matrix multiplication of row-major matrices, C = op(A) * op(B),
+	// or C += op(A) * op(B) if accumulate is true, where op transposes the
+	// operand or not. The blocks of the operands are packed into contiguous
+	// panels (allocated from the arena of the current step), transposing them
+	// on the way, and multiplied by a register-blocked, vectorized microkernel
+	// (see kernels.h).
+	// @param m, n, k:	C is (m x n), op(A) is (m x k), op(B) is (k x n)
+	// @param a:		A, with rows lda elements apart
+	// @param b:		B, with rows ldb elements apart
+	// @param c:		C, with rows ldc elements apart
+	template<typename T>
+	void Gemm(Transpose transpose_a, Transpose transpose_b, int m, int n, int k,
+			  const T* a, int lda, const T* b, int ldb, T* c, int ldc, bool accumulate = false);
+
+	// Number of elements of a (k x n) matrix packed by PackGemvMatrix.
+	int GemvPackedSize(int k, int n);
+
+	// Packs a row-major (k x n) matrix into column panels of kGemmNR
+	// columns, zero-padded to full width. A panel is contiguous, so Gemv
+	// streams the matrix once, sequentially.
+	// @param b:		the matrix, with rows ldb elements apart
+	// @param packed:	GemvPackedSize(k, n) elements
+	template<typename T>
+	void PackGemvMatrix(int k, int n, const T* b, int ldb, T* packed);
+
+	// Vector-matrix product y = x * B, or y += x * B if accumulate is true,
+	// where B is a (k x n) matrix packed by PackGemvMatrix. The panels are
+	// multiplied by a vectorized microkernel (see kernels.h), in parallel
+	// for large matrices.
+	// @param x:		k elements
+	// @param y:		n elements
+	template<typename T>
+	void Gemv(int k, int n, const T* x, const T* packed, T* y, bool accumulate = false);
+}
@@ -0,0 +1,529 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "kernels.h"
+#include "kernelsImpl.h"
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONVNET_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace convnet_core {
+	namespace kernels {
+		namespace {
+			// One element at a time, used when no vector instruction set is available.
+			template<typename T>
+			struct ScalarTraits {
+				typedef T Scalar;
+				typedef T Vec;
+				static const int kWidth = 1;
+				static Vec Load(const T* p) { return *p; }
+				static void Store(T* p, Vec v) { *p = v; }
+				static Vec Set1(T value) { return value; }
+				static Vec LoadU8(const unsigned char* p) { return static_cast<T>(*p); }
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					c0 = p[0];
+					c1 = p[1];
+					c2 = p[2];
+				}
+				static Vec Add(Vec a, Vec b) { return a + b; }
+				static Vec Sub(Vec a, Vec b) { return a - b; }
+				static Vec Mul(Vec a, Vec b) { return a * b; }
+				static Vec Div(Vec a, Vec b) { return a / b; }
+				static Vec SelectNegative(Vec x, Vec a, Vec b) { return x < 0 ? a : b; }
+				static Vec SelectPositive(Vec x, Vec a, Vec b) { return x > 0 ? a : b; }
+				static unsigned NegativeMask(Vec x) { return x < 0 ? 1 : 0; }
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) { return bits & 1 ? a : b; }
+			};
+
+#ifdef CONVNET_SSE2
+			// SSE2 has no blend instruction, selection is done with bit masks.
+			struct SSE2Float {
+				typedef float Scalar;
+				typedef __m128 Vec;
+				static const int kWidth = 4;
+				static Vec Load(const float* p) { return _mm_loadu_ps(p); }
+				static void Store(float* p, Vec v) { _mm_storeu_ps(p, v); }
+				static Vec Set1(float value) { return _mm_set1_ps(value); }
+				static Vec LoadU8(const unsigned char* p) {
+					int bytes;
+					std::memcpy(&bytes, p, sizeof(bytes));
+					const __m128i zero = _mm_setzero_si128();
+					__m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+					return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+				}
+				// SSE2 has no byte shuffle, the pixels are converted as they are
+				// (r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3) and then transposed.
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					const Vec a = LoadU8(p), b = LoadU8(p + 4), c = LoadU8(p + 8);
+					const Vec rgbr = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2));
+					const Vec gbgb = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+					const Vec rggb = _mm_shuffle_ps(b, c, _MM_SHUFFLE(3, 2, 3, 2));
+					c0 = _mm_shuffle_ps(a, rgbr, _MM_SHUFFLE(3, 0, 3, 0));
+					c1 = _mm_shuffle_ps(gbgb, rggb, _MM_SHUFFLE(2, 1, 2, 0));
+					c2 = _mm_shuffle_ps(gbgb, c, _MM_SHUFFLE(3, 0, 3, 1));
+				}
+				static Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm_div_ps(a, b); }
+				static Vec Select(Vec mask, Vec a, Vec b) {
+					return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+				}
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return Select(_mm_cmplt_ps(x, _mm_setzero_ps()), a, b);
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return Select(_mm_cmpgt_ps(x, _mm_setzero_ps()), a, b);
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm_movemask_ps(_mm_cmplt_ps(x, _mm_setzero_ps()));
+				}
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+					const __m128i set = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+					return Select(_mm_castsi128_ps(_mm_cmpeq_epi32(set, lanes)), a, b);
+				}
+			};
+
+			struct SSE2Double {
+				typedef double Scalar;
+				typedef __m128d Vec;
+				static const int kWidth = 2;
+				static Vec Load(const double* p) { return _mm_loadu_pd(p); }
+				static void Store(double* p, Vec v) { _mm_storeu_pd(p, v); }
+				static Vec Set1(double value) { return _mm_set1_pd(value); }
+				static Vec LoadU8(const unsigned char* p) { return _mm_set_pd(p[1], p[0]); }
+				// (r0 g0 | b0 r1 | g1 b1) transposed.
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					const Vec a = LoadU8(p), b = LoadU8(p + 2), c = LoadU8(p + 4);
+					c0 = _mm_shuffle_pd(a, b, 2);
+					c1 = _mm_shuffle_pd(a, c, 1);
+					c2 = _mm_shuffle_pd(b, c, 2);
+				}
+				static Vec Add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+				static Vec Select(Vec mask, Vec a, Vec b) {
+					return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+				}
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return Select(_mm_cmplt_pd(x, _mm_setzero_pd()), a, b);
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return Select(_mm_cmpgt_pd(x, _mm_setzero_pd()), a, b);
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm_movemask_pd(_mm_cmplt_pd(x, _mm_setzero_pd()));
+				}
+				// Both halves of a 64-bit lane test the bit of the lane.
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					const __m128i lanes = _mm_setr_epi32(1, 1, 2, 2);
+					const __m128i set = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+					return Select(_mm_castsi128_pd(_mm_cmpeq_epi32(set, lanes)), a, b);
+				}
+			};
+#endif
+
+			// CPU features, queried with the cpuid instruction.
+			struct CpuFeatures {
+				bool sse2, avx2, avx512f;
+			};
+
+			CpuFeatures QueryCpuFeatures() {
+				CpuFeatures features = { false, false, false };
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+				int info[4];
+				__cpuid(info, 0);
+				const int max_leaf = info[0];
+
+				__cpuid(info, 1);
+				features.sse2 = (info[3] & (1 << 26)) != 0;
+				const bool osxsave = (info[2] & (1 << 27)) != 0;
+				const bool avx = (info[2] & (1 << 28)) != 0;
+				if (max_leaf < 7 || !osxsave || !avx)
+					return features;
+
+				// The OS must save the YMM (and ZMM) registers on context switch.
+				const unsigned long long xcr0 = _xgetbv(0);
+				const bool ymm_enabled = (xcr0 & 0x6) == 0x6;
+				const bool zmm_enabled = (xcr0 & 0xE6) == 0xE6;
+
+				__cpuidex(info, 7, 0);
+				features.avx2 = ymm_enabled && (info[1] & (1 << 5)) != 0;
+				features.avx512f = zmm_enabled && (info[1] & (1 << 16)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+				// Also checks whether the OS supports the extended registers.
+				__builtin_cpu_init();
+				features.sse2 = __builtin_cpu_supports("sse2") != 0;
+				features.avx2 = __builtin_cpu_supports("avx2") != 0;
+				features.avx512f = __builtin_cpu_supports("avx512f") != 0;
+#endif
+				return features;
+			}
+
+			struct KernelTables {
+				KernelTable<float> float_kernels;
+				KernelTable<double> double_kernels;
+				SimdLevel level;
+			};
+
+			// Selects the kernels of the given level, falls back to narrower
+			// levels if a level was not compiled in.
+			void SelectKernels(KernelTables& tables, SimdLevel level) {
+				KernelTable<float>& f = tables.float_kernels;
+				KernelTable<double>& d = tables.double_kernels;
+				// Kernels missing from an instruction set fall back to scalar code.
+				FillKernelTable<ScalarTraits<float>>(f);
+				FillKernelTable<ScalarTraits<double>>(d);
+				if (level == SimdLevel::AVX512 && InitAVX512Kernels(f, d)) {
+					tables.level = SimdLevel::AVX512;
+				} else if (level >= SimdLevel::AVX2 && InitAVX2Kernels(f, d)) {
+					tables.level = SimdLevel::AVX2;
+				} else if (level >= SimdLevel::SSE2 && InitSSE2Kernels(f, d)) {
+					tables.level = SimdLevel::SSE2;
+				} else {
+					tables.level = SimdLevel::Scalar;
+				}
+			}
+
+			// The tables are created on first use, so tensors of other
+			// translation units can be used during static initialization too.
+			KernelTables& Tables() {
+				static KernelTables tables = [] {
+					KernelTables t;
+					SelectKernels(t, DetectSimdLevel());
+					return t;
+				}();
+
+				return tables;
+			}
+
+			// Runs an element-wise kernel on chunks of the arrays, in parallel
+			// on the default thread pool.
+			template<typename F>
+			void ParallelKernel(int n, const F& kernel) {
+				ParallelFor(0, n, kParallelGrain, kernel);
+			}
+
+			// Same for kernels with a bit mask, the ranges start at word
+			// boundaries (multiples of 32 elements).
+			template<typename F>
+			void ParallelMaskKernel(int n, const F& kernel) {
+				ParallelFor(0, (n + 31) / 32, kParallelGrain / 32, [&](int first, int last) {
+					kernel(first * 32, std::min(n, last * 32));
+				});
+			}
+
+			// Detects the CPU features at startup, before main is entered.
+			const SimdLevel startup_level = GetSimdLevel();
+		}
+
+		bool InitSSE2Kernels(KernelTable<float>& f, KernelTable<double>& d) {
+#ifdef CONVNET_SSE2
+			FillKernelTable<SSE2Float>(f);
+			FillKernelTable<SSE2Double>(d);
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		SimdLevel DetectSimdLevel() {
+			static const CpuFeatures features = QueryCpuFeatures();
+			if (features.avx512f)
+				return SimdLevel::AVX512;
+			if (features.avx2)
+				return SimdLevel::AVX2;
+			if (features.sse2)
+				return SimdLevel::SSE2;
+
+			return SimdLevel::Scalar;
+		}
+
+		SimdLevel GetSimdLevel() {
+			return Tables().level;
+		}
+
+		void SetSimdLevel(SimdLevel level) {
+			SimdLevel detected = DetectSimdLevel();
+			SelectKernels(Tables(), level < detected ? level : detected);
+		}
+
+		const char* SimdLevelName(SimdLevel level) {
+			switch (level) {
+			case SimdLevel::SSE2:	return "SSE2";
+			case SimdLevel::AVX2:	return "AVX2";
+			case SimdLevel::AVX512:	return "AVX-512";
+			default:				return "scalar";
+			}
+		}
+
+		// Runtime dispatched kernels. Large arrays are split into chunks that
+		// are processed by the thread pool.
+		template<> void Add<float>(const float* a, const float* b, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.add(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void Add<double>(const double* a, const double* b, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.add(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void Sub<float>(const float* a, const float* b, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.sub(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void Sub<double>(const double* a, const double* b, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.sub(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void Mul<float>(const float* a, const float* b, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.mul(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void Mul<double>(const double* a, const double* b, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.mul(a + first, b + first, out + first, last - first);
+			});
+		}
+
+		template<> void AddScalar<float>(const float* x, float scalar, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.add_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void AddScalar<double>(const double* x, double scalar, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.add_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void MulScalar<float>(const float* x, float scalar, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.mul_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void MulScalar<double>(const double* x, double scalar, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.mul_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void DivScalar<float>(const float* x, float scalar, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.div_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void DivScalar<double>(const double* x, double scalar, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.div_scalar(x + first, scalar, out + first, last - first);
+			});
+		}
+
+		template<> void Axpy<float>(float alpha, const float* x, float* y, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.axpy(alpha, x + first, y + first, last - first);
+			});
+		}
+
+		template<> void Axpy<double>(double alpha, const double* x, double* y, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.axpy(alpha, x + first, y + first, last - first);
+			});
+		}
+
+		template<> void Axpby<float>(float alpha, const float* x, float beta, float* y, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.axpby(alpha, x + first, beta, y + first, last - first);
+			});
+		}
+
+		template<> void Axpby<double>(double alpha, const double* x, double beta, double* y, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.axpby(alpha, x + first, beta, y + first, last - first);
+			});
+		}
+
+		template<> float Sum<float>(const float* x, int n) {
+			// Chunks are summed separately, then their sums are added.
+			return ParallelReduce(0, n, kParallelGrain, float(0), [&](int first, int last) {
+				return Tables().float_kernels.sum(x + first, last - first);
+			}, [](float a, float b) { return a + b; });
+		}
+
+		template<> double Sum<double>(const double* x, int n) {
+			// Chunks are summed separately, then their sums are added.
+			return ParallelReduce(0, n, kParallelGrain, double(0), [&](int first, int last) {
+				return Tables().double_kernels.sum(x + first, last - first);
+			}, [](double a, double b) { return a + b; });
+		}
+
+		template<> float Dot<float>(const float* a, const float* b, int n) {
+			return ParallelReduce(0, n, kParallelGrain, float(0), [&](int first, int last) {
+				return Tables().float_kernels.dot(a + first, b + first, last - first);
+			}, [](float x, float y) { return x + y; });
+		}
+
+		template<> double Dot<double>(const double* a, const double* b, int n) {
+			return ParallelReduce(0, n, kParallelGrain, double(0), [&](int first, int last) {
+				return Tables().double_kernels.dot(a + first, b + first, last - first);
+			}, [](double x, double y) { return x + y; });
+		}
+
+		template<> void Sign<float>(const float* x, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.sign(x + first, out + first, last - first);
+			});
+		}
+
+		template<> void Sign<double>(const double* x, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.sign(x + first, out + first, last - first);
+			});
+		}
+
+		template<> void Fill<float>(float* out, float value, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.fill(out + first, value, last - first);
+			});
+		}
+
+		template<> void Fill<double>(double* out, double value, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.fill(out + first, value, last - first);
+			});
+		}
+
+		template<> void LeakyRelu<float>(const float* x, float slope, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.leaky_relu(x + first, slope, out + first, last - first);
+			});
+		}
+
+		template<> void LeakyRelu<double>(const double* x, double slope, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.leaky_relu(x + first, slope, out + first, last - first);
+			});
+		}
+
+		template<> void LeakyReluBackward<float>(const float* x, const float* grad_output, float slope,
+												 float* grad_input, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.leaky_relu_backward(x + first, grad_output + first, slope, grad_input + first, last - first);
+			});
+		}
+
+		template<> void LeakyReluBackward<double>(const double* x, const double* grad_output, double slope,
+												  double* grad_input, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.leaky_relu_backward(x + first, grad_output + first, slope, grad_input + first, last - first);
+			});
+		}
+
+		template<> void LeakyReluMask<float>(const float* x, float slope, float* out, unsigned* mask, int n) {
+			ParallelMaskKernel(n, [&](int first, int last) {
+				Tables().float_kernels.leaky_relu_mask(x + first, slope, out + first, mask + first / 32, last - first);
+			});
+		}
+
+		template<> void LeakyReluMask<double>(const double* x, double slope, double* out, unsigned* mask, int n) {
+			ParallelMaskKernel(n, [&](int first, int last) {
+				Tables().double_kernels.leaky_relu_mask(x + first, slope, out + first, mask + first / 32, last - first);
+			});
+		}
+
+		template<> void LeakyReluMaskBackward<float>(const unsigned* mask, const float* grad_output, float slope,
+													 float* grad_input, int n) {
+			ParallelMaskKernel(n, [&](int first, int last) {
+				Tables().float_kernels.leaky_relu_mask_backward(mask + first / 32, grad_output + first, slope, grad_input + first, last - first);
+			});
+		}
+
+		template<> void LeakyReluMaskBackward<double>(const unsigned* mask, const double* grad_output, double slope,
+													  double* grad_input, int n) {
+			ParallelMaskKernel(n, [&](int first, int last) {
+				Tables().double_kernels.leaky_relu_mask_backward(mask + first / 32, grad_output + first, slope, grad_input + first, last - first);
+			});
+		}
+
+		template<> void BiasLeakyRelu<float>(const float* x, float bias, float slope, float* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.bias_leaky_relu(x + first, bias, slope, out + first, last - first);
+			});
+		}
+
+		template<> void BiasLeakyRelu<double>(const double* x, double bias, double slope, double* out, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.bias_leaky_relu(x + first, bias, slope, out + first, last - first);
+			});
+		}
+
+		template<> void NesterovStep<float>(const float* grad, float lr, float mu, float* x, float* v, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.nesterov_step(grad + first, lr, mu, x + first, v + first, last - first);
+			});
+		}
+
+		template<> void NesterovStep<double>(const double* grad, double lr, double mu, double* x, double* v, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.nesterov_step(grad + first, lr, mu, x + first, v + first, last - first);
+			});
+		}
+
+		template<> void DeinterleaveU8<float>(const unsigned char* src, int channels, float divisor,
+											  float* out, int plane_stride, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().float_kernels.deinterleave_u8(src + first * channels, channels, divisor, out + first, plane_stride, last - first);
+			});
+		}
+
+		template<> void DeinterleaveU8<double>(const unsigned char* src, int channels, double divisor,
+											   double* out, int plane_stride, int n) {
+			ParallelKernel(n, [&](int first, int last) {
+				Tables().double_kernels.deinterleave_u8(src + first * channels, channels, divisor, out + first, plane_stride, last - first);
+			});
+		}
+
+		template<> void GemmKernel<float>(int kc, const float* a, const float* b, float* c, int ldc,
+										  int mr, int nr, bool accumulate) {
+			Tables().float_kernels.gemm_kernel(kc, a, b, c, ldc, mr, nr, accumulate);
+		}
+
+		template<> void GemmKernel<double>(int kc, const double* a, const double* b, double* c, int ldc,
+										   int mr, int nr, bool accumulate) {
+			Tables().double_kernels.gemm_kernel(kc, a, b, c, ldc, mr, nr, accumulate);
+		}
+
+		template<> void GemvKernel<float>(int k, const float* x, const float* b, float* y, int nr,
+										  bool accumulate) {
+			Tables().float_kernels.gemv_kernel(k, x, b, y, nr, accumulate);
+		}
+
+		template<> void GemvKernel<double>(int k, const double* x, const double* b, double* y, int nr,
+										   bool accumulate) {
+			Tables().double_kernels.gemv_kernel(k, x, b, y, nr, accumulate);
+		}
+	}
+}
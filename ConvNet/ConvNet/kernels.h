@@ -0,0 +1,276 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include "gemm.h"
+
+namespace convnet_core {
+	// Element-wise kernels and reductions on unrolled arrays, used by Tensor3D
+	// and the activation layers.
+	// The float and double versions are vectorized (SSE2, AVX2 or AVX-512) and
+	// the widest instruction set supported by the CPU is selected at startup.
+	// A scalar fallback is always available, so the same binary runs on any
+	// x86 CPU (and on other architectures). Other element types use the
+	// generic scalar definitions below.
+	//
+	// Element-wise kernels allow the output to be the same array as an input
+	// (in-place operation), but not a partially overlapping one.
+	namespace kernels {
+		enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+		// Widest instruction set supported by both the CPU and the build.
+		SimdLevel DetectSimdLevel();
+		// Instruction set used by the kernels.
+		SimdLevel GetSimdLevel();
+		// Forces a narrower instruction set (e.g. for testing). Levels above
+		// the detected one are clamped. Not thread-safe.
+		void SetSimdLevel(SimdLevel level);
+		const char* SimdLevelName(SimdLevel level);
+
+		// out = a + b
+		template<typename T>
+		void Add(const T* a, const T* b, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = a[i] + b[i];
+		}
+
+		// out = a - b
+		template<typename T>
+		void Sub(const T* a, const T* b, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = a[i] - b[i];
+		}
+
+		// out = a * b
+		template<typename T>
+		void Mul(const T* a, const T* b, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = a[i] * b[i];
+		}
+
+		// out = x + scalar
+		template<typename T>
+		void AddScalar(const T* x, T scalar, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = x[i] + scalar;
+		}
+
+		// out = x * scalar
+		template<typename T>
+		void MulScalar(const T* x, T scalar, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = x[i] * scalar;
+		}
+
+		// out = x / scalar
+		template<typename T>
+		void DivScalar(const T* x, T scalar, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = x[i] / scalar;
+		}
+
+		// y = alpha * x + y
+		template<typename T>
+		void Axpy(T alpha, const T* x, T* y, int n) {
+			for (int i = 0; i < n; ++i)
+				y[i] += alpha * x[i];
+		}
+
+		// y = alpha * x + beta * y
+		template<typename T>
+		void Axpby(T alpha, const T* x, T beta, T* y, int n) {
+			for (int i = 0; i < n; ++i)
+				y[i] = alpha * x[i] + beta * y[i];
+		}
+
+		// Sum of the elements. Vectorized versions use a different summation
+		// order, so the result may differ in the last bits.
+		template<typename T>
+		T Sum(const T* x, int n) {
+			T sum = 0;
+			for (int i = 0; i < n; ++i)
+				sum += x[i];
+
+			return sum;
+		}
+
+		// Dot product of a and b, in the summation order of Sum.
+		template<typename T>
+		T Dot(const T* a, const T* b, int n) {
+			T dot = 0;
+			for (int i = 0; i < n; ++i)
+				dot += a[i] * b[i];
+
+			return dot;
+		}
+
+		// out = 1 if x > 0, -1 if x < 0, x otherwise.
+		template<typename T>
+		void Sign(const T* x, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = x[i] > 0 ? T(1) : (x[i] < 0 ? T(-1) : x[i]);
+		}
+
+		// out = value
+		template<typename T>
+		void Fill(T* out, T value, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = value;
+		}
+
+		// out = x < 0 ? slope * x : x
+		template<typename T>
+		void LeakyRelu(const T* x, T slope, T* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = x[i] < 0 ? slope * x[i] : x[i];
+		}
+
+		// grad_input = x < 0 ? slope * grad_output : grad_output
+		template<typename T>
+		void LeakyReluBackward(const T* x, const T* grad_output, T slope, T* grad_input, int n) {
+			for (int i = 0; i < n; ++i)
+				grad_input[i] = x[i] < 0 ? slope * grad_output[i] : grad_output[i];
+		}
+
+		// Leaky ReLU that also records the signs of the input in a bit mask:
+		// bit i % 32 of mask[i / 32] is set if x[i] < 0. out may be x, so the
+		// activation can be computed in place.
+		// @param mask:	(n + 31) / 32 words
+		template<typename T>
+		void LeakyReluMask(const T* x, T slope, T* out, unsigned* mask, int n) {
+			for (int i = 0; i < n; ++i) {
+				if (i % 32 == 0)
+					mask[i / 32] = 0;
+				const bool negative = x[i] < 0;
+				mask[i / 32] |= static_cast<unsigned>(negative) << (i % 32);
+				out[i] = negative ? slope * x[i] : x[i];
+			}
+		}
+
+		// grad_input = negative ? slope * grad_output : grad_output, where the
+		// signs are given by the mask of LeakyReluMask. grad_input may be
+		// grad_output.
+		template<typename T>
+		void LeakyReluMaskBackward(const unsigned* mask, const T* grad_output, T slope,
+								   T* grad_input, int n) {
+			for (int i = 0; i < n; ++i)
+				grad_input[i] = (mask[i / 32] >> (i % 32)) & 1 ? slope * grad_output[i] : grad_output[i];
+		}
+
+		// out = y < 0 ? slope * y : y, where y = x + bias. The epilogue of a
+		// convolution, a slope of 1 adds the bias only.
+		template<typename T>
+		void BiasLeakyRelu(const T* x, T bias, T slope, T* out, int n) {
+			for (int i = 0; i < n; ++i) {
+				const T y = x[i] + bias;
+				out[i] = y < 0 ? slope * y : y;
+			}
+		}
+
+		// Nesterov momentum step of parameters x with velocities v, in one pass:
+		// x += mu^2 * v - (1 + mu) * lr * grad, then v = mu * v - lr * grad.
+		template<typename T>
+		void NesterovStep(const T* grad, T lr, T mu, T* x, T* v, int n) {
+			const T mu2 = mu * mu;
+			const T scale = (1 + mu) * lr;
+			for (int i = 0; i < n; ++i) {
+				x[i] = x[i] + (v[i] * mu2 - grad[i] * scale);
+				v[i] = v[i] * mu - grad[i] * lr;
+			}
+		}
+
+		// Converts 8-bit pixels to the element type and divides them by divisor.
+		// The channels of the interleaved source are separated into planes, in
+		// a single pass over the source.
+		// @param src:			n pixels of channels interleaved bytes
+		// @param channels:		number of channels of a pixel
+		// @param divisor:		e.g. 255 to normalize between (0,1)
+		// @param out:			first plane, out[k * plane_stride + i] = src[i * channels + k] * (1 / divisor)
+		// @param plane_stride:	distance between the planes of the output
+		template<typename T>
+		void DeinterleaveU8(const unsigned char* src, int channels, T divisor,
+							T* out, int plane_stride, int n) {
+			const T scale = T(1) / divisor;
+			for (int i = 0; i < n; ++i)
+				for (int k = 0; k < channels; ++k)
+					out[k * plane_stride + i] = src[i * channels + k] * scale;
+		}
+
+		// Microkernel of Gemm (see gemm.cpp). Multiplies a packed panel of
+		// kGemmMR rows of A with a packed panel of kGemmNR columns of B, and
+		// stores (or adds) the valid mr x nr part of the product into C.
+		template<typename T>
+		void GemmKernel(int kc, const T* a, const T* b, T* c, int ldc,
+						int mr, int nr, bool accumulate) {
+			T acc[kGemmMR][kGemmNR] = {};
+			for (int p = 0; p < kc; ++p)
+				for (int r = 0; r < kGemmMR; ++r)
+					for (int s = 0; s < kGemmNR; ++s)
+						acc[r][s] += a[p * kGemmMR + r] * b[p * kGemmNR + s];
+
+			for (int r = 0; r < mr; ++r)
+				for (int s = 0; s < nr; ++s)
+					c[r * ldc + s] = accumulate ? c[r * ldc + s] + acc[r][s] : acc[r][s];
+		}
+
+		// Microkernel of Gemv (see gemm.cpp). Multiplies k elements of x with
+		// a packed panel of kGemmNR columns of B, and stores (or adds) the
+		// valid nr elements of the product into y.
+		template<typename T>
+		void GemvKernel(int k, const T* x, const T* b, T* y, int nr, bool accumulate) {
+			T acc[kGemmNR] = {};
+			for (int p = 0; p < k; ++p)
+				for (int s = 0; s < kGemmNR; ++s)
+					acc[s] += x[p] * b[p * kGemmNR + s];
+
+			for (int s = 0; s < nr; ++s)
+				y[s] = accumulate ? y[s] + acc[s] : acc[s];
+		}
+
+		// Runtime dispatched versions, defined in kernels.cpp. Arrays longer
+		// than kParallelGrain are processed in parallel (see parallel.h).
+		template<> void Add<float>(const float* a, const float* b, float* out, int n);
+		template<> void Add<double>(const double* a, const double* b, double* out, int n);
+		template<> void Sub<float>(const float* a, const float* b, float* out, int n);
+		template<> void Sub<double>(const double* a, const double* b, double* out, int n);
+		template<> void Mul<float>(const float* a, const float* b, float* out, int n);
+		template<> void Mul<double>(const double* a, const double* b, double* out, int n);
+		template<> void AddScalar<float>(const float* x, float scalar, float* out, int n);
+		template<> void AddScalar<double>(const double* x, double scalar, double* out, int n);
+		template<> void MulScalar<float>(const float* x, float scalar, float* out, int n);
+		template<> void MulScalar<double>(const double* x, double scalar, double* out, int n);
+		template<> void DivScalar<float>(const float* x, float scalar, float* out, int n);
+		template<> void DivScalar<double>(const double* x, double scalar, double* out, int n);
+		template<> void Axpy<float>(float alpha, const float* x, float* y, int n);
+		template<> void Axpy<double>(double alpha, const double* x, double* y, int n);
+		template<> void Axpby<float>(float alpha, const float* x, float beta, float* y, int n);
+		template<> void Axpby<double>(double alpha, const double* x, double beta, double* y, int n);
+		template<> float Sum<float>(const float* x, int n);
+		template<> double Sum<double>(const double* x, int n);
+		template<> float Dot<float>(const float* a, const float* b, int n);
+		template<> double Dot<double>(const double* a, const double* b, int n);
+		template<> void Sign<float>(const float* x, float* out, int n);
+		template<> void Sign<double>(const double* x, double* out, int n);
+		template<> void Fill<float>(float* out, float value, int n);
+		template<> void Fill<double>(double* out, double value, int n);
+		template<> void LeakyRelu<float>(const float* x, float slope, float* out, int n);
+		template<> void LeakyRelu<double>(const double* x, double slope, double* out, int n);
+		template<> void LeakyReluBackward<float>(const float* x, const float* grad_output, float slope, float* grad_input, int n);
+		template<> void LeakyReluBackward<double>(const double* x, const double* grad_output, double slope, double* grad_input, int n);
+		template<> void LeakyReluMask<float>(const float* x, float slope, float* out, unsigned* mask, int n);
+		template<> void LeakyReluMask<double>(const double* x, double slope, double* out, unsigned* mask, int n);
+		template<> void LeakyReluMaskBackward<float>(const unsigned* mask, const float* grad_output, float slope, float* grad_input, int n);
+		template<> void LeakyReluMaskBackward<double>(const unsigned* mask, const double* grad_output, double slope, double* grad_input, int n);
+		template<> void BiasLeakyRelu<float>(const float* x, float bias, float slope, float* out, int n);
+		template<> void BiasLeakyRelu<double>(const double* x, double bias, double slope, double* out, int n);
+		template<> void NesterovStep<float>(const float* grad, float lr, float mu, float* x, float* v, int n);
+		template<> void NesterovStep<double>(const double* grad, double lr, double mu, double* x, double* v, int n);
+		template<> void DeinterleaveU8<float>(const unsigned char* src, int channels, float divisor, float* out, int plane_stride, int n);
+		template<> void DeinterleaveU8<double>(const unsigned char* src, int channels, double divisor, double* out, int plane_stride, int n);
+		template<> void GemmKernel<float>(int kc, const float* a, const float* b, float* c, int ldc, int mr, int nr, bool accumulate);
+		template<> void GemmKernel<double>(int kc, const double* a, const double* b, double* c, int ldc, int mr, int nr, bool accumulate);
+		template<> void GemvKernel<float>(int k, const float* x, const float* b, float* y, int nr, bool accumulate);
+		template<> void GemvKernel<double>(int k, const double* x, const double* b, double* y, int nr, bool accumulate);
+	}
+}
@@ -0,0 +1,127 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+// AVX2 kernels. This file is compiled with AVX2 code generation enabled
+// (/arch:AVX2 or -mavx2), the kernels are only called if the CPU supports it.
+
+#include "kernelsImpl.h"
+
+#ifdef __AVX2__
+#include <cstring>
+#include <immintrin.h>
+
+namespace convnet_core {
+	namespace kernels {
+		namespace {
+			// Separates the channels of the 4 pixels of three interleaved bytes in
+			// the first 12 bytes of pixels. Bytes 0-3, 4-7 and 8-11 of the result
+			// are the channels.
+			__m128i Deinterleave4x3(__m128i pixels) {
+				return _mm_shuffle_epi8(pixels, _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1));
+			}
+
+			// The channels of 8 pixels (24 bytes) in the first 8 bytes of c0, c1, c2.
+			void Deinterleave8x3(const unsigned char* p, __m128i& c0, __m128i& c1, __m128i& c2) {
+				const __m128i lo = Deinterleave4x3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+				const __m128i hi = Deinterleave4x3(
+					_mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), 4));
+				c0 = _mm_unpacklo_epi32(lo, hi);
+				c1 = _mm_srli_si128(c0, 8);
+				c2 = _mm_unpackhi_epi32(lo, hi);
+			}
+
+			struct AVX2Float {
+				typedef float Scalar;
+				typedef __m256 Vec;
+				static const int kWidth = 8;
+				static Vec Load(const float* p) { return _mm256_loadu_ps(p); }
+				static void Store(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+				static Vec Set1(float value) { return _mm256_set1_ps(value); }
+				static Vec LoadU8(const unsigned char* p) {
+					__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+					return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+				}
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					__m128i b0, b1, b2;
+					Deinterleave8x3(p, b0, b1, b2);
+					c0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b0));
+					c1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b1));
+					c2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b2));
+				}
+				static Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ));
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+					const __m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), lanes);
+					return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes)));
+				}
+			};
+
+			struct AVX2Double {
+				typedef double Scalar;
+				typedef __m256d Vec;
+				static const int kWidth = 4;
+				static Vec Load(const double* p) { return _mm256_loadu_pd(p); }
+				static void Store(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+				static Vec Set1(double value) { return _mm256_set1_pd(value); }
+				static Vec LoadU8(const unsigned char* p) {
+					int bytes;
+					std::memcpy(&bytes, p, sizeof(bytes));
+					return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+				}
+				// 12 bytes, read without crossing the end of the block.
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					int last;
+					std::memcpy(&last, p + 8, sizeof(last));
+					const __m128i pixels = _mm_insert_epi32(
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), last, 2);
+					const __m128i channels = Deinterleave4x3(pixels);
+					c0 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(channels));
+					c1 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 4)));
+					c2 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 8)));
+				}
+				static Vec Add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ));
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ));
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm256_movemask_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ));
+				}
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					const __m256i lanes = _mm256_setr_epi64x(1, 2, 4, 8);
+					const __m256i set = _mm256_and_si256(_mm256_set1_epi64x(bits), lanes);
+					return _mm256_blendv_pd(b, a, _mm256_castsi256_pd(_mm256_cmpeq_epi64(set, lanes)));
+				}
+			};
+		}
+
+		bool InitAVX2Kernels(KernelTable<float>& f, KernelTable<double>& d) {
+			FillKernelTable<AVX2Float>(f);
+			FillKernelTable<AVX2Double>(d);
+			return true;
+		}
+	}
+}
+#else
+// The compiler does not generate AVX2 code for this file.
+bool convnet_core::kernels::InitAVX2Kernels(KernelTable<float>&, KernelTable<double>&) {
+	return false;
+}
+#endif
@@ -0,0 +1,129 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+// AVX-512 kernels. This file is compiled with AVX-512 code generation enabled
+// (/arch:AVX512 or -mavx512f), the kernels are only called if the CPU supports it.
+// Older compilers without AVX-512 support build the fallback only.
+
+#include "kernelsImpl.h"
+
+#ifdef __AVX512F__
+#include <immintrin.h>
+
+namespace convnet_core {
+	namespace kernels {
+		namespace {
+			// Separates the channels of the 4 pixels of three interleaved bytes in
+			// the first 12 bytes of pixels. Bytes 0-3, 4-7 and 8-11 of the result
+			// are the channels.
+			__m128i Deinterleave4x3(__m128i pixels) {
+				return _mm_shuffle_epi8(pixels, _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1));
+			}
+
+			// The channels of 8 pixels (24 bytes) in the first 8 bytes of c0, c1, c2.
+			void Deinterleave8x3(const unsigned char* p, __m128i& c0, __m128i& c1, __m128i& c2) {
+				const __m128i lo = Deinterleave4x3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+				const __m128i hi = Deinterleave4x3(
+					_mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), 4));
+				c0 = _mm_unpacklo_epi32(lo, hi);
+				c1 = _mm_srli_si128(c0, 8);
+				c2 = _mm_unpackhi_epi32(lo, hi);
+			}
+
+			// Comparisons produce mask registers, selection is a masked blend.
+			struct AVX512Float {
+				typedef float Scalar;
+				typedef __m512 Vec;
+				static const int kWidth = 16;
+				static Vec Load(const float* p) { return _mm512_loadu_ps(p); }
+				static void Store(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+				static Vec Set1(float value) { return _mm512_set1_ps(value); }
+				static Vec LoadU8(const unsigned char* p) {
+					__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+					return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+				}
+				// Four blocks of 4 pixels, the last one read from the end of the
+				// 48 bytes.
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					const __m128i* q = reinterpret_cast<const __m128i*>(p);
+					const __m128i s0 = Deinterleave4x3(_mm_loadu_si128(q));
+					const __m128i s1 = Deinterleave4x3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)));
+					const __m128i s2 = Deinterleave4x3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 24)));
+					const __m128i s3 = Deinterleave4x3(_mm_srli_si128(_mm_loadu_si128(q + 2), 4));
+					const __m128i rg01 = _mm_unpacklo_epi32(s0, s1), rg23 = _mm_unpacklo_epi32(s2, s3);
+					const __m128i b01 = _mm_unpackhi_epi32(s0, s1), b23 = _mm_unpackhi_epi32(s2, s3);
+					c0 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_unpacklo_epi64(rg01, rg23)));
+					c1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_unpackhi_epi64(rg01, rg23)));
+					c2 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_unpacklo_epi64(b01, b23)));
+				}
+				static Vec Add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm512_div_ps(a, b); }
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ), b, a);
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), b, a);
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ);
+				}
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					return _mm512_mask_blend_ps(static_cast<__mmask16>(bits), b, a);
+				}
+			};
+
+			struct AVX512Double {
+				typedef double Scalar;
+				typedef __m512d Vec;
+				static const int kWidth = 8;
+				static Vec Load(const double* p) { return _mm512_loadu_pd(p); }
+				static void Store(double* p, Vec v) { _mm512_storeu_pd(p, v); }
+				static Vec Set1(double value) { return _mm512_set1_pd(value); }
+				static Vec LoadU8(const unsigned char* p) {
+					__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+					return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(bytes));
+				}
+				static void LoadU8x3(const unsigned char* p, Vec& c0, Vec& c1, Vec& c2) {
+					__m128i b0, b1, b2;
+					Deinterleave8x3(p, b0, b1, b2);
+					c0 = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(b0));
+					c1 = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(b1));
+					c2 = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(b2));
+				}
+				static Vec Add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+				static Vec Sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+				static Vec Mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+				static Vec Div(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+				static Vec SelectNegative(Vec x, Vec a, Vec b) {
+					return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_LT_OQ), b, a);
+				}
+				static Vec SelectPositive(Vec x, Vec a, Vec b) {
+					return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_GT_OQ), b, a);
+				}
+				static unsigned NegativeMask(Vec x) {
+					return _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_LT_OQ);
+				}
+				static Vec SelectBits(unsigned bits, Vec a, Vec b) {
+					return _mm512_mask_blend_pd(static_cast<__mmask8>(bits), b, a);
+				}
+			};
+		}
+
+		bool InitAVX512Kernels(KernelTable<float>& f, KernelTable<double>& d) {
+			// Kernels that do not fit the 512-bit registers (the float GEMM
+			// microkernel) keep their AVX2 version.
+			InitAVX2Kernels(f, d);
+			FillKernelTable<AVX512Float>(f);
+			FillKernelTable<AVX512Double>(d);
+			return true;
+		}
+	}
+}
+#else
+// The compiler does not generate AVX-512 code for this file.
+bool convnet_core::kernels::InitAVX512Kernels(KernelTable<float>&, KernelTable<double>&) {
+	return false;
+}
+#endif
@@ -0,0 +1,508 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+// Private header of the kernel layer (see kernels.h), included only by the
+// kernels*.cpp translation units.
+
+#include "gemm.h"
+
+// Multiplications and additions are not contracted into fused multiply-adds
+// (which AVX2 and AVX-512 code generation would do), so the vector body, the
+// scalar remainder and every instruction set round the same way.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+
+namespace convnet_core {
+	namespace kernels {
+		// Function table of one instruction set and element type.
+		template<typename T>
+		struct KernelTable {
+			void (*add)(const T* a, const T* b, T* out, int n);
+			void (*sub)(const T* a, const T* b, T* out, int n);
+			void (*mul)(const T* a, const T* b, T* out, int n);
+			void (*add_scalar)(const T* x, T scalar, T* out, int n);
+			void (*mul_scalar)(const T* x, T scalar, T* out, int n);
+			void (*div_scalar)(const T* x, T scalar, T* out, int n);
+			void (*axpy)(T alpha, const T* x, T* y, int n);
+			void (*axpby)(T alpha, const T* x, T beta, T* y, int n);
+			T (*sum)(const T* x, int n);
+			T (*dot)(const T* a, const T* b, int n);
+			void (*sign)(const T* x, T* out, int n);
+			void (*fill)(T* out, T value, int n);
+			void (*leaky_relu)(const T* x, T slope, T* out, int n);
+			void (*leaky_relu_backward)(const T* x, const T* grad_output, T slope, T* grad_input, int n);
+			void (*leaky_relu_mask)(const T* x, T slope, T* out, unsigned* mask, int n);
+			void (*leaky_relu_mask_backward)(const unsigned* mask, const T* grad_output, T slope, T* grad_input, int n);
+			void (*bias_leaky_relu)(const T* x, T bias, T slope, T* out, int n);
+			void (*nesterov_step)(const T* grad, T lr, T mu, T* x, T* v, int n);
+			void (*deinterleave_u8)(const unsigned char* src, int channels, T divisor, T* out, int plane_stride, int n);
+			void (*gemm_kernel)(int kc, const T* a, const T* b, T* c, int ldc, int mr, int nr, bool accumulate);
+			void (*gemv_kernel)(int k, const T* x, const T* b, T* y, int nr, bool accumulate);
+		};
+
+		// Fill the tables with the kernels of an instruction set. Return false
+		// if the instruction set was not compiled in.
+		bool InitSSE2Kernels(KernelTable<float>& f, KernelTable<double>& d);
+		bool InitAVX2Kernels(KernelTable<float>& f, KernelTable<double>& d);
+		bool InitAVX512Kernels(KernelTable<float>& f, KernelTable<double>& d);
+
+		// The generic kernels are instantiated separately in every translation
+		// unit (each compiled for a different instruction set), so they must
+		// have internal linkage.
+		namespace {
+			// Vector kernels on top of a traits class V, which provides:
+			//	V::Scalar, V::Vec, V::kWidth:	element type, register type and lane count
+			//	Load, Store, Set1:				unaligned memory access and broadcast
+			//	LoadU8:							loads kWidth bytes, converted to V::Scalar
+			//	LoadU8x3(p, c0, c1, c2):		loads kWidth pixels of three interleaved
+			//									bytes, a register per channel
+			//	Add, Sub, Mul, Div:				lane-wise arithmetic
+			//	SelectNegative(x, a, b):		x < 0 ? a : b
+			//	SelectPositive(x, a, b):		x > 0 ? a : b
+			//	NegativeMask(x):				bit k is set if lane k of x < 0
+			//	SelectBits(bits, a, b):			lane k is bit k of bits ? a : b
+			// The remainder of the arrays is processed with scalar code.
+			template<typename V>
+			void VecAdd(const typename V::Scalar* a, const typename V::Scalar* b,
+						typename V::Scalar* out, int n) {
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Add(V::Load(a + i), V::Load(b + i)));
+				for (; i < n; ++i)
+					out[i] = a[i] + b[i];
+			}
+
+			template<typename V>
+			void VecSub(const typename V::Scalar* a, const typename V::Scalar* b,
+						typename V::Scalar* out, int n) {
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Sub(V::Load(a + i), V::Load(b + i)));
+				for (; i < n; ++i)
+					out[i] = a[i] - b[i];
+			}
+
+			template<typename V>
+			void VecMul(const typename V::Scalar* a, const typename V::Scalar* b,
+						typename V::Scalar* out, int n) {
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Mul(V::Load(a + i), V::Load(b + i)));
+				for (; i < n; ++i)
+					out[i] = a[i] * b[i];
+			}
+
+			template<typename V>
+			void VecAddScalar(const typename V::Scalar* x, typename V::Scalar scalar,
+							  typename V::Scalar* out, int n) {
+				const typename V::Vec s = V::Set1(scalar);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Add(V::Load(x + i), s));
+				for (; i < n; ++i)
+					out[i] = x[i] + scalar;
+			}
+
+			template<typename V>
+			void VecMulScalar(const typename V::Scalar* x, typename V::Scalar scalar,
+							  typename V::Scalar* out, int n) {
+				const typename V::Vec s = V::Set1(scalar);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Mul(V::Load(x + i), s));
+				for (; i < n; ++i)
+					out[i] = x[i] * scalar;
+			}
+
+			template<typename V>
+			void VecDivScalar(const typename V::Scalar* x, typename V::Scalar scalar,
+							  typename V::Scalar* out, int n) {
+				const typename V::Vec s = V::Set1(scalar);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, V::Div(V::Load(x + i), s));
+				for (; i < n; ++i)
+					out[i] = x[i] / scalar;
+			}
+
+			template<typename V>
+			void VecAxpy(typename V::Scalar alpha, const typename V::Scalar* x,
+						 typename V::Scalar* y, int n) {
+				const typename V::Vec a = V::Set1(alpha);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(y + i, V::Add(V::Mul(a, V::Load(x + i)), V::Load(y + i)));
+				for (; i < n; ++i)
+					y[i] = alpha * x[i] + y[i];
+			}
+
+			template<typename V>
+			void VecAxpby(typename V::Scalar alpha, const typename V::Scalar* x,
+						  typename V::Scalar beta, typename V::Scalar* y, int n) {
+				const typename V::Vec a = V::Set1(alpha);
+				const typename V::Vec b = V::Set1(beta);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(y + i, V::Add(V::Mul(a, V::Load(x + i)), V::Mul(b, V::Load(y + i))));
+				for (; i < n; ++i)
+					y[i] = alpha * x[i] + beta * y[i];
+			}
+
+			// Uses two accumulators to hide the latency of the additions.
+			template<typename V>
+			typename V::Scalar VecSum(const typename V::Scalar* x, int n) {
+				typedef typename V::Scalar Scalar;
+				typename V::Vec acc0 = V::Set1(0);
+				typename V::Vec acc1 = V::Set1(0);
+				int i = 0;
+				for (; i + 2 * V::kWidth <= n; i += 2 * V::kWidth) {
+					acc0 = V::Add(acc0, V::Load(x + i));
+					acc1 = V::Add(acc1, V::Load(x + i + V::kWidth));
+				}
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					acc0 = V::Add(acc0, V::Load(x + i));
+
+				Scalar lanes[V::kWidth];
+				V::Store(lanes, V::Add(acc0, acc1));
+				Scalar sum = 0;
+				for (int k = 0; k < V::kWidth; ++k)
+					sum += lanes[k];
+				for (; i < n; ++i)
+					sum += x[i];
+
+				return sum;
+			}
+
+			// Same structure as VecSum.
+			template<typename V>
+			typename V::Scalar VecDot(const typename V::Scalar* a, const typename V::Scalar* b, int n) {
+				typedef typename V::Scalar Scalar;
+				typename V::Vec acc0 = V::Set1(0);
+				typename V::Vec acc1 = V::Set1(0);
+				int i = 0;
+				for (; i + 2 * V::kWidth <= n; i += 2 * V::kWidth) {
+					acc0 = V::Add(acc0, V::Mul(V::Load(a + i), V::Load(b + i)));
+					acc1 = V::Add(acc1, V::Mul(V::Load(a + i + V::kWidth), V::Load(b + i + V::kWidth)));
+				}
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					acc0 = V::Add(acc0, V::Mul(V::Load(a + i), V::Load(b + i)));
+
+				Scalar lanes[V::kWidth];
+				V::Store(lanes, V::Add(acc0, acc1));
+				Scalar dot = 0;
+				for (int k = 0; k < V::kWidth; ++k)
+					dot += lanes[k];
+				for (; i < n; ++i)
+					dot += a[i] * b[i];
+
+				return dot;
+			}
+
+			template<typename V>
+			void VecSign(const typename V::Scalar* x, typename V::Scalar* out, int n) {
+				const typename V::Vec one = V::Set1(1);
+				const typename V::Vec minus_one = V::Set1(-1);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth) {
+					typename V::Vec v = V::Load(x + i);
+					V::Store(out + i, V::SelectPositive(v, one, V::SelectNegative(v, minus_one, v)));
+				}
+				for (; i < n; ++i)
+					out[i] = x[i] > 0 ? 1 : (x[i] < 0 ? -1 : x[i]);
+			}
+
+			template<typename V>
+			void VecFill(typename V::Scalar* out, typename V::Scalar value, int n) {
+				const typename V::Vec v = V::Set1(value);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth)
+					V::Store(out + i, v);
+				for (; i < n; ++i)
+					out[i] = value;
+			}
+
+			template<typename V>
+			void VecLeakyRelu(const typename V::Scalar* x, typename V::Scalar slope,
+							  typename V::Scalar* out, int n) {
+				const typename V::Vec s = V::Set1(slope);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth) {
+					typename V::Vec v = V::Load(x + i);
+					V::Store(out + i, V::SelectNegative(v, V::Mul(s, v), v));
+				}
+				for (; i < n; ++i)
+					out[i] = x[i] < 0 ? slope * x[i] : x[i];
+			}
+
+			template<typename V>
+			void VecLeakyReluBackward(const typename V::Scalar* x, const typename V::Scalar* grad_output,
+									  typename V::Scalar slope, typename V::Scalar* grad_input, int n) {
+				const typename V::Vec s = V::Set1(slope);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth) {
+					typename V::Vec g = V::Load(grad_output + i);
+					V::Store(grad_input + i, V::SelectNegative(V::Load(x + i), V::Mul(s, g), g));
+				}
+				for (; i < n; ++i)
+					grad_input[i] = x[i] < 0 ? slope * grad_output[i] : grad_output[i];
+			}
+
+			// A word of the mask covers 32 / kWidth vectors.
+			template<typename V>
+			void VecLeakyReluMask(const typename V::Scalar* x, typename V::Scalar slope,
+								  typename V::Scalar* out, unsigned* mask, int n) {
+				const typename V::Vec s = V::Set1(slope);
+				int i = 0;
+				for (; i + 32 <= n; i += 32) {
+					unsigned bits = 0;
+					for (int k = 0; k < 32; k += V::kWidth) {
+						typename V::Vec v = V::Load(x + i + k);
+						bits |= V::NegativeMask(v) << k;
+						V::Store(out + i + k, V::SelectNegative(v, V::Mul(s, v), v));
+					}
+					mask[i / 32] = bits;
+				}
+				if (i < n) {
+					unsigned bits = 0;
+					for (int k = 0; i + k < n; ++k) {
+						const bool negative = x[i + k] < 0;
+						bits |= static_cast<unsigned>(negative) << k;
+						out[i + k] = negative ? slope * x[i + k] : x[i + k];
+					}
+					mask[i / 32] = bits;
+				}
+			}
+
+			template<typename V>
+			void VecLeakyReluMaskBackward(const unsigned* mask, const typename V::Scalar* grad_output,
+										  typename V::Scalar slope, typename V::Scalar* grad_input, int n) {
+				const typename V::Vec s = V::Set1(slope);
+				int i = 0;
+				for (; i + 32 <= n; i += 32) {
+					const unsigned bits = mask[i / 32];
+					for (int k = 0; k < 32; k += V::kWidth) {
+						typename V::Vec g = V::Load(grad_output + i + k);
+						V::Store(grad_input + i + k, V::SelectBits(bits >> k, V::Mul(s, g), g));
+					}
+				}
+				for (; i < n; ++i)
+					grad_input[i] = (mask[i / 32] >> (i % 32)) & 1 ? slope * grad_output[i] : grad_output[i];
+			}
+
+			template<typename V>
+			void VecBiasLeakyRelu(const typename V::Scalar* x, typename V::Scalar bias,
+								  typename V::Scalar slope, typename V::Scalar* out, int n) {
+				const typename V::Vec b = V::Set1(bias);
+				const typename V::Vec s = V::Set1(slope);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth) {
+					typename V::Vec y = V::Add(V::Load(x + i), b);
+					V::Store(out + i, V::SelectNegative(y, V::Mul(s, y), y));
+				}
+				for (; i < n; ++i) {
+					const typename V::Scalar y = x[i] + bias;
+					out[i] = y < 0 ? slope * y : y;
+				}
+			}
+
+			template<typename V>
+			void VecNesterovStep(const typename V::Scalar* grad, typename V::Scalar lr,
+								 typename V::Scalar mu, typename V::Scalar* x,
+								 typename V::Scalar* v, int n) {
+				typedef typename V::Scalar Scalar;
+				const Scalar mu2 = mu * mu;
+				const Scalar scale = (1 + mu) * lr;
+				const typename V::Vec m = V::Set1(mu);
+				const typename V::Vec m2 = V::Set1(mu2);
+				const typename V::Vec s = V::Set1(scale);
+				const typename V::Vec l = V::Set1(lr);
+				int i = 0;
+				for (; i + V::kWidth <= n; i += V::kWidth) {
+					const typename V::Vec g = V::Load(grad + i);
+					const typename V::Vec vel = V::Load(v + i);
+					V::Store(x + i, V::Add(V::Load(x + i), V::Sub(V::Mul(vel, m2), V::Mul(g, s))));
+					V::Store(v + i, V::Sub(V::Mul(vel, m), V::Mul(g, l)));
+				}
+				for (; i < n; ++i) {
+					x[i] = x[i] + (v[i] * mu2 - grad[i] * scale);
+					v[i] = v[i] * mu - grad[i] * lr;
+				}
+			}
+
+			// Blocks of kWidth pixels of one or three channels (grayscale and BGR
+			// images) are converted at once, the three channels are separated by
+			// shuffles in registers. Other channel counts are converted with
+			// scalar code.
+			template<typename V>
+			void VecDeinterleaveU8(const unsigned char* src, int channels, typename V::Scalar divisor,
+								   typename V::Scalar* out, int plane_stride, int n) {
+				const typename V::Scalar scale = typename V::Scalar(1) / divisor;
+				const typename V::Vec s = V::Set1(scale);
+				int i = 0;
+				if (channels == 1) {
+					for (; i + V::kWidth <= n; i += V::kWidth)
+						V::Store(out + i, V::Mul(V::LoadU8(src + i), s));
+				} else if (channels == 3) {
+					typename V::Vec c0, c1, c2;
+					for (; i + V::kWidth <= n; i += V::kWidth) {
+						V::LoadU8x3(src + 3 * i, c0, c1, c2);
+						V::Store(out + i, V::Mul(c0, s));
+						V::Store(out + plane_stride + i, V::Mul(c1, s));
+						V::Store(out + 2 * plane_stride + i, V::Mul(c2, s));
+					}
+				}
+				for (; i < n; ++i)
+					for (int k = 0; k < channels; ++k)
+						out[k * plane_stride + i] = src[i * channels + k] * scale;
+			}
+
+			// The kGemmMR x kGemmNR block of C is held in kGemmMR * kGemmNR / kWidth
+			// vector registers. Every step broadcasts the elements of a column of
+			// the A panel and multiplies them with a row of the B panel. The rows
+			// are unrolled by hand (kGemmMR is 4), so that the accumulators are
+			// not kept in memory.
+			template<typename V>
+			void VecGemmKernel(int kc, const typename V::Scalar* a, const typename V::Scalar* b,
+							   typename V::Scalar* c, int ldc, int mr, int nr, bool accumulate) {
+				static_assert(kGemmMR == 4, "the microkernel is unrolled for 4 rows");
+				typedef typename V::Scalar Scalar;
+				typedef typename V::Vec Vec;
+				const int kVecs = kGemmNR / V::kWidth;
+				Vec acc0[kVecs], acc1[kVecs], acc2[kVecs], acc3[kVecs];
+				for (int v = 0; v < kVecs; ++v)
+					acc0[v] = acc1[v] = acc2[v] = acc3[v] = V::Set1(0);
+
+				for (int p = 0; p < kc; ++p) {
+					const Vec a0 = V::Set1(a[0]);
+					const Vec a1 = V::Set1(a[1]);
+					const Vec a2 = V::Set1(a[2]);
+					const Vec a3 = V::Set1(a[3]);
+					for (int v = 0; v < kVecs; ++v) {
+						const Vec b_v = V::Load(b + v * V::kWidth);
+						acc0[v] = V::Add(acc0[v], V::Mul(a0, b_v));
+						acc1[v] = V::Add(acc1[v], V::Mul(a1, b_v));
+						acc2[v] = V::Add(acc2[v], V::Mul(a2, b_v));
+						acc3[v] = V::Add(acc3[v], V::Mul(a3, b_v));
+					}
+					a += kGemmMR;
+					b += kGemmNR;
+				}
+
+				if (mr == kGemmMR && nr == kGemmNR) {
+					Vec* rows[kGemmMR] = { acc0, acc1, acc2, acc3 };
+					for (int r = 0; r < kGemmMR; ++r) {
+						for (int v = 0; v < kVecs; ++v) {
+							Scalar* out = c + r * ldc + v * V::kWidth;
+							V::Store(out, accumulate ? V::Add(V::Load(out), rows[r][v]) : rows[r][v]);
+						}
+					}
+					return;
+				}
+
+				// Edge blocks are stored through a local buffer.
+				Scalar block[kGemmMR][kGemmNR];
+				for (int v = 0; v < kVecs; ++v) {
+					V::Store(block[0] + v * V::kWidth, acc0[v]);
+					V::Store(block[1] + v * V::kWidth, acc1[v]);
+					V::Store(block[2] + v * V::kWidth, acc2[v]);
+					V::Store(block[3] + v * V::kWidth, acc3[v]);
+				}
+				for (int r = 0; r < mr; ++r) {
+					Scalar* out = c + r * ldc;
+					if (accumulate) {
+						for (int s = 0; s < nr; ++s)
+							out[s] += block[r][s];
+					} else {
+						for (int s = 0; s < nr; ++s)
+							out[s] = block[r][s];
+					}
+				}
+			}
+
+			// A row of the panel is streamed once, with four independent sets of
+			// accumulators, so consecutive additions do not wait for each other.
+			template<typename V>
+			void VecGemvKernel(int k, const typename V::Scalar* x, const typename V::Scalar* b,
+							   typename V::Scalar* y, int nr, bool accumulate) {
+				typedef typename V::Scalar Scalar;
+				typedef typename V::Vec Vec;
+				const int kVecs = kGemmNR / V::kWidth;
+				Vec acc0[kVecs], acc1[kVecs], acc2[kVecs], acc3[kVecs];
+				for (int v = 0; v < kVecs; ++v)
+					acc0[v] = acc1[v] = acc2[v] = acc3[v] = V::Set1(0);
+
+				int p = 0;
+				for (; p + 4 <= k; p += 4) {
+					const Vec x0 = V::Set1(x[p]);
+					const Vec x1 = V::Set1(x[p + 1]);
+					const Vec x2 = V::Set1(x[p + 2]);
+					const Vec x3 = V::Set1(x[p + 3]);
+					for (int v = 0; v < kVecs; ++v) {
+						const Scalar* row = b + p * kGemmNR + v * V::kWidth;
+						acc0[v] = V::Add(acc0[v], V::Mul(x0, V::Load(row)));
+						acc1[v] = V::Add(acc1[v], V::Mul(x1, V::Load(row + kGemmNR)));
+						acc2[v] = V::Add(acc2[v], V::Mul(x2, V::Load(row + 2 * kGemmNR)));
+						acc3[v] = V::Add(acc3[v], V::Mul(x3, V::Load(row + 3 * kGemmNR)));
+					}
+				}
+				for (; p < k; ++p) {
+					const Vec xp = V::Set1(x[p]);
+					for (int v = 0; v < kVecs; ++v)
+						acc0[v] = V::Add(acc0[v], V::Mul(xp, V::Load(b + p * kGemmNR + v * V::kWidth)));
+				}
+
+				Scalar sums[kGemmNR];
+				for (int v = 0; v < kVecs; ++v)
+					V::Store(sums + v * V::kWidth, V::Add(V::Add(acc0[v], acc1[v]), V::Add(acc2[v], acc3[v])));
+				for (int s = 0; s < nr; ++s)
+					y[s] = accumulate ? y[s] + sums[s] : sums[s];
+			}
+
+			// The GEMM and GEMV microkernels need a whole number of vectors in a
+			// row of the panel. Other instruction sets keep the previous kernels.
+			template<typename V, bool Fits = (kGemmNR % V::kWidth == 0)>
+			struct GemmKernelOf {
+				static void Set(KernelTable<typename V::Scalar>& table) {
+					table.gemm_kernel = VecGemmKernel<V>;
+					table.gemv_kernel = VecGemvKernel<V>;
+				}
+			};
+
+			template<typename V>
+			struct GemmKernelOf<V, false> {
+				static void Set(KernelTable<typename V::Scalar>&) { }
+			};
+
+			template<typename V>
+			void FillKernelTable(KernelTable<typename V::Scalar>& table) {
+				table.add = VecAdd<V>;
+				table.sub = VecSub<V>;
+				table.mul = VecMul<V>;
+				table.add_scalar = VecAddScalar<V>;
+				table.mul_scalar = VecMulScalar<V>;
+				table.div_scalar = VecDivScalar<V>;
+				table.axpy = VecAxpy<V>;
+				table.axpby = VecAxpby<V>;
+				table.sum = VecSum<V>;
+				table.dot = VecDot<V>;
+				table.sign = VecSign<V>;
+				table.fill = VecFill<V>;
+				table.leaky_relu = VecLeakyRelu<V>;
+				table.leaky_relu_backward = VecLeakyReluBackward<V>;
+				table.leaky_relu_mask = VecLeakyReluMask<V>;
+				table.leaky_relu_mask_backward = VecLeakyReluMaskBackward<V>;
+				table.bias_leaky_relu = VecBiasLeakyRelu<V>;
+				table.nesterov_step = VecNesterovStep<V>;
+				table.deinterleave_u8 = VecDeinterleaveU8<V>;
+				GemmKernelOf<V>::Set(table);
+			}
+		}
+	}
+}
@@ -0,0 +1,110 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include "tensorView.h"
+
+namespace convnet_core {
+	// Order of the elements of a densely packed 3D volume in memory.
+	//	CHW:	planar, channels one after the other, each of them row by row
+	//	HWC:	interleaved, the channels of a pixel are adjacent (like cv::Mat)
+	//	CHWc8:	blocked, groups of kChannelBlock channels are stored as an
+	//			interleaved HWC volume, the groups one after the other. The
+	//			last group holds the remaining channels, so there is no padding.
+	// Every layout stores exactly height * width * depth elements.
+	enum class Layout { CHW, HWC, CHWc8 };
+
+	// Number of channels in a block of the CHWc8 layout.
+	const int kChannelBlock = 8;
+
+	// Number of channels in the block that starts at channel first.
+	inline int BlockWidth(const Triplet& shape, int first) {
+		return std::min(kChannelBlock, shape.depth - first);
+	}
+
+	// Index of an element in a volume stored in the given layout.
+	inline int LayoutOffset(const Triplet& shape, Layout layout, int row, int col, int channel) {
+		const int pixel = row * shape.width + col;
+		switch (layout) {
+		case Layout::HWC:
+			return pixel * shape.depth + channel;
+		case Layout::CHWc8: {
+			const int first = channel - channel % kChannelBlock;
+			return first * shape.height * shape.width +
+				pixel * BlockWidth(shape, first) + channel - first;
+		}
+		default:
+			return channel * shape.height * shape.width + pixel;
+		}
+	}
+
+	// Strides of a layout. The blocked layout cannot be described by strides.
+	inline Strides LayoutStrides(const Triplet& shape, Layout layout) {
+		assert(layout != Layout::CHWc8);
+		if (layout == Layout::HWC)
+			return Strides{ shape.width * shape.depth, shape.depth, 1 };
+
+		return PlanarStrides(shape);
+	}
+
+	inline const char* LayoutName(Layout layout) {
+		switch (layout) {
+		case Layout::HWC:	return "HWC";
+		case Layout::CHWc8:	return "CHWc8";
+		default:			return "CHW";
+		}
+	}
+
+	// Copies a volume into another layout. In every layout, the channels of
+	// a pixel within a block are at a constant distance from each other, so
+	// the conversion runs block by block and pixel by pixel, with a short
+	// inner loop over the channels of the block. That loop has unit stride
+	// on the interleaved and blocked sides.
+	// @param src:			source volume
+	// @param src_layout:	layout of the source
+	// @param dst:			destination, must not overlap the source
+	// @param dst_layout:	layout of the destination
+	// @param shape:		shape of the volume
+	template<typename T>
+	void ConvertLayout(const T* src, Layout src_layout, T* dst, Layout dst_layout, Triplet shape) {
+		const int pixels = shape.height * shape.width;
+		if (src_layout == dst_layout) {
+			std::copy(src, src + pixels * shape.depth, dst);
+			return;
+		}
+
+		// Offset of the first channel of a block and the distance between
+		// its channels, for a given pixel.
+		struct Walk {
+			Layout layout;
+			int pixels, depth;
+			int Base(int first, int width, int pixel) const {
+				switch (layout) {
+				case Layout::HWC:	return pixel * depth + first;
+				case Layout::CHWc8:	return first * pixels + pixel * width;
+				default:			return first * pixels + pixel;
+				}
+			}
+			int Step() const {
+				return layout == Layout::CHW ? pixels : 1;
+			}
+		};
+		const Walk from = { src_layout, pixels, shape.depth };
+		const Walk to = { dst_layout, pixels, shape.depth };
+		const int src_step = from.Step();
+		const int dst_step = to.Step();
+
+		for (int first = 0; first < shape.depth; first += kChannelBlock) {
+			const int width = BlockWidth(shape, first);
+			for (int p = 0; p < pixels; ++p) {
+				const T* in = src + from.Base(first, width, p);
+				T* out = dst + to.Base(first, width, p);
+				for (int k = 0; k < width; ++k)
+					out[k * dst_step] = in[k * src_step];
+			}
+		}
+	}
+}
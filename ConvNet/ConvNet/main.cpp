@@ -17,15 +17,17 @@
 #include "Softmax.h"
 #include "Model.h"
 #include "Utils.h"
+#include "autotune.h"
 
 #include <iostream>
 #include <string>
 
 std::string dataset_path = "../../../datasets/traffic_signs/train-52x52/";
 
+template<typename T>
 void Classify(std::string model_path, std::string image_path) {
-	convnet_core::Model model;
-	model.Load(model_path);
+	convnet_core::Model<T> model;
+	model.Load(model_path, convnet_core::TuningCachePath());
 
 	cv::Mat img;
 	img = cv::imread(image_path, cv::IMREAD_COLOR);
@@ -36,13 +38,14 @@ void Classify(std::string model_path, std::string image_path) {
 	convnet_core::PrintTensor(model.Predict(img));
 }
 
+template<typename T>
 void Evaluate(std::string model_path, std::string dataset_path) {
-	convnet_core::Model model;
-	model.Load(model_path);
+	convnet_core::Model<T> model;
+	model.Load(model_path, convnet_core::TuningCachePath());
 
 	std::cout << "Loading test data..." << std::endl;
-	utils::Dataset testSet = utils::GetTestSet(dataset_path, 500);
-	Tensor3D<double> input, target, predicted;
+	utils::Dataset<T> testSet = utils::GetTestSet<T>(dataset_path, 500);
+	Tensor3D<T> input, target, predicted;
 	int correct = 0;
 	
 	for (int m = 0; m < testSet.size(); ++m) {
@@ -64,15 +67,16 @@ void Evaluate(std::string model_path, std::string dataset_path) {
 	std::cout << "Final Test set accuracy: " << 100 * correct / (double)testSet.size() << "%" << std::endl;
 }
 
+template<typename T>
 void Train(std::string model_path, std::string dataset_path, double lr, 
 		   int epoch_num, int train_num, int valid_num, std::string model_name="cnn") {
-	convnet_core::Model model;
+	convnet_core::Model<T> model;
 	model.Load(model_path);
 
 	std::cout << "Load training and validation sets..." << std::endl;
-	utils::Dataset trainingSet = utils::GetTrainingSet(dataset_path, train_num);
-	utils::Dataset validSet = utils::GetValidationSet(dataset_path, valid_num);
-	Tensor3D<double> input, target;
+	utils::Dataset<T> trainingSet = utils::GetTrainingSet<T>(dataset_path, train_num);
+	utils::Dataset<T> validSet = utils::GetValidationSet<T>(dataset_path, valid_num);
+	Tensor3D<T> input, target;
 	std::pair<bool, double> result;
 
 	double cum_loss = 0;
@@ -133,20 +137,42 @@ void Train(std::string model_path, std::string dataset_path, double lr,
 }
 
 int main(int argc, char** argv) {
+	// The precision of the layers is selected by the model file.
+	bool single = false;
+	if (argc == 3 || argc == 8) {
+		single = convnet_core::Model<float>::ReadPrecision(argv[1]) == "float";
+	} else if (argc == 4) {
+		single = convnet_core::Model<float>::ReadPrecision(argv[2]) == "float";
+	}
+
 	if (argc == 3) {
-		Evaluate(argv[1], argv[2]);
+		if (single)
+			Evaluate<float>(argv[1], argv[2]);
+		else
+			Evaluate<double>(argv[1], argv[2]);
 	} else if (argc == 4) {
-		Classify(argv[2], argv[3]);
+		if (single)
+			Classify<float>(argv[2], argv[3]);
+		else
+			Classify<double>(argv[2], argv[3]);
 	}
 	else if (argc == 8) {
-		Train(argv[1], argv[2], atof(argv[3]), atoi(argv[4]), 
-			  atoi(argv[5]), atoi(argv[6]), argv[7]);
+		if (single)
+			Train<float>(argv[1], argv[2], atof(argv[3]), atoi(argv[4]),
+						 atoi(argv[5]), atoi(argv[6]), argv[7]);
+		else
+			Train<double>(argv[1], argv[2], atof(argv[3]), atoi(argv[4]),
+						  atoi(argv[5]), atoi(argv[6]), argv[7]);
 	} else {
 		std::cout << "Usage:" << std::endl;
 		std::cout << "Classifiy one image: ConvNet.exe -c model_path image_path" << std::endl;
 		std::cout << "Evaluate model on test set: ConvNet.exe model_path dataset_path" << std::endl;
 		std::cout << "Train model: ConvNet.exe model_path dataset_path learning_rate "
 			<< "epochs train_set_size valid_set_size model_name" << std::endl;
+		std::cout << "The number of threads is set by the CONVNET_THREADS environment variable "
+			<< "(all hardware threads by default)." << std::endl;
+		std::cout << "If CONVNET_TUNING_CACHE is set to a file, the convolution algorithms are "
+			<< "benchmarked on first use and the choices are kept in that file." << std::endl;
 	}
 
 	return 0;
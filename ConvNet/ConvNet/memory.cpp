@@ -0,0 +1,248 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "memory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace convnet_core {
+	namespace {
+		const size_t kMinBlockSize = kTensorAlignment;
+
+		void* AlignedAlloc(size_t bytes) {
+#ifdef _MSC_VER
+			void* p = _aligned_malloc(bytes, kTensorAlignment);
+#else
+			void* p = nullptr;
+			if (posix_memalign(&p, kTensorAlignment, bytes) != 0)
+				p = nullptr;
+#endif
+			if (!p)
+				throw std::bad_alloc();
+
+			return p;
+		}
+
+		void AlignedFree(void* p) {
+#ifdef _MSC_VER
+			_aligned_free(p);
+#else
+			free(p);
+#endif
+		}
+
+		// Index of the smallest power of two size class that holds bytes.
+		int SizeClass(size_t bytes) {
+			int size_class = 0;
+			size_t block = kMinBlockSize;
+			while (block < bytes) {
+				block <<= 1;
+				++size_class;
+			}
+
+			return size_class;
+		}
+
+		size_t ClassSize(int size_class) {
+			return kMinBlockSize << size_class;
+		}
+
+		size_t RoundUp(size_t bytes) {
+			return (bytes + kTensorAlignment - 1) / kTensorAlignment * kTensorAlignment;
+		}
+
+		// Arena of the innermost ArenaScope of the thread.
+		thread_local ArenaResource* current_arena = nullptr;
+	}
+
+	PoolResource::PoolResource() : free_lists(kClassCount, nullptr), system_allocations(0) { }
+
+	PoolResource::~PoolResource() {
+		Release();
+	}
+
+	void* PoolResource::Allocate(size_t bytes) {
+		const int size_class = SizeClass(bytes);
+		assert(size_class < kClassCount);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			FreeBlock* block = free_lists[size_class];
+			if (block) {
+				free_lists[size_class] = block->next;
+				return block;
+			}
+			++system_allocations;
+		}
+
+		return AlignedAlloc(ClassSize(size_class));
+	}
+
+	void PoolResource::Deallocate(void* p, size_t bytes) {
+		if (!p)
+			return;
+
+		const int size_class = SizeClass(bytes);
+		FreeBlock* block = static_cast<FreeBlock*>(p);
+		std::lock_guard<std::mutex> lock(mutex);
+		block->next = free_lists[size_class];
+		free_lists[size_class] = block;
+	}
+
+	void PoolResource::Release() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (FreeBlock*& head : free_lists) {
+			while (head) {
+				FreeBlock* next = head->next;
+				AlignedFree(head);
+				head = next;
+			}
+		}
+	}
+
+	size_t PoolResource::SystemAllocations() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return system_allocations;
+	}
+
+	ArenaResource::ArenaResource(MemoryResource* upstream)
+		: upstream(upstream ? upstream : DefaultResource()), offset(0), overflow_bytes(0), peak(0) {
+		main.data = nullptr;
+		main.size = 0;
+	}
+
+	ArenaResource::~ArenaResource() {
+		Rewind(ArenaMark{ 0, 0 });
+		if (main.data)
+			upstream->Deallocate(main.data, main.size);
+	}
+
+	void* ArenaResource::Allocate(size_t bytes) {
+		bytes = RoundUp(bytes > 0 ? bytes : 1);
+		void* p;
+		if (offset + bytes <= main.size) {
+			p = main.data + offset;
+			offset += bytes;
+		} else {
+			Chunk chunk = { static_cast<char*>(upstream->Allocate(bytes)), bytes };
+			overflow.push_back(chunk);
+			overflow_bytes += bytes;
+			p = chunk.data;
+		}
+		if (offset + overflow_bytes > peak)
+			peak = offset + overflow_bytes;
+
+		return p;
+	}
+
+	void ArenaResource::Deallocate(void*, size_t) { }
+
+	ArenaMark ArenaResource::Mark() const {
+		return ArenaMark{ offset, overflow.size() };
+	}
+
+	void ArenaResource::Rewind(const ArenaMark& mark) {
+		while (overflow.size() > mark.overflow_count) {
+			const Chunk& chunk = overflow.back();
+			upstream->Deallocate(chunk.data, chunk.size);
+			overflow_bytes -= chunk.size;
+			overflow.pop_back();
+		}
+		offset = mark.offset;
+	}
+
+	void ArenaResource::Reset() {
+		Rewind(ArenaMark{ 0, 0 });
+		// Grows the main chunk to the peak usage, so the next step fits in it.
+		if (peak > main.size) {
+			if (main.data)
+				upstream->Deallocate(main.data, main.size);
+			main.data = static_cast<char*>(upstream->Allocate(peak));
+			main.size = peak;
+		}
+		peak = 0;
+	}
+
+	size_t ArenaResource::Capacity() const {
+		return main.size;
+	}
+
+	ArenaScope::ArenaScope(ArenaResource& arena)
+		: arena(arena), mark(arena.Mark()), previous(current_arena) {
+		current_arena = &arena;
+	}
+
+	ArenaScope::~ArenaScope() {
+		current_arena = previous;
+		// The outermost scope of the arena ends the step.
+		if (mark.offset == 0 && mark.overflow_count == 0)
+			arena.Reset();
+		else
+			arena.Rewind(mark);
+	}
+
+	RegionResource::RegionResource(void* data, size_t size) : data(data), size(size) { }
+
+	void* RegionResource::Allocate(size_t bytes) {
+		return bytes <= size ? data : DefaultResource()->Allocate(bytes);
+	}
+
+	void RegionResource::Deallocate(void* p, size_t bytes) {
+		if (p != data)
+			DefaultResource()->Deallocate(p, bytes);
+	}
+
+	size_t PlanMemory(const std::vector<TensorLifetime>& tensors, std::vector<size_t>& offsets) {
+		offsets.assign(tensors.size(), 0);
+		std::vector<int> order(tensors.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+			return tensors[a].bytes > tensors[b].bytes;
+		});
+
+		size_t total = 0;
+		std::vector<int> placed;
+		std::vector<std::pair<size_t, size_t>> busy;
+		for (int t : order) {
+			const TensorLifetime& tensor = tensors[t];
+			const size_t bytes = RoundUp(tensor.bytes);
+			// Ranges of the placed tensors that are live at the same time.
+			busy.clear();
+			for (int p : placed) {
+				if (tensors[p].first <= tensor.last && tensor.first <= tensors[p].last)
+					busy.push_back(std::make_pair(offsets[p], offsets[p] + RoundUp(tensors[p].bytes)));
+			}
+			std::sort(busy.begin(), busy.end());
+
+			// The first gap that is large enough.
+			size_t offset = 0;
+			for (const auto& range : busy) {
+				if (offset + bytes <= range.first)
+					break;
+				offset = std::max(offset, range.second);
+			}
+			offsets[t] = offset;
+			placed.push_back(t);
+			total = std::max(total, offset + bytes);
+		}
+
+		return total;
+	}
+
+	PoolResource* DefaultResource() {
+		// Never destroyed, so tensors with static storage duration can be
+		// released at exit in any order.
+		static PoolResource* pool = new PoolResource();
+		return pool;
+	}
+
+	MemoryResource* StepResource() {
+		return current_arena ? current_arena : static_cast<MemoryResource*>(DefaultResource());
+	}
+}
@@ -0,0 +1,289 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace convnet_core {
+	// Alignment of every tensor buffer (a cache line, also enough for AVX-512).
+	const size_t kTensorAlignment = 64;
+
+	// Interface of the allocators that provide tensor storage.
+	class MemoryResource {
+	public:
+		virtual ~MemoryResource() { }
+		// Returns a kTensorAlignment aligned block of at least bytes bytes.
+		virtual void* Allocate(size_t bytes) = 0;
+		// Returns a block obtained from Allocate (with the same size).
+		virtual void Deallocate(void* p, size_t bytes) = 0;
+	};
+
+	// Size-class pool of aligned blocks. Block sizes are rounded up to a power of
+	// two, freed blocks are kept on a free list of their class and reused, so
+	// repeated allocations of the same sizes do not reach the system allocator.
+	// Thread-safe.
+	class PoolResource : public MemoryResource {
+	public:
+		PoolResource();
+		~PoolResource();
+
+		void* Allocate(size_t bytes) override;
+		void Deallocate(void* p, size_t bytes) override;
+		// Returns the cached free blocks to the system.
+		void Release();
+		// Number of blocks requested from the system allocator so far.
+		size_t SystemAllocations() const;
+
+	private:
+		// Freed blocks are linked through their first bytes.
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+		static const int kClassCount = 48;
+
+		std::vector<FreeBlock*> free_lists;
+		size_t system_allocations;
+		mutable std::mutex mutex;
+
+		PoolResource(const PoolResource&) = delete;
+		PoolResource& operator=(const PoolResource&) = delete;
+	};
+
+	// Position of an arena, used to release everything allocated after it.
+	struct ArenaMark {
+		size_t offset, overflow_count;
+	};
+
+	// Bump allocator for short-lived tensors of one training or inference step.
+	// Deallocate does nothing, the memory is reclaimed at once by Rewind/Reset.
+	// The arena grows to the peak usage of a step, so steady-state steps do
+	// not allocate. Not thread-safe.
+	class ArenaResource : public MemoryResource {
+	public:
+		// @param upstream:	resource that provides the chunks of the arena
+		explicit ArenaResource(MemoryResource* upstream = nullptr);
+		~ArenaResource();
+
+		void* Allocate(size_t bytes) override;
+		void Deallocate(void* p, size_t bytes) override;
+
+		ArenaMark Mark() const;
+		// Releases every allocation made after mark.
+		void Rewind(const ArenaMark& mark);
+		// Releases every allocation.
+		void Reset();
+		// Size of the main chunk in bytes.
+		size_t Capacity() const;
+
+	private:
+		struct Chunk {
+			char* data;
+			size_t size;
+		};
+
+		MemoryResource* upstream;
+		// Allocations are served from the main chunk, and from separate
+		// overflow chunks once it is full.
+		Chunk main;
+		std::vector<Chunk> overflow;
+		size_t offset;
+		size_t overflow_bytes;
+		// Peak usage since the last Reset.
+		size_t peak;
+
+		ArenaResource(const ArenaResource&) = delete;
+		ArenaResource& operator=(const ArenaResource&) = delete;
+	};
+
+	// Sets the current step arena of the thread for its lifetime. Everything
+	// allocated from the arena inside the scope is released at its end.
+	// Scopes can be nested.
+	class ArenaScope {
+	public:
+		explicit ArenaScope(ArenaResource& arena);
+		~ArenaScope();
+
+	private:
+		ArenaResource& arena;
+		ArenaMark mark;
+		ArenaResource* previous;
+
+		ArenaScope(const ArenaScope&) = delete;
+		ArenaScope& operator=(const ArenaScope&) = delete;
+	};
+
+	// Fixed region of a preallocated block, assigned to one or more tensors by
+	// a memory plan (see PlanMemory). Requests that fit are served from the
+	// region, larger ones from the default pool. Deallocate only returns the
+	// latter.
+	class RegionResource : public MemoryResource {
+	public:
+		RegionResource(void* data, size_t size);
+
+		void* Allocate(size_t bytes) override;
+		void Deallocate(void* p, size_t bytes) override;
+
+	private:
+		void* data;
+		size_t size;
+
+		RegionResource(const RegionResource&) = delete;
+		RegionResource& operator=(const RegionResource&) = delete;
+	};
+
+	// Lifetime of a tensor in a memory plan: the tensor is written first in
+	// step first and read last in step last.
+	struct TensorLifetime {
+		size_t bytes;
+		int first, last;
+	};
+
+	// Static memory plan. Assigns an offset in one block to every tensor, so
+	// that tensors whose lifetimes overlap do not overlap in memory. Tensors
+	// are placed by decreasing size, each at the lowest kTensorAlignment
+	// aligned offset that is free during its lifetime.
+	// @param tensors:	lifetimes of the tensors
+	// @param offsets:	receives the offset of each tensor
+	// @returns:		size of the block in bytes
+	size_t PlanMemory(const std::vector<TensorLifetime>& tensors, std::vector<size_t>& offsets);
+
+	// Process-wide pool, the default storage of tensors.
+	PoolResource* DefaultResource();
+	// Storage for temporaries of the current step: the arena of the innermost
+	// ArenaScope of the thread, or the default pool outside of any scope.
+	MemoryResource* StepResource();
+
+	// Owning, aligned storage of a tensor, allocated from a MemoryResource.
+	// The storage is reused whenever the new size fits in the capacity.
+	template<typename T>
+	class Buffer {
+	public:
+		explicit Buffer(MemoryResource* resource = DefaultResource());
+		Buffer(int size, MemoryResource* resource);
+		// Copies are allocated from the default pool, so that they can outlive
+		// the arena of the original.
+		Buffer(const Buffer& other);
+		Buffer(Buffer&& other) noexcept;
+		Buffer& operator=(const Buffer& other);
+		// Takes over the storage if both buffers use the same resource, copies
+		// otherwise. The copy allocates, so it may throw.
+		Buffer& operator=(Buffer&& other);
+		~Buffer();
+
+		// Changes the size, the contents are not preserved.
+		void Resize(int size);
+		// Copies count elements.
+		void Assign(const T* first, int count);
+		// Releases the storage, the next one is allocated from resource.
+		void SetResource(MemoryResource* resource);
+
+		T* data() { return ptr; }
+		const T* data() const { return ptr; }
+		int size() const { return count; }
+		T& operator[](int index) { return ptr[index]; }
+		const T& operator[](int index) const { return ptr[index]; }
+		MemoryResource* GetResource() const { return resource; }
+
+	private:
+		T* ptr;
+		int count;
+		int capacity;
+		MemoryResource* resource;
+
+		void Free();
+	};
+
+	template<typename T>
+	Buffer<T>::Buffer(MemoryResource* resource)
+		: ptr(nullptr), count(0), capacity(0), resource(resource) { }
+
+	template<typename T>
+	Buffer<T>::Buffer(int size, MemoryResource* resource)
+		: ptr(nullptr), count(0), capacity(0), resource(resource) {
+		Resize(size);
+	}
+
+	template<typename T>
+	Buffer<T>::Buffer(const Buffer& other)
+		: ptr(nullptr), count(0), capacity(0), resource(DefaultResource()) {
+		Assign(other.ptr, other.count);
+	}
+
+	template<typename T>
+	Buffer<T>::Buffer(Buffer&& other) noexcept
+		: ptr(other.ptr), count(other.count), capacity(other.capacity), resource(other.resource) {
+		other.ptr = nullptr;
+		other.count = 0;
+		other.capacity = 0;
+	}
+
+	template<typename T>
+	Buffer<T>& Buffer<T>::operator=(const Buffer& other) {
+		if (this != &other)
+			Assign(other.ptr, other.count);
+
+		return *this;
+	}
+
+	template<typename T>
+	Buffer<T>& Buffer<T>::operator=(Buffer&& other) {
+		if (this == &other)
+			return *this;
+
+		if (resource == other.resource) {
+			Free();
+			ptr = other.ptr;
+			count = other.count;
+			capacity = other.capacity;
+			other.ptr = nullptr;
+			other.count = 0;
+			other.capacity = 0;
+		} else {
+			Assign(other.ptr, other.count);
+		}
+
+		return *this;
+	}
+
+	template<typename T>
+	Buffer<T>::~Buffer() {
+		Free();
+	}
+
+	template<typename T>
+	void Buffer<T>::Resize(int size) {
+		assert(size >= 0);
+		if (size > capacity) {
+			Free();
+			ptr = static_cast<T*>(resource->Allocate(size * sizeof(T)));
+			capacity = size;
+		}
+		count = size;
+	}
+
+	template<typename T>
+	void Buffer<T>::Assign(const T* first, int size) {
+		Resize(size);
+		for (int i = 0; i < size; ++i)
+			ptr[i] = first[i];
+	}
+
+	template<typename T>
+	void Buffer<T>::SetResource(MemoryResource* resource) {
+		Free();
+		this->resource = resource;
+	}
+
+	template<typename T>
+	void Buffer<T>::Free() {
+		if (ptr)
+			resource->Deallocate(ptr, capacity * sizeof(T));
+		ptr = nullptr;
+		count = 0;
+		capacity = 0;
+	}
+}
@@ -0,0 +1,150 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "parallel.h"
+#include <cstdlib>
+
+namespace convnet_core {
+	namespace {
+		// Set while the thread runs a task, nested loops run serially.
+		thread_local bool in_parallel_region = false;
+
+		// Number of threads set by the CONVNET_THREADS environment variable,
+		// 0 if it is not set.
+		int ThreadsFromEnvironment() {
+			int threads = 0;
+#ifdef _MSC_VER
+			char* value = nullptr;
+			size_t length = 0;
+			if (_dupenv_s(&value, &length, "CONVNET_THREADS") == 0 && value != nullptr) {
+				threads = std::atoi(value);
+				free(value);
+			}
+#else
+			const char* value = std::getenv("CONVNET_THREADS");
+			if (value != nullptr)
+				threads = std::atoi(value);
+#endif
+			return std::max(0, threads);
+		}
+	}
+
+	ThreadPool::ThreadPool(int threads)
+		: task(nullptr), context(nullptr), chunks(0), next_chunk(0),
+		  pending(0), active(0), generation(0), stop(false) {
+		Resize(threads);
+	}
+
+	ThreadPool::~ThreadPool() {
+		StopWorkers();
+	}
+
+	void ThreadPool::Resize(int threads) {
+		if (threads <= 0)
+			threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+		StopWorkers();
+		stop = false;
+		// The caller is one of the threads.
+		for (int i = 1; i < threads; ++i)
+			workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+
+	int ThreadPool::GetThreadCount() const {
+		return static_cast<int>(workers.size()) + 1;
+	}
+
+	void ThreadPool::Run(int chunks, Task task, void* context) {
+		if (workers.empty() || chunks <= 1 || in_parallel_region) {
+			for (int chunk = 0; chunk < chunks; ++chunk)
+				task(context, chunk);
+			return;
+		}
+
+		std::lock_guard<std::mutex> run_lock(run_mutex);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			// A worker that woke up late for the previous loop may still hold
+			// its task, it finds no chunks left.
+			done.wait(lock, [this] { return active == 0; });
+			this->task = task;
+			this->context = context;
+			this->chunks = chunks;
+			next_chunk = 0;
+			pending = chunks;
+			++generation;
+		}
+		start.notify_all();
+
+		const int finished = RunChunks(task, context, chunks);
+		std::unique_lock<std::mutex> lock(mutex);
+		pending -= finished;
+		// The context must outlive the workers taking part in the loop.
+		done.wait(lock, [this] { return pending == 0 && active == 0; });
+	}
+
+	bool ThreadPool::InParallelRegion() {
+		return in_parallel_region;
+	}
+
+	void ThreadPool::WorkerLoop() {
+		unsigned long long seen = 0;
+		for (;;) {
+			Task current_task;
+			void* current_context;
+			int current_chunks;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start.wait(lock, [&] { return stop || generation != seen; });
+				if (stop)
+					return;
+				seen = generation;
+				current_task = task;
+				current_context = context;
+				current_chunks = chunks;
+				++active;
+			}
+
+			const int finished = RunChunks(current_task, current_context, current_chunks);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending -= finished;
+				--active;
+			}
+			done.notify_all();
+		}
+	}
+
+	int ThreadPool::RunChunks(Task task, void* context, int chunks) {
+		in_parallel_region = true;
+		int finished = 0;
+		for (int chunk = next_chunk++; chunk < chunks; chunk = next_chunk++) {
+			task(context, chunk);
+			++finished;
+		}
+		in_parallel_region = false;
+
+		return finished;
+	}
+
+	void ThreadPool::StopWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		start.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	ThreadPool& DefaultThreadPool() {
+		// Never destroyed, the workers are not joined at exit.
+		static ThreadPool* pool = new ThreadPool(ThreadsFromEnvironment());
+		return *pool;
+	}
+
+	void SetThreadCount(int threads) {
+		DefaultThreadPool().Resize(threads);
+	}
+}
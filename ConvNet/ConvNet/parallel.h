@@ -0,0 +1,201 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace convnet_core {
+	// Minimum number of elements processed by one task of the element-wise
+	// operations. Smaller ranges are processed by the calling thread alone,
+	// since waking up the workers costs more than the operation itself.
+	const int kParallelGrain = 4096;
+	// Upper bound of the number of chunks a range is split into.
+	const int kMaxChunks = 64;
+
+	// Fixed-size pool of worker threads. It runs one parallel loop at a time,
+	// and the calling thread takes part in the work. Loops started from inside
+	// a task run serially on the thread of the task. Running a loop does not
+	// allocate.
+	class ThreadPool {
+	public:
+		// Task of a parallel loop, called with the context and a chunk index.
+		typedef void (*Task)(void* context, int chunk);
+
+		// @param threads:	number of threads, including the caller. 0 selects
+		//					the number of hardware threads.
+		explicit ThreadPool(int threads = 0);
+		~ThreadPool();
+
+		// Changes the number of threads. Must not be called while a loop is running.
+		void Resize(int threads);
+		int GetThreadCount() const;
+		// Calls task(context, chunk) for every chunk in [0, chunks), and
+		// returns when all of them are finished.
+		void Run(int chunks, Task task, void* context);
+		// Whether the calling thread is running a task of a pool.
+		static bool InParallelRegion();
+
+	private:
+		std::vector<std::thread> workers;
+		// Serializes loops started from different threads.
+		std::mutex run_mutex;
+		// Guards the state of the current loop.
+		std::mutex mutex;
+		std::condition_variable start;
+		std::condition_variable done;
+		Task task;
+		void* context;
+		int chunks;
+		std::atomic<int> next_chunk;
+		// Chunks not finished yet, and workers taking part in the loop.
+		int pending;
+		int active;
+		unsigned long long generation;
+		bool stop;
+
+		void WorkerLoop();
+		// Claims and runs chunks until none is left, returns their number.
+		int RunChunks(Task task, void* context, int chunks);
+		void StopWorkers();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+	};
+
+	// Process-wide pool, shared by the tensor operations and the layers. Its
+	// initial number of threads is read from the CONVNET_THREADS environment
+	// variable, all hardware threads are used if it is not set.
+	ThreadPool& DefaultThreadPool();
+	// Changes the number of threads of the default pool, 0 selects the number
+	// of hardware threads. Must not be called while a loop is running.
+	void SetThreadCount(int threads);
+
+	// Number of chunks a range of n elements is split into. It depends only
+	// on n and grain (not on the number of threads), so reductions give the
+	// same result on every machine.
+	inline int ChunkCount(int n, int grain) {
+		return std::max(1, std::min(kMaxChunks, n / std::max(grain, 1)));
+	}
+
+	// Sub-range [first, last) of a chunk.
+	inline void ChunkRange(int begin, int n, int chunks, int chunk, int& first, int& last) {
+		first = begin + static_cast<int>(static_cast<long long>(n) * chunk / chunks);
+		last = begin + static_cast<int>(static_cast<long long>(n) * (chunk + 1) / chunks);
+	}
+
+	// Calls f(first, last) on disjoint sub-ranges of [begin, end), in parallel.
+	// @param grain:	minimum number of elements of a sub-range
+	// @param f:		callable with (int first, int last), must be thread-safe
+	template<typename F>
+	void ParallelFor(ThreadPool& pool, int begin, int end, int grain, const F& f) {
+		const int n = end - begin;
+		if (n <= 0)
+			return;
+		const int chunks = ChunkCount(n, grain);
+		if (chunks == 1 || pool.GetThreadCount() == 1 || ThreadPool::InParallelRegion()) {
+			f(begin, end);
+			return;
+		}
+
+		struct Context {
+			const F* f;
+			int begin, n, chunks;
+		};
+		Context context = { &f, begin, n, chunks };
+		pool.Run(chunks, [](void* p, int chunk) {
+			const Context& c = *static_cast<const Context*>(p);
+			int first, last;
+			ChunkRange(c.begin, c.n, c.chunks, chunk, first, last);
+			(*c.f)(first, last);
+		}, &context);
+	}
+
+	template<typename F>
+	void ParallelFor(int begin, int end, int grain, const F& f) {
+		ParallelFor(DefaultThreadPool(), begin, end, grain, f);
+	}
+
+	// Reduces [begin, end) in parallel. Every chunk is reduced by f, then the
+	// results of the chunks are combined in order, starting from init. The
+	// chunks do not depend on the number of threads, so neither does the result.
+	// @param init:		identity of combine
+	// @param f:		callable with (int first, int last), returns the result of a sub-range
+	// @param combine:	associative, callable with (R a, R b)
+	template<typename R, typename F, typename C>
+	R ParallelReduce(ThreadPool& pool, int begin, int end, int grain, R init, const F& f, const C& combine) {
+		const int n = end - begin;
+		if (n <= 0)
+			return init;
+		const int chunks = ChunkCount(n, grain);
+		if (chunks == 1)
+			return combine(init, f(begin, end));
+
+		R partials[kMaxChunks];
+		ParallelFor(pool, 0, chunks, 1, [&](int first_chunk, int last_chunk) {
+			for (int chunk = first_chunk; chunk < last_chunk; ++chunk) {
+				int first, last;
+				ChunkRange(begin, n, chunks, chunk, first, last);
+				partials[chunk] = f(first, last);
+			}
+		});
+
+		R result = init;
+		for (int chunk = 0; chunk < chunks; ++chunk)
+			result = combine(result, partials[chunk]);
+
+		return result;
+	}
+
+	template<typename R, typename F, typename C>
+	R ParallelReduce(int begin, int end, int grain, R init, const F& f, const C& combine) {
+		return ParallelReduce(DefaultThreadPool(), begin, end, grain, init, f, combine);
+	}
+
+	// Element-wise primitives on densely packed tensors (anything with Data()
+	// and Size()), in parallel on the default pool. The output must already
+	// have the size of the input and may be the same tensor.
+
+	// out[i] = f(x[i])
+	template<typename Tensor, typename F>
+	void Map(const Tensor& x, Tensor& out, const F& f) {
+		assert(x.Size() == out.Size());
+		const auto* in = x.Data();
+		auto* result = out.Data();
+		ParallelFor(0, x.Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; ++i)
+				result[i] = f(in[i]);
+		});
+	}
+
+	// out[i] = f(a[i], b[i])
+	template<typename Tensor, typename F>
+	void Zip(const Tensor& a, const Tensor& b, Tensor& out, const F& f) {
+		assert(a.Size() == b.Size() && a.Size() == out.Size());
+		const auto* lhs = a.Data();
+		const auto* rhs = b.Data();
+		auto* result = out.Data();
+		ParallelFor(0, a.Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; ++i)
+				result[i] = f(lhs[i], rhs[i]);
+		});
+	}
+
+	// Folds the elements with op, which must be associative, init is its identity.
+	template<typename Tensor, typename R, typename Op>
+	R Reduce(const Tensor& x, R init, const Op& op) {
+		const auto* in = x.Data();
+		return ParallelReduce(0, x.Size(), kParallelGrain, init, [&](int first, int last) {
+			R result = init;
+			for (int i = first; i < last; ++i)
+				result = op(result, in[i]);
+			return result;
+		}, op);
+	}
+}
@@ -0,0 +1,82 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "sparse.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace convnet_core {
+	template<typename T>
+	double Density(const T* a, int n) {
+		if (n == 0)
+			return 0;
+
+		const int zeros = static_cast<int>(std::count(a, a + n, T(0)));
+		return double(n - zeros) / n;
+	}
+
+	template<typename T>
+	CsrMatrix<T> ToCsr(Transpose transpose, int rows, int cols, const T* a, int lda) {
+		const int row_step = transpose == Transpose::Yes ? 1 : lda;
+		const int col_step = transpose == Transpose::Yes ? lda : 1;
+		CsrMatrix<T> csr;
+		csr.rows = rows;
+		csr.cols = cols;
+		csr.row_offsets.reserve(rows + 1);
+		csr.row_offsets.push_back(0);
+		for (int r = 0; r < rows; ++r) {
+			for (int c = 0; c < cols; ++c) {
+				const T value = a[r * row_step + c * col_step];
+				if (value != 0) {
+					csr.columns.push_back(c);
+					csr.values.push_back(value);
+				}
+			}
+			csr.row_offsets.push_back(csr.NonZeros());
+		}
+
+		return csr;
+	}
+
+	template<typename T>
+	void FromCsr(const CsrMatrix<T>& csr, T* a, int lda) {
+		for (int r = 0; r < csr.rows; ++r) {
+			std::fill(a + r * lda, a + r * lda + csr.cols, T(0));
+			for (int k = csr.row_offsets[r]; k < csr.row_offsets[r + 1]; ++k)
+				a[r * lda + csr.columns[k]] = csr.values[k];
+		}
+	}
+
+	// Two accumulators hide the latency of the additions, the gathers of x
+	// are independent.
+	template<typename T>
+	void SpMV(const CsrMatrix<T>& a, const T* x, T* y, bool accumulate) {
+		const int grain = std::max(1, static_cast<int>(kParallelGrain * double(a.rows) /
+													   std::max(a.NonZeros(), 1)));
+		ParallelFor(0, a.rows, grain, [&](int first, int last) {
+			const int* columns = a.columns.data();
+			const T* values = a.values.data();
+			for (int r = first; r < last; ++r) {
+				const int end = a.row_offsets[r + 1];
+				T sum0 = 0, sum1 = 0;
+				int k = a.row_offsets[r];
+				for (; k + 2 <= end; k += 2) {
+					sum0 += values[k] * x[columns[k]];
+					sum1 += values[k + 1] * x[columns[k + 1]];
+				}
+				if (k < end)
+					sum0 += values[k] * x[columns[k]];
+				y[r] = accumulate ? y[r] + (sum0 + sum1) : sum0 + sum1;
+			}
+		});
+	}
+
+	template double Density<float>(const float*, int);
+	template double Density<double>(const double*, int);
+	template CsrMatrix<float> ToCsr<float>(Transpose, int, int, const float*, int);
+	template CsrMatrix<double> ToCsr<double>(Transpose, int, int, const double*, int);
+	template void FromCsr<float>(const CsrMatrix<float>&, float*, int);
+	template void FromCsr<double>(const CsrMatrix<double>&, double*, int);
+	template void SpMV<float>(const CsrMatrix<float>&, const float*, float*, bool);
+	template void SpMV<double>(const CsrMatrix<double>&, const double*, double*, bool);
+}
@@ -0,0 +1,52 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include "gemm.h"
+#include <vector>
+
+namespace convnet_core {
+	// Density (fraction of nonzeros) of a matrix below which the sparse
+	// matrix-vector product is faster than the dense one. The sparse product
+	// loads an index for every element and gathers the vector, so it pays
+	// off only if most of the matrix is zero (below about 15% for the
+	// 800 x 64 layer of the digit model with AVX2).
+	const double kSparseDensity = 0.15;
+
+	// Sparse matrix in compressed sparse row format. The nonzeros of row r
+	// are values[row_offsets[r]] ... values[row_offsets[r + 1] - 1], in the
+	// columns given by the same elements of columns.
+	template<typename T>
+	struct CsrMatrix {
+		int rows = 0;
+		int cols = 0;
+		std::vector<int> row_offsets;
+		std::vector<int> columns;
+		std::vector<T> values;
+
+		int NonZeros() const { return static_cast<int>(values.size()); }
+	};
+
+	// Fraction of the nonzero elements of a contiguous array.
+	template<typename T>
+	double Density(const T* a, int n);
+
+	// Compresses op(A) into CSR format, the zeros are dropped.
+	// @param rows, cols:	op(A) is (rows x cols)
+	// @param a:			A, with rows lda elements apart
+	template<typename T>
+	CsrMatrix<T> ToCsr(Transpose transpose, int rows, int cols, const T* a, int lda);
+
+	// Expands a CSR matrix into a dense row-major one.
+	// @param a:	rows x cols elements, with rows lda elements apart
+	template<typename T>
+	void FromCsr(const CsrMatrix<T>& csr, T* a, int lda);
+
+	// Sparse matrix-vector product y = A * x, or y += A * x if accumulate is
+	// true. The rows are processed in parallel.
+	// @param x:	a.cols elements
+	// @param y:	a.rows elements
+	template<typename T>
+	void SpMV(const CsrMatrix<T>& a, const T* x, T* y, bool accumulate = false);
+}
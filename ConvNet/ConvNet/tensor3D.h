@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <numeric>
@@ -11,57 +12,140 @@
 #include <opencv2/core/core.hpp>
 #include <iostream>
 #include <random>
+#include "tensorView.h"
+#include "layout.h"
+#include "tensorExpr.h"
+#include "kernels.h"
+#include "memory.h"
+#include "parallel.h"
 
 namespace convnet_core {
-	// Structure that stores the shape of a tensor.
-	struct Triplet {
-		int height, width, depth;
-	};
-
 	// Core data structure of the project. Stores the 3D volume of data in 
-	// an unrolled vector. 
+	// an unrolled, 64-byte aligned buffer allocated from a MemoryResource
+	// (the default pool, or the arena of the current step for temporaries,
+	// see memory.h). The order of the elements is given by the layout of the
+	// tensor (planar CHW by default, see layout.h). Arithmetic operators build lazily evaluated
+	// expressions (see tensorExpr.h), which are evaluated in a single loop
+	// on assignment. Simple expressions, in-place operators, reductions and
+	// fills are computed by the SIMD kernels (see kernels.h). Large tensors
+	// are processed in chunks by the shared thread pool (see parallel.h).
 	template<typename T>
-	class Tensor3D
+	class Tensor3D : public TensorExpr<Tensor3D<T>>
 	{
 	public:
-		Tensor3D() { };
+		typedef T value_type;
+		// Tensors are captured by reference in expressions.
+		typedef const Tensor3D<T>& ExprRef;
+
+		Tensor3D() : shape{ 0, 0, 0 } { };
 		Tensor3D(Triplet shape);
 		Tensor3D(int height, int width, int depth);
+		// Creates a tensor whose storage is allocated from resource.
+		Tensor3D(Triplet shape, MemoryResource* resource);
+		// Creates a tensor stored in the given layout.
+		Tensor3D(Triplet shape, Layout layout, MemoryResource* resource = DefaultResource());
+		// Copies are allocated from the default pool.
 		Tensor3D(const Tensor3D& other);
-		Tensor3D(const cv::Mat& image);
-		Tensor3D<T> operator+(const Tensor3D<T>& other);
-		Tensor3D<T> operator-(const Tensor3D<T>& other);
-		Tensor3D<T> operator*(const Tensor3D<T>& other);
-		Tensor3D<T> operator*(T scalar);
-		Tensor3D<T> operator/(T scalar);
-		Tensor3D<T> operator+(T scalar);
-		Tensor3D<T> operator=(const Tensor3D<T>& other);
+		Tensor3D(Tensor3D&& other) noexcept;
+		// Creates a deep copy of the viewed volume.
+		explicit Tensor3D(const ConstTensorView<T>& view);
+		// Creates a tensor from an 8-bit image, in the given layout.
+		Tensor3D(const cv::Mat& image, Layout layout = Layout::CHW);
+		// Evaluates an expression into a new tensor.
+		template<typename E>
+		Tensor3D(const TensorExpr<E>& expr);
+		Tensor3D<T>& operator=(const Tensor3D<T>& other);
+		Tensor3D<T>& operator=(Tensor3D<T>&& other);
+		// Copies the viewed volume, reuses the existing storage when the sizes match.
+		Tensor3D<T>& operator=(const ConstTensorView<T>& view);
+		// Evaluates an expression in a single loop. Reuses the existing storage.
+		template<typename E>
+		Tensor3D<T>& operator=(const TensorExpr<E>& expr);
+
+		// In-place element-wise operators, they do not allocate.
+		Tensor3D<T>& operator+=(const Tensor3D<T>& other);
+		Tensor3D<T>& operator-=(const Tensor3D<T>& other);
+		Tensor3D<T>& operator*=(const Tensor3D<T>& other);
+		template<typename E>
+		Tensor3D<T>& operator+=(const TensorExpr<E>& expr);
+		template<typename E>
+		Tensor3D<T>& operator-=(const TensorExpr<E>& expr);
+		template<typename E>
+		Tensor3D<T>& operator*=(const TensorExpr<E>& expr);
+		Tensor3D<T>& operator*=(T scalar);
+		Tensor3D<T>& operator/=(T scalar);
+		Tensor3D<T>& operator+=(T scalar);
+		// this = alpha * x + this (BLAS axpy).
+		Tensor3D<T>& Axpy(T alpha, const Tensor3D<T>& x);
+		// this = alpha * x + beta * this (BLAS axpby).
+		Tensor3D<T>& Axpby(T alpha, const Tensor3D<T>& x, T beta);
 
 		T& operator()(int row, int col, int channel);
+		const T& operator()(int row, int col, int channel) const;
+		// Element access in the unrolled order, without bounds checking.
+		T& operator[](int index);
+		T operator[](int index) const;
 		T& get(int row, int col, int channel);
+		const T& get(int row, int col, int channel) const;
 		// Sums a tensor, returns with a scalar.
-		T Sum();
+		T Sum() const;
 		// Applies the sign function to a tensor.
 		Tensor3D<T> Sign();
-		// Unrolls a 3D tensor into a (n, 1, 1) dimensional vector.
-		Tensor3D<T> Flatten();
-		// Reshapes a tensor to the given shape.
-		Tensor3D<T> Reshape(Triplet shape);
-
-		Triplet GetShape();
+		// Views a 3D tensor as a (n, 1, 1) dimensional vector, without copying.
+		TensorView<T> Flatten();
+		ConstTensorView<T> Flatten() const;
+		// Views a tensor with the given shape, without copying.
+		TensorView<T> Reshape(Triplet shape);
+		ConstTensorView<T> Reshape(Triplet shape) const;
+
+		// Non-owning views of the whole tensor.
+		TensorView<T> View();
+		ConstTensorView<T> View() const;
+		operator TensorView<T>();
+		operator ConstTensorView<T>() const;
+		// Pointer to the unrolled data.
+		T* Data();
+		const T* Data() const;
+		// Allocator of the storage.
+		MemoryResource* GetResource() const;
+		// Moves the storage to resource, the contents are not preserved.
+		void SetResource(MemoryResource* resource);
+		Layout GetLayout() const;
+		// Returns a copy of the tensor stored in the given layout.
+		Tensor3D<T> ToLayout(Layout layout) const;
+
+		Triplet GetShape() const;
+		// Number of elements in the tensor.
+		int Size() const;
 		void InitZeros();
 		void InitRandom();
 
 		~Tensor3D();
 
 	private:
-		// std vector stores elements, takes care of memory handling.
-		std::vector<T> data;
+		// Aligned storage of the elements, reused when the size does not grow.
+		Buffer<T> data;
 		Triplet shape;
+		Layout layout = Layout::CHW;
 
-		// Appends an image channel (as a matrix) to the tensor using depth dimension.
-		void AppendChannel(const cv::Mat& mat, int channel);
 		void SetParams(int height, int width, int depth);
+		// Index of an element in the unrolled data.
+		int Offset(int row, int col, int channel) const;
+
+		// Evaluates an expression into out. Expressions of one tensor-tensor or
+		// tensor-scalar operation are computed by the kernels, others by a
+		// single fused loop, split into chunks for the thread pool.
+		template<typename E>
+		static void Evaluate(const E& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpAdd>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpSub>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpMul>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpAdd>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpSub>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpMul>& e, T* out);
+		static void Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpDiv>& e, T* out);
+		static void Evaluate(const BinaryExpr<ScalarExpr<T>, Tensor3D<T>, OpAdd>& e, T* out);
+		static void Evaluate(const BinaryExpr<ScalarExpr<T>, Tensor3D<T>, OpMul>& e, T* out);
 	};
 
 	// Creates a tensor from a given shape.
@@ -76,95 +160,327 @@ namespace convnet_core {
 		SetParams(height, width, depth);
 	}
 
+	// Creates a tensor from a given shape, its storage is allocated from resource.
+	template<typename T>
+	Tensor3D<T>::Tensor3D(Triplet shape, MemoryResource* resource) : data(resource) {
+		SetParams(shape.height, shape.width, shape.depth);
+	}
+
+	// Creates a tensor stored in the given layout.
+	template<typename T>
+	Tensor3D<T>::Tensor3D(Triplet shape, Layout layout, MemoryResource* resource) 
+		: data(resource), layout(layout) {
+		SetParams(shape.height, shape.width, shape.depth);
+	}
+
 	// Copy constructor, creates a deep copy.
 	template<typename T>
-	Tensor3D<T>::Tensor3D(const Tensor3D& other) {
-		data = std::vector<T>(other.data);
-		this->shape = other.shape;
+	Tensor3D<T>::Tensor3D(const Tensor3D& other) 
+		: data(other.data), shape(other.shape), layout(other.layout) { }
+
+	// Move constructor, takes over the storage (and the resource) of other.
+	template<typename T>
+	Tensor3D<T>::Tensor3D(Tensor3D&& other) noexcept 
+		: data(std::move(other.data)), shape(other.shape), layout(other.layout) {
+		other.shape = { 0, 0, 0 };
+	}
+
+	// Creates a deep copy of the viewed volume. The result is densely packed.
+	template<typename T>
+	Tensor3D<T>::Tensor3D(const ConstTensorView<T>& view) {
+		*this = view;
 	}
 
-	// Creates a tensor from an OpenCV image.
+	// Creates a tensor from an OpenCV image. The pixels are read directly from
+	// the buffer of the image, converted, normalized between (0,1) and (for the
+	// planar layout) de-interleaved by a single vectorized pass.
+	// @param image:	8-bit image with any number of channels
+	// @param layout:	layout of the tensor
 	template<typename T>
-	Tensor3D<T>::Tensor3D(const cv::Mat& image) {
+	Tensor3D<T>::Tensor3D(const cv::Mat& image, Layout layout) : layout(layout) {
+		assert(image.depth() == CV_8U);
 		int depth = image.channels();
 		int height = image.rows;
 		int width = image.cols;
 
 		SetParams(height, width, depth);
 
-		std::vector<cv::Mat> bgr(depth);
-		cv::split(image, bgr);
-
-		for (int i = 0; i < depth; ++i) {
-			AppendChannel(bgr[i], i);
+		// A continuous image is converted at once, otherwise row by row.
+		const int rows = image.isContinuous() ? 1 : height;
+		const int pixels = height * width / rows;
+		for (int i = 0; i < rows; ++i) {
+			const uchar* src = image.ptr<uchar>(i);
+			if (layout == Layout::HWC) {
+				// Same order as the image.
+				kernels::DeinterleaveU8(src, 1, T(255), data.data() + i * pixels * depth, 0, pixels * depth);
+			} else if (layout == Layout::CHW) {
+				kernels::DeinterleaveU8(src, depth, T(255), data.data() + i * pixels, height * width, pixels);
+			} else {
+				// The same normalization as the kernel.
+				const T scale = T(1) / T(255);
+				for (int j = 0; j < pixels; ++j) {
+					const int pixel = i * pixels + j;
+					for (int k = 0; k < depth; ++k)
+						data[Offset(pixel / width, pixel % width, k)] = src[j * depth + k] * scale;
+				}
+			}
 		}
 	}
 	
-	// Adds two tensors (element-wise).
+	// Evaluates an expression into a new tensor.
+	template<typename T>
+	template<typename E>
+	Tensor3D<T>::Tensor3D(const TensorExpr<E>& expr) : shape{ 0, 0, 0 } {
+		*this = expr;
+	}
+
+	// Assignment operator. Reuses the existing storage when the sizes match.
+	template<typename T>
+	inline Tensor3D<T>& Tensor3D<T>::operator=(const Tensor3D<T>& other) {
+		if (this != &other) {
+			data.Assign(other.Data(), other.Size());
+			this->shape = other.shape;
+			layout = other.layout;
+		}
+
+		return *this;
+	}
+
+	// Move assignment operator, takes over the storage of other if both
+	// tensors are allocated from the same resource, copies it otherwise (which
+	// may throw).
+	template<typename T>
+	inline Tensor3D<T>& Tensor3D<T>::operator=(Tensor3D<T>&& other) {
+		if (this != &other) {
+			data = std::move(other.data);
+			this->shape = other.shape;
+			layout = other.layout;
+			other.shape = { 0, 0, 0 };
+		}
+
+		return *this;
+	}
+
+	// Assignment from a view, the result is planar (CHW).
+	// Handles views of this tensor as well.
+	template<typename T>
+	Tensor3D<T>& Tensor3D<T>::operator=(const ConstTensorView<T>& view) {
+		Triplet view_shape = view.GetShape();
+		const T* begin = data.data();
+		const T* end = begin + data.size();
+		bool aliases = view.Data() >= begin && view.Data() < end;
+
+		if (aliases) {
+			// Viewing the whole tensor, only the shape changes.
+			if (layout == Layout::CHW && view.Data() == begin && 
+				view.IsContiguous() && view.Size() == Size()) {
+				shape = view_shape;
+				return *this;
+			}
+			// Overlapping window, copy it out first.
+			return *this = Tensor3D<T>(view);
+		}
+
+		shape = view_shape;
+		layout = Layout::CHW;
+		data.Resize(view.Size());
+		if (view.IsContiguous()) {
+			std::copy(view.Data(), view.Data() + view.Size(), data.data());
+		} else {
+			int index = 0;
+			for (int k = 0; k < view_shape.depth; ++k)
+				for (int i = 0; i < view_shape.height; ++i)
+					for (int j = 0; j < view_shape.width; ++j)
+						data[index++] = view(i, j, k);
+		}
+
+		return *this;
+	}
+
+	// Evaluates an expression element by element into this tensor.
+	// Element-wise expressions may refer to this tensor as well.
+	template<typename T>
+	template<typename E>
+	Tensor3D<T>& Tensor3D<T>::operator=(const TensorExpr<E>& expr) {
+		const E& e = expr.Self();
+		Triplet expr_shape = e.GetShape();
+		data.Resize(e.Size());
+		shape = expr_shape;
+		layout = e.GetLayout();
+		Evaluate(e, data.data());
+
+		return *this;
+	}
+
+	template<typename T>
+	template<typename E>
+	inline void Tensor3D<T>::Evaluate(const E& e, T* out) {
+		ParallelFor(0, e.Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; i++)
+				out[i] = e[i];
+		});
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpAdd>& e, T* out) {
+		kernels::Add(e.Lhs().Data(), e.Rhs().Data(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpSub>& e, T* out) {
+		kernels::Sub(e.Lhs().Data(), e.Rhs().Data(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, Tensor3D<T>, OpMul>& e, T* out) {
+		kernels::Mul(e.Lhs().Data(), e.Rhs().Data(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpAdd>& e, T* out) {
+		kernels::AddScalar(e.Lhs().Data(), e.Rhs().Value(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpSub>& e, T* out) {
+		kernels::AddScalar(e.Lhs().Data(), -e.Rhs().Value(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpMul>& e, T* out) {
+		kernels::MulScalar(e.Lhs().Data(), e.Rhs().Value(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<Tensor3D<T>, ScalarExpr<T>, OpDiv>& e, T* out) {
+		kernels::DivScalar(e.Lhs().Data(), e.Rhs().Value(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<ScalarExpr<T>, Tensor3D<T>, OpAdd>& e, T* out) {
+		kernels::AddScalar(e.Rhs().Data(), e.Lhs().Value(), out, e.Size());
+	}
+
+	template<typename T>
+	inline void Tensor3D<T>::Evaluate(const BinaryExpr<ScalarExpr<T>, Tensor3D<T>, OpMul>& e, T* out) {
+		kernels::MulScalar(e.Rhs().Data(), e.Lhs().Value(), out, e.Size());
+	}
+
+	// Adds a tensor to this tensor in place (element-wise).
+	template<typename T>
+	inline Tensor3D<T>& Tensor3D<T>::operator+=(const Tensor3D<T>& other) {
+		assert(Size() == other.Size() && layout == other.layout);
+		kernels::Add(Data(), other.Data(), Data(), Size());
+
+		return *this;
+	}
+
+	// Subtracts a tensor from this tensor in place (element-wise).
+	template<typename T>
+	inline Tensor3D<T>& Tensor3D<T>::operator-=(const Tensor3D<T>& other) {
+		assert(Size() == other.Size() && layout == other.layout);
+		kernels::Sub(Data(), other.Data(), Data(), Size());
+
+		return *this;
+	}
+
+	// Multiplies this tensor with a tensor in place (element-wise).
+	template<typename T>
+	inline Tensor3D<T>& Tensor3D<T>::operator*=(const Tensor3D<T>& other) {
+		assert(Size() == other.Size() && layout == other.layout);
+		kernels::Mul(Data(), other.Data(), Data(), Size());
+
+		return *this;
+	}
+
+	// Adds an expression to this tensor in place (element-wise).
+	template<typename T>
+	template<typename E>
+	inline Tensor3D<T>& Tensor3D<T>::operator+=(const TensorExpr<E>& expr) {
+		const E& e = expr.Self();
+		assert(Size() == e.Size() && layout == e.GetLayout());
+		T* out = data.data();
+		ParallelFor(0, Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; i++)
+				out[i] += e[i];
+		});
+
+		return *this;
+	}
+
+	// Subtracts an expression from this tensor in place (element-wise).
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator+(const Tensor3D<T>& other) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < other.shape.height * other.shape.width * other.shape.depth; i++)
-			clone.data[i] += other.data[i];
+	template<typename E>
+	inline Tensor3D<T>& Tensor3D<T>::operator-=(const TensorExpr<E>& expr) {
+		const E& e = expr.Self();
+		assert(Size() == e.Size() && layout == e.GetLayout());
+		T* out = data.data();
+		ParallelFor(0, Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; i++)
+				out[i] -= e[i];
+		});
 
-		return clone;
+		return *this;
 	}
 
-	// Subtracts a tensor from this tensor (element-wise).
+	// Multiplies this tensor with an expression in place (element-wise).
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator-(const Tensor3D<T>& other) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < other.shape.height * other.shape.width * other.shape.depth; i++)
-			clone.data[i] -= other.data[i];
+	template<typename E>
+	inline Tensor3D<T>& Tensor3D<T>::operator*=(const TensorExpr<E>& expr) {
+		const E& e = expr.Self();
+		assert(Size() == e.Size() && layout == e.GetLayout());
+		T* out = data.data();
+		ParallelFor(0, Size(), kParallelGrain, [&](int first, int last) {
+			for (int i = first; i < last; i++)
+				out[i] *= e[i];
+		});
 
-		return clone;
+		return *this;
 	}
 
-	// Multiplies two tensors (element-wise).
+	// Multiplies this tensor with a scalar in place.
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator*(const Tensor3D<T>& other) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < other.shape.height * other.shape.width * other.shape.depth; i++)
-			clone.data[i] *= other.data[i];
+	inline Tensor3D<T>& Tensor3D<T>::operator*=(T scalar) {
+		kernels::MulScalar(Data(), scalar, Data(), Size());
 
-		return clone;
+		return *this;
 	}
 
-	// Multiplies a tensor with a scalar.
+	// Divides this tensor with a scalar in place.
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator*(T scalar) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++)
-			clone.data[i] *= scalar;
+	inline Tensor3D<T>& Tensor3D<T>::operator/=(T scalar) {
+		kernels::DivScalar(Data(), scalar, Data(), Size());
 
-		return clone;
+		return *this;
 	}
 
-	// Divides a tensor with a scalar.
+	// Adds a scalar to this tensor in place.
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator/(T scalar) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++)
-			clone.data[i] = this->data[i] / scalar;
+	inline Tensor3D<T>& Tensor3D<T>::operator+=(T scalar) {
+		kernels::AddScalar(Data(), scalar, Data(), Size());
 
-		return clone;
+		return *this;
 	}
 
-	// Adds a scalar to a tensor.
+	// Adds alpha * x to this tensor in place, without any temporaries.
+	// @param alpha:	scale factor of x
+	// @param x:		tensor with the same number of elements
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator+(T scalar) {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++)
-			clone.data[i] = this->data[i] + scalar;
+	inline Tensor3D<T>& Tensor3D<T>::Axpy(T alpha, const Tensor3D<T>& x) {
+		assert(Size() == x.Size() && layout == x.layout);
+		kernels::Axpy(alpha, x.Data(), Data(), Size());
 
-		return clone;
+		return *this;
 	}
 
-	// Assignment operator.
+	// Overwrites this tensor with alpha * x + beta * this in place.
+	// @param alpha:	scale factor of x
+	// @param x:		tensor with the same number of elements
+	// @param beta:		scale factor of this tensor
 	template<typename T>
-	inline Tensor3D<T> Tensor3D<T>::operator=(const Tensor3D<T>& other) {
-		data = std::vector<T>(other.data);
-		this->shape = other.shape;
+	inline Tensor3D<T>& Tensor3D<T>::Axpby(T alpha, const Tensor3D<T>& x, T beta) {
+		assert(Size() == x.Size() && layout == x.layout);
+		kernels::Axpby(alpha, x.Data(), beta, Data(), Size());
 
 		return *this;
 	}
@@ -175,95 +491,155 @@ namespace convnet_core {
 		return this->get(row, col, channel);
 	}
 
+	template<typename T>
+	inline const T & Tensor3D<T>::operator()(int row, int col, int channel) const {
+		return this->get(row, col, channel);
+	}
+
+	template<typename T>
+	inline T& Tensor3D<T>::operator[](int index) {
+		return data[index];
+	}
+
+	template<typename T>
+	inline T Tensor3D<T>::operator[](int index) const {
+		return data[index];
+	}
+
 	// Auxiliary function that returns the data element from the unrolled vector.
 	template<typename T>
 	T& Tensor3D<T>::get(int row, int col, int channel) {
 		assert(row >= 0 && col >= 0 && channel >= 0);
 		assert(col < shape.width && row < shape.height && channel < shape.depth);
 
-		return data[
-			channel * (shape.width * shape.height) +
-				row * (shape.width) +
-				col
-		];
+		return data[Offset(row, col, channel)];
+	}
+
+	template<typename T>
+	const T& Tensor3D<T>::get(int row, int col, int channel) const {
+		assert(row >= 0 && col >= 0 && channel >= 0);
+		assert(col < shape.width && row < shape.height && channel < shape.depth);
+
+		return data[Offset(row, col, channel)];
+	}
+
+	template<typename T>
+	inline int Tensor3D<T>::Offset(int row, int col, int channel) const {
+		if (layout == Layout::CHW)
+			return channel * (shape.width * shape.height) + row * shape.width + col;
+
+		return LayoutOffset(shape, layout, row, col, channel);
 	}
 
 	template<typename T>
-	inline T Tensor3D<T>::Sum() {
-		return std::accumulate(data.begin(), data.end(), 0);;
+	inline T Tensor3D<T>::Sum() const {
+		return kernels::Sum(Data(), Size());
 	}
 
 	template<typename T>
 	Tensor3D<T> Tensor3D<T>::Sign() {
-		Tensor3D<T> clone(*this);
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++) {
-			if (clone.data[i] > 0)
-				clone.data[i] = 1;
-			if (clone.data[i] < 0)
-				clone.data[i] = -1;
-		}
+		Tensor3D<T> sign(shape, layout);
+		kernels::Sign(Data(), sign.Data(), Size());
 
-		return clone;
+		return sign;
 	}
 
 	// Creates a (height*width*depth, 1, 1) dimensional
-	// copy of original tensor.
+	// view of the original tensor.
 	template<typename T>
-	Tensor3D<T> Tensor3D<T>::Flatten() {
-		Tensor3D<T> clone(*this);
-		int size = shape.width * shape.height * shape.depth;
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++)
-			clone.data[i] = this->data[i];
-
-		clone.shape.height = size;
-		clone.shape.width = 1;
-		clone.shape.depth = 1;
+	TensorView<T> Tensor3D<T>::Flatten() {
+		return View().Flatten();
+	}
 
-		return clone;
+	template<typename T>
+	ConstTensorView<T> Tensor3D<T>::Flatten() const {
+		return View().Flatten();
 	}
 
 	// Returns an (new_height, new_width, new_depth) dimensional
-	// copy of the original tensor.
+	// view of the original tensor.
 	template<typename T>
-	Tensor3D<T> Tensor3D<T>::Reshape(Triplet new_shape) {
-		Tensor3D<T> clone(*this);
-		int size = shape.width * shape.height * shape.depth;
-		for (int i = 0; i < shape.height * shape.width * shape.depth; i++)
-			clone.data[i] = this->data[i];
+	TensorView<T> Tensor3D<T>::Reshape(Triplet new_shape) {
+		return View().Reshape(new_shape);
+	}
 
-		clone.shape.height = new_shape.height;
-		clone.shape.width = new_shape.width;
-		clone.shape.depth = new_shape.depth;
+	template<typename T>
+	ConstTensorView<T> Tensor3D<T>::Reshape(Triplet new_shape) const {
+		return View().Reshape(new_shape);
+	}
 
-		return clone;
+	// Views of blocked tensors are not supported, convert them first.
+	template<typename T>
+	inline TensorView<T> Tensor3D<T>::View() {
+		return TensorView<T>(data.data(), shape, LayoutStrides(shape, layout));
 	}
 
 	template<typename T>
-	inline Triplet Tensor3D<T>::GetShape() {
-		return this->shape;
+	inline ConstTensorView<T> Tensor3D<T>::View() const {
+		return ConstTensorView<T>(data.data(), shape, LayoutStrides(shape, layout));
 	}
 
 	template<typename T>
-	Tensor3D<T>::~Tensor3D() { }
+	inline Tensor3D<T>::operator TensorView<T>() {
+		return View();
+	}
 
-	// Append the color-channels of an image to the unrolled data array.
-	// @param mat: channel of an image as OpenCV matrix.
-	// @param channel: number of channel.
 	template<typename T>
-	void Tensor3D<T>::AppendChannel(const cv::Mat& mat, int channel) {
-		assert(channel >= 0);
+	inline Tensor3D<T>::operator ConstTensorView<T>() const {
+		return View();
+	}
 
-		for (int i = 0; i < mat.rows; ++i) {
-			for (int j = 0; j < mat.cols; ++j) {
-				// Normalize pixel value between (0,1).
-				get(i, j, channel) = (double)mat.at<uchar>(i, j) / 255.0;
-			}
-		}
+	template<typename T>
+	inline T* Tensor3D<T>::Data() {
+		return data.data();
+	}
+
+	template<typename T>
+	inline const T* Tensor3D<T>::Data() const {
+		return data.data();
+	}
+
+	template<typename T>
+	inline MemoryResource* Tensor3D<T>::GetResource() const {
+		return data.GetResource();
 	}
 
+	template<typename T>
+	void Tensor3D<T>::SetResource(MemoryResource* resource) {
+		data.SetResource(resource);
+		data.Resize(Size());
+	}
+
+	template<typename T>
+	inline Layout Tensor3D<T>::GetLayout() const {
+		return layout;
+	}
+
+	template<typename T>
+	Tensor3D<T> Tensor3D<T>::ToLayout(Layout new_layout) const {
+		Tensor3D<T> converted(shape, new_layout);
+		ConvertLayout(Data(), layout, converted.Data(), new_layout, shape);
+
+		return converted;
+	}
+
+	template<typename T>
+	inline Triplet Tensor3D<T>::GetShape() const {
+		return this->shape;
+	}
+
+	template<typename T>
+	inline int Tensor3D<T>::Size() const {
+		return shape.height * shape.width * shape.depth;
+	}
+
+	template<typename T>
+	Tensor3D<T>::~Tensor3D() { }
+
 	template<typename T>
 	void Tensor3D<T>::SetParams(int height, int width, int depth) {
-		data = std::vector<T>(height * width * depth);
+		data.Resize(height * width * depth);
+		kernels::Fill(data.data(), T(0), data.size());
 
 		shape.height = height;
 		shape.width = width;
@@ -273,10 +649,7 @@ namespace convnet_core {
 	// Sets all data elements to zero.
 	template<typename T>
 	void Tensor3D<T>::InitZeros() {
-		for (int i = 0; i < shape.height; ++i)
-			for (int j = 0; j < shape.width; ++j)
-				for (int k = 0; k < shape.depth; ++k)
-					get(i, j, k) = 0;
+		kernels::Fill(Data(), T(0), Size());
 	}
 
 	// Random initialization (used for CNN weights).
@@ -294,11 +667,27 @@ namespace convnet_core {
 		for (int i = 0; i < shape.height; ++i)
 			for (int j = 0; j < shape.width; ++j)
 				for (int k = 0; k < shape.depth; ++k)
-					get(i, j, k) = normalDistribution(generator);
+					get(i, j, k) = static_cast<T>(normalDistribution(generator));
+	}
+
+	// Wraps an OpenCV image, already converted to the element type (CV_32F for
+	// float, CV_64F for double), as an interleaved view without copying. The
+	// padding at the end of the rows is skipped by the row stride. The image
+	// must outlive the view.
+	// @param image:	image with any number of channels
+	template<typename T>
+	ConstTensorView<T> BorrowImage(const cv::Mat& image) {
+		assert(image.depth() == (sizeof(T) == sizeof(float) ? CV_32F : CV_64F));
+		assert(image.step[0] % sizeof(T) == 0);
+		Triplet shape = { image.rows, image.cols, image.channels() };
+		Strides strides = { static_cast<int>(image.step[0] / sizeof(T)), shape.depth, 1 };
+
+		return ConstTensorView<T>(reinterpret_cast<const T*>(image.data), shape, strides);
 	}
 
 	// Utils functions.
-	static void PrintTensor(Tensor3D<double>& tensor) {
+	template<typename T>
+	static void PrintTensor(const Tensor3D<T>& tensor) {
 		int width = tensor.GetShape().width;
 		int height = tensor.GetShape().height;
 		int depth = tensor.GetShape().depth;
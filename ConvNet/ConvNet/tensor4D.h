@@ -0,0 +1,206 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "tensor3D.h"
+
+namespace convnet_core {
+	// Minibatch of 3D tensors with the same shape (N x C x H x W). The samples
+	// are stored one after the other in a single aligned buffer, each of them
+	// in the planar order of Tensor3D, so a sample can be viewed without copying.
+	template<typename T>
+	class Tensor4D
+	{
+	public:
+		Tensor4D() : batch_size(0), shape{ 0, 0, 0 } { }
+		// Creates a zero-filled batch.
+		// @param batch_size:	number of samples
+		// @param shape:		shape of one sample
+		Tensor4D(int batch_size, Triplet shape);
+		// Creates a zero-filled batch whose storage is allocated from resource.
+		Tensor4D(int batch_size, Triplet shape, MemoryResource* resource);
+		// Stacks tensors with the same shape into a batch.
+		explicit Tensor4D(const std::vector<Tensor3D<T>>& samples);
+		Tensor4D(const Tensor4D& other) = default;
+		Tensor4D(Tensor4D&& other) noexcept;
+		Tensor4D<T>& operator=(const Tensor4D<T>& other) = default;
+		Tensor4D<T>& operator=(Tensor4D<T>&& other);
+
+		// Changes the batch size and the sample shape. Reuses the existing
+		// storage if it is large enough, the contents are not preserved.
+		void Resize(int batch_size, Triplet shape);
+
+		// Views of one sample, without copying.
+		TensorView<T> Sample(int index);
+		ConstTensorView<T> Sample(int index) const;
+		// Copies a tensor with the sample shape into a sample.
+		void SetSample(int index, const ConstTensorView<T>& sample);
+
+		// In-place element-wise operators.
+		Tensor4D<T>& operator-=(const Tensor4D<T>& other);
+		Tensor4D<T>& operator*=(T scalar);
+
+		// Number of samples.
+		int GetBatchSize() const;
+		// Shape of one sample.
+		Triplet GetShape() const;
+		// Number of elements in one sample.
+		int SampleSize() const;
+		// Number of elements in the batch.
+		int Size() const;
+		T* Data();
+		const T* Data() const;
+		MemoryResource* GetResource() const;
+		void InitZeros();
+
+	private:
+		Buffer<T> data;
+		int batch_size;
+		Triplet shape;
+	};
+
+	template<typename T>
+	Tensor4D<T>::Tensor4D(int batch_size, Triplet shape)
+		: batch_size(0), shape{ 0, 0, 0 } {
+		Resize(batch_size, shape);
+		InitZeros();
+	}
+
+	template<typename T>
+	Tensor4D<T>::Tensor4D(int batch_size, Triplet shape, MemoryResource* resource)
+		: data(resource), batch_size(0), shape{ 0, 0, 0 } {
+		Resize(batch_size, shape);
+		InitZeros();
+	}
+
+	template<typename T>
+	Tensor4D<T>::Tensor4D(const std::vector<Tensor3D<T>>& samples)
+		: batch_size(0), shape{ 0, 0, 0 } {
+		assert(!samples.empty());
+		Resize(static_cast<int>(samples.size()), samples[0].GetShape());
+		for (int n = 0; n < batch_size; ++n)
+			SetSample(n, samples[n]);
+	}
+
+	// Move constructor, takes over the storage of other.
+	template<typename T>
+	Tensor4D<T>::Tensor4D(Tensor4D&& other) noexcept
+		: data(std::move(other.data)), batch_size(other.batch_size), shape(other.shape) {
+		other.batch_size = 0;
+		other.shape = { 0, 0, 0 };
+	}
+
+	// Move assignment operator, takes over the storage of other if both
+	// batches are allocated from the same resource, copies it otherwise (which
+	// may throw).
+	template<typename T>
+	Tensor4D<T>& Tensor4D<T>::operator=(Tensor4D<T>&& other) {
+		if (this != &other) {
+			data = std::move(other.data);
+			batch_size = other.batch_size;
+			shape = other.shape;
+			other.batch_size = 0;
+			other.shape = { 0, 0, 0 };
+		}
+
+		return *this;
+	}
+
+	template<typename T>
+	void Tensor4D<T>::Resize(int batch_size, Triplet shape) {
+		assert(batch_size >= 0);
+		this->batch_size = batch_size;
+		this->shape = shape;
+		data.Resize(Size());
+	}
+
+	template<typename T>
+	inline TensorView<T> Tensor4D<T>::Sample(int index) {
+		assert(index >= 0 && index < batch_size);
+		return TensorView<T>(data.data() + index * SampleSize(), shape);
+	}
+
+	template<typename T>
+	inline ConstTensorView<T> Tensor4D<T>::Sample(int index) const {
+		assert(index >= 0 && index < batch_size);
+		return ConstTensorView<T>(data.data() + index * SampleSize(), shape);
+	}
+
+	// @param index:	index of the sample
+	// @param sample:	tensor with the same number of elements as a sample
+	template<typename T>
+	void Tensor4D<T>::SetSample(int index, const ConstTensorView<T>& sample) {
+		assert(sample.Size() == SampleSize());
+		T* out = data.data() + index * SampleSize();
+		if (sample.IsContiguous()) {
+			std::copy(sample.Data(), sample.Data() + sample.Size(), out);
+			return;
+		}
+
+		Triplet sample_shape = sample.GetShape();
+		for (int k = 0; k < sample_shape.depth; ++k)
+			for (int i = 0; i < sample_shape.height; ++i)
+				for (int j = 0; j < sample_shape.width; ++j)
+					*out++ = sample(i, j, k);
+	}
+
+	template<typename T>
+	inline Tensor4D<T>& Tensor4D<T>::operator-=(const Tensor4D<T>& other) {
+		assert(Size() == other.Size());
+		kernels::Sub(Data(), other.Data(), Data(), Size());
+
+		return *this;
+	}
+
+	template<typename T>
+	inline Tensor4D<T>& Tensor4D<T>::operator*=(T scalar) {
+		kernels::MulScalar(Data(), scalar, Data(), Size());
+
+		return *this;
+	}
+
+	template<typename T>
+	inline int Tensor4D<T>::GetBatchSize() const {
+		return batch_size;
+	}
+
+	template<typename T>
+	inline Triplet Tensor4D<T>::GetShape() const {
+		return shape;
+	}
+
+	template<typename T>
+	inline int Tensor4D<T>::SampleSize() const {
+		return shape.height * shape.width * shape.depth;
+	}
+
+	template<typename T>
+	inline int Tensor4D<T>::Size() const {
+		return batch_size * SampleSize();
+	}
+
+	template<typename T>
+	inline T* Tensor4D<T>::Data() {
+		return data.data();
+	}
+
+	template<typename T>
+	inline const T* Tensor4D<T>::Data() const {
+		return data.data();
+	}
+
+	template<typename T>
+	inline MemoryResource* Tensor4D<T>::GetResource() const {
+		return data.GetResource();
+	}
+
+	// Sets all data elements to zero.
+	template<typename T>
+	void Tensor4D<T>::InitZeros() {
+		kernels::Fill(Data(), T(0), Size());
+	}
+}
@@ -0,0 +1,186 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <cassert>
+#include "layout.h"
+
+namespace convnet_core {
+	// Base class of lazily evaluated element-wise tensor expressions (CRTP).
+	// Operators on tensors build an expression tree instead of a result tensor.
+	// The tree is evaluated when it is assigned to a tensor, so a chain like
+	// w - v * mu + v * (1 + mu) runs in a single loop, without temporaries.
+	// Tensors are captured by reference, hence an expression must not outlive
+	// its operands (i.e. do not store expressions with auto).
+	//
+	// Every expression type E provides:
+	//	E::value_type:			scalar type of the elements
+	//	E::ExprRef:				how E is captured by an enclosing expression
+	//	E[i]:					i-th element in the unrolled order
+	//	E.GetShape(), E.Size():	shape of the result
+	//	E.GetLayout():			memory layout of the operands, element-wise
+	//							operations require the same layout
+	template<typename E>
+	struct TensorExpr {
+		const E& Self() const { return static_cast<const E&>(*this); }
+	};
+
+	// Element-wise operations.
+	struct OpAdd {
+		template<typename T> static T Apply(T a, T b) { return a + b; }
+	};
+	struct OpSub {
+		template<typename T> static T Apply(T a, T b) { return a - b; }
+	};
+	struct OpMul {
+		template<typename T> static T Apply(T a, T b) { return a * b; }
+	};
+	struct OpDiv {
+		template<typename T> static T Apply(T a, T b) { return a / b; }
+	};
+
+	// Scalar operand of an expression, broadcasted to every element.
+	template<typename T>
+	class ScalarExpr : public TensorExpr<ScalarExpr<T>> {
+	public:
+		typedef T value_type;
+		typedef ScalarExpr<T> ExprRef;
+
+		explicit ScalarExpr(T value) : value(value) { }
+		T operator[](int) const { return value; }
+		T Value() const { return value; }
+
+	private:
+		T value;
+	};
+
+	// Shape of a binary expression. Scalars take the shape of the other operand.
+	template<typename L, typename R>
+	inline Triplet ExprShape(const L& l, const R& r) {
+		assert(l.Size() == r.Size());
+		return l.GetShape();
+	}
+
+	template<typename L, typename T>
+	inline Triplet ExprShape(const L& l, const ScalarExpr<T>&) {
+		return l.GetShape();
+	}
+
+	template<typename T, typename R>
+	inline Triplet ExprShape(const ScalarExpr<T>&, const R& r) {
+		return r.GetShape();
+	}
+
+	// Layout of a binary expression. Scalars take the layout of the other operand.
+	template<typename L, typename R>
+	inline Layout ExprLayout(const L& l, const R& r) {
+		assert(l.GetLayout() == r.GetLayout());
+		return l.GetLayout();
+	}
+
+	template<typename L, typename T>
+	inline Layout ExprLayout(const L& l, const ScalarExpr<T>&) {
+		return l.GetLayout();
+	}
+
+	template<typename T, typename R>
+	inline Layout ExprLayout(const ScalarExpr<T>&, const R& r) {
+		return r.GetLayout();
+	}
+
+	// Element-wise binary operation of two expressions.
+	template<typename L, typename R, typename Op>
+	class BinaryExpr : public TensorExpr<BinaryExpr<L, R, Op>> {
+	public:
+		typedef typename L::value_type value_type;
+		typedef BinaryExpr<L, R, Op> ExprRef;
+
+		BinaryExpr(const L& l, const R& r) 
+			: l(l), r(r), shape(ExprShape(l, r)), layout(ExprLayout(l, r)) { }
+
+		value_type operator[](int i) const { return Op::Apply(l[i], r[i]); }
+		Triplet GetShape() const { return shape; }
+		Layout GetLayout() const { return layout; }
+		int Size() const { return shape.height * shape.width * shape.depth; }
+		const typename L::ExprRef& Lhs() const { return l; }
+		const typename R::ExprRef& Rhs() const { return r; }
+
+	private:
+		typename L::ExprRef l;
+		typename R::ExprRef r;
+		Triplet shape;
+		Layout layout;
+	};
+
+	// Sums the elements of an expression in a single pass.
+	template<typename E>
+	typename E::value_type Sum(const TensorExpr<E>& expr) {
+		const E& e = expr.Self();
+		typename E::value_type sum = 0;
+		const int size = e.Size();
+		for (int i = 0; i < size; ++i)
+			sum += e[i];
+
+		return sum;
+	}
+
+	// Tensor-tensor operators (element-wise).
+	template<typename L, typename R>
+	inline BinaryExpr<L, R, OpAdd> operator+(const TensorExpr<L>& l, const TensorExpr<R>& r) {
+		return BinaryExpr<L, R, OpAdd>(l.Self(), r.Self());
+	}
+
+	template<typename L, typename R>
+	inline BinaryExpr<L, R, OpSub> operator-(const TensorExpr<L>& l, const TensorExpr<R>& r) {
+		return BinaryExpr<L, R, OpSub>(l.Self(), r.Self());
+	}
+
+	template<typename L, typename R>
+	inline BinaryExpr<L, R, OpMul> operator*(const TensorExpr<L>& l, const TensorExpr<R>& r) {
+		return BinaryExpr<L, R, OpMul>(l.Self(), r.Self());
+	}
+
+	// Tensor-scalar operators.
+	template<typename E>
+	inline BinaryExpr<E, ScalarExpr<typename E::value_type>, OpAdd>
+		operator+(const TensorExpr<E>& e, typename E::value_type scalar) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<E, S, OpAdd>(e.Self(), S(scalar));
+	}
+
+	template<typename E>
+	inline BinaryExpr<E, ScalarExpr<typename E::value_type>, OpSub>
+		operator-(const TensorExpr<E>& e, typename E::value_type scalar) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<E, S, OpSub>(e.Self(), S(scalar));
+	}
+
+	template<typename E>
+	inline BinaryExpr<E, ScalarExpr<typename E::value_type>, OpMul>
+		operator*(const TensorExpr<E>& e, typename E::value_type scalar) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<E, S, OpMul>(e.Self(), S(scalar));
+	}
+
+	template<typename E>
+	inline BinaryExpr<E, ScalarExpr<typename E::value_type>, OpDiv>
+		operator/(const TensorExpr<E>& e, typename E::value_type scalar) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<E, S, OpDiv>(e.Self(), S(scalar));
+	}
+
+	template<typename E>
+	inline BinaryExpr<ScalarExpr<typename E::value_type>, E, OpAdd>
+		operator+(typename E::value_type scalar, const TensorExpr<E>& e) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<S, E, OpAdd>(S(scalar), e.Self());
+	}
+
+	template<typename E>
+	inline BinaryExpr<ScalarExpr<typename E::value_type>, E, OpMul>
+		operator*(typename E::value_type scalar, const TensorExpr<E>& e) {
+		typedef ScalarExpr<typename E::value_type> S;
+		return BinaryExpr<S, E, OpMul>(S(scalar), e.Self());
+	}
+}
@@ -0,0 +1,170 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include <cassert>
+#include <type_traits>
+
+namespace convnet_core {
+	// Structure that stores the shape of a tensor.
+	struct Triplet {
+		int height, width, depth;
+	};
+
+	// Distance (in elements) between two neighbouring elements along each dimension.
+	struct Strides {
+		int row, col, channel;
+	};
+
+	// Strides of a densely packed tensor (channels are stored one after the other,
+	// each channel is stored row by row).
+	inline Strides PlanarStrides(const Triplet& shape) {
+		return Strides{ shape.width, 1, shape.height * shape.width };
+	}
+
+	// Non-owning view of a 3D volume. Shares the storage of the tensor it was
+	// created from, and carries its own shape and strides, so reshaping,
+	// flattening and slicing a window do not copy any data.
+	// The viewed storage must outlive the view.
+	template<typename T>
+	class TensorView
+	{
+	public:
+		TensorView();
+		TensorView(T* data, Triplet shape);
+		TensorView(T* data, Triplet shape, Strides strides);
+		// Any view can be used as a read-only view.
+		template<typename U, typename = typename std::enable_if<
+			std::is_same<const U, T>::value>::type>
+		TensorView(const TensorView<U>& other);
+
+		T& operator()(int row, int col, int channel) const;
+		T& get(int row, int col, int channel) const;
+
+		Triplet GetShape() const;
+		Strides GetStrides() const;
+		// Number of elements in the view.
+		int Size() const;
+		// Pointer to the first element of the view.
+		T* Data() const;
+		// True if the elements are densely packed in the planar order.
+		bool IsContiguous() const;
+
+		// Reinterprets a contiguous view as a (n, 1, 1) dimensional vector.
+		TensorView<T> Flatten() const;
+		// Reinterprets a contiguous view with the given shape.
+		TensorView<T> Reshape(Triplet shape) const;
+		// Returns a window of the view starting at (row, col, channel).
+		TensorView<T> Slice(int row, int col, int channel, Triplet shape) const;
+		// Returns the (height, width, 1) dimensional view of one channel.
+		TensorView<T> Channel(int channel) const;
+
+	private:
+		T* data;
+		Triplet shape;
+		Strides strides;
+	};
+
+	template<typename T>
+	using ConstTensorView = TensorView<const T>;
+
+	// Creates an empty view.
+	template<typename T>
+	TensorView<T>::TensorView()
+		: data(nullptr), shape{ 0, 0, 0 }, strides{ 0, 0, 0 } { }
+
+	// Creates a view of densely packed data.
+	// @param data:		first element of the volume
+	// @param shape:	shape of the volume
+	template<typename T>
+	TensorView<T>::TensorView(T* data, Triplet shape)
+		: data(data), shape(shape), strides(PlanarStrides(shape)) { }
+
+	// Creates a view with arbitrary strides.
+	// @param data:		first element of the volume
+	// @param shape:	shape of the volume
+	// @param strides:	distance between neighbouring elements along each dimension
+	template<typename T>
+	TensorView<T>::TensorView(T* data, Triplet shape, Strides strides)
+		: data(data), shape(shape), strides(strides) { }
+
+	template<typename T>
+	template<typename U, typename>
+	TensorView<T>::TensorView(const TensorView<U>& other)
+		: data(other.Data()), shape(other.GetShape()), strides(other.GetStrides()) { }
+
+	// Indexing operator for the view.
+	template<typename T>
+	inline T& TensorView<T>::operator()(int row, int col, int channel) const {
+		return get(row, col, channel);
+	}
+
+	template<typename T>
+	inline T& TensorView<T>::get(int row, int col, int channel) const {
+		assert(row >= 0 && col >= 0 && channel >= 0);
+		assert(col < shape.width && row < shape.height && channel < shape.depth);
+
+		return data[channel * strides.channel + row * strides.row + col * strides.col];
+	}
+
+	template<typename T>
+	inline Triplet TensorView<T>::GetShape() const {
+		return shape;
+	}
+
+	template<typename T>
+	inline Strides TensorView<T>::GetStrides() const {
+		return strides;
+	}
+
+	template<typename T>
+	inline int TensorView<T>::Size() const {
+		return shape.height * shape.width * shape.depth;
+	}
+
+	template<typename T>
+	inline T* TensorView<T>::Data() const {
+		return data;
+	}
+
+	template<typename T>
+	inline bool TensorView<T>::IsContiguous() const {
+		Strides planar = PlanarStrides(shape);
+		// Strides of dimensions with a single element do not matter.
+		return (shape.height <= 1 || strides.row == planar.row) &&
+			(shape.width <= 1 || strides.col == planar.col) &&
+			(shape.depth <= 1 || strides.channel == planar.channel);
+	}
+
+	template<typename T>
+	TensorView<T> TensorView<T>::Flatten() const {
+		return Reshape(Triplet{ Size(), 1, 1 });
+	}
+
+	template<typename T>
+	TensorView<T> TensorView<T>::Reshape(Triplet new_shape) const {
+		assert(IsContiguous());
+		assert(new_shape.height * new_shape.width * new_shape.depth == Size());
+
+		return TensorView<T>(data, new_shape);
+	}
+
+	// @param row, col, channel:	first element of the window
+	// @param window:				shape of the window
+	template<typename T>
+	TensorView<T> TensorView<T>::Slice(int row, int col, int channel, Triplet window) const {
+		assert(row >= 0 && col >= 0 && channel >= 0);
+		assert(row + window.height <= shape.height &&
+			   col + window.width <= shape.width &&
+			   channel + window.depth <= shape.depth);
+
+		return TensorView<T>(data + channel * strides.channel + row * strides.row + col * strides.col,
+							 window, strides);
+	}
+
+	template<typename T>
+	TensorView<T> TensorView<T>::Channel(int channel) const {
+		return Slice(0, 0, channel, Triplet{ shape.height, shape.width, 1 });
+	}
+}
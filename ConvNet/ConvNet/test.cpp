@@ -30,9 +30,15 @@ namespace tests {
 		testfc.TestConstructor();
 		testfc.TestForward();
 		testfc.TestBackprop();
+		testfc.TestForwardFloat();
+		testfc.TestBatch();
+		testfc.TestPackedWeights();
+		testfc.TestFusedUpdate();
+		testfc.TestSparse();
 
 		TestNet testNet;
 		testNet.TestReluPool();
+		testNet.TestMemoryPlan();
 		//testNet.TrainConvLayer();
 		//testNet.TrainFC2();
 		//testNet.TrainMNISTdigit();
@@ -42,12 +48,21 @@ namespace tests {
 		//testNet.Evaluate();
 
 		TestTensor t;
+		t.TestMoveSemantics();
+		t.TestCompoundOperators();
+		t.TestView();
+		t.TestExpressions();
+		t.TestKernels();
+		t.TestMemory();
+		t.TestTensor4D();
+		t.TestLayout();
+		t.TestParallel();
+		t.TestGemm();
 		//	t.TestTensorFromMatSuccess();
 		/*t.TestInitZeros();
 		t.TestInitRandom();*/
 
 		TestConv testConv;
-		//testConv.TestUnpadding();
 		/*testConv.TestConstructor();
 		testConv.TestPadding();
 		testConv.TestForward();
@@ -62,7 +77,18 @@ namespace tests {
 		testConv.TestForwardDeep();
 		testConv.TestForwardPadded();
 		*/
+		testConv.TestAlgorithms();
+		testConv.TestBackpropGradients();
+		testConv.TestWinograd();
+		testConv.TestFft();
+		testConv.TestThreads();
+		testConv.TestPadding();
+		testConv.TestAutotune();
+		testConv.TestGroupConv();
+		testConv.TestDepthwiseConv();
+		testConv.TestFusedActivation();
 		TestMaxPool testMaxPool;
+		testMaxPool.TestPoolSizes();
 		//testMaxPool.TestConstructor();
 		//testMaxPool.TestConstructorWithTensor();
 		//testMaxPool.TestConstructorWithMat();
@@ -70,8 +96,9 @@ namespace tests {
 		testMaxPool.TestForwardWithMat();
 		testMaxPool.TestBackprop();
 		*/
-		/*	TestReLU testReLU;
-		testReLU.TestConstructor();
+		TestReLU testReLU;
+		testReLU.TestInPlace();
+		/*testReLU.TestConstructor();
 		testReLU.TestConstructorWithTensor();
 		testReLU.TestConstructorWithMat();
 		testReLU.TestForward();
@@ -81,28 +108,28 @@ namespace tests {
 		//testSoftmax.TestForward();
 
 		// Create layers.
-		//layer::MaxPool pool_0("pool_0", 52, 52, 3, 2, 2);
-		//pool_0 = utils::ReadPoolLayer("models/pool_0.json");
-		//layer::Conv conv(26, 26, 3, "conv", 12, 3, 1, 0);
-		//conv = utils::ReadConvLayer("models/1200/conv-96.json");
-		//layer::ReLU relu("relu", 24, 24, 12);
-		//relu = utils::ReadReLU("models/relu.json");
-		//layer::MaxPool pool("pool", 24, 24, 12, 2, 2);
-		//pool = utils::ReadPoolLayer("models/pool.json");
-		//layer::Conv conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
-		//conv_2 = utils::ReadConvLayer("models/1200/conv_2-96.json");
-		//layer::ReLU relu_1("relu_1", 10, 10, 8);
-		//relu_1 = utils::ReadReLU("models/relu_1.json");
-		//layer::FC fc("fc", 10 * 10 * 8, 64);
-		//fc = utils::ReadFCLayer("models/1200/fc-96.json");
-		//layer::ReLU relu_2("relu_2", 64, 1, 1);
-		//relu_2 = utils::ReadReLU("models/relu_2.json");
-		//layer::FC fc_2("fc_2", 64, 12);
-		//fc_2 = utils::ReadFCLayer("models/1200/fc_2-96.json");
-		//layer::Softmax softmax("softmax", 12, 1, 1);
-		//softmax = utils::ReadSoftmax("models/softmax.json");
-
-		convnet_core::Model model;
+		//layer::MaxPool<double> pool_0("pool_0", 52, 52, 3, 2, 2);
+		//pool_0 = utils::ReadPoolLayer<double>("models/pool_0.json");
+		//layer::Conv<double> conv(26, 26, 3, "conv", 12, 3, 1, 0);
+		//conv = utils::ReadConvLayer<double>("models/1200/conv-96.json");
+		//layer::ReLU<double> relu("relu", 24, 24, 12);
+		//relu = utils::ReadReLU<double>("models/relu.json");
+		//layer::MaxPool<double> pool("pool", 24, 24, 12, 2, 2);
+		//pool = utils::ReadPoolLayer<double>("models/pool.json");
+		//layer::Conv<double> conv_2(12, 12, 12, "conv_2", 8, 3, 1, 0);
+		//conv_2 = utils::ReadConvLayer<double>("models/1200/conv_2-96.json");
+		//layer::ReLU<double> relu_1("relu_1", 10, 10, 8);
+		//relu_1 = utils::ReadReLU<double>("models/relu_1.json");
+		//layer::FC<double> fc("fc", 10 * 10 * 8, 64);
+		//fc = utils::ReadFCLayer<double>("models/1200/fc-96.json");
+		//layer::ReLU<double> relu_2("relu_2", 64, 1, 1);
+		//relu_2 = utils::ReadReLU<double>("models/relu_2.json");
+		//layer::FC<double> fc_2("fc_2", 64, 12);
+		//fc_2 = utils::ReadFCLayer<double>("models/1200/fc_2-96.json");
+		//layer::Softmax<double> softmax("softmax", 12, 1, 1);
+		//softmax = utils::ReadSoftmax<double>("models/softmax.json");
+
+		convnet_core::Model<double> model;
 		//model.Add(pool_0);
 		//model.Add(conv);
 		//model.Add(relu);
@@ -118,8 +145,8 @@ namespace tests {
 		model.Load("models/model.json");
 		std::string dataset_path = "../../../datasets/traffic_signs/train-52x52/";
 
-		utils::Dataset trainingSet = utils::GetTrainingSet(dataset_path, 100);
-		utils::Dataset validSet = utils::GetValidationSet(dataset_path, 10);
+		utils::Dataset<double> trainingSet = utils::GetTrainingSet<double>(dataset_path, 100);
+		utils::Dataset<double> validSet = utils::GetValidationSet<double>(dataset_path, 10);
 		Tensor3D<double> input, target;
 		std::pair<bool, double> result;
 
@@ -195,7 +222,7 @@ namespace tests {
 		//convnet_core::PrintTensor(model.Predict(img));
 
 		std::cout << "Loading data..." << std::endl;
-		utils::Dataset testSet = utils::GetTestSet(dataset_path, 500);
+		utils::Dataset<double> testSet = utils::GetTestSet<double>(dataset_path, 500);
 		//	Tensor3D<double> input, target,
 		Tensor3D<double> predicted;
 		correct = 0;
@@ -0,0 +1,295 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#include "winograd.h"
+#include "gemm.h"
+#include "memory.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace convnet_core {
+	namespace {
+		// Number of tiles transformed together. The transforms work on
+		// vectors of tiles (one element of each), so that they vectorize.
+		const int kTileBlock = 64;
+		// Below this input depth the products are summed directly, the packing
+		// of the GEMM does not pay off.
+		const int kWinogradGemmDepth = 16;
+
+		// One-dimensional transforms of F(2, 3), y = B^T x, y = G g and
+		// y = A^T m, applied to lanes vectors at once. Element k of the vector
+		// is xs (ys) elements after element k - 1, the lanes are contiguous.
+		struct WinogradF2 {
+			static const int kTile = 2;
+			static const int kInput = 4;
+
+			template<typename T>
+			static void Input(const T* x, int xs, T* y, int ys, int lanes) {
+				for (int l = 0; l < lanes; ++l) {
+					const T x0 = x[l], x1 = x[xs + l], x2 = x[2 * xs + l], x3 = x[3 * xs + l];
+					y[l] = x0 - x2;
+					y[ys + l] = x1 + x2;
+					y[2 * ys + l] = x2 - x1;
+					y[3 * ys + l] = x1 - x3;
+				}
+			}
+
+			template<typename T>
+			static void Filter(const T* g, int gs, T* y, int ys, int lanes) {
+				const T half = T(0.5);
+				for (int l = 0; l < lanes; ++l) {
+					const T g0 = g[l], g1 = g[gs + l], g2 = g[2 * gs + l];
+					y[l] = g0;
+					y[ys + l] = half * (g0 + g1 + g2);
+					y[2 * ys + l] = half * (g0 - g1 + g2);
+					y[3 * ys + l] = g2;
+				}
+			}
+
+			template<typename T>
+			static void Output(const T* m, int ms, T* y, int ys, int lanes) {
+				for (int l = 0; l < lanes; ++l) {
+					const T m0 = m[l], m1 = m[ms + l], m2 = m[2 * ms + l], m3 = m[3 * ms + l];
+					y[l] = m0 + m1 + m2;
+					y[ys + l] = m1 - m2 - m3;
+				}
+			}
+		};
+
+		// One-dimensional transforms of F(4, 3).
+		struct WinogradF4 {
+			static const int kTile = 4;
+			static const int kInput = 6;
+
+			template<typename T>
+			static void Input(const T* x, int xs, T* y, int ys, int lanes) {
+				for (int l = 0; l < lanes; ++l) {
+					const T x0 = x[l], x1 = x[xs + l], x2 = x[2 * xs + l];
+					const T x3 = x[3 * xs + l], x4 = x[4 * xs + l], x5 = x[5 * xs + l];
+					y[l] = 4 * x0 - 5 * x2 + x4;
+					y[ys + l] = -4 * (x1 + x2) + x3 + x4;
+					y[2 * ys + l] = 4 * (x1 - x2) - x3 + x4;
+					y[3 * ys + l] = 2 * (x3 - x1) - x2 + x4;
+					y[4 * ys + l] = 2 * (x1 - x3) - x2 + x4;
+					y[5 * ys + l] = 4 * x1 - 5 * x3 + x5;
+				}
+			}
+
+			template<typename T>
+			static void Filter(const T* g, int gs, T* y, int ys, int lanes) {
+				for (int l = 0; l < lanes; ++l) {
+					const T g0 = g[l], g1 = g[gs + l], g2 = g[2 * gs + l];
+					y[l] = g0 / 4;
+					y[ys + l] = -(g0 + g1 + g2) / 6;
+					y[2 * ys + l] = -(g0 - g1 + g2) / 6;
+					y[3 * ys + l] = g0 / 24 + g1 / 12 + g2 / 6;
+					y[4 * ys + l] = g0 / 24 - g1 / 12 + g2 / 6;
+					y[5 * ys + l] = g2;
+				}
+			}
+
+			template<typename T>
+			static void Output(const T* m, int ms, T* y, int ys, int lanes) {
+				for (int l = 0; l < lanes; ++l) {
+					const T m0 = m[l], m1 = m[ms + l], m2 = m[2 * ms + l];
+					const T m3 = m[3 * ms + l], m4 = m[4 * ms + l], m5 = m[5 * ms + l];
+					y[l] = m0 + m1 + m2 + m3 + m4;
+					y[ys + l] = m1 - m2 + 2 * (m3 - m4);
+					y[2 * ys + l] = m1 + m2 + 4 * (m3 + m4);
+					y[3 * ys + l] = m1 - m2 + 8 * (m3 - m4) + m5;
+				}
+			}
+		};
+
+		// Applies a one-dimensional transform (n -> k elements) to the columns,
+		// then to the rows of an n x n matrix of lane vectors, giving a k x k
+		// matrix. Element (i, j) is at x + (i * N + j) * xs (y + (i * K + j) * ys).
+		// @param columns:	temporary of K * N * lanes elements
+		template<typename T, int N, int K, typename Transform>
+		void Transform2D(const T* x, int xs, T* y, int ys, T* columns, int lanes, Transform transform) {
+			for (int j = 0; j < N; ++j)
+				transform(x + j * xs, N * xs, columns + j * lanes, N * lanes, lanes);
+			for (int i = 0; i < K; ++i)
+				transform(columns + i * N * lanes, lanes, y + i * K * ys, ys, lanes);
+		}
+
+		template<typename Tile, typename T>
+		void TransformFilter(const T* kernel, bool rotate, T* transformed, int stride) {
+			const int a = Tile::kInput;
+			T g[9];
+			for (int i = 0; i < 9; ++i)
+				g[i] = rotate ? kernel[8 - i] : kernel[i];
+			T columns[a * 3];
+			Transform2D<T, 3, a>(g, 1, transformed, stride, columns, 1,
+				[](const T* x, int xs, T* y, int ys, int lanes) { Tile::Filter(x, xs, y, ys, lanes); });
+		}
+
+		// Copies the a x a input tiles first, ..., first + count - 1 of a
+		// channel into a matrix of tile vectors, zero where a tile overlaps
+		// the padding or the end of the input.
+		template<typename T>
+		void GatherTiles(const T* channel, Triplet shape, Strides strides, int a, int m, int padding,
+						 int tiles_w, int first, int count, T* d) {
+			for (int t = 0; t < count; ++t) {
+				const int row0 = (first + t) / tiles_w * m - padding;
+				const int col0 = (first + t) % tiles_w * m - padding;
+				if (row0 >= 0 && col0 >= 0 && row0 + a <= shape.height && col0 + a <= shape.width) {
+					for (int i = 0; i < a; ++i)
+						for (int j = 0; j < a; ++j)
+							d[(i * a + j) * count + t] = channel[(row0 + i) * strides.row + (col0 + j) * strides.col];
+				} else {
+					for (int i = 0; i < a; ++i) {
+						for (int j = 0; j < a; ++j) {
+							const int row = row0 + i, col = col0 + j;
+							d[(i * a + j) * count + t] = row >= 0 && row < shape.height && col >= 0 && col < shape.width
+								? channel[row * strides.row + col * strides.col] : T(0);
+						}
+					}
+				}
+			}
+		}
+
+		template<typename Tile, typename T>
+		void Convolve(const ConstTensorView<T>& input, const T* filters, int padding,
+					  const TensorView<T>& out, const T* bias, T slope) {
+			const int m = Tile::kTile;
+			const int a = Tile::kInput;
+			Triplet shape = input.GetShape();
+			Triplet out_shape = out.GetShape();
+			assert(out_shape.height == shape.height + 2 * padding - 2);
+			assert(out_shape.width == shape.width + 2 * padding - 2);
+
+			const int tiles_h = (out_shape.height + m - 1) / m;
+			const int tiles_w = (out_shape.width + m - 1) / m;
+			const int tiles = tiles_h * tiles_w;
+			const int in_depth = shape.depth;
+			const int out_depth = out_shape.depth;
+
+			auto input_transform = [](const T* x, int xs, T* y, int ys, int lanes) {
+				Tile::Input(x, xs, y, ys, lanes);
+			};
+			auto output_transform = [](const T* x, int xs, T* y, int ys, int lanes) {
+				Tile::Output(x, xs, y, ys, lanes);
+			};
+
+			// The three stages run in parallel over blocks of tiles of a
+			// channel, transformed coordinates and blocks of tiles of a filter,
+			// every task writes its own part of the result.
+			const int blocks = (tiles + kTileBlock - 1) / kTileBlock;
+			const int block_work = a * a * kTileBlock;
+
+			// Transformed input tiles, a matrix of (input depth x tiles) for
+			// each transformed coordinate.
+			Buffer<T> v(a * a * in_depth * tiles, StepResource());
+			ParallelFor(0, in_depth * blocks, std::max(1, kParallelGrain / block_work), [&](int first_task, int last_task) {
+				Buffer<T> block(a * a * kTileBlock, StepResource());
+				Buffer<T> columns(a * a * kTileBlock, StepResource());
+				for (int task = first_task; task < last_task; ++task) {
+					const int c = task / blocks;
+					const int first = task % blocks * kTileBlock;
+					const int count = std::min(kTileBlock, tiles - first);
+					const T* channel = input.Data() + c * input.GetStrides().channel;
+					GatherTiles(channel, shape, input.GetStrides(), a, m, padding, tiles_w,
+								first, count, block.data());
+					Transform2D<T, a, a>(block.data(), count, v.data() + c * tiles + first, in_depth * tiles,
+										 columns.data(), count, input_transform);
+				}
+			});
+
+			// The element-wise products summed over the input channels, a
+			// matrix product for each transformed coordinate.
+			Buffer<T> products(a * a * out_depth * tiles, StepResource());
+			const int product_work = out_depth * in_depth * tiles;
+			ParallelFor(0, a * a, std::max(1, kParallelGrain / product_work), [&](int first_xi, int last_xi) {
+				for (int xi = first_xi; xi < last_xi; ++xi) {
+					const T* u = filters + xi * out_depth * in_depth;
+					const T* vx = v.data() + xi * in_depth * tiles;
+					T* px = products.data() + xi * out_depth * tiles;
+					if (in_depth >= kWinogradGemmDepth) {
+						Gemm(Transpose::No, Transpose::No, out_depth, tiles, in_depth,
+							 u, in_depth, vx, tiles, px, tiles);
+						continue;
+					}
+					for (int f = 0; f < out_depth; ++f) {
+						T* row = px + f * tiles;
+						const T* uf = u + f * in_depth;
+						for (int t = 0; t < tiles; ++t)
+							row[t] = uf[0] * vx[t];
+						for (int c = 1; c < in_depth; ++c) {
+							const T* vc = vx + c * tiles;
+							const T w = uf[c];
+							for (int t = 0; t < tiles; ++t)
+								row[t] += w * vc[t];
+						}
+					}
+				}
+			});
+
+			Strides out_strides = out.GetStrides();
+			ParallelFor(0, out_depth * blocks, std::max(1, kParallelGrain / block_work), [&](int first_task, int last_task) {
+				Buffer<T> block(a * a * kTileBlock, StepResource());
+				Buffer<T> columns(a * a * kTileBlock, StepResource());
+				for (int task = first_task; task < last_task; ++task) {
+					const int f = task / blocks;
+					const int first = task % blocks * kTileBlock;
+					const int count = std::min(kTileBlock, tiles - first);
+					T* plane = out.Data() + f * out_strides.channel;
+					const T b = bias ? bias[f] : T(0);
+					T* y = block.data();
+					Transform2D<T, a, m>(products.data() + f * tiles + first, out_depth * tiles, y, count,
+										 columns.data(), count, output_transform);
+					for (int t = 0; t < count; ++t) {
+						const int th = (first + t) / tiles_w, tw = (first + t) % tiles_w;
+						// Tiles at the end may be partially outside.
+						const int rows = std::min(m, out_shape.height - th * m);
+						const int cols = std::min(m, out_shape.width - tw * m);
+						for (int i = 0; i < rows; ++i) {
+							for (int j = 0; j < cols; ++j) {
+								const T value = y[(i * m + j) * count + t] + b;
+								plane[(th * m + i) * out_strides.row + (tw * m + j) * out_strides.col] =
+									value < 0 ? slope * value : value;
+							}
+						}
+					}
+				}
+			});
+		}
+	}
+
+	double WinogradCost(int tile, Triplet out_shape, int in_depth) {
+		assert(tile == 2 || tile == 4);
+		// Operations of the input and output transforms of a tile.
+		const double input_ops = tile == 2 ? 32 : 240;
+		const double output_ops = tile == 2 ? 24 : 140;
+		const double tiles = double((out_shape.height + tile - 1) / tile) *
+							 ((out_shape.width + tile - 1) / tile);
+		return tiles * (WinogradTransformSize(tile) * double(in_depth) * out_shape.depth +
+						2 * (input_ops * in_depth + output_ops * out_shape.depth));
+	}
+
+	template<typename T>
+	void WinogradTransformFilter(int tile, const T* kernel, bool rotate, T* transformed, int stride) {
+		assert(tile == 2 || tile == 4);
+		if (tile == 2)
+			TransformFilter<WinogradF2>(kernel, rotate, transformed, stride);
+		else
+			TransformFilter<WinogradF4>(kernel, rotate, transformed, stride);
+	}
+
+	template<typename T>
+	void WinogradConvolve(int tile, const ConstTensorView<T>& input, const T* filters,
+						  int padding, const TensorView<T>& out, const T* bias, T slope) {
+		assert(tile == 2 || tile == 4);
+		if (tile == 2)
+			Convolve<WinogradF2>(input, filters, padding, out, bias, slope);
+		else
+			Convolve<WinogradF4>(input, filters, padding, out, bias, slope);
+	}
+
+	template void WinogradTransformFilter<float>(int, const float*, bool, float*, int);
+	template void WinogradTransformFilter<double>(int, const double*, bool, double*, int);
+	template void WinogradConvolve<float>(int, const ConstTensorView<float>&, const float*,
+										  int, const TensorView<float>&, const float*, float);
+	template void WinogradConvolve<double>(int, const ConstTensorView<double>&, const double*,
+										   int, const TensorView<double>&, const double*, double);
+}
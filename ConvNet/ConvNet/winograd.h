@@ -0,0 +1,57 @@
+// PROJECT: Convolutional neural network implementation.
+// AUTHOR: Tams Matuszka
+
+#pragma once
+
+#include "tensorView.h"
+
+namespace convnet_core {
+	// Winograd minimal filtering F(m x m, 3 x 3). An m x m tile of the output
+	// is computed from an (m + 2) x (m + 2) tile of the input with (m + 2)^2
+	// multiplications per channel pair instead of 9 * m^2: the input tile and
+	// the filter are transformed, multiplied element-wise, and the product is
+	// transformed back. Tiles of size 2 (16 vs 36 multiplications) and 4
+	// (36 vs 144, at the cost of larger rounding errors) are supported.
+
+	// Number of transformed elements per filter or input tile, (m + 2)^2.
+	inline int WinogradTransformSize(int tile) {
+		return (tile + 2) * (tile + 2);
+	}
+
+	// Estimated number of operations of WinogradConvolve: the element-wise
+	// products, plus the transforms of the input and output tiles, weighted
+	// twice (they vectorize worse than the products). Comparable to the
+	// 9 * input depth * out depth operations per output pixel of a GEMM
+	// based convolution.
+	// @param out_shape:	shape of the output of the convolution
+	double WinogradCost(int tile, Triplet out_shape, int in_depth);
+
+	// Transforms a 3x3 kernel (one channel of a filter) for WinogradConvolve.
+	// @param tile:			output tile size (2 or 4)
+	// @param kernel:		3x3 kernel, row by row
+	// @param rotate:		whether the kernel is rotated by 180 degrees first
+	//						(the kernels of the backward-data convolution)
+	// @param transformed:	receives the (m + 2)^2 elements, stride elements apart
+	template<typename T>
+	void WinogradTransformFilter(int tile, const T* kernel, bool rotate, T* transformed, int stride);
+
+	// Stride 1 convolution of a volume with 3x3 filters. The input tiles of
+	// every channel are transformed, then for each of the (m + 2)^2
+	// transformed coordinates the filters are applied to all tiles by one
+	// GEMM, and the products are transformed back into the output. The bias
+	// and the LeakyReLU are applied to the transformed tiles before they are
+	// stored. Temporaries are allocated from the arena of the current step.
+	// @param tile:			output tile size (2 or 4)
+	// @param input:		input volume
+	// @param filters:		transformed filters, (m + 2)^2 matrices of
+	//						(out depth x input depth), see WinogradTransformFilter
+	// @param padding:		zeros around the border of the input
+	// @param out:			output volume, (height + 2 * padding - 2) x
+	//						(width + 2 * padding - 2) x out depth
+	// @param bias:			bias of each output channel, or nullptr
+	// @param slope:		slope of the negative outputs, 1 without activation
+	template<typename T>
+	void WinogradConvolve(int tile, const ConstTensorView<T>& input, const T* filters,
+						  int padding, const TensorView<T>& out,
+						  const T* bias = nullptr, T slope = 1);
+}